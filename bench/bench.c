@@ -0,0 +1,425 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+#define DEFAULT_SIZES "1k,10k,100k,1M,10M"
+
+/** The most sizes that can be given on the command line */
+#define MAX_SIZES 32
+
+/** The most labels in a generated name */
+#define MAX_LABELS 4
+
+/** The longest generated name, including the NULL terminator */
+#define MAX_NAME_LEN 128
+
+static uint64_t rand_state = BENCH_SEED;
+
+/** A TLD and how often it is chosen, out of the total of all weights */
+struct tld_weight
+{
+    const char *tld;
+    unsigned int weight;
+};
+
+/* Roughly the shares of registered and blacklisted names. Multi-label
+ * suffixes are written as one label and split when the name is built. */
+static const struct tld_weight tlds[] = {
+    { "com", 46 }, { "net", 8 }, { "org", 6 }, { "ru", 5 }, { "de", 4 },
+    { "info", 3 }, { "io", 3 }, { "xyz", 3 }, { "top", 3 }, { "cn", 3 },
+    { "co.uk", 2 }, { "com.br", 2 }, { "online", 2 }, { "site", 2 },
+    { "jp", 2 }, { "fr", 2 }, { "nl", 2 }, { "com.au", 2 },
+};
+
+static const char *subdomains[] = {
+    "www", "mail", "api", "cdn", "login", "secure", "update", "m", "static",
+    "app",
+};
+
+static const char *syllables[] = {
+    "an", "ar", "ba", "be", "co", "da", "de", "el", "en", "er", "fi", "go",
+    "in", "ka", "la", "le", "lo", "ma", "me", "mo", "na", "ne", "no", "on",
+    "or", "pa", "pro", "ra", "re", "ri", "sa", "se", "shop", "st", "ta", "te",
+    "ti", "to", "tech", "un", "va", "web", "za",
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+double
+bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+uint64_t
+bench_rand(void)
+{
+    // xorshift64*
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+size_t
+bench_uniform(size_t n)
+{
+    return bench_rand() % n;
+}
+
+size_t
+bench_zipf(size_t n)
+{
+    double u = (bench_rand() >> 11) * (1.0 / 9007199254740992.0);
+    size_t rank = (size_t) exp(u * log((double) n + 1)) - 1;
+
+    return rank < n ? rank : n - 1;
+}
+
+/**
+ * Write a random label that looks like a word into \p out.
+ *
+ * @return The length of the label
+ */
+static size_t
+word_label(char *out)
+{
+    size_t len = 0, i, parts = 2 + bench_uniform(3);
+    const char *s;
+
+    for (i = 0; i < parts; i++)
+    {
+        s = syllables[bench_uniform(ARRAY_LEN(syllables))];
+        memcpy(out + len, s, strlen(s));
+        len += strlen(s);
+    }
+
+    // Some names have a hyphenated word or a number on the end
+    switch (bench_uniform(8))
+    {
+    case 0:
+        out[len++] = '-';
+        s = syllables[bench_uniform(ARRAY_LEN(syllables))];
+        memcpy(out + len, s, strlen(s));
+        len += strlen(s);
+        break;
+    case 1:
+        len += sprintf(out + len, "%u", (unsigned int) bench_uniform(1000));
+        break;
+    }
+
+    return len;
+}
+
+/**
+ * Write a label that looks algorithmically generated into \p out.
+ *
+ * @return The length of the label
+ */
+static size_t
+random_label(char *out, size_t min, size_t max)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    size_t len = min + bench_uniform(max - min + 1), i;
+
+    for (i = 0; i < len; i++)
+        out[i] = chars[bench_uniform(sizeof(chars) - 1)];
+
+    return len;
+}
+
+/**
+ * Choose a TLD according to the weights in #tlds.
+ */
+static const char *
+random_tld(void)
+{
+    unsigned int total = 0, pick;
+    size_t i;
+
+    for (i = 0; i < ARRAY_LEN(tlds); i++) total += tlds[i].weight;
+
+    pick = bench_uniform(total);
+    for (i = 0; pick >= tlds[i].weight; i++) pick -= tlds[i].weight;
+
+    return tlds[i].tld;
+}
+
+/**
+ * Generate a name into \p out, which holds #MAX_NAME_LEN bytes.
+ *
+ * @return The length of the name
+ */
+static size_t
+generate_name(char *out, int reverse)
+{
+    char labels[MAX_LABELS + 1][MAX_NAME_LEN / 2];
+    size_t label_lens[MAX_LABELS + 1], num = 0, len = 0, i;
+    unsigned int kind = bench_uniform(100);
+    const char *tld = random_tld();
+
+    // Subdomains: none, a common one, a random one or two levels
+    if (kind >= 40 && kind < 70)
+    {
+        const char *sub = subdomains[bench_uniform(ARRAY_LEN(subdomains))];
+
+        label_lens[num] = strlen(sub);
+        memcpy(labels[num], sub, label_lens[num]);
+        num++;
+    }
+    else if (kind >= 70)
+    {
+        label_lens[num] = random_label(labels[num], 3, 8);
+        num++;
+        if (kind >= 90)
+        {
+            label_lens[num] = random_label(labels[num], 2, 6);
+            num++;
+        }
+    }
+
+    // The registered name: mostly words, some generated by malware
+    if (bench_uniform(100) < 85)
+        label_lens[num] = word_label(labels[num]);
+    else
+        label_lens[num] = random_label(labels[num], 12, 20);
+    num++;
+
+    label_lens[num] = strlen(tld);
+    memcpy(labels[num], tld, label_lens[num]);
+    num++;
+
+    for (i = 0; i < num; i++)
+    {
+        size_t l = reverse ? num - 1 - i : i;
+        const char *dot = memchr(labels[l], '.', label_lens[l]);
+
+        if (i) out[len++] = '.';
+        if (reverse && dot)
+        {
+            // Reverse a multi-label suffix such as "co.uk" as well
+            size_t first = dot - labels[l];
+
+            memcpy(out + len, dot + 1, label_lens[l] - first - 1);
+            len += label_lens[l] - first - 1;
+            out[len++] = '.';
+            memcpy(out + len, labels[l], first);
+            len += first;
+        }
+        else
+        {
+            memcpy(out + len, labels[l], label_lens[l]);
+            len += label_lens[l];
+        }
+    }
+    out[len] = '\0';
+
+    return len;
+}
+
+int
+bench_names_generate(struct bench_names *names, size_t count, int reverse)
+{
+    size_t cap = count * 24 + MAX_NAME_LEN, used = 0, i;
+    char name[MAX_NAME_LEN], *grown;
+    size_t len;
+
+    names->count = count;
+    names->buf = malloc(cap);
+    names->offsets = malloc((count + 1) * sizeof(*names->offsets));
+    if (!names->buf || !names->offsets) goto error;
+
+    for (i = 0; i < count; i++)
+    {
+        len = generate_name(name, reverse);
+        if (used + len + 1 > cap)
+        {
+            cap *= 2;
+            if (!(grown = realloc(names->buf, cap))) goto error;
+            names->buf = grown;
+        }
+        names->offsets[i] = used;
+        memcpy(names->buf + used, name, len + 1);
+        used += len + 1;
+    }
+    names->offsets[count] = used;
+
+    return 0;
+
+error:
+    bench_names_free(names);
+    return -1;
+}
+
+const char *
+bench_names_get(const struct bench_names *names, size_t index, size_t *len)
+{
+    if (len)
+        *len = names->offsets[index + 1] - names->offsets[index] - 1;
+    return names->buf + names->offsets[index];
+}
+
+void
+bench_names_free(struct bench_names *names)
+{
+    free(names->buf);
+    free(names->offsets);
+    names->buf = NULL;
+    names->offsets = NULL;
+    names->count = 0;
+}
+
+/**
+ * Parse a comma-separated list of sizes, each of which may end in k or M.
+ *
+ * @return The number of sizes, or -1 if the list is malformed
+ */
+static int
+parse_sizes(const char *list, size_t *sizes)
+{
+    const char *pos = list;
+    char *end;
+    int count = 0;
+
+    while (*pos)
+    {
+        if (count == MAX_SIZES) return -1;
+
+        sizes[count] = strtoul(pos, &end, 10);
+        if (end == pos) return -1;
+        if ('k' == *end) sizes[count] *= 1000, end++;
+        else if ('M' == *end) sizes[count] *= 1000000, end++;
+        if (!sizes[count]) return -1;
+        count++;
+
+        if (',' == *end) end++;
+        else if (*end) return -1;
+        pos = end;
+    }
+
+    return count;
+}
+
+/**
+ * Run one case at one size in a child process, which writes its result.
+ *
+ * @return 0 if the run succeeded, -1 if it failed
+ */
+static int
+run_one(const char *suite, const struct bench_case *c, size_t n)
+{
+    struct rusage usage;
+    size_t ops = 0;
+    double ns;
+    int status;
+    pid_t pid;
+
+    // Anything buffered would be written by the child as well
+    fflush(stdout);
+
+    if (-1 == (pid = fork()))
+    {
+        perror("fork");
+        return -1;
+    }
+
+    if (0 == pid)
+    {
+        rand_state = BENCH_SEED ^ (n * 0x9e3779b97f4a7c15ULL);
+        ns = c->run(n, &ops);
+        if (ns < 0 || !ops)
+        {
+            fprintf(stderr, "%s %s %zu: failed\n", suite, c->name, n);
+            _exit(1);
+        }
+
+        getrusage(RUSAGE_SELF, &usage);
+        printf("%s\t%s\t%zu\t%zu\t%.2f\t%.0f\t%ld\n", suite, c->name, n, ops,
+                ns / ops, ops / (ns / 1e9), usage.ru_maxrss);
+        fflush(stdout);
+        _exit(0);
+    }
+
+    if (-1 == waitpid(pid, &status, 0))
+    {
+        perror("waitpid");
+        return -1;
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+    {
+        if (WIFSIGNALED(status))
+            fprintf(stderr, "%s %s %zu: killed by signal %d\n", suite,
+                    c->name, n, WTERMSIG(status));
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+bench_main(int argc, char **argv, const char *suite,
+        const struct bench_case *cases, size_t num_cases)
+{
+    size_t sizes[MAX_SIZES], i;
+    const char *only = NULL;
+    int num_sizes = parse_sizes(DEFAULT_SIZES, sizes), opt, s, ret = 0;
+
+    while (-1 != (opt = getopt(argc, argv, "s:c:")))
+    {
+        switch (opt)
+        {
+        case 's':
+            if (0 >= (num_sizes = parse_sizes(optarg, sizes)))
+            {
+                fprintf(stderr, "%s: bad list of sizes: %s\n", argv[0],
+                        optarg);
+                return 1;
+            }
+            break;
+        case 'c':
+            only = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s sizes] [-c case]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("#suite\tcase\tsize\tops\tns_per_op\tops_per_sec\tpeak_rss_kib\n");
+
+    for (i = 0; i < num_cases; i++)
+    {
+        if (only && strcmp(only, cases[i].name)) continue;
+
+        for (s = 0; s < num_sizes; s++)
+        {
+            if (cases[i].max_size && sizes[s] > cases[i].max_size) continue;
+            if (0 != run_one(suite, &cases[i], sizes[s])) ret = 1;
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,133 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Harness shared by the microbenchmarks of the core data structures
+ *
+ * Each benchmark program is a list of cases, each run once at every size
+ * given on the command line. Every run happens in a process of its own so
+ * that its peak RSS is not inflated by earlier runs, and the random inputs
+ * are generated from a fixed seed so that runs are reproducible.
+ *
+ * Results are written to stdout one run per line, as tab-separated columns:
+ *
+ *     suite case size ops ns_per_op ops_per_sec peak_rss_kib
+ *
+ * preceded by a header line starting with `#`. Sizes that a case does not
+ * support are skipped. Errors go to stderr.
+ *
+ * Usage: bench_<suite> [-s sizes] [-c case]
+ *
+ * where sizes is a comma-separated list that may use k and M suffixes
+ * (default 1k,10k,100k,1M,10M) and case runs only the named case.
+ */
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The seed of every run. The size is mixed in so that each size gets
+ * different inputs. */
+#define BENCH_SEED 0x6e73696473ULL
+
+/** A benchmark that is run at each size */
+struct bench_case
+{
+    const char *name;
+    /** Larger sizes are skipped, or 0 to run every size */
+    size_t max_size;
+    /**
+     * Run the case with \p n entries.
+     *
+     * @param n The number of entries
+     * @param[out] ops The number of operations that were timed
+     * @return The time the operations took in nanoseconds, or a negative
+     * value if the run failed
+     */
+    double (*run)(size_t n, size_t *ops);
+};
+
+/**
+ * A set of generated domain names, stored end to end
+ */
+struct bench_names
+{
+    char *buf;
+    /** The offset of each name within #buf. Has count + 1 entries so that
+     * the length of a name is the difference between two offsets, less the
+     * NULL terminator. */
+    size_t *offsets;
+    size_t count;
+};
+
+/**
+ * Run the cases of a benchmark program at the sizes given in \p argv.
+ *
+ * @return The exit status of the program
+ */
+int
+bench_main(int argc, char **argv, const char *suite,
+        const struct bench_case *cases, size_t num_cases);
+
+/**
+ * A monotonic clock in nanoseconds.
+ */
+double
+bench_now_ns(void);
+
+/**
+ * The next number from the generator seeded for this run.
+ */
+uint64_t
+bench_rand(void);
+
+/**
+ * A number in [0, n), uniformly distributed.
+ */
+size_t
+bench_uniform(size_t n);
+
+/**
+ * A rank in [0, n), where lower ranks are more likely in the way that
+ * popular domains are looked up more often than the rest: the probability
+ * that the rank is below k is about log(k + 1) / log(n + 1), which is a
+ * continuous approximation of Zipf's law with an exponent of 1.
+ */
+size_t
+bench_zipf(size_t n);
+
+/**
+ * Generate \p count domain names that resemble those seen on a network and
+ * in blacklists: mostly common TLDs, dictionary-like and algorithmically
+ * generated second level labels, and some subdomains. Names may repeat.
+ *
+ * @param[out] names The names. Free with bench_names_free().
+ * @param reverse If true, the labels of each name are in reverse order, as
+ * the domain blacklist stores them
+ * @return 0 if successful, -1 if memory could not be allocated
+ */
+int
+bench_names_generate(struct bench_names *names, size_t count, int reverse);
+
+/**
+ * The name at \p index, which is NULL terminated.
+ *
+ * @param[out] len If not NULL, set to the length of the name
+ */
+const char *
+bench_names_get(const struct bench_names *names, size_t index, size_t *len);
+
+void
+bench_names_free(struct bench_names *names);
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,305 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Decoding DNS queries and responses
+ *
+ * Compares dns_parse(), which copies a message into allocated structures,
+ * with the dns_view functions used on the packet path, which decode each
+ * name into a buffer on the stack.
+ *
+ * The messages are built in wire format the way common resolvers write them:
+ * a query has one question for an A, AAAA or HTTPS record, and a response
+ * repeats the question and answers it with an optional CNAME and up to four
+ * addresses, using compression pointers for the names. A pool of up to
+ * #POOL_SIZE distinct messages is decoded in turn until the size is reached.
+ *
+ * Usage: bench_dns [-s sizes] [-c case]
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "dns.h"
+#include "dns_view.h"
+
+/** The most distinct messages that are decoded */
+#define POOL_SIZE 65536
+
+/** Larger than any message that is built */
+#define MAX_MESSAGE_LEN 512
+
+#define TYPE_A 1
+#define TYPE_CNAME 5
+#define TYPE_AAAA 28
+#define TYPE_HTTPS 65
+
+/** Messages stored end to end */
+struct message_pool
+{
+    uint8_t *buf;
+    /** Has count + 1 entries, as in bench_names */
+    size_t *offsets;
+    size_t count;
+};
+
+static uint8_t *
+put_u16(uint8_t *pos, uint16_t v)
+{
+    pos[0] = v >> 8;
+    pos[1] = v & 0xff;
+    return pos + 2;
+}
+
+static uint8_t *
+put_u32(uint8_t *pos, uint32_t v)
+{
+    pos = put_u16(pos, v >> 16);
+    return put_u16(pos, v & 0xffff);
+}
+
+/**
+ * Write a name in wire format, without compression.
+ */
+static uint8_t *
+put_name(uint8_t *pos, const char *name)
+{
+    const char *dot;
+    size_t len;
+
+    while (*name)
+    {
+        dot = strchr(name, '.');
+        len = dot ? (size_t) (dot - name) : strlen(name);
+        *pos++ = len;
+        memcpy(pos, name, len);
+        pos += len;
+        name += len + (dot ? 1 : 0);
+    }
+    *pos++ = 0;
+
+    return pos;
+}
+
+/**
+ * Build a query or a response for \p name into \p out.
+ *
+ * @return The length of the message
+ */
+static size_t
+build_message(uint8_t *out, const char *name, int response)
+{
+    unsigned int kind = bench_uniform(10), answers = 0, i;
+    uint16_t qtype = kind < 6 ? TYPE_A : kind < 9 ? TYPE_AAAA : TYPE_HTTPS;
+    uint16_t target = 12;   // The offset of the name in the question
+    uint8_t *pos = out, *cname;
+
+    if (response && TYPE_HTTPS != qtype) answers = 1 + bench_uniform(4);
+
+    pos = put_u16(pos, bench_rand());
+    pos = put_u16(pos, response ? 0x8180 : 0x0100);
+    pos = put_u16(pos, 1);
+    pos = put_u16(pos, answers + (answers && kind % 3 == 0));
+    pos = put_u16(pos, 0);
+    pos = put_u16(pos, 0);
+
+    pos = put_name(pos, name);
+    pos = put_u16(pos, qtype);
+    pos = put_u16(pos, 1);
+
+    if (!answers) return pos - out;
+
+    if (kind % 3 == 0)
+    {
+        // CNAME to a label under the same name, as CDNs often answer
+        pos = put_u16(pos, 0xc000 | 12);
+        pos = put_u16(pos, TYPE_CNAME);
+        pos = put_u16(pos, 1);
+        pos = put_u32(pos, 300);
+        pos = put_u16(pos, 7);
+        cname = pos;
+        *pos++ = 4;
+        memcpy(pos, "edge", 4);
+        pos += 4;
+        pos = put_u16(pos, 0xc000 | 12);
+        target = cname - out;
+    }
+
+    for (i = 0; i < answers; i++)
+    {
+        pos = put_u16(pos, 0xc000 | target);
+        pos = put_u16(pos, qtype);
+        pos = put_u16(pos, 1);
+        pos = put_u32(pos, 60);
+        if (TYPE_A == qtype)
+        {
+            pos = put_u16(pos, 4);
+            pos = put_u32(pos, bench_rand());
+        }
+        else
+        {
+            pos = put_u16(pos, 16);
+            pos = put_u32(pos, 0x20010db8);
+            pos = put_u32(pos, bench_rand());
+            pos = put_u32(pos, bench_rand());
+            pos = put_u32(pos, bench_rand());
+        }
+    }
+
+    return pos - out;
+}
+
+static int
+make_pool(struct message_pool *pool, size_t n, int response)
+{
+    struct bench_names names;
+    size_t used = 0, i;
+
+    pool->count = n < POOL_SIZE ? n : POOL_SIZE;
+    if (0 != bench_names_generate(&names, pool->count, 0)) return -1;
+
+    pool->buf = malloc(pool->count * MAX_MESSAGE_LEN);
+    pool->offsets = malloc((pool->count + 1) * sizeof(*pool->offsets));
+    if (!pool->buf || !pool->offsets) return -1;
+
+    for (i = 0; i < pool->count; i++)
+    {
+        pool->offsets[i] = used;
+        used += build_message(pool->buf + used,
+                bench_names_get(&names, i, NULL), response);
+    }
+    pool->offsets[pool->count] = used;
+
+    bench_names_free(&names);
+    return 0;
+}
+
+static void
+free_pool(struct message_pool *pool)
+{
+    free(pool->buf);
+    free(pool->offsets);
+}
+
+static double
+run_parse(size_t n, size_t *ops, int response)
+{
+    struct message_pool pool;
+    struct dns_packet *pkt;
+    double start, elapsed;
+    size_t i, m;
+
+    if (0 != make_pool(&pool, n, response)) return -1;
+
+    start = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        m = i % pool.count;
+        if (!(pkt = dns_parse(pool.buf + pool.offsets[m],
+                pool.buf + pool.offsets[m + 1])))
+            return -1;
+        free_dns_packet(&pkt);
+    }
+    elapsed = bench_now_ns() - start;
+
+    free_pool(&pool);
+    *ops = n;
+    return elapsed;
+}
+
+/**
+ * Decode every name in each message, as the packet handler does when it
+ * checks a message against the domain blacklist.
+ */
+static double
+run_view(size_t n, size_t *ops, int response)
+{
+    struct message_pool pool;
+    struct dns_view view;
+    struct dns_view_iter it;
+    struct dns_question_view qn;
+    struct dns_rr_view rr;
+    char name[DNS_NAME_BUF_LEN];
+    double start, elapsed;
+    size_t i, m;
+    int rc;
+
+    if (0 != make_pool(&pool, n, response)) return -1;
+
+    start = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        m = i % pool.count;
+        if (0 != dns_view_init(&view, pool.buf + pool.offsets[m],
+                pool.buf + pool.offsets[m + 1]))
+            return -1;
+
+        dns_view_iter_init(&view, &it);
+        while (1 == (rc = dns_view_next_question(&it, &qn)))
+        {
+            if (0 > dns_view_name(&view, qn.name, name, sizeof(name)))
+                return -1;
+        }
+        if (0 > rc) return -1;
+
+        while (1 == (rc = dns_view_next_record(&it, &rr)))
+        {
+            if (TYPE_CNAME == rr.type
+                    && 0 > dns_view_rdata_name(&view, &rr, name, sizeof(name)))
+                return -1;
+        }
+        if (0 > rc) return -1;
+    }
+    elapsed = bench_now_ns() - start;
+
+    free_pool(&pool);
+    *ops = n;
+    return elapsed;
+}
+
+static double
+run_parse_query(size_t n, size_t *ops)
+{
+    return run_parse(n, ops, 0);
+}
+
+static double
+run_parse_response(size_t n, size_t *ops)
+{
+    return run_parse(n, ops, 1);
+}
+
+static double
+run_view_query(size_t n, size_t *ops)
+{
+    return run_view(n, ops, 0);
+}
+
+static double
+run_view_response(size_t n, size_t *ops)
+{
+    return run_view(n, ops, 1);
+}
+
+static const struct bench_case cases[] = {
+    { "parse_query", 0, run_parse_query },
+    { "parse_response", 0, run_parse_response },
+    { "view_query", 0, run_view_query },
+    { "view_response", 0, run_view_response },
+};
+
+int
+main(int argc, char **argv)
+{
+    return bench_main(argc, argv, "dns", cases,
+            sizeof(cases) / sizeof(cases[0]));
+}
@@ -0,0 +1,227 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief The HAT-trie and the label reversal behind the domain blacklist
+ *
+ * The trie is filled with generated names whose labels are reversed, as
+ * domain_blacklist_add() stores them. Names that are looked up are chosen
+ * with a Zipf-like distribution, so that a few popular names make up most of
+ * the lookups as they do in DNS traffic. Misses are names generated after
+ * those in the trie.
+ *
+ * Usage: bench_domain [-s sizes] [-c case]
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "blacklist/domain_blacklist.h"
+#include "utils/hat/hat-trie.h"
+
+/* Not in domain_blacklist.h because the blacklist reverses names itself */
+char *
+_domain_blacklist_reverse_labels(const char *domain);
+
+/**
+ * Build a trie of the first \p n names in \p names.
+ */
+static hattrie_t *
+make_trie(const struct bench_names *names, size_t n)
+{
+    hattrie_t *trie = hattrie_create();
+    const char *name;
+    value_t *v;
+    size_t i, len;
+
+    if (!trie) return NULL;
+
+    for (i = 0; i < n; i++)
+    {
+        name = bench_names_get(names, i, &len);
+        if (!(v = hattrie_get(trie, name, len)))
+        {
+            hattrie_free(trie);
+            return NULL;
+        }
+        *v = i + 1;
+    }
+
+    return trie;
+}
+
+static double
+run_get_insert(size_t n, size_t *ops)
+{
+    struct bench_names names;
+    hattrie_t *trie;
+    double start, elapsed;
+
+    if (0 != bench_names_generate(&names, n, 1)) return -1;
+
+    start = bench_now_ns();
+    if (!(trie = make_trie(&names, n))) return -1;
+    elapsed = bench_now_ns() - start;
+
+    hattrie_free(trie);
+    bench_names_free(&names);
+    *ops = n;
+    return elapsed;
+}
+
+/**
+ * Look up \p n names in a trie of \p n names, with either hattrie_get() or
+ * hattrie_tryget().
+ *
+ * @param hits If true, the names are in the trie. Otherwise they are
+ * generated after the names in the trie, so almost all of them miss.
+ */
+static double
+run_lookup(size_t n, size_t *ops, int use_get, int hits)
+{
+    struct bench_names names;
+    hattrie_t *trie;
+    size_t *queries, i, len, found = 0;
+    const char *name;
+    double start, elapsed;
+
+    if (0 != bench_names_generate(&names, 2 * n, 1)) return -1;
+    if (!(trie = make_trie(&names, n))) return -1;
+
+    if (!(queries = malloc(n * sizeof(*queries)))) return -1;
+    for (i = 0; i < n; i++)
+        queries[i] = hits ? bench_zipf(n) : n + bench_zipf(n);
+
+    start = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        name = bench_names_get(&names, queries[i], &len);
+        if (use_get)
+            found += NULL != hattrie_get(trie, name, len);
+        else
+            found += NULL != hattrie_tryget(trie, name, len);
+    }
+    elapsed = bench_now_ns() - start;
+
+    if (found > n) return -1;
+
+    free(queries);
+    hattrie_free(trie);
+    bench_names_free(&names);
+    *ops = n;
+    return elapsed;
+}
+
+static double
+run_get_existing(size_t n, size_t *ops)
+{
+    return run_lookup(n, ops, 1, 1);
+}
+
+static double
+run_tryget_hit(size_t n, size_t *ops)
+{
+    return run_lookup(n, ops, 0, 1);
+}
+
+static double
+run_tryget_miss(size_t n, size_t *ops)
+{
+    return run_lookup(n, ops, 0, 0);
+}
+
+static double
+run_reverse_labels(size_t n, size_t *ops)
+{
+    struct bench_names names;
+    double start, elapsed;
+    char *reversed;
+    size_t i;
+
+    if (0 != bench_names_generate(&names, n, 0)) return -1;
+
+    start = bench_now_ns();
+    for (i = 0; i < n; i++)
+    {
+        if (!(reversed = _domain_blacklist_reverse_labels(
+                bench_names_get(&names, i, NULL))))
+            return -1;
+        free(reversed);
+    }
+    elapsed = bench_now_ns() - start;
+
+    bench_names_free(&names);
+    *ops = n;
+    return elapsed;
+}
+
+/**
+ * The whole lookup done for each name in a DNS message: reversing the labels
+ * and looking the result up. Half of the names are in the blacklist.
+ */
+static double
+run_is_blacklisted(size_t n, size_t *ops)
+{
+    struct bench_names names;
+    domain_blacklist *bl;
+    size_t *queries, i;
+    char *reversed;
+    value_t *v;
+    double start, elapsed;
+
+    if (0 != bench_names_generate(&names, 2 * n, 0)) return -1;
+    if (!(bl = new_domain_blacklist())) return -1;
+
+    // domain_blacklist_add() takes ownership of a value per name, so fill the
+    // trie directly
+    for (i = 0; i < n; i++)
+    {
+        if (!(reversed = _domain_blacklist_reverse_labels(
+                bench_names_get(&names, i, NULL))))
+            return -1;
+        if (!(v = hattrie_get(bl, reversed, strlen(reversed)))) return -1;
+        *v = i + 1;
+        free(reversed);
+    }
+
+    if (!(queries = malloc(n * sizeof(*queries)))) return -1;
+    for (i = 0; i < n; i++)
+        queries[i] = (bench_rand() & 1) * n + bench_zipf(n);
+
+    start = bench_now_ns();
+    for (i = 0; i < n; i++)
+        domain_blacklist_is_blacklisted(bl,
+                bench_names_get(&names, queries[i], NULL));
+    elapsed = bench_now_ns() - start;
+
+    free(queries);
+    free_domain_blacklist(&bl);
+    bench_names_free(&names);
+    *ops = n;
+    return elapsed;
+}
+
+static const struct bench_case cases[] = {
+    { "hattrie_get_insert", 0, run_get_insert },
+    { "hattrie_get_existing", 0, run_get_existing },
+    { "hattrie_tryget_hit", 0, run_tryget_hit },
+    { "hattrie_tryget_miss", 0, run_tryget_miss },
+    { "reverse_labels", 0, run_reverse_labels },
+    { "is_blacklisted", 0, run_is_blacklisted },
+};
+
+int
+main(int argc, char **argv)
+{
+    return bench_main(argc, argv, "domain", cases,
+            sizeof(cases) / sizeof(cases[0]));
+}
@@ -0,0 +1,185 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Insert, sort and lookup in the EBVBL behind the IP blacklist
+ *
+ * The EBVBL is used through ip_blacklist so that it has the comparison
+ * function and bit vector size of the IDS. Addresses are clustered in a few
+ * thousand /16 networks, as the addresses in IP blacklists are, with the
+ * rest spread over the whole address space.
+ *
+ * Usage: bench_ebvbl [-s sizes] [-c case]
+ */
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "bench.h"
+#include "blacklist/ip_blacklist.h"
+#include "utils/ebvbl/ebvbl.h"
+
+/** The number of /16 networks that most addresses are drawn from */
+#define HOT_NETWORKS 4096
+
+/** The percentage of addresses drawn from the hot networks */
+#define HOT_PERCENT 70
+
+static uint32_t hot_networks[HOT_NETWORKS];
+
+static void
+init_networks(void)
+{
+    size_t i;
+
+    for (i = 0; i < HOT_NETWORKS; i++)
+        hot_networks[i] = (uint32_t) bench_rand() & 0xffff0000;
+}
+
+/**
+ * An address in host byte order.
+ */
+static uint32_t
+random_address(void)
+{
+    if (bench_uniform(100) < HOT_PERCENT)
+        return hot_networks[bench_uniform(HOT_NETWORKS)]
+                | (uint32_t) (bench_rand() & 0xffff);
+
+    return (uint32_t) bench_rand();
+}
+
+/**
+ * Build a blacklist of \p n random addresses.
+ *
+ * @param[out] addrs If not NULL, set to the addresses that were added, in
+ * host byte order. Free with free().
+ */
+static ip_blacklist *
+make_blacklist(size_t n, uint32_t **addrs)
+{
+    ip_blacklist *bl = new_ip_blacklist();
+    ip_key_value_t kv = { 0 };
+    size_t i;
+
+    if (!bl) return NULL;
+    if (addrs && !(*addrs = malloc(n * sizeof(**addrs)))) goto error;
+
+    for (i = 0; i < n; i++)
+    {
+        kv.ip_addr = random_address();
+        if (!ip_blacklist_add(bl, &kv)) goto error;
+        if (addrs) (*addrs)[i] = kv.ip_addr;
+    }
+
+    return bl;
+
+error:
+    if (addrs) free(*addrs);
+    free_ip_blacklist(&bl);
+    return NULL;
+}
+
+static double
+run_insert(size_t n, size_t *ops)
+{
+    ip_blacklist *bl;
+    double start, elapsed;
+
+    init_networks();
+    start = bench_now_ns();
+    if (!(bl = make_blacklist(n, NULL))) return -1;
+    elapsed = bench_now_ns() - start;
+
+    free_ip_blacklist(&bl);
+    *ops = n;
+    return elapsed;
+}
+
+static double
+run_sort(size_t n, size_t *ops)
+{
+    ip_blacklist *bl;
+    double start, elapsed;
+
+    init_networks();
+    if (!(bl = make_blacklist(n, NULL))) return -1;
+
+    start = bench_now_ns();
+    if (!ebvbl_sort((EBVBL *) bl)) return -1;
+    elapsed = bench_now_ns() - start;
+
+    free_ip_blacklist(&bl);
+    *ops = n;
+    return elapsed;
+}
+
+/**
+ * Look up \p n addresses, which are either in the blacklist or drawn from
+ * the same distribution as the blacklist.
+ */
+static double
+run_lookup(size_t n, size_t *ops, int hits)
+{
+    ip_blacklist *bl;
+    uint32_t *addrs = NULL, *queries;
+    double start, elapsed;
+    size_t i, found = 0;
+
+    init_networks();
+    if (!(bl = make_blacklist(n, &addrs))) return -1;
+    if (!ebvbl_sort((EBVBL *) bl)) return -1;
+
+    // Choose the queries before timing, in network byte order
+    if (!(queries = malloc(n * sizeof(*queries)))) return -1;
+    for (i = 0; i < n; i++)
+        queries[i] = htonl(hits ? addrs[bench_uniform(n)] : random_address());
+
+    start = bench_now_ns();
+    for (i = 0; i < n; i++)
+        found += NULL != ip_blacklist_lookup(bl, queries[i], 0);
+    elapsed = bench_now_ns() - start;
+
+    // Every hit must be found, or the results are meaningless
+    if (hits && found != n) return -1;
+
+    free(queries);
+    free(addrs);
+    free_ip_blacklist(&bl);
+    *ops = n;
+    return elapsed;
+}
+
+static double
+run_lookup_hit(size_t n, size_t *ops)
+{
+    return run_lookup(n, ops, 1);
+}
+
+static double
+run_lookup_miss(size_t n, size_t *ops)
+{
+    return run_lookup(n, ops, 0);
+}
+
+static const struct bench_case cases[] = {
+    { "insert", 0, run_insert },
+    { "sort", 0, run_sort },
+    { "lookup_hit", 0, run_lookup_hit },
+    { "lookup_miss", 0, run_lookup_miss },
+};
+
+int
+main(int argc, char **argv)
+{
+    return bench_main(argc, argv, "ebvbl", cases,
+            sizeof(cases) / sizeof(cases[0]));
+}
@@ -0,0 +1,195 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Compare the cost and size of the event server output formats
+ *
+ * Serializes a list of synthetic events in each format and reports the time
+ * taken per event and the number of bytes that would be sent to a client.
+ * The original snprintf-based text serializer is included for comparison.
+ *
+ * Usage: bench_event_format [num_events] [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ids_event_format.h"
+
+#define DEFAULT_EVENTS 1000
+#define DEFAULT_ITERATIONS 1000
+
+static const char *format_labels[IDS_EVENT_FORMAT_COUNT] = {
+    [IDS_EVENT_FORMAT_TEXT] = "text",
+    [IDS_EVENT_FORMAT_JSON] = "json",
+    [IDS_EVENT_FORMAT_BINARY] = "binary"
+};
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Build a list of events with IoCs and addresses that vary in length, as a
+ * real list would.
+ */
+static struct ids_event *
+make_events(size_t count, struct ids_event_ts *ts, char (*iocs)[64])
+{
+    struct ids_event *events = calloc(count, sizeof(*events));
+    size_t i;
+
+    if (!events) return NULL;
+
+    ts->tm_stamp.tv_sec = 1586313317;
+    ts->tm_stamp.tv_nsec = 0;
+    ts->next = NULL;
+
+    for (i = 0; i < count; i++)
+    {
+        snprintf(iocs[i], sizeof(iocs[i]), "host%zu.malicious-domain-%zu.com",
+                i, i % 97);
+        events[i].ioc = iocs[i];
+        events[i].iface = "br-lan";
+        events[i].times_seen = ts;
+        events[i].num_times = i % 1000 + 1;
+        // 192.168.0.x as an IPv4-mapped address
+        events[i].src_ip.s6_addr[10] = 0xff;
+        events[i].src_ip.s6_addr[11] = 0xff;
+        events[i].src_ip.s6_addr[12] = 192;
+        events[i].src_ip.s6_addr[13] = 168;
+        events[i].src_ip.s6_addr[15] = i % 254 + 1;
+        events[i].mac.m_addr[5] = i;
+        events[i].seq = count - i;
+        events[i].next = i + 1 < count ? &events[i + 1] : NULL;
+    }
+
+    return events;
+}
+
+/**
+ * The serializer used before ids_event_format was added, which measures each
+ * event with snprintf before formatting it.
+ */
+static size_t
+format_legacy(char *out, size_t out_sz, const struct ids_event *event)
+{
+    const uint8_t *ip = event->src_ip.s6_addr + 12;
+    const uint8_t *mac = event->mac.m_addr;
+    char ip_str[16];
+    int len;
+
+    snprintf(ip_str, sizeof(ip_str), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+    len = snprintf(NULL, 0, "IOC: %s\nTimestamp: %11lu\nOccurrences: %d\n"
+            "Interface: %s\nSrc-IP: %s\n"
+            "Src-MAC: %02X-%02X-%02X-%02X-%02X-%02X\n\n",
+            event->ioc, (long) event->times_seen->tm_stamp.tv_sec,
+            event->num_times, event->iface, ip_str,
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    if (len < 0 || (size_t) len >= out_sz) return 0;
+
+    return snprintf(out, out_sz, "IOC: %s\nTimestamp: %11lu\nOccurrences: %d\n"
+            "Interface: %s\nSrc-IP: %s\n"
+            "Src-MAC: %02X-%02X-%02X-%02X-%02X-%02X\n\n",
+            event->ioc, (long) event->times_seen->tm_stamp.tv_sec,
+            event->num_times, event->iface, ip_str,
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t num_events = DEFAULT_EVENTS, iterations = DEFAULT_ITERATIONS;
+    struct ids_event_ts ts;
+    struct ids_event *events, *iter;
+    char (*iocs)[64];
+    char *out;
+    size_t cap = 0, len = 0, i;
+    double start, elapsed;
+    int fmt;
+
+    if (argc > 1) num_events = strtoul(argv[1], NULL, 10);
+    if (argc > 2) iterations = strtoul(argv[2], NULL, 10);
+    if (!num_events || !iterations)
+    {
+        fprintf(stderr, "usage: %s [num_events] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    iocs = calloc(num_events, sizeof(*iocs));
+    if (!iocs || !(events = make_events(num_events, &ts, iocs)))
+    {
+        fprintf(stderr, "could not allocate events\n");
+        return 1;
+    }
+
+    for (fmt = 0; fmt < IDS_EVENT_FORMAT_COUNT; fmt++)
+    {
+        for (iter = events; iter; iter = iter->next)
+        {
+            size_t max = ids_event_format_len_max(fmt, iter);
+            cap += max;
+        }
+    }
+    if (NULL == (out = malloc(cap)))
+    {
+        fprintf(stderr, "could not allocate output buffer\n");
+        return 1;
+    }
+
+    printf("%-8s %12s %12s %14s\n", "format", "ns/event", "bytes/event",
+            "bytes/response");
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        len = 0;
+        for (iter = events; iter; iter = iter->next)
+            len += format_legacy(out + len, cap - len, iter);
+    }
+    elapsed = now_ns() - start;
+    printf("%-8s %12.1f %12.1f %14zu\n", "legacy",
+            elapsed / iterations / num_events, (double) len / num_events, len);
+
+    for (fmt = 0; fmt < IDS_EVENT_FORMAT_COUNT; fmt++)
+    {
+        start = now_ns();
+        for (i = 0; i < iterations; i++)
+        {
+            // Size the buffer then fill it, as the event server does
+            len = 0;
+            for (iter = events; iter; iter = iter->next)
+                len += ids_event_format_len_max(fmt, iter);
+            if (len > cap) return 1;
+
+            len = 0;
+            for (iter = events; iter; iter = iter->next)
+                len += ids_event_format(fmt, out + len, iter);
+            len += ids_event_format_cursor(fmt, out + len, events->seq);
+        }
+        elapsed = now_ns() - start;
+        printf("%-8s %12.1f %12.1f %14zu\n", format_labels[fmt],
+                elapsed / iterations / num_events, (double) len / num_events,
+                len);
+    }
+
+    free(out);
+    free(events);
+    free(iocs);
+    return 0;
+}
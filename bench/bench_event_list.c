@@ -0,0 +1,167 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Adding observations to a full event list
+ *
+ * The size is the maximum number of events in the list, which starts full.
+ * Each operation is one call to ids_event_list_add_event(). In the churn
+ * case half of the observations repeat an event already in the list, most
+ * often a recent one, and the rest are new events that push the oldest out
+ * of the list. In the new case every observation is a new event.
+ *
+ * The list is searched linearly for each observation, so the larger sizes
+ * are skipped and at most #MAX_OPS observations are timed.
+ *
+ * Usage: bench_event_list [-s sizes] [-c case]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "ids_event_list.h"
+#include "utils/mem.h"
+
+/** The most observations that are timed at each size */
+#define MAX_OPS 10000
+
+/** The largest list that is tested */
+#define MAX_EVENTS 100000
+
+/** The number of timestamps kept per event, as configured by default */
+#define MAX_TIMESTAMPS 10
+
+/** The number of devices the observations come from */
+#define NUM_DEVICES 64
+
+static char iface[] = "br-lan";
+
+/**
+ * Create the event for observation \p id, which is seen by a device chosen
+ * from \p id.
+ */
+static struct ids_event *
+make_event(uint64_t id)
+{
+    struct in6_addr src = IN6ADDR_ANY_INIT;
+    mac_addr mac = { { 0 } };
+    ids_ioc_value_t value;
+    char ioc[64];
+
+    memset(&value, 0, sizeof(value));
+    snprintf(ioc, sizeof(ioc), "host%llu.malicious-domain.com",
+            (unsigned long long) id);
+
+    // 192.168.0.x as an IPv4-mapped address
+    src.s6_addr[10] = 0xff;
+    src.s6_addr[11] = 0xff;
+    src.s6_addr[12] = 192;
+    src.s6_addr[13] = 168;
+    src.s6_addr[15] = id % NUM_DEVICES + 1;
+    mac.m_addr[5] = id % NUM_DEVICES + 1;
+
+    return new_ids_event(iface, &src, mem_strdup(MEM_EVENTS, ioc), mac,
+            value);
+}
+
+/**
+ * Build a list that is already full, with events 0 to n - 1 and the newest
+ * at the head. The events are linked directly because adding them would
+ * search the list each time.
+ */
+static struct ids_event_list *
+make_full_list(size_t n)
+{
+    struct ids_event_list *list = new_ids_event_list(n, MAX_TIMESTAMPS);
+    struct ids_event *e;
+    size_t i;
+
+    if (!list) return NULL;
+
+    for (i = 0; i < n; i++)
+    {
+        if (!(e = make_event(i))) return NULL;
+
+        e->seq = ++list->seq;
+        e->next = list->head;
+        if (list->head) list->head->previous = e;
+        list->head = e;
+    }
+
+    return list;
+}
+
+/**
+ * Add observations to a full list of \p n events.
+ *
+ * @param repeat_percent The percentage of observations that repeat an event
+ * in the list
+ */
+static double
+run_add(size_t n, size_t *ops, unsigned int repeat_percent)
+{
+    struct ids_event_list *list;
+    struct ids_event **events;
+    size_t num_ops = n < MAX_OPS ? n : MAX_OPS, i;
+    uint64_t next_id = n;
+    double start, elapsed;
+
+    if (!(list = make_full_list(n))) return -1;
+
+    // Create the observations before timing
+    if (!(events = malloc(num_ops * sizeof(*events)))) return -1;
+    for (i = 0; i < num_ops; i++)
+    {
+        // New events are added in order, so the most recent n are in the list
+        uint64_t id = bench_uniform(100) < repeat_percent
+                ? next_id - 1 - bench_zipf(n) : next_id++;
+
+        if (!(events[i] = make_event(id))) return -1;
+    }
+
+    start = bench_now_ns();
+    for (i = 0; i < num_ops; i++)
+    {
+        if (!ids_event_list_add_event(list, events[i])) return -1;
+    }
+    elapsed = bench_now_ns() - start;
+
+    free(events);
+    free_ids_event_list(&list);
+    *ops = num_ops;
+    return elapsed;
+}
+
+static double
+run_churn(size_t n, size_t *ops)
+{
+    return run_add(n, ops, 50);
+}
+
+static double
+run_new(size_t n, size_t *ops)
+{
+    return run_add(n, ops, 0);
+}
+
+static const struct bench_case cases[] = {
+    { "add_event_churn", MAX_EVENTS, run_churn },
+    { "add_event_new", MAX_EVENTS, run_new },
+};
+
+int
+main(int argc, char **argv)
+{
+    return bench_main(argc, argv, "event_list", cases,
+            sizeof(cases) / sizeof(cases[0]));
+}
@@ -0,0 +1,248 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Receiving a full update from the update server
+ *
+ * An update of the given number of IoCs, 60% domain names and the rest IPv4
+ * addresses and ports, is passed through the client side of the update
+ * protocol in pieces of #CHUNK_LEN bytes, as TLS would deliver it. The time
+ * taken includes parsing the update, building the new blacklists and
+ * swapping them in. Each operation is one IoC.
+ *
+ * The text case is a v1 update, and the binary case a v3 update with the
+ * same IoCs as binary records (see record_decoder.h).
+ *
+ * Usage: bench_update [-s sizes] [-c case]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "bench.h"
+#include "updates/ids_tls_update.h"
+
+/** The most plaintext that one TLS record carries */
+#define CHUNK_LEN 16384
+
+/** The percentage of IoCs that are domain names */
+#define DOMAIN_PERCENT 60
+
+/** An update as the server sends it, after the protocol version */
+struct update
+{
+    char *buf;
+    size_t len;
+    size_t cap;
+    /** The number of IPv4 IoCs, each of which is a different address */
+    size_t ips;
+};
+
+static int
+append(struct update *u, const void *data, size_t len)
+{
+    char *buf;
+
+    if (u->len + len > u->cap)
+    {
+        u->cap = (u->cap + len) * 2;
+        if (!(buf = realloc(u->buf, u->cap))) return -1;
+        u->buf = buf;
+    }
+    memcpy(u->buf + u->len, data, len);
+    u->len += len;
+    return 0;
+}
+
+/**
+ * A different address for each \p i, spread over the address space.
+ */
+static uint32_t
+address(size_t i)
+{
+    return (uint32_t) (i * 2654435761u);
+}
+
+/**
+ * Generate an update of \p n IoCs.
+ *
+ * @param binary Non-zero for binary records, otherwise text lines
+ */
+static int
+make_update(size_t n, int binary, struct update *u)
+{
+    struct bench_names names;
+    const char *name;
+    char line[320];
+    uint8_t rec[3 + 1 + 255 + 4];
+    uint32_t addr;
+    size_t i, len;
+    int rc = 0;
+
+    memset(u, 0, sizeof(*u));
+    if (bench_names_generate(&names, n, 0)) return -1;
+
+    for (i = 0; i < n && !rc; i++)
+    {
+        if (bench_uniform(100) < DOMAIN_PERCENT)
+        {
+            name = bench_names_get(&names, i, &len);
+            if (binary)
+            {
+                rec[0] = NS_RECORD_DOMAIN;
+                rec[1] = 0;
+                rec[2] = 1 + len + 4;
+                rec[3] = len;
+                memcpy(rec + 4, name, len);
+                memset(rec + 4 + len, 0, 4);
+                rc = append(u, rec, 3 + 1 + len + 4);
+            }
+            else
+            {
+                len = snprintf(line, sizeof(line), "DN_IOC: %s\n", name);
+                rc = append(u, line, len);
+            }
+            continue;
+        }
+
+        addr = address(u->ips++);
+        if (binary)
+        {
+            rec[0] = NS_RECORD_IP;
+            rec[1] = 0;
+            rec[2] = 10;
+            addr = htonl(addr);
+            memcpy(rec + 3, &addr, 4);
+            rec[7] = 0;
+            rec[8] = 80;
+            memset(rec + 9, 0, 4);
+            rc = append(u, rec, 13);
+        }
+        else
+        {
+            len = snprintf(line, sizeof(line), "IP_IOC: %u.%u.%u.%u 80\n",
+                    addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff,
+                    addr & 0xff);
+            rc = append(u, line, len);
+        }
+    }
+
+    // The end of the update
+    if (!rc) rc = binary ? append(u, "\0\0\0", 3) : append(u, "\n", 1);
+
+    bench_names_free(&names);
+    return rc;
+}
+
+/**
+ * Pass \p len bytes from the server to the protocol, and complete any write
+ * that it asks for.
+ *
+ * @return 1 once the update has been confirmed, 0 if the protocol is waiting
+ * for more, or -1 on an error
+ */
+static int
+receive(ns_cli_state_t *state, tls_stream_t *stream, char *data, size_t len)
+{
+    ns_action_t action = { .type = NS_ACTION_NOP };
+    uv_buf_t buf = { .base = data, .len = len };
+    int confirmed;
+
+    if (ns_cl_proto_on_recv(&action, state, stream, &buf)) return -1;
+    if (NS_ACTION_WRITE != action.type) return 0;
+
+    confirmed = !strncmp(action.send_buffer.base, "UPDATE CONFIRMED", 16);
+    free(action.send_buffer.base);
+    if (ns_cl_proto_on_send(&action, state, stream, 0)) return -1;
+
+    return NS_PROTO_IOCS_WAITING == *state ? 0 : (confirmed ? 1 : -1);
+}
+
+static double
+run_update(size_t n, size_t *ops, int binary)
+{
+    static ids_update_ctx_t ctx;
+    domain_blacklist *dn = new_domain_blacklist();
+    ip_blacklist *ip = new_ip_blacklist();
+    ip6_blacklist *ip6 = new_ip6_blacklist();
+    ns_cli_state_t state = NS_PROTO_VERSION_WAITING;
+    tls_stream_t stream;
+    struct update u = { NULL, 0, 0, 0 };
+    char version[4], header[16];
+    double start, elapsed = -1;
+    size_t pos, len;
+    int rc = 0;
+
+    if (!dn || !ip || !ip6 || make_update(n, binary, &u)) goto done;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.domain = &dn;
+    ctx.ip = &ip;
+    ctx.ip6 = &ip6;
+    memset(&stream, 0, sizeof(stream));
+    stream.data = &ctx;
+    strcpy(version, binary ? "v3\n" : "v1\n");
+    strcpy(header, "FULL: 1\n");
+
+    start = bench_now_ns();
+    if (receive(&state, &stream, version, 3) < 0) goto done;
+    if (binary && receive(&state, &stream, header, strlen(header)) < 0)
+        goto done;
+    for (pos = 0; pos < u.len && !rc; pos += len)
+    {
+        len = u.len - pos < CHUNK_LEN ? u.len - pos : CHUNK_LEN;
+        rc = receive(&state, &stream, u.buf + pos, len);
+    }
+    if (rc <= 0) goto done;
+    elapsed = bench_now_ns() - start;
+
+    // Every address is different, so each must have been added
+    if (ip_blacklist_count(ip) != u.ips)
+    {
+        fprintf(stderr, "%zu of %zu addresses were added\n",
+                (size_t) ip_blacklist_count(ip), u.ips);
+        elapsed = -1;
+    }
+    *ops = n;
+
+done:
+    free(u.buf);
+    free_domain_blacklist(&dn);
+    free_ip_blacklist(&ip);
+    free_ip6_blacklist(&ip6);
+    return elapsed;
+}
+
+static double
+run_text(size_t n, size_t *ops)
+{
+    return run_update(n, ops, 0);
+}
+
+static double
+run_binary(size_t n, size_t *ops)
+{
+    return run_update(n, ops, 1);
+}
+
+static const struct bench_case cases[] = {
+    { "text", 1000000, run_text },
+    { "binary", 1000000, run_binary },
+};
+
+int
+main(int argc, char **argv)
+{
+    return bench_main(argc, argv, "update", cases,
+            sizeof(cases) / sizeof(cases[0]));
+}
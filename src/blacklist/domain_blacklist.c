@@ -15,63 +15,114 @@
 #include <assert.h>
 
 #include "utils/logging.h"
+#include "../trace.h"
 #include "domain_blacklist.h"
 #include "ids_storedvalues.h"
 
+/** Names up to this length are reversed on the stack when looked up */
+#define REVERSE_BUF_LEN 256
+
 /**
  * At least for the HAT-trie, extra compression can be attained by reversing the labels so that
  * TLDs come first.
  *
  * When checking domain names, they will also need to be reversed before lookup.
  *
- * Does not modify original domain string. Returns a dynamically allocated string.
+ * Empty labels are skipped, so "a..b." is reversed to "b.a".
  *
- * Will return NULL if memory allocation failed (there are a few extra strings required for this
- * operation).
+ * @param domain The domain to reverse. Not modified.
+ * @param out The buffer to write the reversed domain to, which is NULL
+ * terminated
+ * @param out_sz The size of \p out. strlen(domain) + 1 is always enough.
+ * @return The length of the reversed domain, or -1 if it does not fit in
+ * \p out
  */
-char *
-_domain_blacklist_reverse_labels(const char * domain)
+static int
+_domain_blacklist_reverse_labels_into(const char *domain, char *out,
+        size_t out_sz)
 {
     assert(domain);
-    int reversed_idx = -1;
-    char *delim = ".";
+    assert(out);
+
+    const char *label_end = domain + strlen(domain), *label_start;
+    size_t out_len = 0, label_len;
+
+    // Walk the labels from the last to the first, appending each to out
+    while (label_end > domain)
+    {
+        label_start = label_end;
+        while (label_start > domain && '.' != label_start[-1]) label_start--;
+
+        label_len = label_end - label_start;
+        if (label_len)
+        {
+            if (out_len + (out_len ? 1 : 0) + label_len >= out_sz) return -1;
+            if (out_len) out[out_len++] = '.';
+            memcpy(out + out_len, label_start, label_len);
+            out_len += label_len;
+        }
 
-    // token_cpy is the copy which will be destroyed by strtok
-    char *token_cpy = strdup(domain), *reversed = NULL;
-    if (!token_cpy) goto error;
+        // Skip the '.' before this label
+        label_end = label_start > domain ? label_start - 1 : domain;
+    }
+
+    if (out_len >= out_sz) return -1;
+    out[out_len] = '\0';
+    return out_len;
+}
 
-    char *tok = NULL;
-    size_t tok_len;
+/**
+ * Reverse the labels of a domain into a dynamically allocated string. See
+ * _domain_blacklist_reverse_labels_into().
+ *
+ * Will return NULL if memory allocation failed.
+ */
+char *
+_domain_blacklist_reverse_labels(const char * domain)
+{
+    assert(domain);
 
     size_t reversed_sz = strlen(domain) + 1;
-    reversed = malloc(reversed_sz);
+    char *reversed = malloc(reversed_sz);
+
     if (!reversed) return NULL;	// Memory allocation error
 
-    // Counts back from end as domain labels are prepended
-    reversed_idx = (int) reversed_sz - 1;
-    if (reversed_idx < 0) goto error;
-    reversed[reversed_idx] = '\0';
+    if (0 > _domain_blacklist_reverse_labels_into(domain, reversed,
+            reversed_sz))
+    {
+        free(reversed);
+        return NULL;
+    }
+
+    return reversed;
+}
+
+/**
+ * Reverse the labels of a domain into \p buf if they fit, or into an allocated
+ * string if they do not. The result must be released with
+ * release_reversed().
+ *
+ * @return The reversed domain, or NULL if memory allocation failed
+ */
+static char *
+reverse_labels(const char *domain, char *buf, size_t buf_sz, int *len)
+{
+    char *reversed = buf;
 
-    if (NULL != (tok = strtok(token_cpy, delim)))
+    *len = _domain_blacklist_reverse_labels_into(domain, buf, buf_sz);
+    if (0 > *len)
     {
-        do {
-            tok_len = strlen(tok);
-            reversed_idx -= tok_len;
-            assert(reversed_idx >= 0);
-            strncpy(reversed + reversed_idx, tok, tok_len);
-
-            // prepend '.'
-            if (--reversed_idx >= 0) reversed[reversed_idx] = '.';
-        } while (NULL != (tok = strtok(NULL, delim)));
+        reversed = _domain_blacklist_reverse_labels(domain);
+        if (reversed) *len = strlen(reversed);
     }
 
-    free(token_cpy);
     return reversed;
+}
 
-error:
-    if (token_cpy) free(token_cpy);
-    if (reversed) free(reversed);
-    return NULL;
+static void
+release_reversed(char *reversed, const char *buf)
+{
+    if (reversed != buf) free(reversed);
 }
 
 int
@@ -80,52 +131,82 @@ domain_blacklist_add(domain_blacklist *b, const char *domain, ids_ioc_value_t *v
     assert(b);
     assert(domain);
 
-    // Reverse domain label order before inserting.
-    char *reversed = _domain_blacklist_reverse_labels(domain);
-    if (!reversed) return 0;
-
     hattrie_t *h = (hattrie_t *)b;
+    char buf[REVERSE_BUF_LEN];
     value_t *result = NULL;
-    size_t len;
+    int len;
+
+    // Reverse domain label order before inserting. Updates add every domain,
+    // so avoid allocating for those that fit.
+    char *reversed = reverse_labels(domain, buf, sizeof(buf), &len);
+    if (!reversed) return 0;
 
-    len = strlen(reversed);
     result = hattrie_get(h, reversed, len);
-    if (result && *result)
+    release_reversed(reversed, buf);
+    if (!result) return 0;
+
+    if (*result)
     {
         // If the trie already has a value for this domain, free the old one
         free_ids_ioc_value((ids_ioc_value_t *)*result);
     }
     *result = (uintptr_t)value;
-    free(reversed);
 
-    return (result ? 1 : 0);
+    return 1;
 }
 
-ids_ioc_value_t *
-domain_blacklist_is_blacklisted(domain_blacklist *b, const char *domain)
+int
+domain_blacklist_remove(domain_blacklist *b, const char *domain)
 {
     assert(b);
     assert(domain);
 
     hattrie_t *h = (hattrie_t *)b;
-    size_t len;
+    char buf[REVERSE_BUF_LEN];
     value_t *result = NULL;
+    int len;
+    int removed = 0;
+
+    char *reversed = reverse_labels(domain, buf, sizeof(buf), &len);
+    if (!reversed) return 0;
 
-    char *reversed = _domain_blacklist_reverse_labels(domain);
-    if (!reversed)
+    result = hattrie_tryget(h, reversed, len);
+    if (result)
     {
-        // This is a serious error since we can't check the blacklist. Definitely log it.
-        logger(L_WARN, "Could not reverse domain name when checking blacklist: %s\n", domain);
-        return 0;
+        free_ids_ioc_value((ids_ioc_value_t *)*result);
+        removed = (0 == hattrie_del(h, reversed, len));
     }
+    release_reversed(reversed, buf);
+
+    return removed;
+}
 
-    if (b && domain)
+ids_ioc_value_t *
+domain_blacklist_is_blacklisted(domain_blacklist *b, const char *domain)
+{
+    assert(b);
+    assert(domain);
+
+    hattrie_t *h = (hattrie_t *)b;
+    char reversed[REVERSE_BUF_LEN];
+    value_t *result = NULL;
+    int len;
+
+    // This is done for every name in every DNS packet, so avoid allocating.
+    // Names captured from the network always fit.
+    TRACE_BEGIN(TRACE_REVERSE);
+    len = _domain_blacklist_reverse_labels_into(domain, reversed,
+            sizeof(reversed));
+    TRACE_END(TRACE_REVERSE);
+    if (0 > len)
     {
-        len = strlen(domain);
-        result = hattrie_tryget(h, reversed, len);
+        logger(L_WARN, "Domain name too long to check blacklist: %s\n", domain);
+        return NULL;
     }
 
-    free(reversed);
+    TRACE_BEGIN(TRACE_TRIE);
+    result = hattrie_tryget(h, reversed, len);
+    TRACE_END(TRACE_TRIE);
 
     if (result)
         return (ids_ioc_value_t *) *result;
@@ -167,6 +248,43 @@ free_domain_blacklist(domain_blacklist **b)
     }
 }
 
+domain_blacklist *
+domain_blacklist_copy(domain_blacklist *b)
+{
+    assert(b);
+    bool sorted = false;
+    hattrie_t *copy = hattrie_create();
+    hattrie_iter_t *iter = NULL;
+    ids_ioc_value_t *stored = NULL;
+    value_t *result = NULL;
+    const char *key;
+    size_t len;
+
+    if (!copy) return NULL;
+    if (!(iter = hattrie_iter_begin((hattrie_t *)b, sorted))) goto error;
+
+    // The keys are already reversed, so they are copied as they are
+    while (!hattrie_iter_finished(iter))
+    {
+        key = hattrie_iter_key(iter, &len);
+        stored = (ids_ioc_value_t *) *hattrie_iter_val(iter);
+
+        if (!(result = hattrie_get(copy, key, len))) goto error;
+        if (stored && !(*result = (uintptr_t)new_ids_ioc_value(
+                stored->botnet_id)))
+            goto error;
+        hattrie_iter_next(iter);
+    }
+    hattrie_iter_free(iter);
+
+    return copy;
+
+error:
+    if (iter) hattrie_iter_free(iter);
+    domain_blacklist_clear(copy);
+    return NULL;
+}
+
 domain_blacklist *new_domain_blacklist()
 {
     hattrie_t *h = hattrie_create();
@@ -40,6 +40,18 @@ typedef hattrie_t domain_blacklist;
 int
 domain_blacklist_add(domain_blacklist *b, const char *domain, ids_ioc_value_t *value);
 
+/**
+ * Remove a domain from the blacklist and free its value. Only the domain
+ * itself is removed, not its subdomains.
+ *
+ * @param b The blacklist structure.
+ * @param domain The domain to remove, in its usual label order.
+ * @return 1 if the domain was removed, 0 if it was not in the blacklist or
+ * memory could not be allocated.
+ */
+int
+domain_blacklist_remove(domain_blacklist *b, const char *domain);
+
 /**
  * Lookup a domain in the blacklist. Will handle reversing the labels of the
  * domain which is being looked up.
@@ -67,6 +79,15 @@ domain_blacklist_clear(domain_blacklist *b);
 void
 free_domain_blacklist(domain_blacklist **b);
 
+/**
+ * Copy a domain blacklist, including a new value struct for each domain.
+ *
+ * @param b The blacklist structure to copy.
+ * @return The copy, or NULL if the operation failed.
+ */
+domain_blacklist *
+domain_blacklist_copy(domain_blacklist *b);
+
 /**
  * Initialize a new domain blacklist and return the result.
  * @return An initialized domain blacklist or NULL if the operation
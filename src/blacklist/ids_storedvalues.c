@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../utils/mem.h"
 #include "ids_storedvalues.h"
 
 /* DECLARATIONS */
@@ -37,13 +38,13 @@ new_ids_ioc_value(int botnet_id)
 {
     int rc;
     ids_ioc_value_t *value = NULL;
-    value = malloc(sizeof(*value));
+    value = mem_malloc(MEM_DOMAIN_BLACKLIST, sizeof(*value));
     if (!value) return NULL;
 
     rc = init_ids_ioc_value(value, botnet_id);
     if (rc)
     {
-        free(value);
+        mem_free(MEM_DOMAIN_BLACKLIST, value);
         return NULL;
     }
 
@@ -54,7 +55,7 @@ void
 free_ids_ioc_value(ids_ioc_value_t *value)
 {
     fini_ids_ioc_value(value);
-    if (value) free(value);
+    mem_free(MEM_DOMAIN_BLACKLIST, value);
 }
 
 static int
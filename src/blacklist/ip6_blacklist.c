@@ -0,0 +1,375 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/mem.h"
+#include "ip6_blacklist.h"
+
+#define MAX_PREFIX_LEN 128
+
+/** The number of slots allocated for an empty blacklist */
+#define INITIAL_SLOTS 64
+
+/** log2 of the number of bits in the front bitmap */
+#define FRONT_BITS_LOG2 16
+
+#define FRONT_WORDS ((1u << FRONT_BITS_LOG2) / 64)
+
+struct ip6_blacklist_slot
+{
+    /** The first 64 bits of the prefix, with bits past the length cleared */
+    uint64_t hi;
+    /** The last 64 bits of the prefix, with bits past the length cleared */
+    uint64_t lo;
+    ids_ioc_value_t value;
+    /** The length of the prefix */
+    uint8_t len;
+    /** Non-zero if the slot holds a prefix */
+    uint8_t used;
+};
+
+struct ip6_blacklist
+{
+    /** The hash table, with a power of two number of slots */
+    struct ip6_blacklist_slot *slots;
+    /** The number of slots minus one */
+    uint32_t mask;
+    /** The number of prefixes in the table */
+    uint32_t count;
+    /** The number of prefixes of each length */
+    uint32_t len_count[MAX_PREFIX_LEN + 1];
+    /** The distinct prefix lengths in the table, longest first */
+    uint8_t lengths[MAX_PREFIX_LEN + 1];
+    /** The number of elements of #lengths */
+    unsigned int n_lengths;
+    /** One bit for each hashed /48 containing a prefix of at least
+     * #IP6_BLACKLIST_FRONT_LEN bits */
+    uint64_t front[FRONT_WORDS];
+};
+
+static inline uint64_t
+load_be64(const uint8_t *pos)
+{
+    uint64_t v = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) v = v << 8 | pos[i];
+    return v;
+}
+
+/**
+ * Clear the bits of an address past \p len.
+ */
+static inline void
+mask_prefix(uint64_t *hi, uint64_t *lo, unsigned int len)
+{
+    if (len <= 64)
+    {
+        *hi = len ? *hi & (~UINT64_C(0) << (64 - len)) : 0;
+        *lo = 0;
+    }
+    else
+    {
+        *lo &= ~UINT64_C(0) << (128 - len);
+    }
+}
+
+static inline uint32_t
+hash_prefix(uint64_t hi, uint64_t lo, unsigned int len)
+{
+    uint64_t h = (hi ^ (lo * UINT64_C(0x9e3779b97f4a7c15)) ^ len)
+            * UINT64_C(0xff51afd7ed558ccd);
+
+    return (uint32_t) (h >> 32 ^ h);
+}
+
+/**
+ * The bit of the front bitmap for the /48 at the start of \p hi
+ */
+static inline uint32_t
+front_bit(uint64_t hi)
+{
+    uint64_t h = (hi >> (64 - IP6_BLACKLIST_FRONT_LEN))
+            * UINT64_C(0x9e3779b97f4a7c15);
+
+    return (uint32_t) (h >> (64 - FRONT_BITS_LOG2));
+}
+
+/**
+ * Find the slot holding a prefix, or the empty slot where it would go.
+ */
+static struct ip6_blacklist_slot *
+find_slot(const ip6_blacklist *b, uint64_t hi, uint64_t lo, unsigned int len)
+{
+    uint32_t i = hash_prefix(hi, lo, len) & b->mask;
+    struct ip6_blacklist_slot *s;
+
+    // Linear probing keeps a collision within the same or the next cache line
+    while ((s = &b->slots[i])->used)
+    {
+        if (s->hi == hi && s->lo == lo && s->len == len) break;
+        i = (i + 1) & b->mask;
+    }
+
+    return s;
+}
+
+/**
+ * Double the size of the table.
+ */
+static int
+grow(ip6_blacklist *b)
+{
+    struct ip6_blacklist_slot *old = b->slots, *s;
+    uint32_t old_size = b->mask + 1, i;
+
+    if (NULL == (b->slots = mem_calloc(MEM_IP6_BLACKLIST, old_size * 2,
+            sizeof(*b->slots))))
+    {
+        b->slots = old;
+        return -1;
+    }
+    b->mask = old_size * 2 - 1;
+
+    for (i = 0; i < old_size; i++)
+    {
+        if (!old[i].used) continue;
+        s = find_slot(b, old[i].hi, old[i].lo, old[i].len);
+        *s = old[i];
+    }
+
+    mem_free(MEM_IP6_BLACKLIST, old);
+    return 0;
+}
+
+/**
+ * Record that the table holds a prefix of length \p len.
+ */
+static void
+add_length(ip6_blacklist *b, unsigned int len)
+{
+    unsigned int i;
+
+    if (b->len_count[len]++) return;
+
+    // Insert in descending order
+    for (i = b->n_lengths; i > 0 && b->lengths[i - 1] < len; i--)
+        b->lengths[i] = b->lengths[i - 1];
+    b->lengths[i] = len;
+    b->n_lengths++;
+}
+
+/**
+ * Record that the table holds one fewer prefix of length \p len.
+ */
+static void
+remove_length(ip6_blacklist *b, unsigned int len)
+{
+    unsigned int i;
+
+    if (--b->len_count[len]) return;
+
+    for (i = 0; b->lengths[i] != len; i++)
+        ;
+    for (b->n_lengths--; i < b->n_lengths; i++)
+        b->lengths[i] = b->lengths[i + 1];
+}
+
+ip6_blacklist *
+new_ip6_blacklist(void)
+{
+    ip6_blacklist *b = NULL;
+
+    if (NULL == (b = mem_calloc(MEM_IP6_BLACKLIST, 1, sizeof(*b))))
+        goto error;
+    if (NULL == (b->slots = mem_calloc(MEM_IP6_BLACKLIST, INITIAL_SLOTS,
+            sizeof(*b->slots))))
+        goto error;
+    b->mask = INITIAL_SLOTS - 1;
+
+    return b;
+
+error:
+    free_ip6_blacklist(&b);
+    return NULL;
+}
+
+void
+free_ip6_blacklist(ip6_blacklist **b)
+{
+    assert(b);
+
+    if (*b)
+    {
+        mem_free(MEM_IP6_BLACKLIST, (*b)->slots);
+        mem_free(MEM_IP6_BLACKLIST, *b);
+        *b = NULL;
+    }
+}
+
+int
+ip6_blacklist_add(ip6_blacklist *b, const struct in6_addr *prefix,
+        unsigned int prefix_len, const ids_ioc_value_t *value)
+{
+    assert(b);
+    assert(prefix);
+    assert(value);
+
+    struct ip6_blacklist_slot *s;
+    uint64_t hi, lo;
+    uint32_t bit;
+
+    if (prefix_len > MAX_PREFIX_LEN) return -1;
+
+    hi = load_be64(prefix->s6_addr);
+    lo = load_be64(prefix->s6_addr + 8);
+    mask_prefix(&hi, &lo, prefix_len);
+
+    // Keep the table at most half full so that probe sequences stay short
+    if ((b->count + 1) * 2 > b->mask + 1 && 0 != grow(b)) return -1;
+
+    s = find_slot(b, hi, lo, prefix_len);
+    if (!s->used)
+    {
+        s->hi = hi;
+        s->lo = lo;
+        s->len = prefix_len;
+        s->used = 1;
+        b->count++;
+        add_length(b, prefix_len);
+
+        if (prefix_len >= IP6_BLACKLIST_FRONT_LEN)
+        {
+            bit = front_bit(hi);
+            b->front[bit / 64] |= UINT64_C(1) << (bit % 64);
+        }
+    }
+    s->value = *value;
+
+    return 0;
+}
+
+int
+ip6_blacklist_remove(ip6_blacklist *b, const struct in6_addr *prefix,
+        unsigned int prefix_len)
+{
+    assert(b);
+    assert(prefix);
+
+    struct ip6_blacklist_slot *s;
+    uint64_t hi, lo;
+    uint32_t hole, i, home;
+
+    if (prefix_len > MAX_PREFIX_LEN) return -1;
+
+    hi = load_be64(prefix->s6_addr);
+    lo = load_be64(prefix->s6_addr + 8);
+    mask_prefix(&hi, &lo, prefix_len);
+
+    s = find_slot(b, hi, lo, prefix_len);
+    if (!s->used) return -1;
+
+    s->used = 0;
+    b->count--;
+    remove_length(b, prefix_len);
+
+    // Move later slots of the probe sequence back into the hole, so that no
+    // lookup stops early at it. The bit in the front bitmap is left set, as
+    // other prefixes may share it; it only costs a few extra probes.
+    hole = s - b->slots;
+    for (i = (hole + 1) & b->mask; b->slots[i].used; i = (i + 1) & b->mask)
+    {
+        home = hash_prefix(b->slots[i].hi, b->slots[i].lo, b->slots[i].len)
+                & b->mask;
+
+        // Leave the slot if its home is cyclically within (hole, i]
+        if (((i - home) & b->mask) < ((i - hole) & b->mask)) continue;
+
+        b->slots[hole] = b->slots[i];
+        b->slots[i].used = 0;
+        hole = i;
+    }
+
+    return 0;
+}
+
+const ids_ioc_value_t *
+ip6_blacklist_lookup(const ip6_blacklist *b, const struct in6_addr *addr)
+{
+    assert(b);
+    assert(addr);
+
+    const struct ip6_blacklist_slot *s;
+    uint64_t addr_hi, addr_lo, hi, lo;
+    unsigned int i = 0, len;
+    uint32_t bit;
+
+    if (!b->count) return NULL;
+
+    addr_hi = load_be64(addr->s6_addr);
+    addr_lo = load_be64(addr->s6_addr + 8);
+
+    // Skip the long prefixes if the /48 cannot contain any of them
+    bit = front_bit(addr_hi);
+    if (!(b->front[bit / 64] & (UINT64_C(1) << (bit % 64))))
+    {
+        while (i < b->n_lengths && b->lengths[i] >= IP6_BLACKLIST_FRONT_LEN)
+            i++;
+    }
+
+    for (; i < b->n_lengths; i++)
+    {
+        len = b->lengths[i];
+        hi = addr_hi;
+        lo = addr_lo;
+        mask_prefix(&hi, &lo, len);
+
+        s = find_slot(b, hi, lo, len);
+        if (s->used) return &s->value;
+    }
+
+    return NULL;
+}
+
+unsigned int
+ip6_blacklist_count(const ip6_blacklist *b)
+{
+    assert(b);
+
+    return b->count;
+}
+
+ip6_blacklist *
+ip6_blacklist_copy(const ip6_blacklist *b)
+{
+    assert(b);
+
+    ip6_blacklist *copy = NULL;
+
+    if (NULL == (copy = mem_malloc(MEM_IP6_BLACKLIST, sizeof(*copy))))
+        goto error;
+    *copy = *b;
+    if (NULL == (copy->slots = mem_malloc(MEM_IP6_BLACKLIST,
+            (b->mask + 1) * sizeof(*b->slots))))
+        goto error;
+    memcpy(copy->slots, b->slots, (b->mask + 1) * sizeof(*b->slots));
+
+    return copy;
+
+error:
+    if (copy) copy->slots = NULL;
+    free_ip6_blacklist(&copy);
+    return NULL;
+}
@@ -0,0 +1,114 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief A blacklist of IPv6 addresses and prefixes
+ *
+ * Each entry is a prefix of between 0 and 128 bits; a single address is a
+ * /128. A lookup returns the value of the longest prefix that contains the
+ * address.
+ *
+ * All entries are kept in one open-addressed hash table keyed by the prefix
+ * and its length, and a lookup probes the table once for each distinct
+ * prefix length in the blacklist, longest first. Most lookups are for
+ * addresses that are not blacklisted, so before probing for any prefix of
+ * #IP6_BLACKLIST_FRONT_LEN bits or longer, the /48 containing the address is
+ * checked in a bitmap with one bit per hashed /48. The bitmap fits in a few
+ * cache lines and usually rules out the long prefixes with a single load.
+ */
+#ifndef IP6_BLACKLIST_H_
+#define IP6_BLACKLIST_H_
+
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#include "ids_storedvalues.h"
+
+/** The length of the prefix used for the bitmap checked before the table */
+#define IP6_BLACKLIST_FRONT_LEN 48
+
+/** Hide the implementation from dependent modules */
+typedef struct ip6_blacklist ip6_blacklist;
+
+/**
+ * Allocate a new, empty blacklist
+ *
+ * @return A pointer to the blacklist, or NULL if memory could not be
+ * allocated
+ */
+ip6_blacklist *
+new_ip6_blacklist(void);
+
+/**
+ * @brief Free the memory used by the blacklist
+ * Sets the value pointed to by \p b to NULL
+ */
+void
+free_ip6_blacklist(ip6_blacklist **b);
+
+/**
+ * @brief Add a prefix to the blacklist
+ *
+ * Bits of \p prefix beyond \p prefix_len are ignored. If the prefix is
+ * already in the blacklist, its value is replaced.
+ *
+ * @param b The blacklist
+ * @param prefix The address or network
+ * @param prefix_len The number of significant bits in \p prefix, up to 128
+ * @param value The value to associate with the prefix. It is copied.
+ * @return 0 if successful, -1 if \p prefix_len is invalid or memory could not
+ * be allocated
+ */
+int
+ip6_blacklist_add(ip6_blacklist *b, const struct in6_addr *prefix,
+        unsigned int prefix_len, const ids_ioc_value_t *value);
+
+/**
+ * @brief Remove a prefix from the blacklist
+ *
+ * Only the prefix with exactly \p prefix_len bits is removed, not the longer
+ * prefixes within it.
+ *
+ * @return 0 if the prefix was removed, -1 if it was not in the blacklist
+ */
+int
+ip6_blacklist_remove(ip6_blacklist *b, const struct in6_addr *prefix,
+        unsigned int prefix_len);
+
+/**
+ * Find the longest prefix in the blacklist that contains an address
+ *
+ * @param b The blacklist
+ * @param addr The address to look up
+ * @return The value associated with the prefix, or NULL if the address is not
+ * blacklisted. Only valid until the blacklist is next modified.
+ */
+const ids_ioc_value_t *
+ip6_blacklist_lookup(const ip6_blacklist *b, const struct in6_addr *addr);
+
+/**
+ * The number of prefixes in the blacklist
+ */
+unsigned int
+ip6_blacklist_count(const ip6_blacklist *b);
+
+/**
+ * Copy a blacklist
+ *
+ * @return A pointer to a new blacklist with the same prefixes, or NULL if
+ * memory could not be allocated
+ */
+ip6_blacklist *
+ip6_blacklist_copy(const ip6_blacklist *b);
+
+#endif /* IP6_BLACKLIST_H_ */
@@ -18,6 +18,7 @@
 
 /* #include "firehol_ip_blacklist.h" */
 #include "../utils/ebvbl/ebvbl.h"
+#include "../utils/mem.h"
 
 int ip_blacklist_cmp(void *a, void *b)
 {
@@ -28,26 +29,22 @@ int ip_blacklist_cmp(void *a, void *b)
     // serious problems
     if (!a || !b) return 0;
 
-    long diff;
     ip_key_value_t *a_val, *b_val;
 
     a_val = a;
     b_val = b;
 
     // Rank by IP addresses, and then by ports. Both must be equal to get
-    // a 0 result.
-    diff = a_val->ip_addr - b_val->ip_addr;
+    // a 0 result. The addresses are compared rather than subtracted, as the
+    // difference of two addresses does not fit in an int.
+    if (a_val->ip_addr != b_val->ip_addr)
+        return a_val->ip_addr < b_val->ip_addr ? -1 : 1;
 
-    if (!diff)
-    {
-        // A port value of 0 matches anything
-        if (a_val->port == 0 || b_val->port == 0)
-            diff = 0;
-        else
-            diff = a_val->port - b_val->port;
-    }
+    // A port value of 0 matches anything
+    if (a_val->port == 0 || b_val->port == 0)
+        return 0;
 
-    return diff;
+    return (int) a_val->port - (int) b_val->port;
 }
 
 unsigned int ip_blacklist_get_first_bits(void *item, unsigned int bff)
@@ -100,13 +97,173 @@ ip_blacklist_add(ip_blacklist *b, ip_key_value_t *addr)
     return 1;
 }
 
-void
-ip_blacklist_remove(ip_blacklist *b, void *element)
+/**
+ * Find the entry with exactly the address and port of \p addr.
+ *
+ * @return Its index, or -1 if there is none
+ */
+static SA_INDEX
+find_exact(EBVBL *e, const ip_key_value_t *addr)
+{
+    ip_key_value_t key;
+    const ip_key_value_t *entry;
+    SA_INDEX i;
+    unsigned int n;
+
+    // A port of 0 compares equal to every entry for the address, so find any
+    // of them and then search the run of entries for the exact port
+    key.ip_addr = addr->ip_addr;
+    key.port = 0;
+    i = ebvbl_find_element(e, &key);
+    if (-1 == i) return -1;
+
+    while (i > 0 && ((ip_key_value_t *)ebvbl_get_element(e, i - 1))->ip_addr
+            == addr->ip_addr)
+        i--;
+
+    n = ebvbl_get_number_of_elements(e);
+    for (; (unsigned int)i < n; i++)
+    {
+        entry = ebvbl_get_element(e, i);
+        if (entry->ip_addr != addr->ip_addr) break;
+        if (entry->port == addr->port) return i;
+    }
+
+    return -1;
+}
+
+int
+ip_blacklist_remove(ip_blacklist *b, const ip_key_value_t *addr)
+{
+    assert(b);
+    assert(addr);
+
+    EBVBL *e = (EBVBL *)b;
+    SA_INDEX i;
+
+    if (!b || !addr) return 0;
+
+    if (-1 == (i = find_exact(e, addr))) return 0;
+    ebvbl_remove_element(e, i);
+
+    return 1;
+}
+
+/**
+ * Order changes by their address and then their port, with 0 as just another
+ * port.
+ */
+static int
+change_cmp(const ip_blacklist_change_t *a, const ip_blacklist_change_t *b)
+{
+    if (a->entry.ip_addr != b->entry.ip_addr)
+        return a->entry.ip_addr < b->entry.ip_addr ? -1 : 1;
+    return (int) a->entry.port - (int) b->entry.port;
+}
+
+/**
+ * Sort changes with change_cmp(). Changes to the same entry stay in the order
+ * they are to be made, so that the last of them is the one that counts.
+ *
+ * @param tmp Space for \p n changes
+ */
+static void
+sort_changes(ip_blacklist_change_t *changes, ip_blacklist_change_t *tmp,
+        size_t n)
+{
+    size_t half = n / 2, i = 0, j = half, k = 0;
+
+    if (n < 2) return;
+
+    sort_changes(changes, tmp, half);
+    sort_changes(changes + half, tmp, n - half);
+
+    while (i < half && j < n)
+        tmp[k++] = change_cmp(&changes[j], &changes[i]) < 0
+                ? changes[j++] : changes[i++];
+    while (i < half)
+        tmp[k++] = changes[i++];
+
+    // The rest of the second half is already in place
+    memcpy(changes, tmp, k * sizeof(*changes));
+}
+
+static int
+cmp_index(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int
+ip_blacklist_apply(ip_blacklist *b, ip_blacklist_change_t *changes, size_t n)
 {
     assert(b);
-    assert(element);
+    assert(changes || !n);
+
+    EBVBL *e = (EBVBL *)b;
+    ip_blacklist_change_t *tmp = NULL;
+    ip_key_value_t *inserts;
+    unsigned int *removals;
+    size_t i, net = 0, n_inserts = 0, n_removals = 0;
+    SA_INDEX found;
+
+    if (!b) return 0;
+    if (!n) return 1;
+
+    if (!ebvbl_sort(e)) return 0;
+    if (!(tmp = mem_malloc(MEM_IP_BLACKLIST, n * sizeof(*tmp)))) return 0;
+
+    // Only the last change to each entry counts
+    sort_changes(changes, tmp, n);
+    for (i = 0; i < n; i++)
+    {
+        if (i + 1 < n && 0 == change_cmp(&changes[i], &changes[i + 1]))
+            continue;
+        changes[net++] = changes[i];
+    }
+
+    // Merge in the new entries first, as only that can fail. They are in
+    // order, as the changes are.
+    inserts = (ip_key_value_t *)tmp;
+    for (i = 0; i < net; i++)
+    {
+        if (!changes[i].remove && -1 == find_exact(e, &changes[i].entry))
+            inserts[n_inserts++] = changes[i].entry;
+    }
+    if (!ebvbl_merge(e, inserts, n_inserts))
+    {
+        mem_free(MEM_IP_BLACKLIST, tmp);
+        return 0;
+    }
 
-    assert(false);	// Not implemented, may not be necessary
+    // Replace the values of entries that were already there, and find those
+    // to remove. A run of entries for one address is not sorted by port, so
+    // neither are the indexes.
+    removals = (unsigned int *)tmp;
+    for (i = 0; i < net; i++)
+    {
+        if (-1 == (found = find_exact(e, &changes[i].entry))) continue;
+        if (changes[i].remove)
+            removals[n_removals++] = found;
+        else
+            ((ip_key_value_t *)ebvbl_get_element(e, found))->value =
+                    changes[i].entry.value;
+    }
+    qsort(removals, n_removals, sizeof(*removals), cmp_index);
+    ebvbl_remove_elements(e, removals, n_removals);
+
+    mem_free(MEM_IP_BLACKLIST, tmp);
+    return 1;
+}
+
+ip_blacklist *
+ip_blacklist_copy(ip_blacklist *b)
+{
+    assert(b);
+
+    return (ip_blacklist *)ebvbl_copy((EBVBL *)b);
 }
 
 const ip_key_value_t *
@@ -123,3 +280,19 @@ ip_blacklist_lookup(ip_blacklist *b, uint32_t addr, uint16_t port)
 
     return (const ip_key_value_t *)ebvbl_lookup((EBVBL *)b, &key);
 }
+
+int
+ip_blacklist_sort(ip_blacklist *b)
+{
+    assert(b);
+
+    return ebvbl_sort((EBVBL *)b) ? 1 : 0;
+}
+
+unsigned int
+ip_blacklist_count(ip_blacklist *b)
+{
+    assert(b);
+
+    return ebvbl_get_number_of_elements((EBVBL *)b);
+}
@@ -31,6 +31,13 @@ typedef struct
     ids_ioc_value_t value;  ///< A value to associate with this entry
 } ip_key_value_t;
 
+/** @brief A change to make to an #ip_blacklist, see ip_blacklist_apply() */
+typedef struct
+{
+    ip_key_value_t entry;   ///< The entry to add, or the key of one to remove
+    int remove;             ///< Non-zero to remove the entry, not add it
+} ip_blacklist_change_t;
+
 /**
  * @brief Empty all entries in the blacklist
  *
@@ -55,11 +62,46 @@ free_ip_blacklist(ip_blacklist **b);
  * freed
  * @param b A pointer to an #ip_blacklist
  * @param addr A key_value struct to copy into the blacklist
- * @return 0 if successful, 1 on error
+ * @return 1 if successful, 0 on error
  */
 int
 ip_blacklist_add(ip_blacklist *b, ip_key_value_t *addr);
 
+/**
+ * @brief Remove a key-value from the IP blacklist
+ *
+ * Only an entry with exactly the address and port of \p addr is removed. A
+ * port of 0 removes the entry for the whole address, not every entry for it.
+ * @param b A pointer to an #ip_blacklist
+ * @param addr The key to remove. The value is ignored.
+ * @return 1 if an entry was removed, 0 if there was no such entry
+ */
+int
+ip_blacklist_remove(ip_blacklist *b, const ip_key_value_t *addr);
+
+/**
+ * @brief Add and remove many entries at once, keeping the blacklist sorted
+ *
+ * The result is that of making the changes one at a time, in order, except
+ * that adding an entry with exactly the address and port of one already in
+ * the blacklist replaces its value rather than adding another. A removal
+ * removes one entry, as ip_blacklist_remove() does.
+ *
+ * Unlike ip_blacklist_add(), which appends, the blacklist stays sorted, so
+ * the next lookup does not sort it. For k changes to a blacklist of n
+ * entries this takes O(k log k + k log n) comparisons, and the entries after
+ * the first change are each moved once.
+ * @param b A pointer to an #ip_blacklist
+ * @param changes The changes, in the order they are to be made. They are
+ * reordered.
+ * @param n The number of \p changes
+ * @return 1 if successful, or 0 if memory could not be allocated, in which
+ * case the blacklist is unchanged
+ */
+int
+ip_blacklist_apply(ip_blacklist *b, ip_blacklist_change_t *changes,
+        size_t n);
+
 /**
  * Return the key-value struct if it exists
  * @param b A pointer to an #ip_blacklist
@@ -73,6 +115,33 @@ ip_blacklist_add(ip_blacklist *b, ip_key_value_t *addr);
 const ip_key_value_t *
 ip_blacklist_lookup(ip_blacklist *b, uint32_t ip_addr, uint16_t port);
 
+/**
+ * @brief Sort the entries of the blacklist
+ *
+ * ip_blacklist_add() appends to the blacklist, and it is sorted by the next
+ * lookup. Sorting it first, before it is made the active blacklist, keeps
+ * that cost off the packet path.
+ * @param b A pointer to an #ip_blacklist
+ * @return 1 if successful, 0 if memory could not be allocated
+ */
+int
+ip_blacklist_sort(ip_blacklist *b);
+
+/**
+ * The number of entries in the blacklist
+ */
+unsigned int
+ip_blacklist_count(ip_blacklist *b);
+
+/**
+ * @brief Copy a blacklist
+ *
+ * @return A pointer to a new #ip_blacklist with the same entries, or NULL if
+ * memory could not be allocated
+ */
+ip_blacklist *
+ip_blacklist_copy(ip_blacklist *b);
+
 /**
  * Allocate a new, empty blacklist
  *
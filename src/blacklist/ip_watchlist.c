@@ -0,0 +1,323 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../utils/mem.h"
+#include "ip_watchlist.h"
+
+/** Marks the end of a hash chain or wheel slot, or an unused entry */
+#define NONE UINT32_MAX
+
+/**
+ * The number of one second slots in the timer wheel. Entries that expire
+ * further in the future than this are skipped when their slot comes around
+ * early.
+ */
+#define WHEEL_SLOTS 256
+
+struct ip_watchlist_entry
+{
+    /** The address, IPv4-mapped if it is an IPv4 address */
+    struct in6_addr addr;
+    /** The time at which the entry expires */
+    uint32_t expires;
+    /** The value of the domain that resolved to the address */
+    ids_ioc_value_t value;
+    /** The next entry in the same hash bucket, or the next free entry */
+    uint32_t hash_next;
+    /** The previous entry in the same wheel slot */
+    uint32_t wheel_prev;
+    /** The next entry in the same wheel slot */
+    uint32_t wheel_next;
+};
+
+struct ip_watchlist
+{
+    /** All entries, used or free */
+    struct ip_watchlist_entry *entries;
+    /** The number of elements in #entries */
+    uint32_t capacity;
+    /** The number of entries in use */
+    uint32_t count;
+    /** The first unused entry */
+    uint32_t free_head;
+    /** The first entry of each hash chain */
+    uint32_t *buckets;
+    /** log2 of the number of buckets */
+    unsigned int bucket_bits;
+    /** The first entry of each slot of the timer wheel */
+    uint32_t wheel[WHEEL_SLOTS];
+    /** The time the wheel was last advanced to */
+    uint32_t now;
+    /** Non-zero once the wheel has been advanced for the first time */
+    int started;
+};
+
+static inline uint32_t
+bucket_of(const ip_watchlist *wl, const struct in6_addr *addr)
+{
+    uint32_t w[4];
+
+    // Fold the address into 32 bits, then use Fibonacci hashing, taking the
+    // high bits of the product. Only the last word of an IPv4-mapped
+    // address varies.
+    memcpy(w, addr->s6_addr, sizeof(w));
+    w[0] ^= w[1] ^ w[2] ^ w[3];
+    return (uint32_t) (w[0] * 2654435761u) >> (32 - wl->bucket_bits);
+}
+
+static void
+wheel_link(ip_watchlist *wl, uint32_t idx)
+{
+    struct ip_watchlist_entry *e = &wl->entries[idx];
+    uint32_t *slot = &wl->wheel[e->expires % WHEEL_SLOTS];
+
+    e->wheel_prev = NONE;
+    e->wheel_next = *slot;
+    if (NONE != *slot) wl->entries[*slot].wheel_prev = idx;
+    *slot = idx;
+}
+
+static void
+wheel_unlink(ip_watchlist *wl, uint32_t idx)
+{
+    struct ip_watchlist_entry *e = &wl->entries[idx];
+
+    if (NONE != e->wheel_prev)
+        wl->entries[e->wheel_prev].wheel_next = e->wheel_next;
+    else
+        wl->wheel[e->expires % WHEEL_SLOTS] = e->wheel_next;
+    if (NONE != e->wheel_next)
+        wl->entries[e->wheel_next].wheel_prev = e->wheel_prev;
+}
+
+/**
+ * Find an entry, returning its index or NONE. If \p prev is not NULL, the
+ * index of the previous entry in the hash chain is stored there.
+ */
+static uint32_t
+find(const ip_watchlist *wl, const struct in6_addr *addr, uint32_t *prev)
+{
+    uint32_t idx = wl->buckets[bucket_of(wl, addr)], last = NONE;
+
+    while (NONE != idx && 0 != memcmp(&wl->entries[idx].addr, addr,
+            sizeof(*addr)))
+    {
+        last = idx;
+        idx = wl->entries[idx].hash_next;
+    }
+
+    if (prev) *prev = last;
+    return idx;
+}
+
+/**
+ * Remove an entry from the hash table and the wheel, and free it.
+ */
+static void
+remove_entry(ip_watchlist *wl, uint32_t idx)
+{
+    struct ip_watchlist_entry *e = &wl->entries[idx];
+    uint32_t prev;
+
+    find(wl, &e->addr, &prev);
+    if (NONE != prev)
+        wl->entries[prev].hash_next = e->hash_next;
+    else
+        wl->buckets[bucket_of(wl, &e->addr)] = e->hash_next;
+
+    wheel_unlink(wl, idx);
+
+    e->hash_next = wl->free_head;
+    wl->free_head = idx;
+    wl->count--;
+}
+
+/**
+ * Evict the entry in the first non-empty slot after the current time, which
+ * is usually the entry that is closest to expiring.
+ */
+static void
+evict_one(ip_watchlist *wl)
+{
+    unsigned int i;
+    uint32_t idx;
+
+    for (i = 1; i <= WHEEL_SLOTS; i++)
+    {
+        idx = wl->wheel[(wl->now + i) % WHEEL_SLOTS];
+        if (NONE != idx)
+        {
+            remove_entry(wl, idx);
+            return;
+        }
+    }
+}
+
+ip_watchlist *
+new_ip_watchlist(unsigned int capacity)
+{
+    ip_watchlist *wl = NULL;
+    uint32_t i;
+
+    if (!capacity) goto error;
+
+    if (NULL == (wl = mem_calloc(MEM_FLOWS, 1, sizeof(*wl)))) goto error;
+
+    // Use at least as many buckets as entries to keep the chains short
+    while ((1u << wl->bucket_bits) < capacity) wl->bucket_bits++;
+    if (!wl->bucket_bits) wl->bucket_bits = 1;
+
+    wl->entries = mem_malloc(MEM_FLOWS, capacity * sizeof(*wl->entries));
+    wl->buckets = mem_malloc(MEM_FLOWS,
+            (1u << wl->bucket_bits) * sizeof(*wl->buckets));
+    if (!wl->entries || !wl->buckets) goto error;
+
+    wl->capacity = capacity;
+    for (i = 0; i < capacity; i++)
+        wl->entries[i].hash_next = i + 1 < capacity ? i + 1 : NONE;
+    wl->free_head = 0;
+    for (i = 0; i < (1u << wl->bucket_bits); i++) wl->buckets[i] = NONE;
+    for (i = 0; i < WHEEL_SLOTS; i++) wl->wheel[i] = NONE;
+
+    return wl;
+
+error:
+    free_ip_watchlist(&wl);
+    return NULL;
+}
+
+void
+free_ip_watchlist(ip_watchlist **wl)
+{
+    assert(wl);
+
+    if (*wl)
+    {
+        mem_free(MEM_FLOWS, (*wl)->entries);
+        mem_free(MEM_FLOWS, (*wl)->buckets);
+        mem_free(MEM_FLOWS, *wl);
+        *wl = NULL;
+    }
+}
+
+void
+ip_watchlist_add(ip_watchlist *wl, const struct in6_addr *addr, uint32_t ttl,
+        const ids_ioc_value_t *value, uint32_t now)
+{
+    assert(wl);
+    assert(addr);
+    assert(value);
+
+    struct ip_watchlist_entry *e;
+    uint32_t idx, bucket;
+
+    if (ttl < IP_WATCHLIST_TTL_MIN) ttl = IP_WATCHLIST_TTL_MIN;
+    if (ttl > IP_WATCHLIST_TTL_MAX) ttl = IP_WATCHLIST_TTL_MAX;
+
+    ip_watchlist_advance(wl, now);
+
+    if (NONE != (idx = find(wl, addr, NULL)))
+    {
+        // Already watched; keep it for as long as the longest answer
+        e = &wl->entries[idx];
+        e->value = *value;
+        if (now + ttl > e->expires)
+        {
+            wheel_unlink(wl, idx);
+            e->expires = now + ttl;
+            wheel_link(wl, idx);
+        }
+        return;
+    }
+
+    if (NONE == wl->free_head) evict_one(wl);
+    if (NONE == (idx = wl->free_head)) return;
+
+    e = &wl->entries[idx];
+    wl->free_head = e->hash_next;
+
+    e->addr = *addr;
+    e->expires = now + ttl;
+    e->value = *value;
+
+    bucket = bucket_of(wl, addr);
+    e->hash_next = wl->buckets[bucket];
+    wl->buckets[bucket] = idx;
+    wheel_link(wl, idx);
+    wl->count++;
+}
+
+const ids_ioc_value_t *
+ip_watchlist_lookup(const ip_watchlist *wl, const struct in6_addr *addr,
+        uint32_t now)
+{
+    assert(wl);
+    assert(addr);
+
+    uint32_t idx;
+
+    if (!wl->count) return NULL;
+    if (NONE == (idx = find(wl, addr, NULL))) return NULL;
+
+    // The entry may have expired since the wheel was last advanced
+    if (wl->entries[idx].expires <= now) return NULL;
+
+    return &wl->entries[idx].value;
+}
+
+void
+ip_watchlist_advance(ip_watchlist *wl, uint32_t now)
+{
+    assert(wl);
+
+    uint32_t ticks, idx, next;
+
+    if (!wl->started)
+    {
+        wl->now = now;
+        wl->started = 1;
+        return;
+    }
+
+    // Time can go backwards when reading packets from several sources
+    if ((int32_t) (now - wl->now) <= 0) return;
+
+    // Visit each slot at most once however long it has been
+    ticks = now - wl->now;
+    if (ticks > WHEEL_SLOTS) ticks = WHEEL_SLOTS;
+
+    while (ticks--)
+    {
+        wl->now++;
+        idx = wl->wheel[wl->now % WHEEL_SLOTS];
+        while (NONE != idx)
+        {
+            next = wl->entries[idx].wheel_next;
+            if (wl->entries[idx].expires <= now) remove_entry(wl, idx);
+            idx = next;
+        }
+    }
+
+    wl->now = now;
+}
+
+unsigned int
+ip_watchlist_count(const ip_watchlist *wl)
+{
+    assert(wl);
+
+    return wl->count;
+}
@@ -0,0 +1,113 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief A short-lived overlay of IP addresses learned from DNS answers
+ *
+ * When a client resolves a blacklisted domain, the addresses in the answer
+ * are added to the watchlist for the TTL of the record. Connections to those
+ * addresses can then be detected even though the addresses are not in the
+ * #ip_blacklist or #ip6_blacklist. IPv4 addresses are kept as IPv4-mapped
+ * IPv6 addresses, so one watchlist holds the addresses of both A and AAAA
+ * records.
+ *
+ * The watchlist has a fixed capacity chosen when it is created and never
+ * allocates after that. Entries are expired by a timer wheel with one second
+ * slots, which is advanced using the timestamps of captured packets rather
+ * than the system clock. When the watchlist is full, the entry closest to
+ * expiring is evicted to make room.
+ */
+#ifndef IP_WATCHLIST_H_
+#define IP_WATCHLIST_H_
+
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+#include "ids_storedvalues.h"
+
+/** TTLs shorter than this are extended, in seconds */
+#define IP_WATCHLIST_TTL_MIN 30
+
+/** TTLs longer than this are shortened, in seconds */
+#define IP_WATCHLIST_TTL_MAX 3600
+
+/** The default number of addresses a watchlist can hold */
+#define IP_WATCHLIST_DEFAULT_CAPACITY 4096
+
+/** Hide the implementation from dependent modules */
+typedef struct ip_watchlist ip_watchlist;
+
+/**
+ * Allocate a new, empty watchlist
+ * @param capacity The maximum number of addresses in the watchlist
+ * @return A pointer to the watchlist, or NULL if memory could not be
+ * allocated
+ */
+ip_watchlist *
+new_ip_watchlist(unsigned int capacity);
+
+/**
+ * @brief Free the memory used by the watchlist
+ * Sets the value pointed to by \p wl to NULL
+ */
+void
+free_ip_watchlist(ip_watchlist **wl);
+
+/**
+ * Add an address to the watchlist, or extend the lifetime of an address that
+ * is already in it. Runs in constant time.
+ *
+ * @param wl The watchlist
+ * @param addr The address, IPv4-mapped if it is an IPv4 address
+ * @param ttl The TTL of the DNS record, which is clamped to
+ * #IP_WATCHLIST_TTL_MIN and #IP_WATCHLIST_TTL_MAX
+ * @param value The value of the blacklisted domain that resolved to
+ * \p addr. It is copied.
+ * @param now The current time in seconds
+ */
+void
+ip_watchlist_add(ip_watchlist *wl, const struct in6_addr *addr, uint32_t ttl,
+        const ids_ioc_value_t *value, uint32_t now);
+
+/**
+ * Look up an address in the watchlist.
+ *
+ * @param wl The watchlist
+ * @param addr The address, IPv4-mapped if it is an IPv4 address
+ * @param now The current time in seconds
+ * @return The value associated with the address if it is in the watchlist
+ * and has not expired, otherwise NULL. Only valid until the watchlist is
+ * next modified.
+ */
+const ids_ioc_value_t *
+ip_watchlist_lookup(const ip_watchlist *wl, const struct in6_addr *addr,
+        uint32_t now);
+
+/**
+ * Remove the entries that have expired by \p now. Does very little if the
+ * time has not changed since the last call.
+ *
+ * @param wl The watchlist
+ * @param now The current time in seconds
+ */
+void
+ip_watchlist_advance(ip_watchlist *wl, uint32_t now);
+
+/**
+ * The number of addresses in the watchlist, including any that have expired
+ * but have not yet been removed by ip_watchlist_advance().
+ */
+unsigned int
+ip_watchlist_count(const ip_watchlist *wl);
+
+#endif /* IP_WATCHLIST_H_ */
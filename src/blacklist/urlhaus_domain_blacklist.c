@@ -76,13 +76,13 @@ handle_urlhaus_line(char *line, void *user_data)
     for (size_t it = 0; it <= domain_name_len; it++)
         line[it] = domain_name_pos[it];
 
-    value = malloc(sizeof(*value));
+    value = new_ids_ioc_value(0);
     if (!value) return;
-    value->botnet_id = 0;
 
     rc = domain_blacklist_add(data->blacklist, line, value);
     if (!rc)
     {
+        free_ids_ioc_value(value);
         return;
     }
 
@@ -458,6 +458,9 @@ dns_label_dereference_pointer(const dns_domain pointer, const uint8_t *packet_st
         /* Make sure that it is a pointer, not a length byte */
         assert((*pointer & 0xC0) == 0xC0);
 
+        /* The pointer is two bytes long */
+        if (packet_end - pointer < 2) return (NULL);
+
         offset = domain_pointer_offset(pointer);
         dest = (dns_domain)(packet_start + offset);
 
@@ -555,11 +558,15 @@ dns_parse_answer(uint8_t **buf_pos,
     if (!(*buf_pos = byte_array_read_uint16(&(ans->class), *buf_pos, packet_end))) goto error;
     if (!(*buf_pos = byte_array_read_uint32(&(ans->ttl), *buf_pos, packet_end))) goto error;
     if (!(*buf_pos = byte_array_read_uint16(&(ans->rdlength), *buf_pos, packet_end))) goto error;
+    if (ans->rdlength > packet_end - *buf_pos) goto error;
 
     if (!dns_parse_rdata(&(ans->rdata), ans->type, *buf_pos, packet_start,
             *buf_pos + ans->rdlength))
         goto error;
 
+    /* The next record starts after the record data */
+    *buf_pos += ans->rdlength;
+
     return (ans);
 
 error:
@@ -82,6 +82,7 @@ enum dns_qtype
     MX = 15,
     TXT = 16,	/* TXT and above valid for both questions and
                  * answers */
+    AAAA = 28,
     SRV = 33,
     /* below are only for questions */
     AXFR = 252,
@@ -220,6 +221,10 @@ char *dns_name_to_readable(uint8_t *name);
 /**
  * Parses a DNS packet (in a buffer beginning at PACKET_START and ending at
  * PACKET_END) into a newly allocated dns_packet structure.
+ *
+ * Every name and record is copied, so this is intended for building
+ * responses with dns_write(). To inspect captured packets use the
+ * non-allocating functions in dns_view.h instead.
  * @param packet_start The address of the first byte of the packet.
  * @param packet_end The address of the first byte that is not a part of the
  * packet.
@@ -0,0 +1,258 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "dns_view.h"
+
+#define DNS_HEADER_LEN 12
+
+/** The length of the fixed fields of a question after the name */
+#define QUESTION_FIXED_LEN 4
+
+/** The length of the fixed fields of a resource record after the name */
+#define RR_FIXED_LEN 10
+
+#define MAX_LABEL_LEN 63
+
+/** The maximum length of a name in wire format */
+#define MAX_NAME_LEN 255
+
+/**
+ * The maximum number of compression pointers followed when decoding a name.
+ * Each pointer must refer to before the start of the labels that led to it,
+ * which is what stops pointers from looping. This limit stops a name from
+ * being built from many tiny fragments.
+ */
+#define MAX_POINTERS 32
+
+static inline uint16_t
+get_uint16(const uint8_t *pos)
+{
+    return (uint16_t) (pos[0] << 8 | pos[1]);
+}
+
+static inline uint32_t
+get_uint32(const uint8_t *pos)
+{
+    return (uint32_t) pos[0] << 24 | (uint32_t) pos[1] << 16
+            | (uint32_t) pos[2] << 8 | pos[3];
+}
+
+static inline int
+is_pointer(uint8_t length_byte)
+{
+    return (length_byte & 0xC0) == 0xC0;
+}
+
+/**
+ * Find the end of a name without decoding it. Compression pointers are not
+ * followed as the name ends at the first pointer.
+ *
+ * @return The first byte after the name, or NULL if it is malformed
+ */
+static const uint8_t *
+skip_name(const struct dns_view *view, const uint8_t *pos)
+{
+    size_t wire_len = 0;
+    uint8_t label_len;
+
+    while (pos < view->end)
+    {
+        label_len = *pos;
+        if (is_pointer(label_len))
+            return (pos + 2 <= view->end) ? pos + 2 : NULL;
+        if (label_len > MAX_LABEL_LEN) return NULL;
+
+        wire_len += label_len + 1;
+        if (wire_len > MAX_NAME_LEN) return NULL;
+
+        pos += label_len + 1;
+        if (!label_len) return pos;
+    }
+
+    return NULL;
+}
+
+int
+dns_view_init(struct dns_view *view, const uint8_t *start, const uint8_t *end)
+{
+    assert(view);
+    assert(start);
+    assert(end);
+
+    struct dns_header *h = &view->header;
+
+    if (end < start || (size_t) (end - start) < DNS_HEADER_LEN) return -1;
+
+    view->start = start;
+    view->end = end;
+
+    h->id = get_uint16(start);
+    h->qr = (start[2] & 0x80) >> 7;
+    h->opcode = (start[2] & 0x78) >> 3;
+    h->aa = (start[2] & 0x04) >> 2;
+    h->tc = (start[2] & 0x02) >> 1;
+    h->rd = (start[2] & 0x01);
+    h->ra = (start[3] & 0x80) >> 7;
+    h->z = (start[3] & 0x70) >> 4;
+    h->rcode = (start[3] & 0x0F);
+    h->qdcount = get_uint16(start + 4);
+    h->ancount = get_uint16(start + 6);
+    h->nscount = get_uint16(start + 8);
+    h->arcount = get_uint16(start + 10);
+
+    return 0;
+}
+
+void
+dns_view_iter_init(const struct dns_view *view, struct dns_view_iter *it)
+{
+    assert(view);
+    assert(it);
+
+    it->view = view;
+    it->pos = view->start + DNS_HEADER_LEN;
+    it->questions = view->header.qdcount;
+    it->records[DNS_SECTION_ANSWER] = view->header.ancount;
+    it->records[DNS_SECTION_AUTHORITY] = view->header.nscount;
+    it->records[DNS_SECTION_ADDITIONAL] = view->header.arcount;
+}
+
+int
+dns_view_next_question(struct dns_view_iter *it, struct dns_question_view *out)
+{
+    assert(it);
+    assert(out);
+
+    const uint8_t *pos;
+
+    if (!it->questions) return 0;
+
+    if (NULL == (pos = skip_name(it->view, it->pos))) return -1;
+    if (it->view->end - pos < QUESTION_FIXED_LEN) return -1;
+
+    out->name = it->pos;
+    out->qtype = get_uint16(pos);
+    out->qclass = get_uint16(pos + 2);
+
+    it->pos = pos + QUESTION_FIXED_LEN;
+    it->questions--;
+    return 1;
+}
+
+int
+dns_view_next_record(struct dns_view_iter *it, struct dns_rr_view *out)
+{
+    assert(it);
+    assert(out);
+
+    struct dns_question_view qn;
+    const uint8_t *pos;
+    int section, rc;
+
+    while (it->questions)
+    {
+        if (1 != (rc = dns_view_next_question(it, &qn))) return rc;
+    }
+
+    for (section = DNS_SECTION_ANSWER; section <= DNS_SECTION_ADDITIONAL;
+            section++)
+    {
+        if (it->records[section]) break;
+    }
+    if (section > DNS_SECTION_ADDITIONAL) return 0;
+
+    if (NULL == (pos = skip_name(it->view, it->pos))) return -1;
+    if (it->view->end - pos < RR_FIXED_LEN) return -1;
+
+    out->section = section;
+    out->name = it->pos;
+    out->type = get_uint16(pos);
+    out->class = get_uint16(pos + 2);
+    out->ttl = get_uint32(pos + 4);
+    out->rdlength = get_uint16(pos + 8);
+    out->rdata = pos + RR_FIXED_LEN;
+    if (it->view->end - out->rdata < out->rdlength) return -1;
+
+    it->pos = out->rdata + out->rdlength;
+    it->records[section]--;
+    return 1;
+}
+
+int
+dns_view_name(const struct dns_view *view, const uint8_t *name, char *buf,
+        size_t buf_sz)
+{
+    assert(view);
+    assert(name);
+    assert(buf);
+
+    const uint8_t *pos = name, *segment = name, *target;
+    size_t out_len = 0, wire_len = 0;
+    unsigned int pointers = 0;
+    uint8_t label_len;
+
+    if (!buf_sz) return -1;
+
+    while (1)
+    {
+        if (pos < view->start || pos >= view->end) return -1;
+        label_len = *pos;
+
+        if (is_pointer(label_len))
+        {
+            if (pos + 1 >= view->end || ++pointers > MAX_POINTERS) return -1;
+            target = view->start + ((label_len & 0x3F) << 8 | pos[1]);
+
+            // A pointer to the labels already read since the last jump, or
+            // after them, would lead back to this pointer
+            if (target >= segment) return -1;
+            pos = segment = target;
+            continue;
+        }
+
+        if (label_len > MAX_LABEL_LEN) return -1;
+        if (!label_len) break;
+
+        wire_len += label_len + 1;
+        if (wire_len > MAX_NAME_LEN) return -1;
+        if (view->end - (pos + 1) < label_len) return -1;
+
+        // Leave room for the separator and the NULL terminator
+        if (out_len + (out_len ? 1 : 0) + label_len >= buf_sz) return -1;
+        // A NULL within a label would truncate the name
+        if (memchr(pos + 1, '\0', label_len)) return -1;
+
+        if (out_len) buf[out_len++] = '.';
+        memcpy(buf + out_len, pos + 1, label_len);
+        out_len += label_len;
+
+        pos += label_len + 1;
+    }
+
+    buf[out_len] = '\0';
+    return out_len;
+}
+
+int
+dns_view_rdata_name(const struct dns_view *view, const struct dns_rr_view *rr,
+        char *buf, size_t buf_sz)
+{
+    assert(rr);
+
+    if (CNAME != rr->type && NS != rr->type && PTR != rr->type) return -1;
+    if (!rr->rdlength) return -1;
+
+    return dns_view_name(view, rr->rdata, buf, buf_sz);
+}
@@ -0,0 +1,180 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief A read-only, non-allocating view of a DNS message
+ *
+ * Unlike dns_parse(), which copies the whole message into a #dns_packet,
+ * these functions only record where each part of the message is within the
+ * original packet. Names are left in wire format and are decoded into a
+ * caller-supplied buffer only when dns_view_name() is called.
+ *
+ * The packet must not be modified or freed while a view of it is in use.
+ *
+ * @code
+ * struct dns_view view;
+ * struct dns_view_iter it;
+ * struct dns_question_view qn;
+ * char name[DNS_NAME_BUF_LEN];
+ *
+ * if (0 != dns_view_init(&view, start, end)) return -1;
+ * dns_view_iter_init(&view, &it);
+ * while (1 == dns_view_next_question(&it, &qn))
+ *     if (0 < dns_view_name(&view, qn.name, name, sizeof(name))) ...
+ * @endcode
+ */
+#ifndef DNS_VIEW_H_
+#define DNS_VIEW_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dns.h"
+
+/**
+ * A buffer of this size can hold any name decoded by dns_view_name(),
+ * including the NULL terminator
+ */
+#define DNS_NAME_BUF_LEN 256
+
+/**
+ * A view of a DNS message
+ */
+struct dns_view
+{
+    /** The first byte of the message */
+    const uint8_t *start;
+    /** The first byte after the message */
+    const uint8_t *end;
+    /** The decoded header */
+    struct dns_header header;
+};
+
+/**
+ * The sections of a DNS message that contain resource records
+ */
+enum dns_section
+{
+    DNS_SECTION_ANSWER,
+    DNS_SECTION_AUTHORITY,
+    DNS_SECTION_ADDITIONAL
+};
+
+/**
+ * A view of an entry in the question section
+ */
+struct dns_question_view
+{
+    /** The start of the name within the message, in wire format */
+    const uint8_t *name;
+    uint16_t qtype;
+    uint16_t qclass;
+};
+
+/**
+ * A view of a resource record
+ */
+struct dns_rr_view
+{
+    /** The section the record was found in */
+    enum dns_section section;
+    /** The start of the name within the message, in wire format */
+    const uint8_t *name;
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t rdlength;
+    /** The start of the record data within the message */
+    const uint8_t *rdata;
+};
+
+/**
+ * Position of an iteration through the questions and records of a message.
+ * Questions must be read before records; reading a record skips any
+ * questions that have not been read.
+ */
+struct dns_view_iter
+{
+    /** The message being iterated over */
+    const struct dns_view *view;
+    /** The start of the next entry */
+    const uint8_t *pos;
+    /** The number of questions not yet read */
+    unsigned int questions;
+    /** The number of records not yet read in each section */
+    unsigned int records[3];
+};
+
+/**
+ * Create a view of a DNS message. Only the header is read.
+ *
+ * @param[out] view The view to initialize
+ * @param start The first byte of the message
+ * @param end The first byte after the message
+ * @return 0 if successful, -1 if the message is too short to hold a header
+ */
+int
+dns_view_init(struct dns_view *view, const uint8_t *start, const uint8_t *end);
+
+/**
+ * Start iterating over the questions and records of \p view.
+ */
+void
+dns_view_iter_init(const struct dns_view *view, struct dns_view_iter *it);
+
+/**
+ * Read the next question.
+ *
+ * @return 1 if a question was read into \p out, 0 if there are no more
+ * questions, -1 if the message is malformed
+ */
+int
+dns_view_next_question(struct dns_view_iter *it, struct dns_question_view *out);
+
+/**
+ * Read the next resource record from the answer, authority or additional
+ * sections, in that order.
+ *
+ * @return 1 if a record was read into \p out, 0 if there are no more records,
+ * -1 if the message is malformed
+ */
+int
+dns_view_next_record(struct dns_view_iter *it, struct dns_rr_view *out);
+
+/**
+ * Decode a name in wire format into a readable, NULL-terminated string such
+ * as "www.example.com". Compression pointers are followed; a pointer must
+ * refer to before the start of the labels that led to it, so that loops are
+ * impossible. The root name is decoded as an empty string.
+ *
+ * @param view The message containing the name
+ * @param name The start of the name within the message
+ * @param buf The buffer to write the name to
+ * @param buf_sz The size of \p buf. #DNS_NAME_BUF_LEN is always sufficient.
+ * @return The length of the decoded name (excluding the NULL terminator), or
+ * -1 if the name is malformed or does not fit in \p buf
+ */
+int
+dns_view_name(const struct dns_view *view, const uint8_t *name, char *buf,
+        size_t buf_sz);
+
+/**
+ * Decode the name held in the record data of a CNAME, NS or PTR record.
+ *
+ * @return As for dns_view_name(), or -1 if \p rr is a different type of
+ * record
+ */
+int
+dns_view_rdata_name(const struct dns_view *view, const struct dns_rr_view *rr,
+        char *buf, size_t buf_sz);
+
+#endif /* DNS_VIEW_H_ */
@@ -0,0 +1,417 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <strings.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "ids_event_format.h"
+
+/** The maximum number of decimal digits in a 64-bit integer */
+#define UINT64_DIGITS_MAX 20
+
+/** The width that timestamps are padded to, to match the original format */
+#define TIMESTAMP_WIDTH 11
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+/**
+ * Copy a string literal, returning the position after it.
+ */
+#define PUT_LITERAL(out, lit) \
+    (memcpy((out), (lit), sizeof(lit) - 1), (out) + sizeof(lit) - 1)
+
+/** The fixed part of a text event, excluding the lengths of the values */
+static const size_t text_fixed_len =
+        sizeof("IOC: \n") - 1
+        + sizeof("Timestamp: \n") - 1
+        + sizeof("Occurrences: \n") - 1
+        + sizeof("Interface: \n") - 1
+        + sizeof("Src-IP: \n") - 1
+        + sizeof("Src-MAC: \n\n") - 1;
+
+/** The fixed part of a JSON event, excluding the lengths of the values */
+static const size_t json_fixed_len =
+        sizeof("{\"seq\":,\"ioc\":\"\",\"timestamp\":,\"occurrences\":,"
+                "\"interface\":\"\",\"src_ip\":\"\",\"src_mac\":\"\",\"rrtype\":}\n")
+        - 1;
+
+/** The length of a binary record header */
+#define RECORD_HDR_LEN 5
+
+/** The maximum length of an address written by put_ip() */
+#define IP_STR_MAX (INET6_ADDRSTRLEN - 1)
+
+/** The fixed part of a binary event, excluding the lengths of the strings */
+static const size_t binary_fixed_len =
+        RECORD_HDR_LEN + 8 + 8 + 4 + 16 + sizeof(((mac_addr *) 0)->m_addr)
+        + 2 + 2 + 2;
+
+/** Strings in binary records are truncated to this length */
+#define RECORD_STR_MAX UINT16_MAX
+
+static const char *format_names[IDS_EVENT_FORMAT_COUNT] = {
+    [IDS_EVENT_FORMAT_TEXT] = "TEXT",
+    [IDS_EVENT_FORMAT_JSON] = "JSON",
+    [IDS_EVENT_FORMAT_BINARY] = "BINARY"
+};
+
+/**
+ * Write \p value in decimal, left-padded with spaces to \p width.
+ *
+ * @return The position after the last digit
+ */
+static char *
+put_uint(char *out, uint64_t value, unsigned int width)
+{
+    char digits[UINT64_DIGITS_MAX];
+    unsigned int n = 0;
+
+    do
+    {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    for (; width > n; width--) *out++ = ' ';
+    while (n) *out++ = digits[--n];
+
+    return out;
+}
+
+/**
+ * Write an IPv4 address given in network byte order as a dotted quad.
+ */
+static char *
+put_ipv4(char *out, uint32_t addr)
+{
+    const uint8_t *octets = (const uint8_t *) &addr;
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        if (i) *out++ = '.';
+        out = put_uint(out, octets[i], 0);
+    }
+
+    return out;
+}
+
+static char *
+put_str(char *out, const char *str)
+{
+    size_t len = strlen(str);
+
+    memcpy(out, str, len);
+    return out + len;
+}
+
+/**
+ * Write an address as a dotted quad if it is an IPv4-mapped address,
+ * otherwise in the text form of an IPv6 address.
+ */
+static char *
+put_ip(char *out, const struct in6_addr *addr)
+{
+    char buf[INET6_ADDRSTRLEN];
+    uint32_t v4;
+
+    if (IN6_IS_ADDR_V4MAPPED(addr))
+    {
+        memcpy(&v4, addr->s6_addr + 12, sizeof(v4));
+        return put_ipv4(out, v4);
+    }
+
+    if (!inet_ntop(AF_INET6, addr, buf, sizeof(buf))) return out;
+    return put_str(out, buf);
+}
+
+/**
+ * Write a MAC address as upper case hex octets separated by '-'.
+ */
+static char *
+put_mac(char *out, const mac_addr *mac)
+{
+    int i;
+
+    for (i = 0; i < (int) sizeof(mac->m_addr); i++)
+    {
+        if (i) *out++ = '-';
+        *out++ = hex_digits[mac->m_addr[i] >> 4];
+        *out++ = hex_digits[mac->m_addr[i] & 0xF];
+    }
+
+    return out;
+}
+
+/**
+ * Write \p str as the contents of a JSON string, escaping quotes, backslashes,
+ * control characters and bytes outside ASCII. Writes at most 6 bytes per
+ * input byte.
+ *
+ * IoCs and interface names come from packets and are not necessarily UTF-8,
+ * so each byte from 0x80 is written as the code point of the same value
+ * rather than passed through as a possibly invalid sequence.
+ */
+static char *
+put_json_str(char *out, const char *str)
+{
+    unsigned char c;
+
+    for (; '\0' != (c = *str); str++)
+    {
+        if ('"' == c || '\\' == c)
+        {
+            *out++ = '\\';
+            *out++ = c;
+        }
+        else if (c < 0x20 || c >= 0x80)
+        {
+            out = PUT_LITERAL(out, "\\u00");
+            *out++ = hex_digits[c >> 4];
+            *out++ = hex_digits[c & 0xF];
+        }
+        else *out++ = c;
+    }
+
+    return out;
+}
+
+static char *
+put_be16(char *out, uint16_t value)
+{
+    *out++ = value >> 8;
+    *out++ = value;
+    return out;
+}
+
+static char *
+put_be32(char *out, uint32_t value)
+{
+    out = put_be16(out, value >> 16);
+    return put_be16(out, value);
+}
+
+static char *
+put_be64(char *out, uint64_t value)
+{
+    out = put_be32(out, value >> 32);
+    return put_be32(out, value);
+}
+
+/**
+ * Write a string prefixed with its two byte length.
+ */
+static char *
+put_record_str(char *out, const char *str)
+{
+    size_t len = strlen(str);
+
+    if (len > RECORD_STR_MAX) len = RECORD_STR_MAX;
+    out = put_be16(out, len);
+    memcpy(out, str, len);
+    return out + len;
+}
+
+/**
+ * Write a binary record containing a single integer.
+ */
+static size_t
+put_record_uint(char *out, ids_event_record_type type, uint64_t value)
+{
+    char *pos = out;
+
+    *pos++ = type;
+    pos = put_be32(pos, 8);
+    pos = put_be64(pos, value);
+
+    return pos - out;
+}
+
+static size_t
+format_text(char *out, const struct ids_event *event)
+{
+    char *pos = out;
+
+    pos = PUT_LITERAL(pos, "IOC: ");
+    pos = put_str(pos, event->ioc);
+    pos = PUT_LITERAL(pos, "\nTimestamp: ");
+    pos = put_uint(pos, event->times_seen->tm_stamp.tv_sec, TIMESTAMP_WIDTH);
+    pos = PUT_LITERAL(pos, "\nOccurrences: ");
+    pos = put_uint(pos, event->num_times, 0);
+    pos = PUT_LITERAL(pos, "\nInterface: ");
+    pos = put_str(pos, event->iface);
+    pos = PUT_LITERAL(pos, "\nSrc-IP: ");
+    pos = put_ip(pos, &event->src_ip);
+    pos = PUT_LITERAL(pos, "\nSrc-MAC: ");
+    pos = put_mac(pos, &event->mac);
+    pos = PUT_LITERAL(pos, "\n\n");
+
+    return pos - out;
+}
+
+static size_t
+format_json(char *out, const struct ids_event *event)
+{
+    char *pos = out;
+
+    pos = PUT_LITERAL(pos, "{\"seq\":");
+    pos = put_uint(pos, event->seq, 0);
+    pos = PUT_LITERAL(pos, ",\"ioc\":\"");
+    pos = put_json_str(pos, event->ioc);
+    pos = PUT_LITERAL(pos, "\",\"timestamp\":");
+    pos = put_uint(pos, event->times_seen->tm_stamp.tv_sec, 0);
+    pos = PUT_LITERAL(pos, ",\"occurrences\":");
+    pos = put_uint(pos, event->num_times, 0);
+    pos = PUT_LITERAL(pos, ",\"interface\":\"");
+    pos = put_json_str(pos, event->iface);
+    pos = PUT_LITERAL(pos, "\",\"src_ip\":\"");
+    pos = put_ip(pos, &event->src_ip);
+    pos = PUT_LITERAL(pos, "\",\"src_mac\":\"");
+    pos = put_mac(pos, &event->mac);
+    pos = PUT_LITERAL(pos, "\",\"rrtype\":");
+    pos = put_uint(pos, event->rrtype, 0);
+    pos = PUT_LITERAL(pos, "}\n");
+
+    return pos - out;
+}
+
+static size_t
+format_binary(char *out, const struct ids_event *event)
+{
+    char *pos = out + RECORD_HDR_LEN;
+
+    pos = put_be64(pos, event->seq);
+    pos = put_be64(pos, event->times_seen->tm_stamp.tv_sec);
+    pos = put_be32(pos, event->num_times);
+    // The address is already in network byte order
+    memcpy(pos, event->src_ip.s6_addr, 16);
+    pos += 16;
+    memcpy(pos, event->mac.m_addr, sizeof(event->mac.m_addr));
+    pos += sizeof(event->mac.m_addr);
+    pos = put_record_str(pos, event->ioc);
+    pos = put_record_str(pos, event->iface);
+    pos = put_be16(pos, event->rrtype);
+
+    // Fill in the header now that the length is known
+    out[0] = IDS_EVENT_RECORD_EVENT;
+    put_be32(out + 1, pos - out - RECORD_HDR_LEN);
+
+    return pos - out;
+}
+
+int
+ids_event_format_from_name(const char *name, ids_event_format_t *format)
+{
+    int i;
+
+    for (i = 0; i < IDS_EVENT_FORMAT_COUNT; i++)
+    {
+        if (0 == strcasecmp(name, format_names[i]))
+        {
+            *format = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+size_t
+ids_event_format_len_max(ids_event_format_t format,
+        const struct ids_event *event)
+{
+    size_t strings = strlen(event->ioc) + strlen(event->iface);
+
+    switch (format)
+    {
+    case IDS_EVENT_FORMAT_JSON:
+        return json_fixed_len
+                + 6 * strings
+                + UINT64_DIGITS_MAX * 4     // seq, timestamp, occurrences, rrtype
+                + IP_STR_MAX
+                + sizeof(event->mac.m_addr) * 3 - 1;
+    case IDS_EVENT_FORMAT_BINARY:
+        return binary_fixed_len + strings;
+    case IDS_EVENT_FORMAT_TEXT:
+    default:
+        return text_fixed_len
+                + strings
+                + UINT64_DIGITS_MAX * 2     // timestamp, occurrences
+                + IP_STR_MAX
+                + sizeof(event->mac.m_addr) * 3 - 1;
+    }
+}
+
+size_t
+ids_event_format(ids_event_format_t format, char *out,
+        const struct ids_event *event)
+{
+    switch (format)
+    {
+    case IDS_EVENT_FORMAT_JSON:
+        return format_json(out, event);
+    case IDS_EVENT_FORMAT_BINARY:
+        return format_binary(out, event);
+    case IDS_EVENT_FORMAT_TEXT:
+    default:
+        return format_text(out, event);
+    }
+}
+
+size_t
+ids_event_format_cursor(ids_event_format_t format, char *out, uint64_t seq)
+{
+    char *pos = out;
+
+    switch (format)
+    {
+    case IDS_EVENT_FORMAT_JSON:
+        pos = PUT_LITERAL(pos, "{\"cursor\":");
+        pos = put_uint(pos, seq, 0);
+        pos = PUT_LITERAL(pos, "}\n");
+        return pos - out;
+    case IDS_EVENT_FORMAT_BINARY:
+        return put_record_uint(out, IDS_EVENT_RECORD_CURSOR, seq);
+    case IDS_EVENT_FORMAT_TEXT:
+    default:
+        pos = PUT_LITERAL(pos, "Cursor: ");
+        pos = put_uint(pos, seq, 0);
+        pos = PUT_LITERAL(pos, "\n\n");
+        return pos - out;
+    }
+}
+
+size_t
+ids_event_format_dropped(ids_event_format_t format, char *out,
+        uint64_t dropped)
+{
+    char *pos = out;
+
+    switch (format)
+    {
+    case IDS_EVENT_FORMAT_JSON:
+        pos = PUT_LITERAL(pos, "{\"dropped\":");
+        pos = put_uint(pos, dropped, 0);
+        pos = PUT_LITERAL(pos, "}\n");
+        return pos - out;
+    case IDS_EVENT_FORMAT_BINARY:
+        return put_record_uint(out, IDS_EVENT_RECORD_DROPPED, dropped);
+    case IDS_EVENT_FORMAT_TEXT:
+    default:
+        pos = PUT_LITERAL(pos, "Dropped: ");
+        pos = put_uint(pos, dropped, 0);
+        pos = PUT_LITERAL(pos, "\n\n");
+        return pos - out;
+    }
+}
@@ -0,0 +1,136 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Serialization of events for the event server
+ *
+ * Events are written directly into a caller-supplied buffer without using
+ * the printf family. The caller sizes the buffer from
+ * ids_event_format_len_max(), which only needs the lengths of the strings in
+ * the event, so a response containing many events can be built with a single
+ * allocation.
+ *
+ * Three formats are supported:
+ * - #IDS_EVENT_FORMAT_TEXT: the original "Field: value" format
+ * - #IDS_EVENT_FORMAT_JSON: one JSON object per line (JSON Lines)
+ * - #IDS_EVENT_FORMAT_BINARY: length-prefixed binary records
+ *
+ * A binary record is a one byte #ids_event_record_type, a four byte length
+ * and then that many bytes of payload. All integers are in network byte
+ * order. The payload of an event record is:
+ * - `seq` (8 bytes)
+ * - `timestamp` (8 bytes, seconds since the UNIX epoch)
+ * - `occurrences` (4 bytes)
+ * - `src_ip` (16 bytes, with IPv4 addresses as IPv4-mapped IPv6 addresses)
+ * - `src_mac` (6 bytes)
+ * - `ioc` (2 byte length followed by the string)
+ * - `interface` (2 byte length followed by the string)
+ * - `rrtype` (2 bytes, the DNS record type the IoC was found in or 0)
+ *
+ * The payload of a cursor or dropped record is a single 8 byte integer.
+ */
+#ifndef IDS_EVENT_FORMAT_H_
+#define IDS_EVENT_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ids_event_list.h"
+
+/**
+ * The formats that events may be serialized in
+ */
+typedef enum
+{
+    IDS_EVENT_FORMAT_TEXT,
+    IDS_EVENT_FORMAT_JSON,
+    IDS_EVENT_FORMAT_BINARY,
+    /** The number of formats */
+    IDS_EVENT_FORMAT_COUNT
+} ids_event_format_t;
+
+/**
+ * The record types of #IDS_EVENT_FORMAT_BINARY
+ */
+typedef enum
+{
+    IDS_EVENT_RECORD_EVENT = 1,
+    IDS_EVENT_RECORD_CURSOR = 2,
+    IDS_EVENT_RECORD_DROPPED = 3
+} ids_event_record_type;
+
+/**
+ * The maximum length of the field written by ids_event_format_cursor() in
+ * any format
+ */
+#define IDS_EVENT_FORMAT_CURSOR_MAX (sizeof("{\"cursor\":}\n") - 1 + 20)
+
+/**
+ * The maximum length of the field written by ids_event_format_dropped() in
+ * any format
+ */
+#define IDS_EVENT_FORMAT_DROPPED_MAX (sizeof("{\"dropped\":}\n") - 1 + 20)
+
+/**
+ * Look up a format by its name in a request, ignoring case.
+ *
+ * @param name "TEXT", "JSON" or "BINARY"
+ * @param[out] format The format that was found
+ * @return 0 if successful, -1 if \p name is not a format
+ */
+int
+ids_event_format_from_name(const char *name, ids_event_format_t *format);
+
+/**
+ * An upper bound on the number of bytes ids_event_format() will write for
+ * \p event.
+ */
+size_t
+ids_event_format_len_max(ids_event_format_t format,
+        const struct ids_event *event);
+
+/**
+ * Write \p event, including the terminating blank line or newline of the
+ * text formats. No NULL terminator is written.
+ *
+ * @param format The format to write
+ * @param out The buffer to write to, which must have space for at least
+ * ids_event_format_len_max() bytes
+ * @param event The event to write
+ * @return The number of bytes written
+ */
+size_t
+ids_event_format(ids_event_format_t format, char *out,
+        const struct ids_event *event);
+
+/**
+ * Write the cursor field which terminates an incremental response.
+ *
+ * @param out A buffer of at least #IDS_EVENT_FORMAT_CURSOR_MAX bytes
+ * @param seq The sequence number to send
+ * @return The number of bytes written
+ */
+size_t
+ids_event_format_cursor(ids_event_format_t format, char *out, uint64_t seq);
+
+/**
+ * Write the field telling a subscriber how many events it missed.
+ *
+ * @param out A buffer of at least #IDS_EVENT_FORMAT_DROPPED_MAX bytes
+ * @param dropped The number of events that were dropped
+ * @return The number of bytes written
+ */
+size_t
+ids_event_format_dropped(ids_event_format_t format, char *out,
+        uint64_t dropped);
+
+#endif /* IDS_EVENT_FORMAT_H_ */
@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <assert.h>
 
+#include "utils/mem.h"
 #include "ids_event_list.h"
 
 /* Both of these structures are linked lists. */
@@ -55,9 +56,9 @@ free_ids_event(struct ids_event **e)
             /* Interface names are from the command line and should not be
              * freed */
 
-            if (tmp->ioc) free(tmp->ioc);
+            mem_free(MEM_EVENTS, tmp->ioc);
 
-            free(tmp);
+            mem_free(MEM_EVENTS, tmp);
         }
 
         *e = NULL;
@@ -72,7 +73,7 @@ free_ids_event_list(struct ids_event_list **list)
     if (list && *list)
     {
         free_ids_event(&(*list)->head);
-        free(*list);
+        mem_free(MEM_EVENTS, *list);
 
         *list = NULL;
     }
@@ -93,7 +94,7 @@ free_ids_event_ts(struct ids_event_ts **t)
             tmp = time_iter;
             time_iter = time_iter->next;
 
-            free(tmp);
+            mem_free(MEM_EVENTS, tmp);
         }
 
         *t = NULL;
@@ -128,23 +129,27 @@ ids_event_list_add_event(struct ids_event_list *list, struct ids_event *e)
 
                 existing->previous = NULL;
                 existing->next = list->head;
+                if (list->head) list->head->previous = existing;
 
                 list->head = existing;
 
                 existing->num_times++;
+                existing->rrtype = e->rrtype;
+                existing->seq = ++list->seq;
 
                 /* Most of the ids_event is no longer needed, but don't free
                  * the time */
 
                 // Free IOC string since it's a duplicate
-                free(e->ioc);
-                free(e);
+                mem_free(MEM_EVENTS, e->ioc);
+                mem_free(MEM_EVENTS, e);
                 result = 1;
             }
         }
         else
         {
             /* Add a new entry */
+            e->seq = ++list->seq;
             if (list->head)
             {
                 /* Add to head of list */
@@ -162,6 +167,8 @@ ids_event_list_add_event(struct ids_event_list *list, struct ids_event *e)
         }
 
         result = 1;
+
+        if (list->observer) list->observer(list->head, list->observer_data);
     }
 
     /* Could not add event because list wasn't initialized */
@@ -170,6 +177,16 @@ ids_event_list_add_event(struct ids_event_list *list, struct ids_event *e)
     return (result);
 }
 
+void
+ids_event_list_set_observer(struct ids_event_list *list,
+        ids_event_observer_cb cb, void *data)
+{
+    assert(list);
+
+    list->observer = cb;
+    list->observer_data = data;
+}
+
 void
 ids_event_list_enforce_max_events(struct ids_event_list *list)
 {
@@ -252,10 +269,11 @@ ids_event_time_list_enforce_max_timestamps(struct ids_event_list *list,
  * Will release IOC if cannot make a new event.
  */
 struct ids_event *
-new_ids_event(char *iface, uint32_t src_ip, char *ioc, mac_addr mac,
-        ids_ioc_value_t ioc_value)
+new_ids_event(char *iface, const struct in6_addr *src_ip, char *ioc,
+        mac_addr mac, ids_ioc_value_t ioc_value)
 {
     assert(iface);
+    assert(src_ip);
     assert(ioc);
 
     struct ids_event *e = NULL;
@@ -263,16 +281,18 @@ new_ids_event(char *iface, uint32_t src_ip, char *ioc, mac_addr mac,
 
     if (iface && ioc)
     {
-        if (!(e = malloc(sizeof(*e)))) goto error;
+        if (!(e = mem_malloc(MEM_EVENTS, sizeof(*e)))) goto error;
         if (!(t = new_ids_event_ts())) goto error;
 
         e->num_times = 1;
         e->times_seen = t;
         e->iface = iface;
-        e->src_ip = src_ip;
+        e->src_ip = *src_ip;
         e->mac = mac;
         e->ioc = ioc;
         e->ioc_value = ioc_value;
+        e->rrtype = 0;
+        e->seq = 0;
 
         e->next = NULL;
         e->previous = NULL;
@@ -282,7 +302,7 @@ new_ids_event(char *iface, uint32_t src_ip, char *ioc, mac_addr mac,
     return (e);
 
 error:
-    if (ioc) free(ioc);
+    mem_free(MEM_EVENTS, ioc);
     free_ids_event_ts(&t);
     free_ids_event(&e);
     return (NULL);
@@ -298,9 +318,12 @@ new_ids_event_list(unsigned int max_events, unsigned int max_timestamps)
 
     if (max_events > 0 && max_timestamps > 0)
     {
-        if (NULL != (list = malloc(sizeof(*list))))
+        if (NULL != (list = mem_malloc(MEM_EVENTS, sizeof(*list))))
         {
             list->head = NULL;
+            list->seq = 0;
+            list->observer = NULL;
+            list->observer_data = NULL;
             list->max_events = max_events;
             list->max_timestamps = max_timestamps;
         }
@@ -325,7 +348,7 @@ ids_event_list_contains(struct ids_event_list *list, struct ids_event *e)
         while (list_iter)
         {
             if (!strcmp(list_iter->iface, e->iface)
-                    && (list_iter->src_ip == e->src_ip)
+                    && IN6_ARE_ADDR_EQUAL(&list_iter->src_ip, &e->src_ip)
                     && !strcmp(list_iter->ioc, e->ioc))
             {
                 result = list_iter;
@@ -344,7 +367,7 @@ new_ids_event_ts()
 {
     struct ids_event_ts *tm = NULL;
 
-    if ( !( tm = malloc( sizeof( *tm ) ) ) ) goto error;
+    if ( !( tm = mem_malloc( MEM_EVENTS, sizeof( *tm ) ) ) ) goto error;
 
     /* 0 indicates success, all errors are programmer errors */
     if ( -1 == clock_gettime( CLOCK_REALTIME, &( tm->tm_stamp ) ) )
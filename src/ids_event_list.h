@@ -24,6 +24,9 @@
 #define IDS_EVENT_LIST_H
 
 #include <stdint.h>
+#include <time.h>
+
+#include <netinet/in.h>
 
 #include "common.h"
 #include "utils/linked_list.h"
@@ -44,37 +47,71 @@ struct ids_event
     unsigned int num_times;
     /** the interface name of the interface where the event was observed */
     char *iface;
-    /** the IPv4 address of the generating device */
-    uint32_t src_ip;
+    /** the address of the generating device. IPv4 addresses are stored as
+     * IPv4-mapped IPv6 addresses. */
+    struct in6_addr src_ip;
     /** the MAC address of the generating device */
     mac_addr mac;
     /** may be a stringify-ed IP address or domain */
     char *ioc;
+    /** The DNS record type the domain was found in, or 0 if the IoC is not a
+     * domain. See ids_pcap_fields.rrtype */
+    uint16_t rrtype;
 
     /** A copy of the value associated with the IOC. This is a copy since the
      * blacklist may change and the IOC/value pair may be removed but the event
      * should still be associated with the same botnet ID. */
     ids_ioc_value_t ioc_value;
 
+    /** The sequence number of the most recent observation of this event.
+     * Assigned by ids_event_list_add_event() from
+     * \ref ids_event_list.seq */
+    uint64_t seq;
+
     /** The next value of the list **/
     struct ids_event *next;
     /** the previous value of the list **/
     struct ids_event *previous;
 };
 
+struct ids_event;
+
+/**
+ * Callback run each time an observation is added to an #ids_event_list
+ *
+ * @param event The event that was observed, which is now at the head of the
+ * list. Must not be modified or freed.
+ * @param data The user data given to ids_event_list_set_observer()
+ */
+typedef void (*ids_event_observer_cb)(const struct ids_event *event,
+        void *data);
+
 /**
  * A linked-list containing #ids_event structures
+ *
+ * Every observation added to the list is given a sequence number that is one
+ * greater than the previous. As an event is moved to the head of the list
+ * whenever it is observed, the list is always ordered by descending
+ * \ref ids_event.seq and the events newer than a given sequence number form a
+ * prefix of the list.
  */
 struct ids_event_list
 {
     /** The head of the linked-list, or NULL for an empty list */
     struct ids_event *head;
+    /** The sequence number of the most recent observation, or 0 if nothing
+     * has been observed yet */
+    uint64_t seq;
     /** The maximum number of events to store in the list */
     unsigned int max_events;
     /** The maximum number of timestamps to store for repeated events */
     unsigned int max_timestamps;
     /** \deprecated Unused */
     unsigned int num_events;
+    /** Called after each observation is added, or NULL */
+    ids_event_observer_cb observer;
+    /** User data passed to #observer */
+    void *observer_data;
 };
 
 /**
@@ -124,6 +161,18 @@ free_ids_event_ts(struct ids_event_ts **t);
 int
 ids_event_list_add_event(struct ids_event_list *list, struct ids_event *e);
 
+/**
+ * Set a callback to be run each time an observation is added to \p list.
+ * Replaces any previous callback.
+ *
+ * @param list The list to observe. May not be NULL.
+ * @param cb The callback, or NULL to remove the current callback
+ * @param data User data passed to \p cb
+ */
+void
+ids_event_list_set_observer(struct ids_event_list *list,
+        ids_event_observer_cb cb, void *data);
+
 /**
  * Checks if the ids_event list contains an event equivalent to E, and returns
  * the equivalent event if it was found.
@@ -156,17 +205,20 @@ ids_event_list_enforce_max_events(struct ids_event_list *list);
  * timestamp.
  * @param iface The name of the network interface which observed this event.
  * May not be NULL.
- * @param src_ip The IP of the device which generated this event.
+ * @param src_ip The address of the device which generated this event, with
+ * IPv4 addresses given as IPv4-mapped IPv6 addresses. It is copied.
  * @param ioc A string containing the indicator of compromise (a domain name or
- * a string-ified IP address). May not be NULL.
+ * a string-ified IP address), allocated with mem_strdup() and #MEM_EVENTS.
+ * The event takes ownership of it, even if it cannot be created. May not be
+ * NULL.
  * @param mac the MAC address of the device that generated this event
  * @param ioc_value The value stored in the blacklist for the particular IOC.
  * @return A pointer to a valid ids_event structure, or NULL if the ids_event
  * could not be created.
  */
 struct ids_event *
-new_ids_event(char *iface, uint32_t src_ip, char *ioc, mac_addr mac,
-        ids_ioc_value_t ioc_value);
+new_ids_event(char *iface, const struct in6_addr *src_ip, char *ioc,
+        mac_addr mac, ids_ioc_value_t ioc_value);
 
 /**
  * Creates a new IDS event list with the given number of maximum events and
@@ -10,10 +10,13 @@
  *
  *
  */
+#include <config.h>
+
 #if defined(__linux__)
 #define __FAVOR_BSD
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -25,6 +28,7 @@
 #include <arpa/inet.h>
 #include <pcap/pcap.h>
 #include <net/ethernet.h>
+#include <stddef.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
@@ -32,69 +36,271 @@
 #include "error/ids_error.h"
 #include "utils/common.h"
 #include "utils/logging.h"
-#include "dns.h"
+#include "utils/mem.h"
+#include "dns_view.h"
 #include "ids_pcap.h"
+#include "metrics.h"
+#include "trace.h"
 
 /**
  * TODO: Refactor references to global state into a struct pointed to by
  * user_dat instead.
  */
 extern ip_blacklist *ip_bl;
+extern ip6_blacklist *ip6_bl;
 extern domain_blacklist *dn_bl;
+extern ip_watchlist *ip_wl;
+extern tcp_dns_tracker *tcp_dns;
+extern ip_reasm *ip_frags;
+extern tls_sni_table *tls_conns;
+#ifdef HAVE_OPENSSL
+extern tls_sni_table *quic_conns;
+#endif
 extern struct ids_event_list *event_queue;
 
-void packet_handler(unsigned char *user_dat __attribute__((unused)),
-                    const struct pcap_pkthdr* pcap_hdr,
-                    const unsigned char *packet)
+/** The port used by DNS over both UDP and TCP */
+#define DNS_PORT 53
+
+#ifndef ETHERTYPE_IPV6
+#define ETHERTYPE_IPV6 0x86dd
+#endif
+
+/** The length of the fixed IPv6 header */
+#define IPV6_HDR_LEN 40
+
+/** The fragment offset bits of a Fragment header, in host byte order */
+#define IPV6_FRAG_OFFMASK 0xfff8
+
+/**
+ * Store an IPv4 address given in network byte order as an IPv4-mapped IPv6
+ * address.
+ */
+static inline void
+ids_pcap_map_ipv4(struct in6_addr *out, uint32_t addr)
 {
-    int result;
+    memset(out->s6_addr, 0, 10);
+    out->s6_addr[10] = 0xff;
+    out->s6_addr[11] = 0xff;
+    memcpy(out->s6_addr + 12, &addr, sizeof(addr));
+}
+
+/**
+ * Write an address in text form, as a dotted quad if it is an IPv4-mapped
+ * address.
+ *
+ * @param buf A buffer of at least INET6_ADDRSTRLEN bytes
+ * @return \p buf
+ */
+static const char *
+ids_pcap_addr_str(const struct in6_addr *addr, char *buf)
+{
+    const char *str;
+
+    if (IN6_IS_ADDR_V4MAPPED(addr))
+        str = inet_ntop(AF_INET, addr->s6_addr + 12, buf, INET6_ADDRSTRLEN);
+    else
+        str = inet_ntop(AF_INET6, addr, buf, INET6_ADDRSTRLEN);
+
+    if (!str) buf[0] = '\0';
+    return buf;
+}
+
+/**
+ * Add an event for an IoC found in the fields of a packet.
+ */
+static void
+ids_pcap_add_event(const struct ids_pcap_fields *fields,
+        const ids_ioc_value_t *ioc_value)
+{
+    char ip[INET6_ADDRSTRLEN];
+    // TODO: A name is required, but has proved difficult to get
+    char *iface_name = "placeholder";
+    char *ioc_str;
+    struct ids_event *ev;
+    const struct in6_addr *client_ip = &fields->src_addr;
+    mac_addr client_mac = fields->src_mac;
+
+    // A DNS response is sent to the client that made the query
+    if (fields->has_dns && fields->dns.header.qr)
+    {
+        client_ip = &fields->dest_addr;
+        client_mac = fields->dest_mac;
+    }
+
+    // Only copy the IoC once it is known to be needed for an event
+    ioc_str = mem_strdup(MEM_EVENTS, fields->domain[0] ? fields->domain
+            : ids_pcap_addr_str(&fields->dest_addr, ip));
+    if (!ioc_str)
+    {
+        logger(L_ERROR, "packet_handler: could not copy IoC");
+        return;
+    }
+    ev = new_ids_event(
+            iface_name,
+            client_ip,
+            ioc_str,
+            client_mac,
+            *ioc_value);
+    if (!ev)
+    {
+        logger(L_ERROR, "packet_handler: new_ids_event() failed");
+        return;
+    }
+    ev->rrtype = fields->rrtype;
+
+    if (!ids_event_list_add_event(event_queue, ev)) {
+        logger(L_ERROR, "packet_handler: ids_event_list_add() failed");
+        return;
+    }
+    metrics_inc(METRICS_EVENTS);
 
+    logger(L_DEBUG, "pcap_io_task_read(): NEW DETECTED INTRUSION");
+}
+
+/**
+ * Check the fields of a packet or of a DNS message reassembled from TCP, and
+ * add an event if they contain an IoC.
+ */
+static void
+ids_pcap_handle_fields(struct ids_pcap_fields *fields)
+{
     // Value retrieved from blacklist
     const ids_ioc_value_t *ioc_value;
 
+    // Value will be non-NULL if the domain/IP is blacklisted
+    TRACE_BEGIN(TRACE_CHECK);
+    ioc_value = ids_pcap_is_blacklisted(fields, ip_bl, ip6_bl, dn_bl, ip_wl);
+    TRACE_END(TRACE_CHECK);
+
+    if (NULL != ioc_value) {
+        TRACE_BEGIN(TRACE_EVENT);
+        ids_pcap_add_event(fields, ioc_value);
+        TRACE_END(TRACE_EVENT);
+    } else {
+        logger(L_DEBUG, "Safe!");
+    }
+}
+
+/**
+ * Called by the #tcp_dns_tracker with each DNS message reassembled from TCP.
+ */
+static void
+ids_pcap_tcp_dns_message(const uint8_t *msg, size_t len, void *arg)
+{
+    struct ids_pcap_fields *fields = arg;
+
+    if (0 != dns_view_init(&fields->dns, msg, msg + len))
+    {
+        logger(L_DEBUG, "ids_pcap_tcp_dns_message(): dns_view_init() failed");
+        metrics_inc(METRICS_PARSE_ERRORS_DNS);
+        return;
+    }
+    metrics_inc(METRICS_DNS_MESSAGES_TCP);
+
+    fields->has_dns = 1;
+    fields->domain[0] = '\0';
+    fields->rrtype = 0;
+    ids_pcap_handle_fields(fields);
+    fields->has_dns = 0;
+    fields->domain[0] = '\0';
+}
+
+void packet_handler(unsigned char *user_dat,
+                    const struct pcap_pkthdr* pcap_hdr,
+                    const unsigned char *packet)
+{
+    const struct ids_pcap_user *user = (const struct ids_pcap_user *)user_dat;
+    int result;
+    struct tcp_dns_key key;
+
     struct ids_pcap_fields fields;
+
+    TRACE_BEGIN(TRACE_PACKET);
     memset(&fields, 0, sizeof(fields));
-    result = ids_pcap_read_packet(pcap_hdr, packet, &fields);
+    TRACE_BEGIN(TRACE_DECODE);
+    result = ids_pcap_read_packet(pcap_hdr, packet,
+            user ? user->decode : link_decode_ethernet, ip_frags, &fields);
+    TRACE_END(TRACE_DECODE);
     if (result == 1) {
+        metrics_inc(IPPROTO_TCP == fields.protocol ? METRICS_PACKETS_TCP
+                : METRICS_PACKETS_UDP);
+        metrics_inc(6 == fields.ip_version ? METRICS_IP_PACKETS_V6
+                : METRICS_IP_PACKETS_V4);
+        if (fields.has_dns) metrics_inc(METRICS_DNS_MESSAGES_UDP);
+
+        if (tcp_dns && IPPROTO_TCP == fields.protocol
+                && (htons(DNS_PORT) == fields.dest_port
+                    || htons(DNS_PORT) == fields.src_port))
+        {
+            key.src_ip = fields.src_addr;
+            key.dest_ip = fields.dest_addr;
+            key.src_port = fields.src_port;
+            key.dest_port = fields.dest_port;
+            TRACE_BEGIN(TRACE_TCP_DNS);
+            tcp_dns_tracker_segment(tcp_dns, &key, fields.tcp_seq,
+                    fields.tcp_flags, fields.payload,
+                    fields.payload_len, fields.timestamp,
+                    ids_pcap_tcp_dns_message, &fields);
+            TRACE_END(TRACE_TCP_DNS);
+        }
 
-        // Value will be non-NULL if the domain/IP is blacklisted
-        if (NULL != (ioc_value = ids_pcap_is_blacklisted(&fields, ip_bl, dn_bl))) {
-            struct in_addr ip;
-            // TODO: A name is required, but has proved difficult to get
-            char *iface_name = "placeholder";
-            char *ioc_str;
-            struct ids_event *ev;
-
-            ip.s_addr = fields.dest_ip;
-            ioc_str = fields.domain ? fields.domain : strdup(inet_ntoa(ip));
-            ev = new_ids_event(
-                    iface_name,
-                    fields.src_ip,
-                    ioc_str,
-                    fields.src_mac,
-                    *ioc_value);
-
-            if (!ids_event_list_add_event(event_queue, ev)) {
-                logger(L_ERROR, "packet_handler: ids_event_list_add() failed");
-                goto end;
+        if (tls_conns && IPPROTO_TCP == fields.protocol
+                && htons(TLS_SNI_PORT) == fields.dest_port)
+        {
+            if ((fields.tcp_flags & TH_SYN) && !(fields.tcp_flags & TH_ACK))
+                tls_sni_table_add(tls_conns, &fields.src_addr,
+                        &fields.dest_addr, fields.src_port, fields.timestamp);
+            else if (fields.payload_len)
+            {
+                metrics_inc(METRICS_FLOW_LOOKUPS_TLS);
+                if (tls_sni_table_take(tls_conns, &fields.src_addr,
+                        &fields.dest_addr, fields.src_port, fields.timestamp))
+                {
+                    metrics_inc(METRICS_FLOW_HITS_TLS);
+                    TRACE_BEGIN(TRACE_SNI);
+                    if (0 < tls_sni_parse(fields.payload, fields.payload_len,
+                            fields.domain, sizeof(fields.domain)))
+                    {
+                        fields.has_sni = 1;
+                        metrics_inc(METRICS_SERVER_NAMES_TLS);
+                    }
+                    TRACE_END(TRACE_SNI);
+                }
             }
+        }
 
-            logger(L_DEBUG, "pcap_io_task_read(): NEW DETECTED INTRUSION");
-            // Don't free domain name because it is added to event list
-            return;
-
-        } else {
-            logger(L_DEBUG, "Safe!");
+#ifdef HAVE_OPENSSL
+        // Only the first Initial of a flow is decrypted, to bound the cost
+        if (quic_conns && IPPROTO_UDP == fields.protocol
+                && htons(QUIC_PORT) == fields.dest_port
+                && fields.payload_len)
+        {
+            metrics_inc(METRICS_FLOW_LOOKUPS_QUIC);
+            if (tls_sni_table_first(quic_conns, &fields.src_addr,
+                    &fields.dest_addr, fields.src_port, fields.timestamp))
+            {
+                metrics_inc(METRICS_FLOW_HITS_QUIC);
+                TRACE_BEGIN(TRACE_SNI);
+                if (0 < quic_initial_sni(fields.payload, fields.payload_len,
+                        fields.domain, sizeof(fields.domain)))
+                {
+                    fields.has_sni = 1;
+                    metrics_inc(METRICS_SERVER_NAMES_QUIC);
+                }
+                TRACE_END(TRACE_SNI);
+            }
         }
+#endif
+
+        // Connections to port 53 are checked against the IP blacklist too
+        ids_pcap_handle_fields(&fields);
     } else if (result == -1) {
+        metrics_inc(METRICS_PARSE_ERRORS_PACKET);
         logger(L_INFO, "pcap_io_task_read(): ids_pcap_read_packet() failed");
+    } else {
+        metrics_inc(METRICS_PACKETS_OTHER);
     }
-
-end:
-    // If domain name is not added to event list, free it
-    if (fields.domain != NULL) {
-        free(fields.domain);
-    }
+    TRACE_END(TRACE_PACKET);
 }
 
 const ip_key_value_t *
@@ -104,20 +310,213 @@ ids_pcap_lookup_ip(ip_blacklist *b, uint32_t addr, uint16_t port)
     return (ip_blacklist_lookup(b, addr, port));
 }
 
+/**
+ * Add a fragment of a UDP datagram to the reassembly cache. Only datagrams
+ * to or from the DNS port are reassembled, as DNS is the only protocol that
+ * is inspected in UDP datagrams large enough to be fragmented.
+ *
+ * @param off The fragment offset field of the IP header, in host byte order
+ * @param[in, out] l4 The start of the fragment's payload, set to the start of
+ * the datagram's payload if it is complete
+ * @param[in, out] ip_end The end of the fragment's payload, set to the end of
+ * the datagram's payload if it is complete
+ * @return 1 if the datagram is complete, or this is the first fragment of a
+ * datagram that is not reassembled, otherwise 0
+ */
+static int
+ids_pcap_reassemble(ip_reasm *reasm, const struct ip *ip_hdr, uint16_t off,
+        uint32_t now, const uint8_t **l4, const uint8_t **ip_end)
+{
+    const struct udphdr *udp_hdr;
+    struct ip_reasm_key key;
+    const uint8_t *data;
+    size_t len;
+
+    key.src_ip = ip_hdr->ip_src.s_addr;
+    key.dest_ip = ip_hdr->ip_dst.s_addr;
+    key.id = ip_hdr->ip_id;
+    key.protocol = ip_hdr->ip_p;
+
+    if (!(off & IP_OFFMASK))
+    {
+        udp_hdr = (const struct udphdr *)*l4;
+        if (*ip_end - *l4 < (ptrdiff_t) sizeof(*udp_hdr)
+                || (htons(DNS_PORT) != udp_hdr->uh_sport
+                    && htons(DNS_PORT) != udp_hdr->uh_dport))
+        {
+            // Drop any later fragments that arrived before this one
+            ip_reasm_discard(reasm, &key);
+            return (1);
+        }
+    }
+
+    metrics_inc(METRICS_IP_FRAGMENTS);
+    if (1 != ip_reasm_fragment(reasm, &key, (size_t) (off & IP_OFFMASK) * 8,
+            off & IP_MF, *l4, *ip_end - *l4, now, &data, &len))
+        return (0);
+    metrics_inc(METRICS_IP_REASSEMBLED);
+
+    *l4 = data;
+    *ip_end = data + len;
+    return (1);
+}
+
+/**
+ * Read the addresses from an IPv4 header and find the transport header.
+ * Fragments of UDP datagrams are passed to \p reasm, if it is not NULL, and
+ * the datagram is read once it is complete.
+ *
+ * @param[out] l4 The start of the transport header
+ * @param[out] ip_end The end of the IP packet, or of the captured bytes if
+ * the capture is shorter
+ * @param[out] proto The protocol of the transport header
+ * @return 1 if the transport header was found, 0 if the packet does not
+ * contain one, -1 if the packet is malformed
+ */
+static int
+ids_pcap_read_ipv4(const uint8_t *l3, const uint8_t *cap_end,
+        ip_reasm *reasm, struct ids_pcap_fields *out, const uint8_t **l4,
+        const uint8_t **ip_end, uint8_t *proto)
+{
+    const struct ip *ip_hdr;
+    size_t ip_hdr_len;
+    uint16_t off;
+
+    if (cap_end - l3 < (ptrdiff_t) sizeof(*ip_hdr))
+    {
+        logger(L_WARN, "ids_pcap_read_packet(): pcap length too small to contain IP header");
+        return -1;
+    }
+    ip_hdr = (const struct ip *)l3;
+
+    // The header may contain options, so the transport header is found
+    // using the header length rather than the size of the structure
+    ip_hdr_len = ip_hdr->ip_hl * 4;
+    if (ip_hdr_len < sizeof(*ip_hdr) || ntohs(ip_hdr->ip_len) < ip_hdr_len)
+    {
+        logger(L_WARN, "ids_pcap_read_packet(): bad IP header length");
+        return -1;
+    }
+
+    // Link-layer padding after the IP packet is not part of the payload
+    *ip_end = l3 + ntohs(ip_hdr->ip_len);
+    if (*ip_end > cap_end) *ip_end = cap_end;
+    *l4 = l3 + ip_hdr_len;
+    *proto = ip_hdr->ip_p;
+
+    out->ip_version = 4;
+    out->dest_ip = ip_hdr->ip_dst.s_addr;
+    out->src_ip = ip_hdr->ip_src.s_addr;
+    ids_pcap_map_ipv4(&out->dest_addr, out->dest_ip);
+    ids_pcap_map_ipv4(&out->src_addr, out->src_ip);
+
+    off = ntohs(ip_hdr->ip_off);
+    if (!(off & (IP_OFFMASK | IP_MF))) return (1);
+
+    if (reasm && IPPROTO_UDP == *proto)
+        return (ids_pcap_reassemble(reasm, ip_hdr, off, out->timestamp, l4,
+                ip_end));
+
+    // Only the first fragment holds the transport header
+    return (off & IP_OFFMASK ? 0 : 1);
+}
+
+/**
+ * Read the addresses from an IPv6 header and find the transport header by
+ * walking at most #IDS_PCAP_MAX_IPV6_EXT_HDRS extension headers.
+ *
+ * The parameters and return value are those of ids_pcap_read_ipv4(), other
+ * than the reassembly cache.
+ */
+static int
+ids_pcap_read_ipv6(const uint8_t *l3, const uint8_t *cap_end,
+        struct ids_pcap_fields *out, const uint8_t **l4,
+        const uint8_t **ip_end, uint8_t *proto)
+{
+    const uint8_t *pos = l3 + IPV6_HDR_LEN;
+    unsigned int hdrs;
+    uint16_t payload_len;
+    uint8_t next;
+    size_t len;
+
+    if (cap_end - l3 < IPV6_HDR_LEN)
+    {
+        logger(L_WARN, "ids_pcap_read_packet(): pcap length too small to contain IPv6 header");
+        return -1;
+    }
+
+    // A length of zero is a jumbogram, which is bounded by the capture
+    payload_len = l3[4] << 8 | l3[5];
+    *ip_end = payload_len ? pos + payload_len : cap_end;
+    if (*ip_end > cap_end) *ip_end = cap_end;
+    next = l3[6];
+
+    out->ip_version = 6;
+    memcpy(out->src_addr.s6_addr, l3 + 8, sizeof(out->src_addr.s6_addr));
+    memcpy(out->dest_addr.s6_addr, l3 + 24, sizeof(out->dest_addr.s6_addr));
+
+    for (hdrs = 0; hdrs <= IDS_PCAP_MAX_IPV6_EXT_HDRS; hdrs++)
+    {
+        switch (next)
+        {
+        case IPPROTO_TCP:
+        case IPPROTO_UDP:
+            *l4 = pos;
+            *proto = next;
+            return (1);
+        case IPPROTO_HOPOPTS:
+        case IPPROTO_ROUTING:
+        case IPPROTO_DSTOPTS:
+            if (*ip_end - pos < 8) goto truncated;
+            len = (pos[1] + 1) * 8;
+            break;
+        case IPPROTO_FRAGMENT:
+            if (*ip_end - pos < 8) goto truncated;
+            // Only the first fragment holds the transport header
+            if ((pos[2] << 8 | pos[3]) & IPV6_FRAG_OFFMASK) return (0);
+            len = 8;
+            break;
+        case IPPROTO_AH:
+            if (*ip_end - pos < 8) goto truncated;
+            len = (pos[1] + 2) * 4;
+            break;
+        default:
+            // No next header, ESP or a protocol that is not of interest
+            return (0);
+        }
+
+        if (*ip_end - pos < (ptrdiff_t) len) goto truncated;
+        next = pos[0];
+        pos += len;
+    }
+
+    logger(L_DEBUG, "ids_pcap_read_packet(): more than %d IPv6 extension headers",
+            IDS_PCAP_MAX_IPV6_EXT_HDRS);
+    return (0);
+
+truncated:
+    logger(L_WARN, "ids_pcap_read_packet(): truncated IPv6 extension header");
+    return (-1);
+}
+
 int
 ids_pcap_read_packet(const struct pcap_pkthdr *pcap_hdr,
                      const unsigned char *pcap_data,
+                     link_decode_fn decode,
+                     ip_reasm *reasm,
                      struct ids_pcap_fields *out)
 {
-    struct ether_header *eth_hdr = NULL;
-    struct ip *ip_hdr = NULL;
+    struct link_frame frame;
     struct tcphdr *tcp_hdr = NULL;
     struct udphdr *udp_hdr = NULL;
-    struct dns_packet *dns_pkt = NULL;
+    const uint8_t *cap_end, *ip_end = NULL, *l4 = NULL;
+    uint8_t proto = 0;
+    int rc;
 
     uint8_t *payload_pos = NULL;
     /* Crash immediately during debugging if pcap_data is not a valid pointer */
     assert(pcap_data);
+    assert(decode);
     if (pcap_data)
     {
         if (!pcap_hdr)
@@ -125,97 +524,116 @@ ids_pcap_read_packet(const struct pcap_pkthdr *pcap_hdr,
             logger(L_WARN, "ids_pcap_read_packet(): pcap header was NULL");
             goto error;
         }
-        if (pcap_hdr->len < sizeof(*eth_hdr))
-        {
-            logger(L_WARN, "ids_pcap_read_packet(): pcap length too small to contain ethernet header: %d",
-                    pcap_hdr->len);
-            goto error;
-        }
-
-        // These are stored Most Significant Byte first
-        eth_hdr = (struct ether_header *)pcap_data;
-        out->src_mac = *(mac_addr *)eth_hdr->ether_shost;
-        out->dest_mac = *(mac_addr *)eth_hdr->ether_dhost;
 
-        /* Not an error if not IP but not interested in it. */
-        if (ntohs(eth_hdr->ether_type) != ETHERTYPE_IP) return (0);
+        out->timestamp = pcap_hdr->ts.tv_sec;
 
-        if (pcap_hdr->len < (sizeof(*eth_hdr) + sizeof(*ip_hdr)))
+        // Only the captured bytes may be read, which can be fewer than the
+        // length of the packet on the wire
+        cap_end = pcap_data + pcap_hdr->caplen;
+        memset(&frame, 0, sizeof(frame));
+        TRACE_BEGIN(TRACE_LINK);
+        rc = decode(pcap_data, pcap_hdr->caplen, &frame);
+        TRACE_END(TRACE_LINK);
+        if (0 != rc)
         {
-            logger(L_WARN, "ids_pcap_read_packet(): pcap length too small to contain IP header: %d\n",
-                    pcap_hdr->len);
+            logger(L_WARN, "ids_pcap_read_packet(): pcap length too small to contain link header: %d",
+                    pcap_hdr->caplen);
             goto error;
         }
-        ip_hdr = (struct ip *)(pcap_data + sizeof(*eth_hdr));
+        out->src_mac = frame.src_mac;
+        out->dest_mac = frame.dest_mac;
+
+        if (ETHERTYPE_IP == frame.ethertype)
+            rc = ids_pcap_read_ipv4(frame.l3, cap_end, reasm, out, &l4,
+                    &ip_end, &proto);
+        else if (ETHERTYPE_IPV6 == frame.ethertype)
+            rc = ids_pcap_read_ipv6(frame.l3, cap_end, out, &l4, &ip_end,
+                    &proto);
+        else
+            /* Not an error if not IP but not interested in it. */
+            return (0);
 
-        out->dest_ip = ip_hdr->ip_dst.s_addr;
-        out->src_ip = ip_hdr->ip_src.s_addr;
+        if (rc < 0) goto error;
+        if (rc == 0) return (0);
 
-        char s_ip[16];
-        char d_ip[16];
+        char s_ip[INET6_ADDRSTRLEN];
+        char d_ip[INET6_ADDRSTRLEN];
 
-        switch (ip_hdr->ip_p)
+        switch (proto)
         {
             case IPPROTO_TCP:
-                tcp_hdr = (struct tcphdr *)(pcap_data + sizeof(*eth_hdr) + sizeof(*ip_hdr));
+                if (ip_end - l4 < (ptrdiff_t) sizeof(*tcp_hdr))
+                {
+                    logger(L_WARN, "ids_pcap_read_packet(): pcap length too small to contain TCP header: %d",
+                            pcap_hdr->caplen);
+                    goto error;
+                }
+                tcp_hdr = (struct tcphdr *)l4;
                 
+                out->protocol = IPPROTO_TCP;
                 out->dest_port = tcp_hdr->th_dport;
                 out->src_port = tcp_hdr->th_sport;
-
-                snprintf(s_ip, sizeof(s_ip), "%s", inet_ntoa(ip_hdr->ip_src));
-                snprintf(d_ip, sizeof(d_ip), "%s", inet_ntoa(ip_hdr->ip_dst));
+                out->tcp_flags = tcp_hdr->th_flags;
+                out->tcp_seq = ntohl(tcp_hdr->th_seq);
 
                 logger(L_INFO, "ids_pcap_read_packet(): TCP %s:%d -> %s:%d",
-                       s_ip, ntohs(tcp_hdr->th_sport),
-                       d_ip, ntohs(tcp_hdr->th_dport));
-
-                /* Check header is correct */
-                assert((tcp_hdr->th_flags & TH_SYN) && !(tcp_hdr->th_flags & TH_ACK));
+                       ids_pcap_addr_str(&out->src_addr, s_ip),
+                       ntohs(tcp_hdr->th_sport),
+                       ids_pcap_addr_str(&out->dest_addr, d_ip),
+                       ntohs(tcp_hdr->th_dport));
+
+                // Segments of DNS connections are captured as well as SYNs
+                payload_pos = (uint8_t *)tcp_hdr + tcp_hdr->th_off * 4;
+                if (tcp_hdr->th_off < 5 || payload_pos > ip_end)
+                {
+                    logger(L_WARN, "ids_pcap_read_packet(): bad TCP header length");
+                    goto error;
+                }
+                out->payload = payload_pos;
+                out->payload_len = ip_end - payload_pos;
 
-                out->domain = NULL;
+                out->domain[0] = '\0';
                 break;
             case IPPROTO_UDP:
-                udp_hdr = (struct udphdr *)(pcap_data + (sizeof(*eth_hdr) + sizeof(*ip_hdr)));
+                if (ip_end - l4 <= (ptrdiff_t) sizeof(*udp_hdr)) goto error;
+                udp_hdr = (struct udphdr *)l4;
+                out->protocol = IPPROTO_UDP;
                 out->dest_port = udp_hdr->uh_dport;
                 out->src_port = udp_hdr->uh_sport;
 
-                snprintf(s_ip, sizeof(s_ip), "%s", inet_ntoa(ip_hdr->ip_src));
-                snprintf(d_ip, sizeof(d_ip), "%s", inet_ntoa(ip_hdr->ip_dst));
-
-                logger(L_INFO, "ids_pcap_read_packet(): TCP %s:%d -> %s:%d",
-                       s_ip, ntohs(udp_hdr->uh_sport),
-                       d_ip, ntohs(udp_hdr->uh_dport));
-
-                payload_pos = (uint8_t *)(pcap_data + (sizeof(*eth_hdr) + sizeof(*ip_hdr) + sizeof(*udp_hdr)));
+                logger(L_INFO, "ids_pcap_read_packet(): UDP %s:%d -> %s:%d",
+                       ids_pcap_addr_str(&out->src_addr, s_ip),
+                       ntohs(udp_hdr->uh_sport),
+                       ids_pcap_addr_str(&out->dest_addr, d_ip),
+                       ntohs(udp_hdr->uh_dport));
 
-                uint8_t *payload_end = (uint8_t *) payload_pos + (pcap_hdr->len - (sizeof(*eth_hdr) + sizeof(*ip_hdr) + sizeof(*udp_hdr)));
-                if (payload_pos >= payload_end) goto error;
-                dns_pkt = dns_parse(payload_pos, payload_end);
+                payload_pos = (uint8_t *)udp_hdr + sizeof(*udp_hdr);
 
-                if (!dns_pkt)
+                if (htons(QUIC_PORT) == out->dest_port)
                 {
-                    logger(L_WARN,
-                        "ids_pcap_read_packet(): dns_parse() failed");
-                    goto error;
+                    // QUIC is parsed by the packet handler
+                    out->payload = payload_pos;
+                    out->payload_len = ip_end - payload_pos;
+                    out->domain[0] = '\0';
+                    break;
                 }
 
-                /* Check if this is a query */
-                if (dns_pkt->header.qdcount)
+                // Names are decoded when the blacklist is checked, so that
+                // only one pass is made over the message
+                if (0 != dns_view_init(&out->dns, payload_pos, ip_end))
                 {
-                    /* TODO: Check multiple questions */
-                    out->domain = dns_name_to_readable((unsigned char *)
-                            dns_pkt->questions->qname);
-                    logger(L_DEBUG, "ids_pcap_read_packet(): domain %s",
-                           out->domain);
+                    logger(L_WARN,
+                        "ids_pcap_read_packet(): dns_view_init() failed");
+                    goto error;
                 }
-
-                free_dns_packet(&dns_pkt);
+                out->has_dns = 1;
+                out->domain[0] = '\0';
                 break;
             default:
                 /* This shouldn't happen */
                 logger(L_ERROR,
                        "ids_pcap_read_packet(): captured packet with protocol %d",
-                       ip_hdr->ip_p);
+                       proto);
                 goto error;
         }
     }
@@ -223,39 +641,251 @@ ids_pcap_read_packet(const struct pcap_pkthdr *pcap_hdr,
     return (1);
 
 error:
-    free_dns_packet(&dns_pkt);
+    out->has_dns = 0;
+    out->domain[0] = '\0';
     return (-1);
 }
 
+/**
+ * Look up a domain name in the blacklist, counting the lookup.
+ */
+static inline const ids_ioc_value_t *
+ids_pcap_lookup_domain(domain_blacklist *dn_bl, const char *name)
+{
+    const ids_ioc_value_t *value = domain_blacklist_is_blacklisted(dn_bl, name);
+
+    metrics_inc(METRICS_LOOKUPS_DOMAIN);
+    if (value) metrics_inc(METRICS_HITS_DOMAIN);
+    return value;
+}
+
+/**
+ * Check a name from a DNS message against the blacklist.
+ *
+ * @param name_buf The buffer to decode the name into, of #DNS_NAME_BUF_LEN
+ * bytes
+ * @return The value associated with the name if it is blacklisted, otherwise
+ * NULL
+ */
+static const ids_ioc_value_t *
+ids_pcap_check_dns_name(const struct ids_pcap_fields *f,
+        domain_blacklist *dn_bl, const uint8_t *name, char *name_buf)
+{
+    int rc;
+
+    TRACE_BEGIN(TRACE_DNS_NAME);
+    rc = dns_view_name(&f->dns, name, name_buf, DNS_NAME_BUF_LEN);
+    TRACE_END(TRACE_DNS_NAME);
+    if (0 > rc)
+    {
+        logger(L_DEBUG, "ids_pcap_check_dns_name(): malformed name");
+        metrics_inc(METRICS_PARSE_ERRORS_DNS);
+        return NULL;
+    }
+
+    return ids_pcap_lookup_domain(dn_bl, name_buf);
+}
+
+/**
+ * Check the names in a DNS query against the blacklist.
+ */
+static const ids_ioc_value_t *
+ids_pcap_check_dns_query(struct ids_pcap_fields *f, domain_blacklist *dn_bl)
+{
+    const ids_ioc_value_t *value;
+    struct dns_view_iter it;
+    struct dns_question_view qn;
+    unsigned int names = 0;
+    int rc;
+
+    dns_view_iter_init(&f->dns, &it);
+    while (1 == (rc = dns_view_next_question(&it, &qn)))
+    {
+        if (++names > IDS_PCAP_MAX_DNS_NAMES) goto budget;
+        if ((value = ids_pcap_check_dns_name(f, dn_bl, qn.name, f->domain)))
+        {
+            f->rrtype = qn.qtype;
+            return value;
+        }
+    }
+
+    if (rc < 0)
+    {
+        logger(L_DEBUG, "ids_pcap_check_dns_query(): malformed message");
+        metrics_inc(METRICS_PARSE_ERRORS_DNS);
+    }
+    f->domain[0] = '\0';
+    return NULL;
+
+budget:
+    logger(L_DEBUG, "ids_pcap_check_dns_query(): more than %d names",
+            IDS_PCAP_MAX_DNS_NAMES);
+    f->domain[0] = '\0';
+    return NULL;
+}
+
+/**
+ * Check the names in a DNS response against the blacklist and add the
+ * addresses that blacklisted names resolve to to the watchlist, in a single
+ * pass over the message.
+ */
+static const ids_ioc_value_t *
+ids_pcap_check_dns_response(struct ids_pcap_fields *f,
+        domain_blacklist *dn_bl, ip_watchlist *ip_wl)
+{
+    const ids_ioc_value_t *hit = NULL, *value, *resolving = NULL;
+    char name[DNS_NAME_BUF_LEN];
+    struct dns_view_iter it;
+    struct dns_question_view qn;
+    struct dns_rr_view rr;
+    unsigned int names = 0;
+    struct in6_addr addr;
+    uint32_t addr4;
+    int rc;
+
+    f->domain[0] = '\0';
+    dns_view_iter_init(&f->dns, &it);
+
+    // The question was checked when the query was seen, so a blacklisted
+    // question only decides whether the answers are watched
+    if (ip_wl && 1 == dns_view_next_question(&it, &qn))
+    {
+        names++;
+        resolving = ids_pcap_check_dns_name(f, dn_bl, qn.name, name);
+    }
+
+    while (1 == (rc = dns_view_next_record(&it, &rr)))
+    {
+        // Glue in the additional section does not reveal the target
+        if (DNS_SECTION_ADDITIONAL == rr.section) break;
+
+        if (A == rr.type && 4 == rr.rdlength)
+        {
+            if (resolving)
+            {
+                memcpy(&addr4, rr.rdata, sizeof(addr4));
+                ids_pcap_map_ipv4(&addr, addr4);
+                ip_watchlist_add(ip_wl, &addr, rr.ttl, resolving, f->timestamp);
+            }
+            continue;
+        }
+        if (AAAA == rr.type && 16 == rr.rdlength)
+        {
+            if (resolving)
+            {
+                memcpy(&addr, rr.rdata, sizeof(addr));
+                ip_watchlist_add(ip_wl, &addr, rr.ttl, resolving, f->timestamp);
+            }
+            continue;
+        }
+
+        if (CNAME != rr.type && NS != rr.type && PTR != rr.type) continue;
+        if (!rr.rdlength) continue;
+        if (++names > IDS_PCAP_MAX_DNS_NAMES)
+        {
+            logger(L_DEBUG, "ids_pcap_check_dns_response(): more than %d names",
+                    IDS_PCAP_MAX_DNS_NAMES);
+            break;
+        }
+
+        if (!(value = ids_pcap_check_dns_name(f, dn_bl, rr.rdata, name)))
+            continue;
+
+        // Report the first blacklisted target, but keep going to find the
+        // addresses it resolves to
+        if (!hit)
+        {
+            hit = value;
+            f->rrtype = rr.type;
+            memcpy(f->domain, name, sizeof(f->domain));
+        }
+        if (CNAME == rr.type && !resolving) resolving = value;
+    }
+
+    if (rc < 0)
+    {
+        logger(L_DEBUG, "ids_pcap_check_dns_response(): malformed message");
+        metrics_inc(METRICS_PARSE_ERRORS_DNS);
+    }
+
+    return hit;
+}
+
 const ids_ioc_value_t *
-ids_pcap_is_blacklisted(struct ids_pcap_fields *f, ip_blacklist *ip_bl, domain_blacklist *dn_bl)
+ids_pcap_is_blacklisted(struct ids_pcap_fields *f, ip_blacklist *ip_bl,
+        ip6_blacklist *ip6_bl, domain_blacklist *dn_bl, ip_watchlist *ip_wl)
 {
-    struct in_addr src_ip_buf, dst_ip_buf;
-    src_ip_buf.s_addr = f->src_ip;
-    dst_ip_buf.s_addr = f->dest_ip;
+    char src[INET6_ADDRSTRLEN], dest[INET6_ADDRSTRLEN];
 
-    char *src = strdup(inet_ntoa(src_ip_buf));
+    logger(L_DEBUG, "%s -> %s", ids_pcap_addr_str(&f->src_addr, src),
+            ids_pcap_addr_str(&f->dest_addr, dest));
 
-    /* Can only have one inet_ntoa call per line because it will over-write the buffer */
-    logger(L_DEBUG, "%s -> %s: %s ", src, inet_ntoa(dst_ip_buf), f->domain);
-    free(src);
+    if (ip_wl) ip_watchlist_advance(ip_wl, f->timestamp);
 
-    if (f->domain)
+    if (f->has_sni)
     {
-        return (domain_blacklist_is_blacklisted(dn_bl, f->domain));
+        const ids_ioc_value_t *value =
+            ids_pcap_lookup_domain(dn_bl, f->domain);
+
+        if (!value) f->domain[0] = '\0';
+        return value;
     }
-    else
+    else if (f->has_dns)
     {
-        const ip_key_value_t *ip_value =
-            ip_blacklist_lookup(ip_bl, f->dest_ip, f->dest_port);
+        if (f->dns.header.qr)
+            return (ids_pcap_check_dns_response(f, dn_bl, ip_wl));
+        else
+            return (ids_pcap_check_dns_query(f, dn_bl));
+    }
+    else if (IPPROTO_TCP == f->protocol
+            && (f->tcp_flags & TH_SYN) && !(f->tcp_flags & TH_ACK))
+    {
+        const ids_ioc_value_t *value;
 
-        if (ip_value) {
-            return &(ip_value->value);
+        if (6 == f->ip_version)
+        {
+            if (ip6_bl)
+            {
+                metrics_inc(METRICS_LOOKUPS_IP6);
+                TRACE_BEGIN(TRACE_IP_LOOKUP);
+                value = ip6_blacklist_lookup(ip6_bl, &f->dest_addr);
+                TRACE_END(TRACE_IP_LOOKUP);
+                if (value)
+                {
+                    metrics_inc(METRICS_HITS_IP6);
+                    return value;
+                }
+            }
         }
         else
         {
-            return NULL;
+            metrics_inc(METRICS_LOOKUPS_IP);
+            TRACE_BEGIN(TRACE_IP_LOOKUP);
+            const ip_key_value_t *ip_value =
+                ip_blacklist_lookup(ip_bl, f->dest_ip, f->dest_port);
+            TRACE_END(TRACE_IP_LOOKUP);
+
+            if (ip_value) {
+                metrics_inc(METRICS_HITS_IP);
+                return &(ip_value->value);
+            }
         }
+
+        if (!ip_wl) return NULL;
+
+        // Connections to addresses that blacklisted domains resolved to
+        metrics_inc(METRICS_LOOKUPS_WATCHLIST);
+        TRACE_BEGIN(TRACE_IP_LOOKUP);
+        value = ip_watchlist_lookup(ip_wl, &f->dest_addr, f->timestamp);
+        TRACE_END(TRACE_IP_LOOKUP);
+        if (value) metrics_inc(METRICS_HITS_WATCHLIST);
+        return value;
+    }
+    else
+    {
+        // Only the SYN of a connection is checked, so that it is reported
+        // once
+        return NULL;
     }
 }
 
@@ -287,6 +917,44 @@ done:
     return rc;
 }
 
+/**
+ * Set \p filter on \p pcap, extended to the frames of its link type that
+ * carry VLAN tags.
+ *
+ * libpcap only accepts the vlan keyword on some link types, so the clauses
+ * are added for Ethernet alone. They match one or two tags, as many as
+ * link_decode_ethernet() skips. The second clause is nested within the first
+ * because older versions of libpcap keep the offset that a vlan keyword adds
+ * for the rest of the expression.
+ */
+static int
+set_link_filter(pcap_t *pcap, const char *filter, char *err)
+{
+    char *vlan_filter;
+    size_t len;
+    int rc;
+
+    if (DLT_EN10MB != pcap_datalink(pcap))
+        return set_filter(pcap, filter, err);
+
+    len = 3 * strlen(filter) + 64;
+    if (NULL == (vlan_filter = malloc(len)))
+    {
+        logger(L_ERROR, "Could not allocate pcap filter");
+        return NSIDS_PCAP;
+    }
+    snprintf(vlan_filter, len, "(%s) or (vlan and ((%s) or (vlan and (%s))))",
+            filter, filter, filter);
+    rc = set_filter(pcap, vlan_filter, err);
+    free(vlan_filter);
+    return rc;
+}
+
+/**
+ * Passed to packet_handler() by pcap_data_cb(). Set up by setup_pcap_handle().
+ */
+static struct ids_pcap_user pcap_user;
+
 /**
  * Called when an event occurs on the pcap file descriptor.
  * @param handle The handle of the libuv poll handle.
@@ -309,7 +977,8 @@ static void pcap_data_cb(uv_poll_t *handle, int status, int events)
         // If we are here, the fd is ready to read
         // cnt = 0 or -1 means read all packets (but -1 will work with older
         // versions of pcap, where 0 does not)
-        pkt_num = pcap_dispatch(pcap, cnt, packet_handler, NULL);
+        pkt_num = pcap_dispatch(pcap, cnt, packet_handler,
+                (unsigned char *)&pcap_user);
 
         if (pkt_num == PCAP_ERROR) {
             logger(L_ERROR, "Error processing packet: %s",
@@ -332,6 +1001,14 @@ int setup_pcap_handle(uv_loop_t *loop, uv_poll_t *pcap_handle, pcap_t *pcap)
 
     if (PCAP_ERROR == (fd = pcap_get_selectable_fd(pcap))) return NSIDS_PCAP;
 
+    // The link type cannot change, so choose the decoder once
+    if (NULL == (pcap_user.decode = link_decoder_for(pcap_datalink(pcap))))
+    {
+        logger(L_ERROR, "Unsupported link type: %s",
+                pcap_datalink_val_to_name(pcap_datalink(pcap)));
+        return NSIDS_PCAP;
+    }
+
     if (0 > (uv_rc = uv_poll_init(loop, pcap_handle, fd)))
     {
         logger(L_ERROR, "Failed to setup pcap event loop handle: %s",
@@ -351,6 +1028,100 @@ int setup_pcap_handle(uv_loop_t *loop, uv_poll_t *pcap_handle, pcap_t *pcap)
     return NSIDS_OK;
 }
 
+/**
+ * Called each time the event loop is idle while a file is replayed.
+ */
+static void pcap_replay_cb(uv_idle_t *handle)
+{
+    struct ids_pcap_replay *replay = handle->data;
+    int pkt_num;
+
+    pkt_num = pcap_dispatch(replay->pcap, IDS_PCAP_REPLAY_BATCH,
+            packet_handler, (unsigned char *)&pcap_user);
+
+    if (pkt_num > 0)
+    {
+        replay->packets += pkt_num;
+        return;
+    }
+
+    // A file has no more packets when nothing could be read from it
+    if (pkt_num == PCAP_ERROR)
+        logger(L_ERROR, "Error replaying packets: %s",
+                pcap_geterr(replay->pcap));
+
+    replay->end = uv_hrtime();
+    uv_idle_stop(handle);
+    uv_stop(handle->loop);
+}
+
+int setup_pcap_replay(uv_loop_t *loop, struct ids_pcap_replay *replay,
+        pcap_t *pcap)
+{
+    assert(loop);
+    assert(replay);
+    assert(pcap);
+
+    int uv_rc;
+
+    memset(replay, 0, sizeof(*replay));
+    replay->pcap = pcap;
+
+    if (NULL == (pcap_user.decode = link_decoder_for(pcap_datalink(pcap))))
+    {
+        logger(L_ERROR, "Unsupported link type: %s",
+                pcap_datalink_val_to_name(pcap_datalink(pcap)));
+        return NSIDS_PCAP;
+    }
+
+    if (0 > (uv_rc = uv_idle_init(loop, &replay->handle)))
+    {
+        logger(L_ERROR, "Failed to setup replay handle: %s",
+                uv_strerror(uv_rc));
+        return NSIDS_UV;
+    }
+
+    replay->handle.data = replay;
+    replay->start = uv_hrtime();
+
+    if (0 > (uv_rc = uv_idle_start(&replay->handle, pcap_replay_cb)))
+    {
+        logger(L_ERROR, "Failed to setup replay handle: %s",
+                uv_strerror(uv_rc));
+        return NSIDS_UV;
+    }
+
+    return NSIDS_OK;
+}
+
+int configure_pcap_replay(pcap_t **pcap, const char *filter, const char *path)
+{
+    assert(pcap);
+    assert(filter);
+    assert(path);
+
+    char errbuf[PCAP_ERRBUF_SIZE];
+
+    if (NULL == (*pcap = pcap_open_offline(path, errbuf))) {
+        logger(L_ERROR, "Can't open %s: %s", path, errbuf);
+        goto error;
+    }
+    if (NULL == link_decoder_for(pcap_datalink(*pcap))) {
+        logger(L_ERROR, "Unsupported link type in %s: %s", path,
+                pcap_datalink_val_to_name(pcap_datalink(*pcap)));
+        goto error;
+    }
+    if (set_link_filter(*pcap, filter, errbuf) != 0) {
+        goto error;
+    }
+
+    return NSIDS_OK;
+error:
+    if (*pcap) pcap_close(*pcap);
+    *pcap = NULL;
+    return NSIDS_PCAP;
+}
+
 int configure_pcap(pcap_t **pcap, const char *filter, const char *dev)
 {
     // None of the arguments should be NULL
@@ -388,7 +1159,12 @@ int configure_pcap(pcap_t **pcap, const char *filter, const char *dev)
             goto error;
         }
     }
-    if (set_filter(*pcap, filter, errbuf) != 0) {
+    if (NULL == link_decoder_for(pcap_datalink(*pcap))) {
+        logger(L_ERROR, "Unsupported link type on %s: %s", dev,
+                pcap_datalink_val_to_name(pcap_datalink(*pcap)));
+        goto error;
+    }
+    if (set_link_filter(*pcap, filter, errbuf) != 0) {
         goto error;
     }
 
@@ -20,17 +20,32 @@
 #include <uv.h>
 
 #include "common.h"
+#include "dns_view.h"
 #include "ids_event_list.h"
+#include "ip_reasm.h"
+#include "link_layer.h"
+#include "tcp_dns.h"
+#include "quic_initial.h"
+#include "tls_sni.h"
 #include "blacklist/domain_blacklist.h"
 #include "blacklist/ip_blacklist.h"
+#include "blacklist/ip6_blacklist.h"
+#include "blacklist/ip_watchlist.h"
 
 /** Packet fields relevant to IoC detection */
 struct ids_pcap_fields
 {
-    /** IPv4 source address */
+    /** IPv4 source address, or 0 for an IPv6 packet */
     uint32_t src_ip;
-    /** IPv4 destination address */
+    /** IPv4 destination address, or 0 for an IPv6 packet */
     uint32_t dest_ip;
+    /** The IP version of the packet: 4 or 6 */
+    uint8_t ip_version;
+    /** The source address. IPv4 addresses are stored as IPv4-mapped IPv6
+     * addresses. */
+    struct in6_addr src_addr;
+    /** The destination address, stored in the same way as #src_addr */
+    struct in6_addr dest_addr;
     /** MAC address of the source device */
     mac_addr src_mac;
     /** MAC address of the destination device */
@@ -39,16 +54,42 @@ struct ids_pcap_fields
     uint16_t src_port;
     /** TCP/UDP port of the destination */
     uint16_t dest_port;
-    /** The domain name of the DNS query (if applicable, otherwise NULL) */
-    char *domain;
+    /** The blacklisted domain name found by ids_pcap_is_blacklisted(), the
+     * server name of a TLS ClientHello if #has_sni is set, or an empty
+     * string */
+    char domain[DNS_NAME_BUF_LEN];
+    /** The type of record that #domain was found in: the QTYPE of a question,
+     * or CNAME, NS or PTR for the target of a record in a response */
+    uint16_t rrtype;
+    /** Non-zero if the packet contains a DNS message */
+    int has_dns;
+    /** A view of the DNS message. Only valid while the packet is handled. */
+    struct dns_view dns;
     /** Interface name of the generating interface (currently not set) */
     char *iface;
+    /** The capture time of the packet, in seconds */
+    uint32_t timestamp;
+    /** The IP protocol of the packet: IPPROTO_TCP or IPPROTO_UDP */
+    uint8_t protocol;
+    /** The flags of a TCP header */
+    uint8_t tcp_flags;
+    /** The sequence number of a TCP segment, in host byte order */
+    uint32_t tcp_seq;
+    /** The payload of a TCP segment or of a UDP datagram that does not
+     * hold a DNS message. Only valid while the packet is handled. */
+    const uint8_t *payload;
+    /** The length of #payload */
+    size_t payload_len;
+    /** Non-zero if #domain holds the server name of a TLS or QUIC
+     * ClientHello */
+    int has_sni;
 };
 
 /**
  * @brief Configure a pcap context with a filter on a network interface
  *
  * Create and activate a pcap on \p dev then set the filter to \p filter .
+ * On Ethernet the filter is also applied within one or two VLAN tags.
  * Also get a `selectable' file descriptor such that reads from pcap can be
  * done asynchronously.
  *
@@ -62,6 +103,58 @@ struct ids_pcap_fields
 int
 configure_pcap(pcap_t **pcap, const char *filter, const char *dev);
 
+/**
+ * @brief Open a capture file to replay through the packet handler
+ *
+ * The file is read as fast as the packet handler allows rather than at the
+ * rate it was captured, so that the throughput of the whole pipeline can be
+ * measured. \p filter is applied as it would be to a live capture, including
+ * within VLAN tags on Ethernet.
+ *
+ * @param[out] pcap Set to the opened handle
+ * @param filter The BPF to apply to the packets in the file
+ * @param path The path of a pcap or pcapng file
+ * @return #NSIDS_OK on success or #NSIDS_PCAP on error
+ */
+int
+configure_pcap_replay(pcap_t **pcap, const char *filter, const char *path);
+
+/** The most packets handled in one iteration of the event loop while
+ * replaying a file, so that other handles still get a chance to run */
+#define IDS_PCAP_REPLAY_BATCH 256
+
+/**
+ * The progress of a replay started by setup_pcap_replay()
+ */
+struct ids_pcap_replay
+{
+    /** Reads the next batch of packets each time the loop is idle */
+    uv_idle_t handle;
+    pcap_t *pcap;
+    /** The number of packets that passed the filter and were handled */
+    uint64_t packets;
+    /** uv_hrtime() when the replay started */
+    uint64_t start;
+    /** uv_hrtime() when the end of the file was reached, or 0 if it has not
+     * been reached yet */
+    uint64_t end;
+};
+
+/**
+ * @brief Replay the packets of a file opened by configure_pcap_replay()
+ *
+ * The event loop is stopped once the end of the file is reached.
+ *
+ * @param loop The event loop to replay the file on
+ * @param replay An uninitialized structure to track the replay with. Must
+ * remain valid until its handle is closed.
+ * @param pcap The handle of the file
+ * @return #NSIDS_OK on success, #NSIDS_PCAP or #NSIDS_UV on error
+ */
+int
+setup_pcap_replay(uv_loop_t *loop, struct ids_pcap_replay *replay,
+        pcap_t *pcap);
+
 /**
  * @brief Add a uv_poll_t task to the event loop to read from pcap
  *
@@ -79,18 +172,44 @@ int
 setup_pcap_handle(uv_loop_t *loop, uv_poll_t *pcap_handle, pcap_t *pcap);
 
 /**
- * Checks the domain name blacklist if a domain name is present in F, otherwise
- * checks the IP address blacklist.
+ * The maximum number of IPv6 extension headers skipped to find the transport
+ * header. Packets with more are ignored.
+ */
+#define IDS_PCAP_MAX_IPV6_EXT_HDRS 8
+
+/**
+ * The maximum number of names checked in a single DNS message. This bounds
+ * the work done for a packet however many records it claims to contain.
+ */
+#define IDS_PCAP_MAX_DNS_NAMES 16
+
+/**
+ * Checks the domain name blacklist if F contains a DNS message or the server
+ * name of a TLS ClientHello, otherwise checks the IP address blacklist if F
+ * is the SYN that starts a TCP connection.
+ *
+ * For a DNS query, every name in the question section is checked. For a DNS
+ * response, the targets of CNAME, NS and PTR records in the answer and
+ * authority sections are checked; the question names were checked when the
+ * query was seen. The first blacklisted name is stored in the DOMAIN
+ * attribute of F and the type of record it came from in the RRTYPE attribute.
+ *
+ * If the question or a CNAME target of a response is blacklisted, the
+ * addresses in its A and AAAA records are added to \p ip_wl so that
+ * connections to them are detected. Other IPv4 packets are checked against
+ * \p ip_bl and \p ip_wl, and IPv6 packets against \p ip6_bl and \p ip_wl.
  *
  * @param f The relevant fields from a packet capture
  * @param ip_bl The #ip_blacklist structure to check
+ * @param ip6_bl The #ip6_blacklist structure to check, or NULL
  * @param dn_bl The #domain_blacklist structure to check
+ * @param ip_wl The #ip_watchlist to check and add addresses to, or NULL
  * @return Address of the value associated with the IOC if the IOC is in the
  * blacklist, otherwise NULL
  */
 const ids_ioc_value_t *
 ids_pcap_is_blacklisted(struct ids_pcap_fields *f, ip_blacklist *ip_bl,
-        domain_blacklist *dn_bl);
+        ip6_blacklist *ip6_bl, domain_blacklist *dn_bl, ip_watchlist *ip_wl);
 
 /**
  * @brief Attempt to compile and set \p filter on the context \p pcap
@@ -104,13 +223,24 @@ set_filter(pcap_t *pcap, const char *filter, char *err);
 
 /**
  * Puts fields from the incoming packet into an ids_pcap_fields structure. If
- * the packet was a DNS query, the query will be in the DOMAIN attribute.
+ * the packet contains a DNS message, a view of it is stored in the DNS
+ * attribute; its names are not decoded until ids_pcap_is_blacklisted().
  *
  * This does not change the IFACE attribute.
  * @param pcap_hdr The libpcap header of the read packet
  * @param pcap_data The data payload (including protocol headers) of the packet
+ * @param decode The decoder for the link type of the capture
+ * @param reasm The cache that fragments of IPv4 DNS datagrams are
+ * reassembled in, or NULL to only read the first fragment of a datagram
  * @param out Pointer to a struct that will be populated with fields relating
  *            to the IDS status of this packet (listed or not)
+ * Both IPv4 and IPv6 packets are read. The extension headers of an IPv6
+ * packet are skipped, up to #IDS_PCAP_MAX_IPV6_EXT_HDRS of them.
+ *
+ * A TCP segment's payload is stored in the PAYLOAD attribute rather than
+ * being parsed, as a DNS message may span several segments. So is the
+ * payload of a UDP datagram sent to the QUIC port.
+ *
  * @return 1 if reading was successful and the packet was one that we are
  * interested in, 0 if packet was not one we are interested in, -1 if there
  * was an error
@@ -118,10 +248,35 @@ set_filter(pcap_t *pcap, const char *filter, char *err);
 int
 ids_pcap_read_packet(const struct pcap_pkthdr *pcap_hdr,
                      const unsigned char *pcap_data,
+                     link_decode_fn decode,
+                     ip_reasm *reasm,
                      struct ids_pcap_fields *out);
 
+/**
+ * The user data passed to packet_handler()
+ */
+struct ids_pcap_user
+{
+    /** The decoder for the link type of the capture */
+    link_decode_fn decode;
+};
+
 /**
  * Packet handler callback for libpcap.
+ *
+ * \p user_dat points to an #ids_pcap_user, or is NULL for Ethernet.
+ *
+ * Fragments of IPv4 DNS datagrams are reassembled in the global #ip_reasm
+ * cache, and the datagram is checked once it is complete.
+ *
+ * TCP segments to or from port 53 are passed to the global #tcp_dns_tracker,
+ * and each DNS message they complete is checked in the same way as a DNS
+ * message carried over UDP.
+ *
+ * The SYN of each connection to port 443 is recorded in the global
+ * #tls_sni_table, and the server name is extracted from the first segment
+ * of the connection that carries data. The server name is also extracted
+ * from the first QUIC Initial packet of each UDP flow to port 443.
  */
 void
 packet_handler(unsigned char *user_dat,
@@ -13,308 +13,811 @@
 #include <string.h>
 
 #include "utils/logging.h"
+#include "ids_event_format.h"
 #include "ids_server.h"
+#include "ids_server_request.h"
 #include "error/ids_error.h"
 
 /** The maximum number of concurrent connections to the server */
 #define MAX_CONNS 128
 
-static char *fmt_ioc = "IOC: %s\n";
-static char *fmt_timestamp = "Timestamp: %11lu\n";
-static char *fmt_event_count = "Occurrences: %d\n";
-static char *fmt_iface = "Interface: %s\n";
-static char *fmt_src_ip = "Src-IP: %s\n";
-static char *fmt_src_mac = "Src-MAC: %02X-%02X-%02X-%02X-%02X-%02X\n\n";
+/** The maximum length of a request line sent by a client */
+#define EVS_REQ_MAX 64
 
 /**
- * A datatype to store the location of buffers used by uv_write. This should be
- * initialized and stored in the 'data' field of a write request so that the
- * write callback can free the buffers.
+ * How long to wait for a request line before assuming the client uses the
+ * original protocol and sending the full event list (in milliseconds)
  */
-typedef struct evs_usr_data_s
+#define EVS_REQ_TIMEOUT_MS 250
+
+/** How often clients awaiting a request are checked for timeouts */
+#define EVS_REQ_POLL_MS 50
+
+/**
+ * The maximum number of bytes that may be waiting to be written to a
+ * subscriber. Events pushed to a subscriber with a full queue are dropped.
+ */
+#define EVS_SUB_QUEUE_MAX (64 * 1024)
+
+/**
+ * A reference-counted buffer that is written to many clients. It is freed
+ * when the last write using it has completed.
+ */
+typedef struct evs_shared_buf_s
 {
-    /** Pointer to the array of buffers */
-    uv_buf_t *bufs;
-    /** The number of buffers in #bufs */
-    unsigned int nbufs;
-} evs_usr_data_t;
+    /** The number of references held to this buffer */
+    unsigned int refs;
+    /** The number of bytes in #data */
+    size_t len;
+    /** The contents of the buffer */
+    char data[];
+} evs_shared_buf_t;
+
+/**
+ * A client connection to the event server.
+ *
+ * The TCP handle must be the first member so that the handle passed to libuv
+ * callbacks can be cast back to the client.
+ */
+typedef struct evs_client_s
+{
+    /** The TCP connection to the client */
+    uv_tcp_t tcp;
+    /** The list of events being served */
+    struct ids_event_list *list;
+    /** The time that the connection was accepted, from uv_now() */
+    uint64_t accepted_at;
+    /** Buffer holding the (partial) request line received so far */
+    char req[EVS_REQ_MAX];
+    /** The number of bytes in #req */
+    size_t req_len;
+    /** Non-zero once a response has been started */
+    int responded;
+    /** Non-zero if new events are pushed to this client as they occur */
+    int subscribed;
+    /** The format that the client requested */
+    ids_event_format_t format;
+    /** The number of bytes of pushed events not yet written to the socket */
+    size_t queued;
+    /** The number of events dropped because the queue was full */
+    unsigned long dropped;
+    /** The number of dropped events not yet reported to the client */
+    unsigned long dropped_unreported;
+    /** Previous client in the pending or subscriber list */
+    struct evs_client_s *prev;
+    /** Next client in the pending or subscriber list */
+    struct evs_client_s *next;
+    /** The response to the request, which is sent with a single write. Grown
+     * as required and freed when the client is closed. */
+    char *out;
+    /** The number of bytes allocated for #out */
+    size_t out_cap;
+    /** The snapshot being written to the client, or NULL. A reference is held
+     * until the client is closed. */
+    evs_shared_buf_t *snapshot;
+    /** Writes the response to the client */
+    uv_write_t write_req;
+    /** Shuts down the connection once the response has been written */
+    uv_shutdown_t shutdown_req;
+} evs_client_t;
+
+/**
+ * The location of an event within the serialized snapshot
+ */
+typedef struct evs_snapshot_entry_s
+{
+    /** The sequence number of the event */
+    uint64_t seq;
+    /** The offset of the first byte after the event */
+    size_t end;
+} evs_snapshot_entry_t;
+
+/**
+ * The event list serialized in one of the formats
+ */
+typedef struct evs_snapshot_s
+{
+    /** The serialized list, or NULL if the list has changed since it was
+     * last serialized */
+    evs_shared_buf_t *buf;
+    /** The sequence number of the list when #buf was serialized */
+    uint64_t seq;
+    /** The sequence number and end offset of each event in #buf */
+    evs_snapshot_entry_t *index;
+    /** The number of entries in #index that are in use */
+    size_t events;
+    /** The number of entries allocated for #index */
+    size_t index_cap;
+} evs_snapshot_t;
+
+/**
+ * State shared by all connections to the event server
+ */
+typedef struct evs_server_s
+{
+    /** The list of events to send to clients */
+    struct ids_event_list *list;
+    /** Periodically checks whether #pending clients have timed out */
+    uv_timer_t req_timer;
+    /** Clients that have connected but not yet sent a request line */
+    evs_client_t *pending;
+    /** Clients that are sent new events as they occur */
+    evs_client_t *subscribers;
+    /** The total number of events dropped for slow subscribers */
+    unsigned long long dropped;
+    /** The event list serialized in each format that has been requested */
+    evs_snapshot_t snapshots[IDS_EVENT_FORMAT_COUNT];
+} evs_server_t;
+
+static evs_server_t evs_server;
 
-void ids_server_write_cb(uv_write_t *req, int status);
 static void on_client_close(uv_handle_t *handle);
 
 /**
- * Bundle the write buffers into a single data structure. Copies all uv_buf_t
- * in case they were allocated on the stack.
+ * Allocate a shared buffer with space for \p size bytes, holding a single
+ * reference.
+ */
+static evs_shared_buf_t *
+evs_shared_buf_new(size_t size)
+{
+    evs_shared_buf_t *shared = malloc(sizeof(*shared) + size);
+
+    if (!shared) return NULL;
+    shared->refs = 1;
+    shared->len = 0;
+    return shared;
+}
+
+/**
+ * Release a reference to a shared buffer, freeing it if it was the last.
+ */
+static void
+evs_shared_buf_release(evs_shared_buf_t *shared)
+{
+    if (0 == --shared->refs) free(shared);
+}
+
+/**
+ * Ensure the output buffer of \p client can hold at least \p len bytes.
  *
- * @param bufs A set of buffers provided by libuv
- * @param nbufs The number of buffers pointed to by \p bufs
+ * @return 0 if successful, -1 if the buffer could not be grown
  */
-static evs_usr_data_t *
-new_usr_data(uv_buf_t *bufs, unsigned int nbufs)
+static int
+evs_client_reserve(evs_client_t *client, size_t len)
+{
+    char *out;
+
+    if (len <= client->out_cap) return 0;
+    if (NULL == (out = realloc(client->out, len))) return -1;
+
+    client->out = out;
+    client->out_cap = len;
+    return 0;
+}
+
+static void
+evs_response_write_cb(uv_write_t *req __attribute__((unused)), int status)
 {
-    evs_usr_data_t *data = NULL;
-    uv_buf_t *buf_copy = NULL;
+    if (status && UV_ECANCELED != status)
+        logger(L_ERROR, "write error: %s", uv_strerror(status));
+}
 
-    // There must be at least one buffer
-    if (!bufs || !nbufs) return NULL;
+/**
+ * Write \p bufs to \p client with a single write. The buffers must not be
+ * modified until the write has completed, so this may only be used once per
+ * connection.
+ *
+ * @return 0 if successful, -1 if the write could not be queued
+ */
+static int
+evs_client_send(evs_client_t *client, const uv_buf_t *bufs, unsigned int nbufs)
+{
+    int ret;
 
-    // Allocate main struct
-    data = malloc(sizeof(*data));
-    if (!data) return NULL;
+    if (!nbufs) return 0;
 
-    // Create copy of bufs
-    buf_copy = malloc(sizeof(*buf_copy) * nbufs);
-    if (!data)
+    if (0 > (ret = uv_write(&client->write_req, (uv_stream_t *) client, bufs,
+            nbufs, evs_response_write_cb)))
     {
-        free(data);
-        return NULL;
+        logger(L_ERROR, "event server: write error: %s", uv_strerror(ret));
+        return -1;
     }
-    memcpy(buf_copy, bufs, sizeof(*buf_copy) * nbufs);
 
-    data->bufs = buf_copy;
-    data->nbufs = nbufs;
+    return 0;
+}
 
-    return data;
+static void write_sock_shutdown(uv_shutdown_t *req, int status) {
+    if (status < 0) {
+        logger(L_WARN, "Failed to close write socket");
+    }
+    if (req != NULL) {
+        uv_stream_t *stream = req->handle;
+        if (stream) uv_close((uv_handle_t *) stream, (uv_close_cb) on_client_close);
+    }
 }
 
 /**
- * Clean up a user data structure. Does NOT free the buffers themselves as that
- * is the job of the user in the write callback.
+ * Shutdown the writing side of a client stream once all queued writes have
+ * completed. The stream is closed once the shutdown is complete.
  */
 static void
-free_usr_data(evs_usr_data_t *data)
+shutdown_client_stream(evs_client_t *client)
 {
-    if (!data) return;
+    if (0 > uv_shutdown(&client->shutdown_req, (uv_stream_t *) client,
+            write_sock_shutdown))
+    {
+        logger(L_ERROR, "Could not shutdown client stream");
+        if (!uv_is_closing((uv_handle_t *) client))
+            uv_close((uv_handle_t *) client, (uv_close_cb) on_client_close);
+    }
+}
 
-    // Free copy of bufs
-    if (data->bufs) free(data->bufs);
+/**
+ * Release the serialized list held by a snapshot, if any.
+ */
+static void
+evs_snapshot_invalidate(evs_snapshot_t *snap)
+{
+    if (snap->buf)
+    {
+        evs_shared_buf_release(snap->buf);
+        snap->buf = NULL;
+    }
+}
+
+/**
+ * Get the event list serialized in \p format, serializing the list again only
+ * if it has changed since the snapshot was taken.
+ *
+ * The buffer is sized from an upper bound on the length of each event before
+ * anything is formatted, so it is allocated once however many events there
+ * are.
+ *
+ * @return The snapshot, or NULL if memory could not be allocated. The server
+ * holds the reference to the snapshot buffer; callers must take their own
+ * reference if they use it beyond the current callback.
+ */
+static evs_snapshot_t *
+evs_snapshot_get(evs_server_t *evs, ids_event_format_t format)
+{
+    evs_snapshot_t *snap = &evs->snapshots[format];
+    const struct ids_event *event_iter;
+    evs_snapshot_entry_t *index;
+    evs_shared_buf_t *shared;
+    size_t count = 0, len = 0;
+
+    if (snap->buf && snap->seq == evs->list->seq) return snap;
+
+    evs_snapshot_invalidate(snap);
+
+    for (event_iter = evs->list->head; event_iter;
+            event_iter = event_iter->next)
+    {
+        len += ids_event_format_len_max(format, event_iter);
+        count++;
+    }
 
-    // Free struct itself
-    free(data);
+    if (count > snap->index_cap)
+    {
+        if (NULL == (index = realloc(snap->index, count * sizeof(*index))))
+            return NULL;
+        snap->index = index;
+        snap->index_cap = count;
+    }
+    if (NULL == (shared = evs_shared_buf_new(len))) return NULL;
+
+    count = 0;
+    for (event_iter = evs->list->head; event_iter;
+            event_iter = event_iter->next)
+    {
+        shared->len += ids_event_format(format, shared->data + shared->len,
+                event_iter);
+        snap->index[count].seq = event_iter->seq;
+        snap->index[count].end = shared->len;
+        count++;
+    }
+
+    snap->buf = shared;
+    snap->seq = evs->list->seq;
+    snap->events = count;
+    return snap;
 }
 
 /**
- * Calculates the length of a string required to hold an IDS event (excluding
- * termination character).
+ * The length of the prefix of the snapshot holding the events observed after
+ * \p since. The list is ordered by descending sequence number, so these are
+ * always at the start of the snapshot.
  */
-static size_t ids_event_len(struct ids_event *event)
+static size_t
+evs_snapshot_len_since(const evs_snapshot_t *snap, uint64_t since)
 {
-    struct in_addr ip;
-    char ip_str[30];
-    size_t char_count = 0;
-    int ret;
+    size_t i;
+
+    for (i = 0; i < snap->events; i++)
+    {
+        if (snap->index[i].seq <= since) break;
+    }
+
+    return i ? snap->index[i - 1].end : 0;
+}
+
+/**
+ * Write every event in the client's list that was observed after \p since,
+ * most recent first. The events are written straight from the snapshot, so
+ * repeated requests do not format anything.
+ *
+ * @param client The client to write to
+ * @param since Only events with a sequence number greater than this are
+ * written. Use 0 to write the entire list.
+ * @param with_cursor If non-zero, terminate the response with the sequence
+ * number of the most recent event so the client can use it in its next request
+ * @return 0 if successful, -1 on error
+ */
+static int
+evs_client_send_since(evs_client_t *client, uint64_t since, int with_cursor)
+{
+    evs_snapshot_t *snap;
+    uv_buf_t bufs[2];
+    unsigned int nbufs = 0;
+    size_t len;
+
+    if (NULL == (snap = evs_snapshot_get(&evs_server, client->format)))
+        goto error;
 
-    char buf[30];
+    if (0 != (len = evs_snapshot_len_since(snap, since)))
+        bufs[nbufs++] = uv_buf_init(snap->buf->data, len);
 
-    ret = snprintf(buf, 30, fmt_ioc, event->ioc);
-    if (ret >= 0) char_count += ret;
+    if (with_cursor)
+    {
+        if (0 != evs_client_reserve(client, IDS_EVENT_FORMAT_CURSOR_MAX))
+            goto error;
+        len = ids_event_format_cursor(client->format, client->out, snap->seq);
+        bufs[nbufs++] = uv_buf_init(client->out, len);
+    }
 
-    ret = snprintf(buf, 30, fmt_timestamp,
-            (long long)event->times_seen->tm_stamp.tv_sec);
-    if (ret >= 0) char_count += ret;
+    if (0 != evs_client_send(client, bufs, nbufs)) return -1;
 
-    ret = snprintf(buf, 30, fmt_event_count, event->num_times);
-    if (ret >= 0) char_count += ret;
+    // Keep the snapshot alive until the write has completed, even if the
+    // list changes in the meantime
+    snap->buf->refs++;
+    client->snapshot = snap->buf;
+    return 0;
 
-    ret = snprintf(buf, 30, fmt_iface, event->iface);
-    if (ret >= 0) char_count += ret;
+error:
+    logger(L_ERROR, "evs_client_send_since: could not allocate buffer");
+    return -1;
+}
 
-    ip.s_addr = event->src_ip;
-    ret = snprintf(buf, 30, fmt_src_ip, inet_ntop(AF_INET, &ip, ip_str, 30));
-    if (ret >= 0) char_count += ret;
+/**
+ * Write every event in the client's list that was observed after \p since,
+ * then shutdown the stream. See evs_client_send_since().
+ */
+static void
+write_ids_event_list_since(evs_client_t *client, uint64_t since,
+        int with_cursor)
+{
+    evs_client_send_since(client, since, with_cursor);
+    shutdown_client_stream(client);
+}
 
-    ret = snprintf(buf, 30, fmt_src_mac, event->mac.m_addr[0], event->mac.m_addr[1],
-            event->mac.m_addr[2], event->mac.m_addr[3], event->mac.m_addr[4], event->mac.m_addr[5]);
-    if (ret >= 0) char_count += ret;
+void write_ids_event_list(uv_stream_t *stream)
+{
+    write_ids_event_list_since((evs_client_t *) stream, 0, 0);
+}
 
-    return char_count;
+void alloc_buffer(uv_handle_t *handle __attribute__((unused)),
+                  size_t suggested_size, uv_buf_t *buf)
+{
+    assert(buf);
+    buf->base = malloc(suggested_size);
+    if (buf->base) buf->len = suggested_size;
+    else buf->len = 0;
 }
 
 /**
- * IOC: <domain name or IP address>
- * Last seen: <timestamp>
- * Number of times seen: <unsigned int>
- * Interface: <iface name>
- * Source IP: <IP address of infected machine>
+ * Remove a client from whichever of the pending or subscriber lists it is in.
+ * Stops the request timer if no clients remain pending.
  */
-void write_ids_event(uv_stream_t *stream, struct ids_event *event)
+static void
+evs_client_unlink(evs_client_t *client)
 {
-    // This buffer will be strdup'd so that the contents will outlast this function
-    char *buffer;
-    size_t buf_idx = 0;
-    struct in_addr ip;
-    char ip_str[20];
-    int ret;
+    evs_client_t **head =
+            client->subscribed ? &evs_server.subscribers : &evs_server.pending;
+
+    if (client->prev)
+        client->prev->next = client->next;
+    else if (*head == client)
+        *head = client->next;
+    if (client->next)
+        client->next->prev = client->prev;
+
+    client->prev = NULL;
+    client->next = NULL;
+
+    if (!evs_server.pending) uv_timer_stop(&evs_server.req_timer);
+}
+
+/**
+ * Add a client to the front of a pending or subscriber list.
+ */
+static void
+evs_client_link(evs_client_t **head, evs_client_t *client)
+{
+    client->prev = NULL;
+    client->next = *head;
+    if (client->next) client->next->prev = client;
+    *head = client;
+}
 
-    uv_write_t *ioc_req;
-    uv_buf_t ioc_buf;
-    evs_usr_data_t *write_req_data = NULL;
+static void
+on_client_close(uv_handle_t *handle)
+{
+    if (handle->type == UV_TCP)
+    {
+        evs_client_t *client = (evs_client_t *) handle;
+        evs_client_unlink(client);
+        if (client->dropped)
+            logger(L_WARN, "event server: dropped %lu events for a slow subscriber",
+                    client->dropped);
+        if (client->snapshot) evs_shared_buf_release(client->snapshot);
+        free(client->out);
+        free(client);
+    }
+}
+
+/**
+ * Close a client connection without sending anything further.
+ */
+static void
+evs_client_close(evs_client_t *client)
+{
+    evs_client_unlink(client);
+    if (!uv_is_closing((uv_handle_t *) client))
+        uv_close((uv_handle_t *) client, (uv_close_cb) on_client_close);
+}
 
-    size_t buf_sz = ids_event_len(event) + 1;
-    if (NULL == (buffer = malloc(buf_sz)))
+/**
+ * Start pushing events to a client. Events observed after \p since are sent
+ * immediately so that a subscriber that reconnects does not miss any.
+ */
+static void
+evs_client_subscribe(evs_client_t *client, uint64_t since)
+{
+    client->subscribed = 1;
+    client->req_len = 0;
+    evs_client_link(&evs_server.subscribers, client);
+
+    if (0 != evs_client_send_since(client, since, 1))
     {
-        logger(L_ERROR, "write_ids_event: could not allocate buffer");
-        return;
+        logger(L_ERROR, "event server: could not send events to subscriber");
+        evs_client_close(client);
     }
+}
 
-    ret = snprintf(buffer + buf_idx, buf_sz - buf_idx, fmt_ioc, event->ioc);
-    assert((size_t) ret < buf_sz - buf_idx);
-    buf_idx += ret;
+/**
+ * Respond to a client's request line. A NULL or empty request receives the
+ * full event list, as in the original protocol. See evs_request_parse().
+ *
+ * @param client The client that sent the request
+ * @param line The NULL-terminated request line without a trailing newline, or
+ * NULL if the client did not send a request
+ */
+static void
+evs_client_respond(evs_client_t *client, char *line)
+{
+    static const char *err_msg = "ERROR\n\n";
+    evs_request_t req;
+    uint64_t since;
+    uv_buf_t buf;
 
-    ret = snprintf(buffer + buf_idx, buf_sz - buf_idx, fmt_timestamp,
-            (long) event->times_seen->tm_stamp.tv_sec);
-    assert((size_t) ret < buf_sz - buf_idx);
-    buf_idx += ret;
+    client->responded = 1;
+    evs_client_unlink(client);
 
-    ret = snprintf(buffer + buf_idx, buf_sz - buf_idx, fmt_event_count,
-            event->num_times);
-    assert((size_t) ret < buf_sz - buf_idx);
-    buf_idx += ret;
+    if (0 == evs_request_parse(line, &req))
+    {
+        client->format = req.format;
 
-    ret = snprintf(buffer + buf_idx, buf_sz - buf_idx, fmt_iface, event->iface);
-    assert((size_t) ret < buf_sz - buf_idx);
-    buf_idx += ret;
+        // A cursor from before nsids restarted may be ahead of the list.
+        // Send everything rather than nothing.
+        since = req.has_seq ? req.seq : 0;
+        if (since > client->list->seq) since = 0;
 
-    ip.s_addr = event->src_ip;
+        switch (req.type)
+        {
+        case EVS_REQ_SUBSCRIBE:
+            if (!req.has_seq) since = client->list->seq;
+            // Keep reading so that a disconnect is noticed
+            evs_client_subscribe(client, since);
+            return;
+        case EVS_REQ_SINCE:
+            uv_read_stop((uv_stream_t *) client);
+            write_ids_event_list_since(client, since, 1);
+            return;
+        case EVS_REQ_LIST:
+            uv_read_stop((uv_stream_t *) client);
+            write_ids_event_list_since(client, 0, 0);
+            return;
+        }
+    }
 
-    ret = snprintf(buffer + buf_idx, buf_sz - buf_idx, fmt_src_ip,
-            inet_ntop(AF_INET, &ip, ip_str, 20));
-    assert((size_t) ret < buf_sz - buf_idx);
-    buf_idx += ret;
+    uv_read_stop((uv_stream_t *) client);
+    logger(L_DEBUG, "event server: bad request: %s", line);
+    if (0 == evs_client_reserve(client, strlen(err_msg)))
+    {
+        memcpy(client->out, err_msg, strlen(err_msg));
+        buf = uv_buf_init(client->out, strlen(err_msg));
+        evs_client_send(client, &buf, 1);
+    }
+    shutdown_client_stream(client);
+}
+
+/**
+ * Read request lines directly into the client structure rather than
+ * allocating a buffer for each read. Leaves space for a NULL terminator.
+ */
+static void
+evs_alloc_req(uv_handle_t *handle, size_t suggested_size __attribute__((unused)),
+        uv_buf_t *buf)
+{
+    evs_client_t *client = (evs_client_t *) handle;
 
-    ret = snprintf(buffer + buf_idx, buf_sz - buf_idx, fmt_src_mac,
-            event->mac.m_addr[0], event->mac.m_addr[1], event->mac.m_addr[2], event->mac.m_addr[3],
-            event->mac.m_addr[4], event->mac.m_addr[5]);
-    assert((size_t) ret < buf_sz - buf_idx);
-    buf_idx += ret;
+    buf->base = client->req + client->req_len;
+    buf->len = sizeof(client->req) - client->req_len - 1;
+}
+
+static void
+evs_read_req(uv_stream_t *stream, ssize_t nread,
+        const uv_buf_t *buf __attribute__((unused)))
+{
+    evs_client_t *client = (evs_client_t *) stream;
+    char *eol;
 
-    ioc_buf = uv_buf_init(buffer, buf_sz);
-    if (NULL == (ioc_req = malloc(sizeof(*ioc_req))))
+    if (client->subscribed)
     {
-        logger(L_ERROR, "write_ids_event: could not allocate uv_write_t");
+        // Nothing more is expected from a subscriber until it disconnects
+        client->req_len = 0;
+        if (nread < 0) evs_client_close(client);
         return;
     }
 
-    // Keep a copy of buffers to free after the callback
-    write_req_data = new_usr_data(&ioc_buf, 1);
-    if (!write_req_data)
+    if (client->responded) return;
+
+    if (UV_EOF == nread)
+    {
+        // The client finished sending without a newline
+        client->req[client->req_len] = '\0';
+        evs_client_respond(client, client->req);
+        return;
+    }
+    if (nread < 0)
     {
-        free(buffer);
+        logger(L_WARN, "event server: read error: %s", uv_strerror(nread));
+        evs_client_close(client);
         return;
     }
 
-    // Attach write data to write request to ensure it gets freed later
-    ioc_req->data = (void *) write_req_data;
+    client->req_len += nread;
+    client->req[client->req_len] = '\0';
 
-    if (0 > (ret = uv_write(ioc_req, stream, &ioc_buf, 1, ids_server_write_cb)))
+    if (NULL != (eol = memchr(client->req, '\n', client->req_len)))
     {
-        logger(L_ERROR, "write_ids_event: write error occurred");
-        free(buffer);
-        free_usr_data(write_req_data);
-        return;
+        *eol = '\0';
+        if (eol > client->req && '\r' == eol[-1]) eol[-1] = '\0';
+        evs_client_respond(client, client->req);
+    }
+    else if (client->req_len >= sizeof(client->req) - 1)
+    {
+        logger(L_WARN, "event server: request line too long");
+        evs_client_close(client);
     }
 }
 
-static void write_sock_shutdown(uv_shutdown_t *req, int status) {
-    if (status < 0) {
-        logger(L_WARN, "Failed to close write socket");
-    }
-    if (req != NULL) {
-        uv_stream_t *stream = req->handle;
+/**
+ * Completion of a write of a shared buffer to a subscriber.
+ */
+static void
+evs_push_write_cb(uv_write_t *req, int status)
+{
+    evs_shared_buf_t *shared = req->data;
+    evs_client_t *client = (evs_client_t *) req->handle;
+
+    if (status && UV_ECANCELED != status)
+        logger(L_WARN, "event server: push write error: %s",
+                uv_strerror(status));
+
+    client->queued -= shared->len;
+    evs_shared_buf_release(shared);
+    free(req);
+}
+
+/**
+ * Queue a write of a shared buffer to a subscriber. A reference to the
+ * buffer is held until the write has completed.
+ *
+ * @return 0 if the write was queued, -1 otherwise
+ */
+static int
+evs_push_write(evs_client_t *client, evs_shared_buf_t *shared)
+{
+    uv_write_t *req;
+    uv_buf_t buf;
+
+    if (NULL == (req = malloc(sizeof(*req)))) return -1;
+    req->data = shared;
+    buf = uv_buf_init(shared->data, shared->len);
+    if (0 > uv_write(req, (uv_stream_t *) client, &buf, 1, evs_push_write_cb))
+    {
         free(req);
-        if (stream) uv_close((uv_handle_t *) stream, (uv_close_cb) on_client_close);
+        return -1;
     }
+
+    shared->refs++;
+    client->queued += shared->len;
+    return 0;
 }
 
-void write_ids_event_list(uv_stream_t *stream)
+/**
+ * Record that an event could not be sent to a subscriber.
+ */
+static void
+evs_client_drop(evs_client_t *client)
+{
+    if (!client->dropped)
+        logger(L_WARN, "event server: subscriber is too slow, dropping events");
+    client->dropped++;
+    client->dropped_unreported++;
+    evs_server.dropped++;
+}
+
+/**
+ * Queue a shared buffer to be written to a subscriber, unless the
+ * subscriber already has too much data waiting to be written.
+ *
+ * @return 0 if the buffer was queued, -1 if it was dropped
+ */
+static int
+evs_push(evs_client_t *client, evs_shared_buf_t *shared)
 {
-    struct ids_event *event_iter;
-    struct ids_event_list *list = (struct ids_event_list *)stream->data;
-    for (event_iter = list->head; event_iter; event_iter = event_iter->next)
+    evs_shared_buf_t *notice;
+
+    if (client->queued + shared->len > EVS_SUB_QUEUE_MAX) goto drop;
+
+    // Tell the client how many events it missed before sending the next one
+    if (client->dropped_unreported)
     {
-        write_ids_event(stream, event_iter);
+        if (NULL == (notice = evs_shared_buf_new(IDS_EVENT_FORMAT_DROPPED_MAX)))
+            goto drop;
+        notice->len = ids_event_format_dropped(client->format, notice->data,
+                client->dropped_unreported);
+        if (0 == evs_push_write(client, notice)) client->dropped_unreported = 0;
+        evs_shared_buf_release(notice);
     }
-    uv_shutdown_t *req =
-            (uv_shutdown_t *) malloc(sizeof(uv_shutdown_t));
-    uv_shutdown(req, stream, write_sock_shutdown);
+
+    if (0 != evs_push_write(client, shared)) goto drop;
+    return 0;
+
+drop:
+    evs_client_drop(client);
+    return -1;
 }
 
-void alloc_buffer(uv_handle_t *handle __attribute__((unused)),
-                  size_t suggested_size, uv_buf_t *buf)
+/**
+ * Serialize an event followed by its cursor into a new shared buffer. The
+ * cursor lets a subscriber know where to resume from if it reconnects.
+ */
+static evs_shared_buf_t *
+evs_push_buf_new(ids_event_format_t format, const struct ids_event *event)
 {
-    assert(buf);
-    buf->base = malloc(suggested_size);
-    if (buf->base) buf->len = suggested_size;
-    else buf->len = 0;
+    evs_shared_buf_t *shared;
+
+    shared = evs_shared_buf_new(ids_event_format_len_max(format, event)
+            + IDS_EVENT_FORMAT_CURSOR_MAX);
+    if (!shared)
+    {
+        logger(L_ERROR, "evs_push_buf_new: could not allocate buffer");
+        return NULL;
+    }
+
+    shared->len = ids_event_format(format, shared->data, event);
+    shared->len += ids_event_format_cursor(format, shared->data + shared->len,
+            event->seq);
+    return shared;
 }
 
 /**
- * Check the status of a completed write and free the buffers.
+ * Observer of the event list. Formats a new observation once for each format
+ * that subscribers have asked for, then pushes the same buffer to every
+ * subscriber using that format.
  */
-void ids_server_write_cb(uv_write_t *req, int status)
+static void
+evs_on_event(const struct ids_event *event, void *data)
 {
-    unsigned int buf_idx;
-    evs_usr_data_t *usr_data = NULL;
-
-    if (status) logger(L_ERROR, "write error: %s", uv_strerror(status));
+    evs_server_t *evs = data;
+    evs_shared_buf_t *shared[IDS_EVENT_FORMAT_COUNT] = { NULL };
+    evs_client_t *client;
+    int i;
 
-    if (!req) return;
+    // The list has changed, so the snapshots are out of date. Release them
+    // now rather than holding on to them until the next request.
+    for (i = 0; i < IDS_EVENT_FORMAT_COUNT; i++)
+        evs_snapshot_invalidate(&evs->snapshots[i]);
 
-    usr_data = req->data;
-    free(req);
+    for (client = evs->subscribers; client; client = client->next)
+    {
+        if (!shared[client->format])
+            shared[client->format] = evs_push_buf_new(client->format, event);
 
-    if (usr_data) {
-        if (usr_data->bufs)
-        {
-            for (buf_idx = 0; buf_idx < usr_data->nbufs; buf_idx++)
-            {
-                void *buf_base = usr_data->bufs[buf_idx].base;
-                if (buf_base)
-                    free(buf_base);
-            }
-        }
+        if (shared[client->format]) evs_push(client, shared[client->format]);
+        else evs_client_drop(client);
+    }
 
-        free_usr_data(usr_data);
+    for (i = 0; i < IDS_EVENT_FORMAT_COUNT; i++)
+    {
+        if (shared[i]) evs_shared_buf_release(shared[i]);
     }
 }
 
+/**
+ * Clients which have not sent a request line within #EVS_REQ_TIMEOUT_MS are
+ * assumed to be using the original protocol and are sent the full list.
+ */
 static void
-on_client_close(uv_handle_t *handle)
+evs_req_timer_cb(uv_timer_t *timer)
 {
-    if (handle->type == UV_TCP)
+    uint64_t now = uv_now(timer->loop);
+    evs_client_t *client = evs_server.pending, *next;
+
+    while (client)
     {
-        uv_tcp_t *client = (uv_tcp_t *) handle;
-        // Assume client->data will be freed elsewhere
-        free(client);
+        next = client->next;
+        if (now - client->accepted_at >= EVS_REQ_TIMEOUT_MS)
+            evs_client_respond(client, NULL);
+        client = next;
     }
 }
 
 static void on_new_connection(uv_stream_t *server, int status)
 {
     int err;
-    uv_tcp_t *client = NULL;
+    evs_client_t *client = NULL;
     uv_loop_t *loop;
 
     logger(L_INFO, "new connection");
     loop = ((uv_handle_t *)server)->loop;
     if (0 > (err = status)) goto msg;
-    if (NULL == (client = (uv_tcp_t *)malloc(sizeof(*client)))) goto error;
-    if (0 != (err = uv_tcp_init(loop, client))) goto msg;
+    if (NULL == (client = (evs_client_t *)malloc(sizeof(*client)))) goto error;
+    memset(client, 0, sizeof(*client));
+    if (0 != (err = uv_tcp_init(loop, &client->tcp)))
+    {
+        free(client);
+        client = NULL;
+        goto msg;
+    }
 
-    // Copy pointer to event list from server to client
-    client->data = server->data;
+    client->list = ((evs_server_t *) server->data)->list;
 
     if (0 != (err = uv_accept(server, (uv_stream_t *)client))) goto msg;
 
-    write_ids_event_list((uv_stream_t *)client);
-    // Write the current list to the new connection
+    // Wait for a request line. Clients using the original protocol send
+    // nothing and are sent the full list once the request timer expires.
+    client->accepted_at = uv_now(loop);
+    if (0 != uv_read_start((uv_stream_t *)client, evs_alloc_req, evs_read_req))
+    {
+        evs_client_respond(client, NULL);
+        return;
+    }
+
+    if (!evs_server.pending)
+        uv_timer_start(&evs_server.req_timer, evs_req_timer_cb,
+                EVS_REQ_POLL_MS, EVS_REQ_POLL_MS);
+    evs_client_link(&evs_server.pending, client);
     return;
 
 // For error cases where a specific libuv error message can be printed
 msg:
     logger(L_ERROR, "connection error: %s\n", uv_strerror(err));
 error:
-    if (client) uv_close((uv_handle_t *)client, (uv_close_cb) on_client_close);
+    if (client) evs_client_close(client);
 }
 
 int
@@ -328,9 +831,14 @@ setup_event_server(uv_loop_t *loop, uv_tcp_t *handle, int port, struct ids_event
     int ret;
     struct sockaddr_in server_addr;
 
+    memset(&evs_server, 0, sizeof(evs_server));
+    evs_server.list = list;
+    if (0 != uv_timer_init(loop, &evs_server.req_timer)) goto error;
+    ids_event_list_set_observer(list, evs_on_event, &evs_server);
+
     if (0 != uv_tcp_init(loop, handle)) goto error;
-    // Put a pointer to the ids_event_list in the data field of the tcp handle
-    handle->data = list;
+    // Put a pointer to the server state in the data field of the tcp handle
+    handle->data = &evs_server;
     if (0 != uv_ip4_addr("0.0.0.0", port, &server_addr)) goto error;
     if (0 != uv_tcp_bind(handle, (const struct sockaddr *)&server_addr, 0)) goto error;
     ret = uv_listen((uv_stream_t *)handle, MAX_CONNS, on_new_connection);
@@ -365,9 +873,23 @@ teardown_event_server(uv_tcp_t *handle)
 
     uv_shutdown_t *req = malloc(sizeof(*req));
     int uv_rc;
+    int i;
 
     // Ignore return codes because we'll carry on if a failure occurs
     uv_read_stop((uv_stream_t *)handle);
+    if (evs_server.list)
+        ids_event_list_set_observer(evs_server.list, NULL, NULL);
+    while (evs_server.pending) evs_client_close(evs_server.pending);
+    while (evs_server.subscribers) evs_client_close(evs_server.subscribers);
+    for (i = 0; i < IDS_EVENT_FORMAT_COUNT; i++)
+    {
+        evs_snapshot_invalidate(&evs_server.snapshots[i]);
+        free(evs_server.snapshots[i].index);
+        evs_server.snapshots[i].index = NULL;
+        evs_server.snapshots[i].index_cap = 0;
+    }
+    if (!uv_is_closing((uv_handle_t *)&evs_server.req_timer))
+        uv_close((uv_handle_t *)&evs_server.req_timer, NULL);
     if (req)
     {
         // If this works, the close operation must wait for the callback
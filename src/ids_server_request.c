@@ -0,0 +1,79 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ids_server_request.h"
+
+/**
+ * Parse the sequence number argument of a request.
+ *
+ * @param arg The argument, which must be the remainder of the request line
+ * @param[out] seq The sequence number that was parsed
+ * @return 0 if successful, -1 if \p arg is not a valid sequence number
+ */
+static int
+parse_request_seq(const char *arg, uint64_t *seq)
+{
+    unsigned long long parsed;
+    char *end = NULL;
+
+    // strtoull() would accept a sign or leading space
+    if (!isdigit((unsigned char) *arg)) return -1;
+
+    errno = 0;
+    parsed = strtoull(arg, &end, 10);
+    if (errno || end == arg || '\0' != *end) return -1;
+
+    *seq = parsed;
+    return 0;
+}
+
+int
+evs_request_parse(char *line, evs_request_t *req)
+{
+    char *saveptr = NULL, *token;
+    int has_format = 0;
+
+    memset(req, 0, sizeof(*req));
+    req->type = EVS_REQ_LIST;
+    req->format = IDS_EVENT_FORMAT_TEXT;
+
+    if (!line || NULL == (token = strtok_r(line, " ", &saveptr))) return 0;
+
+    if (0 == strcmp(token, "LIST")) req->type = EVS_REQ_LIST;
+    else if (0 == strcmp(token, "SINCE")) req->type = EVS_REQ_SINCE;
+    else if (0 == strcmp(token, "SUBSCRIBE")) req->type = EVS_REQ_SUBSCRIBE;
+    else return -1;
+
+    while (NULL != (token = strtok_r(NULL, " ", &saveptr)))
+    {
+        if (EVS_REQ_LIST != req->type && !req->has_seq && !has_format
+                && 0 == parse_request_seq(token, &req->seq))
+        {
+            req->has_seq = 1;
+        }
+        else if (!has_format
+                && 0 == ids_event_format_from_name(token, &req->format))
+        {
+            has_format = 1;
+        }
+        else return -1;
+    }
+
+    if (EVS_REQ_SINCE == req->type && !req->has_seq) return -1;
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief The request lines of the event server
+ *
+ * Kept apart from the server so that they can be parsed without libuv.
+ */
+#ifndef SRC_IDS_SERVER_REQUEST_H_
+#define SRC_IDS_SERVER_REQUEST_H_
+
+#include <stdint.h>
+
+#include "ids_event_format.h"
+
+/**
+ * The types of request a client may send
+ */
+typedef enum
+{
+    EVS_REQ_LIST,
+    EVS_REQ_SINCE,
+    EVS_REQ_SUBSCRIBE
+} evs_req_type;
+
+/**
+ * A parsed request line
+ */
+typedef struct evs_request_s
+{
+    /** The type of request */
+    evs_req_type type;
+    /** Non-zero if a sequence number was given */
+    int has_seq;
+    /** The sequence number, if #has_seq */
+    uint64_t seq;
+    /** The format to send the response in */
+    ids_event_format_t format;
+} evs_request_t;
+
+/**
+ * Parse a request line.
+ *
+ * Request lines:
+ * - `LIST [<format>]`: the full event list
+ * - `SINCE <seq> [<format>]`: events observed after \p seq, followed by the
+ *   cursor
+ * - `SUBSCRIBE [<seq>] [<format>]`: events observed after \p seq (if given),
+ *   followed by the cursor and then each new event as it is observed
+ *
+ * where `<format>` is one of `TEXT` (the default), `JSON` or `BINARY`.
+ *
+ * @param line The request line, which is modified. NULL or an empty line is
+ * treated as `LIST`.
+ * @param[out] req The parsed request
+ * @return 0 if successful, -1 if the request is invalid
+ */
+int
+evs_request_parse(char *line, evs_request_t *req);
+
+#endif /* SRC_IDS_SERVER_REQUEST_H_ */
@@ -0,0 +1,284 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/logging.h"
+#include "utils/mem.h"
+#include "ip_reasm.h"
+
+/** Fragment offsets are in units of this many bytes */
+#define FRAG_UNIT 8
+
+/** The number of units in the largest datagram */
+#define MAX_UNITS (IP_REASM_MAX_LEN / FRAG_UNIT)
+
+struct ip_reasm_datagram
+{
+    struct ip_reasm_key key;
+    /** The time of the first fragment */
+    uint32_t started;
+    /** The length of the payload, or 0 until the last fragment is seen */
+    uint16_t total_len;
+    /** The end of the furthest fragment received */
+    uint16_t max_end;
+    /** The number of units received */
+    uint16_t received;
+    /** The number of fragments received */
+    uint8_t fragments;
+    /** Non-zero if the datagram is being reassembled */
+    uint8_t used;
+    /** One bit for each unit of the payload that has been received */
+    uint64_t units[MAX_UNITS / 64];
+    /** The payload, of #IP_REASM_MAX_LEN bytes */
+    uint8_t *data;
+};
+
+struct ip_reasm
+{
+    /** All datagrams, used or free */
+    struct ip_reasm_datagram *datagrams;
+    /** The buffers of all datagrams */
+    uint8_t *buffers;
+    /** The number of elements in #datagrams */
+    unsigned int max_datagrams;
+    /** The maximum number of datagrams from one source */
+    unsigned int max_per_source;
+    /** The number of datagrams in use */
+    unsigned int count;
+};
+
+static inline int
+key_equal(const struct ip_reasm_key *a, const struct ip_reasm_key *b)
+{
+    return a->src_ip == b->src_ip && a->dest_ip == b->dest_ip
+            && a->id == b->id && a->protocol == b->protocol;
+}
+
+static void
+datagram_free(ip_reasm *r, struct ip_reasm_datagram *d)
+{
+    d->used = 0;
+    r->count--;
+}
+
+ip_reasm *
+new_ip_reasm(unsigned int max_datagrams, unsigned int max_per_source)
+{
+    ip_reasm *r = NULL;
+    unsigned int i;
+
+    if (!max_datagrams || !max_per_source) goto error;
+
+    if (NULL == (r = mem_calloc(MEM_FLOWS, 1, sizeof(*r)))) goto error;
+    if (NULL == (r->datagrams = mem_calloc(MEM_FLOWS, max_datagrams,
+            sizeof(*r->datagrams))))
+        goto error;
+    if (NULL == (r->buffers = mem_malloc(MEM_FLOWS,
+            (size_t) max_datagrams * IP_REASM_MAX_LEN)))
+        goto error;
+
+    for (i = 0; i < max_datagrams; i++)
+        r->datagrams[i].data = r->buffers + (size_t) i * IP_REASM_MAX_LEN;
+    r->max_datagrams = max_datagrams;
+    r->max_per_source = max_per_source;
+
+    return r;
+
+error:
+    free_ip_reasm(&r);
+    return NULL;
+}
+
+void
+free_ip_reasm(ip_reasm **r)
+{
+    assert(r);
+
+    if (*r)
+    {
+        mem_free(MEM_FLOWS, (*r)->buffers);
+        mem_free(MEM_FLOWS, (*r)->datagrams);
+        mem_free(MEM_FLOWS, *r);
+        *r = NULL;
+    }
+}
+
+/**
+ * Find the datagram that a fragment belongs to, discarding datagrams that
+ * have timed out on the way. The cache is small, so it is scanned rather
+ * than hashed, which also counts the datagrams from the same source and
+ * finds the slot to use for a new datagram in the same pass.
+ *
+ * @param[out] slot Set to a free slot, or the oldest datagram if there is
+ * none
+ * @param[out] from_source Set to the number of datagrams from the source of
+ * \p key
+ */
+static struct ip_reasm_datagram *
+find(ip_reasm *r, const struct ip_reasm_key *key, uint32_t now,
+        struct ip_reasm_datagram **slot, unsigned int *from_source)
+{
+    struct ip_reasm_datagram *d, *found = NULL;
+    unsigned int i;
+
+    *slot = NULL;
+    *from_source = 0;
+
+    for (i = 0; i < r->max_datagrams; i++)
+    {
+        d = &r->datagrams[i];
+
+        if (d->used && (int32_t) (now - d->started) >= IP_REASM_TIMEOUT)
+            datagram_free(r, d);
+
+        if (!d->used)
+        {
+            if (!*slot || (*slot)->used) *slot = d;
+            continue;
+        }
+
+        if (key_equal(&d->key, key)) found = d;
+        if (d->key.src_ip == key->src_ip) (*from_source)++;
+        if (!*slot || ((*slot)->used
+                && (int32_t) (d->started - (*slot)->started) < 0))
+            *slot = d;
+    }
+
+    return found;
+}
+
+/**
+ * Mark the units from \p first up to \p last as received.
+ *
+ * @return 0 if successful, -1 if any of them had already been received
+ */
+static int
+mark_units(struct ip_reasm_datagram *d, size_t first, size_t last)
+{
+    size_t i;
+
+    for (i = first; i < last; i++)
+    {
+        if (d->units[i / 64] & (UINT64_C(1) << (i % 64))) return -1;
+    }
+    for (i = first; i < last; i++)
+        d->units[i / 64] |= UINT64_C(1) << (i % 64);
+
+    d->received += last - first;
+    return 0;
+}
+
+int
+ip_reasm_fragment(ip_reasm *r, const struct ip_reasm_key *key,
+        size_t offset, int more, const uint8_t *data, size_t len,
+        uint32_t now, const uint8_t **out, size_t *out_len)
+{
+    assert(r);
+    assert(key);
+    assert(out);
+    assert(out_len);
+
+    struct ip_reasm_datagram *d, *slot;
+    unsigned int from_source;
+    size_t end = offset + len;
+
+    if (NULL == (d = find(r, key, now, &slot, &from_source)))
+    {
+        // Fragments that arrive before the first are held like any other,
+        // until the caller sees the ports in the first fragment and either
+        // adds it or discards the datagram
+        if (from_source >= r->max_per_source)
+        {
+            logger(L_DEBUG, "ip_reasm_fragment(): too many datagrams from one source");
+            return -1;
+        }
+
+        d = slot;
+        if (d->used) datagram_free(r, d);
+        memset(d->units, 0, sizeof(d->units));
+        d->key = *key;
+        d->started = now;
+        d->total_len = 0;
+        d->max_end = 0;
+        d->received = 0;
+        d->fragments = 0;
+        d->used = 1;
+        r->count++;
+    }
+
+    if (end > IP_REASM_MAX_LEN || ++d->fragments > IP_REASM_MAX_FRAGMENTS)
+        goto drop;
+
+    if (more)
+    {
+        // All but the last fragment are whole units
+        if (!len || len % FRAG_UNIT) goto drop;
+        if (d->total_len && end > d->total_len) goto drop;
+    }
+    else
+    {
+        if (d->total_len || end < d->max_end) goto drop;
+        d->total_len = end;
+    }
+
+    if (0 != mark_units(d, offset / FRAG_UNIT,
+            (end + FRAG_UNIT - 1) / FRAG_UNIT))
+        goto drop;
+    memcpy(d->data + offset, data, len);
+    if (end > d->max_end) d->max_end = end;
+
+    if (d->total_len
+            && d->received == (d->total_len + FRAG_UNIT - 1) / FRAG_UNIT)
+    {
+        // The buffer is not reused until the next call
+        *out = d->data;
+        *out_len = d->total_len;
+        datagram_free(r, d);
+        return 1;
+    }
+
+    return 0;
+
+drop:
+    logger(L_DEBUG, "ip_reasm_fragment(): dropped datagram");
+    datagram_free(r, d);
+    return -1;
+}
+
+void
+ip_reasm_discard(ip_reasm *r, const struct ip_reasm_key *key)
+{
+    assert(r);
+    assert(key);
+
+    unsigned int i;
+
+    for (i = 0; i < r->max_datagrams; i++)
+    {
+        if (r->datagrams[i].used && key_equal(&r->datagrams[i].key, key))
+        {
+            datagram_free(r, &r->datagrams[i]);
+            return;
+        }
+    }
+}
+
+unsigned int
+ip_reasm_count(const ip_reasm *r)
+{
+    assert(r);
+
+    return r->count;
+}
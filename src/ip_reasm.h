@@ -0,0 +1,130 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Reassembly of fragmented IPv4 datagrams
+ *
+ * DNS responses larger than the path MTU are sent as several IPv4 fragments,
+ * and only the first holds the UDP header. The fragments of a datagram are
+ * identified by the source and destination addresses, the IP identification
+ * field and the protocol (RFC 791).
+ *
+ * All memory is allocated when the cache is created: a fixed number of
+ * datagrams, each with a buffer of #IP_REASM_MAX_LEN bytes. To keep a flood
+ * of fragments from using the cache:
+ * - Each source may only have #IP_REASM_DEFAULT_PER_SOURCE (or the number
+ *   given to new_ip_reasm()) datagrams in progress.
+ * - A datagram is discarded after #IP_REASM_TIMEOUT seconds, after
+ *   #IP_REASM_MAX_FRAGMENTS fragments, or if a fragment overlaps data that
+ *   has already been received (as IPv6 does in RFC 5722).
+ * - When the cache is full, the oldest datagram is discarded.
+ *
+ * Only the first fragment holds the ports, so the fragments that arrive
+ * before it are held under the same limits until it shows whether the
+ * caller is interested in the datagram. If it is not, the caller discards
+ * them with ip_reasm_discard().
+ */
+#ifndef IP_REASM_H_
+#define IP_REASM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The default maximum number of datagrams being reassembled */
+#define IP_REASM_DEFAULT_DATAGRAMS 32
+
+/** The default maximum number of datagrams from one source being
+ * reassembled */
+#define IP_REASM_DEFAULT_PER_SOURCE 4
+
+/** The largest datagram payload that is reassembled, in bytes. DNS servers
+ * rarely send UDP responses of more than 4096 bytes. */
+#define IP_REASM_MAX_LEN 8192
+
+/** The maximum number of fragments in a datagram */
+#define IP_REASM_MAX_FRAGMENTS 64
+
+/** Datagrams that are not complete after this long are discarded, in
+ * seconds */
+#define IP_REASM_TIMEOUT 15
+
+/** Hide the implementation from dependent modules */
+typedef struct ip_reasm ip_reasm;
+
+/**
+ * Identifies the fragments of one datagram. Addresses and the identification
+ * are in network byte order.
+ */
+struct ip_reasm_key
+{
+    uint32_t src_ip;
+    uint32_t dest_ip;
+    uint16_t id;
+    uint8_t protocol;
+};
+
+/**
+ * Allocate a new reassembly cache.
+ *
+ * @param max_datagrams The maximum number of datagrams being reassembled
+ * @param max_per_source The maximum number of datagrams being reassembled
+ * from a single source address
+ * @return A pointer to the cache, or NULL if memory could not be allocated
+ */
+ip_reasm *
+new_ip_reasm(unsigned int max_datagrams, unsigned int max_per_source);
+
+/**
+ * @brief Free the memory used by the cache
+ * Sets the value pointed to by \p r to NULL
+ */
+void
+free_ip_reasm(ip_reasm **r);
+
+/**
+ * Add a fragment.
+ *
+ * @param r The cache
+ * @param key The datagram that the fragment belongs to
+ * @param offset The offset of \p data in the payload of the datagram, in
+ * bytes
+ * @param more Non-zero if the More Fragments flag is set
+ * @param data The payload of the fragment
+ * @param len The length of \p data
+ * @param now The capture time of the fragment, in seconds
+ * @param[out] out Set to the payload of the datagram if it is complete. Only
+ * valid until the next call.
+ * @param[out] out_len Set to the length of the payload
+ * @return 1 if the fragment completed the datagram, 0 if it did not, -1 if
+ * the fragment was dropped
+ */
+int
+ip_reasm_fragment(ip_reasm *r, const struct ip_reasm_key *key,
+        size_t offset, int more, const uint8_t *data, size_t len,
+        uint32_t now, const uint8_t **out, size_t *out_len);
+
+/**
+ * Discard the fragments received of a datagram, if any.
+ *
+ * @param r The cache
+ * @param key The datagram to discard
+ */
+void
+ip_reasm_discard(ip_reasm *r, const struct ip_reasm_key *key);
+
+/**
+ * The number of datagrams being reassembled.
+ */
+unsigned int
+ip_reasm_count(const ip_reasm *r);
+
+#endif /* IP_REASM_H_ */
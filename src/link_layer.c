@@ -0,0 +1,172 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include <pcap/pcap.h>
+#include <net/ethernet.h>
+
+#include "link_layer.h"
+
+#define ETHERNET_HDR_LEN 14
+#define VLAN_TAG_LEN 4
+
+/** The length of a Linux cooked capture (version 1) header */
+#define SLL_HDR_LEN 16
+
+/** The length of a Linux cooked capture version 2 header */
+#define SLL2_HDR_LEN 20
+
+#define ETHERTYPE_8021Q 0x8100
+#define ETHERTYPE_8021AD 0x88a8
+/** Used for QinQ before 802.1ad was standardized */
+#define ETHERTYPE_QINQ 0x9100
+
+#ifndef ETHERTYPE_IPV6
+#define ETHERTYPE_IPV6 0x86dd
+#endif
+
+static inline uint16_t
+get_uint16(const uint8_t *pos)
+{
+    return (uint16_t) (pos[0] << 8 | pos[1]);
+}
+
+static inline int
+is_vlan(uint16_t ethertype)
+{
+    return ETHERTYPE_8021Q == ethertype || ETHERTYPE_8021AD == ethertype
+            || ETHERTYPE_QINQ == ethertype;
+}
+
+/**
+ * Skip the VLAN tags at \p pos, whose EtherType field has already been read
+ * into \p ethertype, and fill in the network layer of \p out.
+ */
+static inline int
+skip_vlan_tags(const uint8_t *pos, const uint8_t *end, uint16_t ethertype,
+        struct link_frame *out)
+{
+    unsigned int tags = 0;
+
+    while (is_vlan(ethertype))
+    {
+        // A tag is a two byte TCI followed by the inner EtherType
+        if (++tags > LINK_MAX_VLAN_TAGS || end - pos < VLAN_TAG_LEN) return -1;
+        ethertype = get_uint16(pos + 2);
+        pos += VLAN_TAG_LEN;
+    }
+
+    out->ethertype = ethertype;
+    out->l3 = pos;
+    return 0;
+}
+
+int
+link_decode_ethernet(const uint8_t *data, size_t caplen,
+        struct link_frame *out)
+{
+    if (caplen < ETHERNET_HDR_LEN) return -1;
+
+    // These are stored Most Significant Byte first
+    memcpy(&out->dest_mac, data, sizeof(out->dest_mac));
+    memcpy(&out->src_mac, data + 6, sizeof(out->src_mac));
+
+    return skip_vlan_tags(data + ETHERNET_HDR_LEN, data + caplen,
+            get_uint16(data + 12), out);
+}
+
+/**
+ * Linux cooked capture, used when capturing on the "any" device. The header
+ * holds the address of the sender but not the receiver.
+ */
+static int
+link_decode_sll(const uint8_t *data, size_t caplen, struct link_frame *out)
+{
+    if (caplen < SLL_HDR_LEN) return -1;
+
+    if (sizeof(out->src_mac) == get_uint16(data + 4))
+        memcpy(&out->src_mac, data + 6, sizeof(out->src_mac));
+
+    return skip_vlan_tags(data + SLL_HDR_LEN, data + caplen,
+            get_uint16(data + 14), out);
+}
+
+#ifdef DLT_LINUX_SLL2
+/**
+ * Linux cooked capture version 2, which moves the protocol to the start of
+ * the header and adds the interface index.
+ */
+static int
+link_decode_sll2(const uint8_t *data, size_t caplen, struct link_frame *out)
+{
+    if (caplen < SLL2_HDR_LEN) return -1;
+
+    if (sizeof(out->src_mac) == data[11])
+        memcpy(&out->src_mac, data + 12, sizeof(out->src_mac));
+
+    return skip_vlan_tags(data + SLL2_HDR_LEN, data + caplen,
+            get_uint16(data), out);
+}
+#endif
+
+/**
+ * Raw IP with no link-layer header. The IP version is read from the packet.
+ */
+static int
+link_decode_raw(const uint8_t *data, size_t caplen, struct link_frame *out)
+{
+    static const uint16_t ethertypes[16] = {
+        [4] = ETHERTYPE_IP, [6] = ETHERTYPE_IPV6
+    };
+
+    if (!caplen) return -1;
+
+    out->ethertype = ethertypes[data[0] >> 4];
+    out->l3 = data;
+    return 0;
+}
+
+/**
+ * Maps link types to their decoders
+ */
+static const struct
+{
+    int dlt;
+    link_decode_fn decode;
+} link_decoders[] = {
+    { DLT_EN10MB, link_decode_ethernet },
+    { DLT_LINUX_SLL, link_decode_sll },
+#ifdef DLT_LINUX_SLL2
+    { DLT_LINUX_SLL2, link_decode_sll2 },
+#endif
+    { DLT_RAW, link_decode_raw },
+#ifdef DLT_IPV4
+    { DLT_IPV4, link_decode_raw },
+#endif
+#ifdef DLT_IPV6
+    { DLT_IPV6, link_decode_raw },
+#endif
+};
+
+link_decode_fn
+link_decoder_for(int dlt)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(link_decoders) / sizeof(link_decoders[0]); i++)
+    {
+        if (dlt == link_decoders[i].dlt) return link_decoders[i].decode;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,81 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Decoders for the link-layer headers of captured packets
+ *
+ * Each supported link type has its own decoder, which finds the start of the
+ * network layer packet and the MAC addresses if the link has them. The
+ * decoder is chosen once per capture handle with link_decoder_for(), using
+ * the value returned by pcap_datalink(), so that decoding a packet does not
+ * depend on the link type.
+ *
+ * Supported link types are Ethernet (with any number of 802.1Q or 802.1ad
+ * tags up to #LINK_MAX_VLAN_TAGS), Linux cooked capture versions 1 and 2,
+ * and raw IP.
+ */
+#ifndef LINK_LAYER_H_
+#define LINK_LAYER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common.h"
+
+/** The maximum number of VLAN tags skipped, enough for QinQ */
+#define LINK_MAX_VLAN_TAGS 2
+
+/**
+ * The result of decoding a link-layer header
+ */
+struct link_frame
+{
+    /** The start of the network layer packet */
+    const uint8_t *l3;
+    /** The EtherType of the network layer packet in host byte order, such as
+     * ETHERTYPE_IP */
+    uint16_t ethertype;
+    /** The source MAC address, or all zeroes if it is not known */
+    mac_addr src_mac;
+    /** The destination MAC address, or all zeroes if it is not known */
+    mac_addr dest_mac;
+};
+
+/**
+ * Decodes the link-layer header of a packet.
+ *
+ * @param data The start of the captured packet
+ * @param caplen The number of bytes captured
+ * @param[out] out The decoded frame. Its addresses are only written if the
+ * link has them.
+ * @return 0 if successful, -1 if the packet is too short
+ */
+typedef int (*link_decode_fn)(const uint8_t *data, size_t caplen,
+        struct link_frame *out);
+
+/**
+ * Find the decoder for a link type.
+ *
+ * @param dlt The link type returned by pcap_datalink()
+ * @return The decoder, or NULL if the link type is not supported
+ */
+link_decode_fn
+link_decoder_for(int dlt);
+
+/**
+ * The decoder for Ethernet, which is used when the link type is unknown.
+ */
+int
+link_decode_ethernet(const uint8_t *data, size_t caplen,
+        struct link_frame *out);
+
+#endif /* LINK_LAYER_H_ */
@@ -21,6 +21,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -37,6 +38,8 @@
 #include "privileges.h"
 #include "blacklist/ids_blacklist.h"
 #include "blacklist/feodo_ip_blacklist.h"
+#include "blacklist/ip_watchlist.h"
+#include "blacklist/ip6_blacklist.h"
 
 #ifndef NO_UPDATES
 #include "utils/uvtls/uv_tls.h"
@@ -49,9 +52,13 @@
 #endif
 #include "utils/common.h"
 #include "utils/logging.h"
+#include "utils/mem.h"
 #include "ids_event_list.h"
 #include "ids_pcap.h"
 #include "ids_server.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "trace.h"
 
 /**
  * Defining FUZZ_TEST enables different code paths which can be run repeatedly
@@ -84,12 +91,18 @@ struct IdsArgs
     char *ip_filename;
     /** Filename for fuzz testing input */
     char *fuzz_filename;
+    /** A capture file to replay instead of capturing from #iface */
+    char *replay_filename;
     /** The name of the interface to capture from */
     char *iface;
     /** The port to use for the IoC event server */
     int server_port;
+    /** The port to serve metrics on, or 0 to not serve them */
+    int metrics_port;
     /** If the help flag was specified on the cmdline */
     int help_flag;
+    /** The memory budget of the blacklists in bytes, or 0 for no limit */
+    size_t blacklist_budget;
 
 #ifndef NO_UPDATES
     /** The host to connect to for IoC updates */
@@ -98,9 +111,30 @@ struct IdsArgs
     uint16_t update_server_port;
     /** If set to non-zero, do not verify the certificate of the remote host */
     int ssl_no_verify;
+    /** If set to non-zero, keep what fits of an update that exceeds the
+     * blacklist budget instead of refusing it */
+    int budget_truncate;
 #endif
 };
 
+/**
+ * Packets that may contain an IoC. On Ethernet the filter is repeated after
+ * the vlan keyword so that VLAN tagged frames are captured as well; see
+ * configure_pcap().
+ *
+ * BPF cannot index into the transport header of an IPv6 packet, so the IPv6
+ * clauses index from the start of the IPv6 header and only match packets
+ * without extension headers.
+ */
+#define IDS_PCAP_FILTER "((udp port 53) or (tcp port 53) or\
+ (tcp[tcpflags] & tcp-syn != 0 and tcp[tcpflags] & tcp-ack == 0) or\
+ (tcp dst port 443 and tcp[((tcp[12:1] & 0xf0) >> 2):1] = 0x16) or\
+ (udp dst port 443 and udp[8] & 0xf0 = 0xc0 and udp[9:4] = 1) or\
+ (ip[9] = 17 and ip[6:2] & 0x1fff != 0) or\
+ (ip6[6] = 6 and ip6[53] & 0x12 = 0x02) or\
+ (ip6[6] = 6 and tcp dst port 443 and ip6[40 + ((ip6[52] & 0xf0) >> 2)] = 0x16) or\
+ (ip6[6] = 17 and udp dst port 443 and ip6[48] & 0xf0 = 0xc0 and ip6[49:4] = 1))"
+
 // Variables that MUST be global so exit callback can free them
 static uv_loop_t *loop = NULL;
 static pcap_t *pcap = NULL;
@@ -108,7 +142,15 @@ static pcap_t *pcap = NULL;
 static AvahiMdnsContext mdns;
 #endif
 ip_blacklist *ip_bl = NULL;                 ///< The IP IoC blacklist
+ip6_blacklist *ip6_bl = NULL;               ///< The IPv6 IoC blacklist
 domain_blacklist *dn_bl = NULL;             ///< The domain IoC blacklist
+ip_watchlist *ip_wl = NULL;                 ///< Addresses of blacklisted domains
+tcp_dns_tracker *tcp_dns = NULL;            ///< Reassembles DNS over TCP
+ip_reasm *ip_frags = NULL;                  ///< Reassembles IPv4 fragments
+tls_sni_table *tls_conns = NULL;            ///< TLS connections awaiting data
+#ifdef HAVE_OPENSSL
+tls_sni_table *quic_conns = NULL;           ///< QUIC flows already inspected
+#endif
 struct ids_event_list *event_queue = NULL;  ///< The buffer of IoC events
 
 // libuv handles
@@ -116,11 +158,18 @@ struct ids_event_list *event_queue = NULL;  ///< The buffer of IoC events
 static uv_pipe_t stdin_pipe;
 #endif
 static uv_poll_t pcap_handle;
+static struct ids_pcap_replay pcap_replay;
 static uv_signal_t sigterm_handle, sigint_handle;
+#ifdef ENABLE_TRACING
+static uv_signal_t sigusr1_handle;
+#endif
 
 // Handle for event server which transmits recently detected events
 static uv_tcp_t server_handle;
 
+// Handle for the server that answers requests for metrics
+static uv_tcp_t metrics_handle;
+
 // Handles for updating blacklists from the server
 #ifndef NO_UPDATES
 static ids_update_ctx_t ids_update_ctx;
@@ -134,7 +183,8 @@ static void close_cb(uv_handle_t *handle)
      * the global variable 'server_handle'), free it as it is dynamically
      * allocated.
      */
-    if (handle == (uv_handle_t *) &server_handle)
+    if (handle == (uv_handle_t *) &server_handle
+            || handle == (uv_handle_t *) &metrics_handle)
     {
         return;
     }
@@ -216,7 +266,15 @@ static void free_globals(void) {
     if (pcap) pcap_close(pcap);
     if (event_queue) free_ids_event_list(&event_queue);
     if (ip_bl) free_ip_blacklist(&ip_bl);
+    if (ip6_bl) free_ip6_blacklist(&ip6_bl);
     if (dn_bl) domain_blacklist_clear(dn_bl);
+    if (ip_wl) free_ip_watchlist(&ip_wl);
+    if (tcp_dns) free_tcp_dns_tracker(&tcp_dns);
+    if (ip_frags) free_ip_reasm(&ip_frags);
+    if (tls_conns) free_tls_sni_table(&tls_conns);
+#ifdef HAVE_OPENSSL
+    if (quic_conns) free_tls_sni_table(&quic_conns);
+#endif
 #ifndef NO_MDNS
     ids_mdns_free_mdns(&mdns);
 #endif
@@ -238,18 +296,28 @@ print_usage(char *prog_name)
     printf("\t%s [-h | --help]\n", prog_name);
     printf("\t%s -p <server_port> -i <interface> ", prog_name);
     printf("[--ipbl <blacklist>] [--dnbl <blacklist]\n");
+    printf("\t%s --replay <pcap> [-p <server_port>] ", prog_name);
+    printf("[--ipbl <blacklist>] [--dnbl <blacklist]\n");
     printf("Options:\n");
     printf("\t\t[-h | --help]:\tPrint this usage message\n");
     printf("\t\t-i <interface>: The name of the interface to capture traffic from.\n");
     printf("\t-p <server_port>:\tThe port that will be advertised via MDNS ");
     printf("(if enabled) and will accept connections from mobile devices.\n");
+    printf("\t[--metrics-port <port>]:\tServe metrics for Prometheus on ");
+    printf("this port.\n");
+    printf("\t[--replay <pcap>]:\tRead packets from a capture file as fast ");
+    printf("as possible instead of capturing, then exit.\n");
     printf("\t[--ipbl <blacklist]:\tPath to a blacklist file containing IP ");
     printf("addresses to load into the blacklist immediately.\n");
     printf("\t[--dnbl <blacklist]:\tPath to a blacklist file containing ");
     printf("domain names to load into the blacklist immediately.\n");
     printf("\t[--update-host]:\tHostname or IP address of the update server.\n");
     printf("\t[--update-port]:\tPort to connect to on the update server.\n");
-    printf("\t[--ssl-no-verify]:\tSkip verification of TLS certificates");
+    printf("\t[--ssl-no-verify]:\tSkip verification of TLS certificates\n");
+    printf("\t[--blacklist-budget <size>]:\tRefuse updates that would take ");
+    printf("the blacklists over this many bytes (k, M or G suffix allowed).\n");
+    printf("\t[--budget-truncate]:\tKeep the part of an update that fits in ");
+    printf("the budget instead of refusing it.\n");
 }
 
 /**
@@ -262,11 +330,15 @@ int parse_args(struct IdsArgs *args, int argc, char **argv)
         {"ipbl", required_argument, 0, 0},
         {"dnbl", required_argument, 0, 0},
         {"fuzz", required_argument, 0, 0},
+        {"metrics-port", required_argument, 0, 0},
+        {"replay", required_argument, 0, 0},
         {"help", no_argument, &args->help_flag, 1},
         {"update-host", required_argument, 0, 0},
         {"update-port", required_argument, 0, 0},
+        {"blacklist-budget", required_argument, 0, 0},
 #ifndef NO_UPDATES
         {"ssl-no-verify", no_argument, &args->ssl_no_verify, 1},
+        {"budget-truncate", no_argument, &args->budget_truncate, 1},
 #endif
         {0, 0, 0, 0}
     };
@@ -300,17 +372,48 @@ int parse_args(struct IdsArgs *args, int argc, char **argv)
                 if (optarg) args->fuzz_filename = optarg;
                 else return NSIDS_CMDLN;
             }
+            else if (3 == option_index)
+            {
+                if (optarg)
+                {
+                    errno = 0;
+                    parsed_ul = strtoul(optarg, &arg_end, 10);
+
+                    if (!parsed_ul || ERANGE == errno || parsed_ul > USHRT_MAX
+                            || '\0' != *arg_end)
+                    {
+                        fprintf(stderr, "Invalid port number: %s\n", optarg);
+                        return NSIDS_CMDLN;
+                    }
+                    args->metrics_port = parsed_ul;
+                }
+                else return NSIDS_CMDLN;
+            }
+            else if (4 == option_index)
+            {
+                if (optarg) args->replay_filename = optarg;
+                else return NSIDS_CMDLN;
+            }
+            else if (8 == option_index)
+            {
+                if (!optarg || mem_parse_size(optarg, &args->blacklist_budget))
+                {
+                    fprintf(stderr, "Invalid memory budget: %s\n",
+                            optarg ? optarg : "");
+                    return NSIDS_CMDLN;
+                }
+            }
 
             /**
              * Options re: the update server.
              */
 #ifndef NO_UPDATES
-            else if (4 == option_index)
+            else if (6 == option_index)
             {
                 if (optarg) args->update_server_host = optarg;
                 else return NSIDS_CMDLN;
             }
-            else if (5 == option_index)
+            else if (7 == option_index)
             {
                 if (optarg)
                 {
@@ -370,8 +473,14 @@ int parse_args(struct IdsArgs *args, int argc, char **argv)
         }
     }
 
-    // Check every required option has been received
-    if (!args->help_flag && (args->server_port <= 0 || !args->iface))
+    // Check every required option has been received. A replay needs neither
+    // an interface nor the event server.
+    if (args->help_flag) return NSIDS_OK;
+    if (args->replay_filename)
+    {
+        if (args->iface) return NSIDS_CMDLN;
+    }
+    else if (args->server_port <= 0 || !args->iface)
         return NSIDS_CMDLN;
 
     return NSIDS_OK;
@@ -508,6 +617,42 @@ setup_sigint_handling(uv_loop_t *loop, uv_signal_t *handle)
     return NSIDS_OK;
 }
 
+#ifdef ENABLE_TRACING
+/**
+ * Write the stacks of traced stages to stderr when SIGUSR1 is received.
+ */
+static void
+sigusr1_cb(uv_signal_t *handle __attribute__((unused)),
+        int signum __attribute__((unused)))
+{
+    if (0 != trace_write_folded(stderr))
+        logger(L_WARN, "Could not write trace stacks");
+    fflush(stderr);
+}
+
+/**
+ * Dump the trace stacks when the process receives SIGUSR1.
+ * @param loop An event loop
+ * @param handle An uninitialized uv_signal_t type handle
+ */
+static int
+setup_sigusr1_handling(uv_loop_t *loop, uv_signal_t *handle)
+{
+    assert(loop);
+    assert(handle);
+    int uv_rc;
+
+    if (0 > (uv_rc = uv_signal_init(loop, handle))
+            || 0 > (uv_rc = uv_signal_start(handle, sigusr1_cb, SIGUSR1)))
+    {
+        logger(L_ERROR, "Could not initialize SIGUSR1 handle: %s",
+                uv_strerror(uv_rc));
+        return NSIDS_UV;
+    }
+    return NSIDS_OK;
+}
+#endif
+
 /**
  * @brief Override the default signal handler for SIGPIPE
  *
@@ -542,8 +687,7 @@ main(int argc, char **argv)
     int n_ip_entries = 0, n_dn_entries = 0;
     struct IdsArgs args;
     int retval = -1;
-    const char *filter = "(udp dst port 53) or (tcp[tcpflags] & tcp-syn != 0\
- and tcp[tcpflags] & tcp-ack == 0)";
+    const char *filter = IDS_PCAP_FILTER;
 
 #ifndef NO_MDNS
     memset(&mdns, 0, sizeof(mdns));
@@ -569,6 +713,16 @@ main(int argc, char **argv)
 #else
     set_log_level(L_WARN);
 #endif
+    if (0 != logger_start())
+        logger(L_WARN, "Could not start the log writer, logging directly");
+
+    if (args.blacklist_budget)
+    {
+        if (!mem_accounting_enabled())
+            logger(L_WARN, "Memory sizes are unavailable on this platform, "
+                    "the blacklist budget will not be enforced");
+        mem_set_blacklist_budget(args.blacklist_budget);
+    }
 
     // pcap_io_task_setup, configure and add the pcap task to the event
     // loop here.
@@ -600,6 +754,47 @@ main(int argc, char **argv)
 
     if (NSIDS_OK != setup_domain_blacklist(&dn_bl)) goto done;
 
+    // IPv6 IoCs are only received from the update server
+    if (NULL == (ip6_bl = new_ip6_blacklist()))
+    {
+        logger(L_ERROR, "Could not allocate IPv6 blacklist");
+        goto done;
+    }
+
+    if (NULL == (ip_wl = new_ip_watchlist(IP_WATCHLIST_DEFAULT_CAPACITY)))
+    {
+        logger(L_ERROR, "Could not allocate IP watchlist");
+        goto done;
+    }
+
+    if (NULL == (tcp_dns = new_tcp_dns_tracker(TCP_DNS_DEFAULT_FLOWS,
+            TCP_DNS_DEFAULT_MEMORY)))
+    {
+        logger(L_ERROR, "Could not allocate TCP DNS tracker");
+        goto done;
+    }
+
+    if (NULL == (ip_frags = new_ip_reasm(IP_REASM_DEFAULT_DATAGRAMS,
+            IP_REASM_DEFAULT_PER_SOURCE)))
+    {
+        logger(L_ERROR, "Could not allocate IP reassembly cache");
+        goto done;
+    }
+
+    if (NULL == (tls_conns = new_tls_sni_table(TLS_SNI_DEFAULT_SLOTS)))
+    {
+        logger(L_ERROR, "Could not allocate TLS connection table");
+        goto done;
+    }
+
+#ifdef HAVE_OPENSSL
+    if (NULL == (quic_conns = new_tls_sni_table(TLS_SNI_DEFAULT_SLOTS)))
+    {
+        logger(L_ERROR, "Could not allocate QUIC flow table");
+        goto done;
+    }
+#endif
+
     if (args.domain_filename)
     {
         if (0 > (n_dn_entries = import_urlhaus_blacklist_file(args.domain_filename, dn_bl)))
@@ -612,7 +807,13 @@ main(int argc, char **argv)
     }
 
     // Setup packet capture handle
-    if (NSIDS_OK != configure_pcap(&pcap, filter, args.iface)
+    if (args.replay_filename)
+    {
+        if (NSIDS_OK != configure_pcap_replay(&pcap, filter,
+                args.replay_filename))
+            goto done;
+    }
+    else if (NSIDS_OK != configure_pcap(&pcap, filter, args.iface)
             && !IGNORE_PCAP_ERRORS) goto done;
 
     // Drop root privileges now that the pcap handle is open
@@ -633,7 +834,11 @@ main(int argc, char **argv)
         goto done;
     }
 
-    if (pcap && setup_pcap_handle(loop, &pcap_handle, pcap)) goto done;
+    if (args.replay_filename)
+    {
+        if (setup_pcap_replay(loop, &pcap_replay, pcap)) goto done;
+    }
+    else if (pcap && setup_pcap_handle(loop, &pcap_handle, pcap)) goto done;
 
 #ifdef DEBUG
     if (setup_stdin_pipe(loop)) goto done;
@@ -641,9 +846,14 @@ main(int argc, char **argv)
     if (setup_sigterm_handling(loop, &sigterm_handle)) goto done;
     if (setup_sigint_handling(loop, &sigint_handle)) goto done;
     if (setup_sigpipe()) goto done;
+#ifdef ENABLE_TRACING
+    trace_init();
+    if (setup_sigusr1_handling(loop, &sigusr1_handle)) goto done;
+#endif
 
 #ifndef NO_MDNS
-    if (ids_mdns_setup_mdns(&mdns, loop, args.server_port)) goto done;
+    if (args.server_port && ids_mdns_setup_mdns(&mdns, loop, args.server_port))
+        goto done;
 #endif
 #ifndef NO_UPDATES
     if (args.update_server_host)
@@ -652,8 +862,8 @@ main(int argc, char **argv)
         if (setup_update_context(&ids_update_ctx, loop,
                 args.update_server_host,
                 (const uint16_t) args.update_server_port,
-                args.ssl_no_verify,
-                &dn_bl, &ip_bl))
+                args.ssl_no_verify, args.budget_truncate,
+                &dn_bl, &ip_bl, &ip6_bl))
         {
             logger(L_ERROR, "Could not setup updates.");
             goto done;
@@ -667,12 +877,42 @@ main(int argc, char **argv)
     }
 #endif
 
-    if (setup_event_server(loop, &server_handle, args.server_port, event_queue)) goto done;
+    if (args.server_port && setup_event_server(loop, &server_handle,
+            args.server_port, event_queue))
+        goto done;
+
+    if (args.metrics_port)
+    {
+        struct metrics_sources sources = {
+            .pcap = pcap,
+            .events = event_queue,
+            .dn_bl = &dn_bl,
+            .ip_bl = &ip_bl,
+            .ip6_bl = &ip6_bl,
+            .ip_wl = ip_wl,
+            .tcp_dns = tcp_dns,
+            .ip_frags = ip_frags
+        };
+
+        if (setup_metrics_server(loop, &metrics_handle, args.metrics_port,
+                &sources))
+            goto done;
+    }
 
 #ifndef FUZZ_TEST
     if (0 > uv_run(loop, UV_RUN_DEFAULT)) goto done;
 #endif
 
+    if (args.replay_filename)
+    {
+        double seconds = ((pcap_replay.end ? pcap_replay.end : uv_hrtime())
+                - pcap_replay.start) / 1e9;
+
+        printf("Replayed %" PRIu64 " packets in %.3f s (%.0f packets/s)\n",
+                pcap_replay.packets, seconds,
+                seconds > 0 ? pcap_replay.packets / seconds : 0);
+    }
+
     retval = 0;
 
 done:
@@ -693,5 +933,7 @@ done:
         }
     }
     free_globals();
+    metrics_free();
+    logger_shutdown();
     return retval;
 }
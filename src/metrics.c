@@ -0,0 +1,308 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <inttypes.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+/** Describes a counter or histogram in the text format */
+struct metrics_desc
+{
+    const char *name;
+    /** The labels of this value without braces, or NULL */
+    const char *labels;
+    const char *help;
+};
+
+static const struct metrics_desc counter_descs[METRICS_COUNTER_COUNT] = {
+    [METRICS_PACKETS_TCP] = { "nsids_packets_total", "protocol=\"tcp\"",
+        "Captured packets by transport protocol" },
+    [METRICS_PACKETS_UDP] = { "nsids_packets_total", "protocol=\"udp\"", NULL },
+    [METRICS_PACKETS_OTHER] = { "nsids_packets_total", "protocol=\"other\"",
+        NULL },
+    [METRICS_IP_PACKETS_V4] = { "nsids_ip_packets_total", "version=\"4\"",
+        "Captured packets with a TCP or UDP header by IP version" },
+    [METRICS_IP_PACKETS_V6] = { "nsids_ip_packets_total", "version=\"6\"",
+        NULL },
+    [METRICS_IP_FRAGMENTS] = { "nsids_ip_fragments_total", NULL,
+        "IPv4 fragments passed to the reassembly cache" },
+    [METRICS_IP_REASSEMBLED] = { "nsids_ip_reassembled_total", NULL,
+        "IPv4 datagrams reassembled from fragments" },
+    [METRICS_DNS_MESSAGES_UDP] = { "nsids_dns_messages_total",
+        "transport=\"udp\"", "DNS messages by transport protocol" },
+    [METRICS_DNS_MESSAGES_TCP] = { "nsids_dns_messages_total",
+        "transport=\"tcp\"", NULL },
+    [METRICS_SERVER_NAMES_TLS] = { "nsids_server_names_total",
+        "protocol=\"tls\"", "Server names found in ClientHellos" },
+    [METRICS_SERVER_NAMES_QUIC] = { "nsids_server_names_total",
+        "protocol=\"quic\"", NULL },
+    [METRICS_PARSE_ERRORS_PACKET] = { "nsids_parse_errors_total",
+        "stage=\"packet\"", "Malformed packets and DNS messages" },
+    [METRICS_PARSE_ERRORS_DNS] = { "nsids_parse_errors_total",
+        "stage=\"dns\"", NULL },
+    [METRICS_LOOKUPS_DOMAIN] = { "nsids_blacklist_lookups_total",
+        "list=\"domain\"", "Lookups by blacklist" },
+    [METRICS_LOOKUPS_IP] = { "nsids_blacklist_lookups_total", "list=\"ip\"",
+        NULL },
+    [METRICS_LOOKUPS_IP6] = { "nsids_blacklist_lookups_total", "list=\"ip6\"",
+        NULL },
+    [METRICS_LOOKUPS_WATCHLIST] = { "nsids_blacklist_lookups_total",
+        "list=\"watchlist\"", NULL },
+    [METRICS_HITS_DOMAIN] = { "nsids_blacklist_hits_total", "list=\"domain\"",
+        "Lookups that found an IoC by blacklist" },
+    [METRICS_HITS_IP] = { "nsids_blacklist_hits_total", "list=\"ip\"", NULL },
+    [METRICS_HITS_IP6] = { "nsids_blacklist_hits_total", "list=\"ip6\"", NULL },
+    [METRICS_HITS_WATCHLIST] = { "nsids_blacklist_hits_total",
+        "list=\"watchlist\"", NULL },
+    [METRICS_FLOW_LOOKUPS_TLS] = { "nsids_flow_table_lookups_total",
+        "table=\"tls\"", "Lookups in the TLS connection and QUIC flow tables" },
+    [METRICS_FLOW_LOOKUPS_QUIC] = { "nsids_flow_table_lookups_total",
+        "table=\"quic\"", NULL },
+    [METRICS_FLOW_HITS_TLS] = { "nsids_flow_table_hits_total", "table=\"tls\"",
+        "Lookups whose packet was inspected for a server name" },
+    [METRICS_FLOW_HITS_QUIC] = { "nsids_flow_table_hits_total",
+        "table=\"quic\"", NULL },
+    [METRICS_EVENTS] = { "nsids_events_total", NULL,
+        "Observations added to the event list" },
+    [METRICS_UPDATES_OK] = { "nsids_updates_total", "result=\"ok\"",
+        "Update connections by result" },
+    [METRICS_UPDATES_FAILED] = { "nsids_updates_total", "result=\"failed\"",
+        NULL },
+    [METRICS_UPDATES_OVER_BUDGET] = { "nsids_updates_over_budget_total", NULL,
+        "Updates that reached the memory budget of the blacklists" },
+    [METRICS_UPDATES_DELTA] = { "nsids_updates_delta_total", NULL,
+        "Updates applied as changes to the active blacklists" },
+    [METRICS_UPDATE_BYTES_RECEIVED] = { "nsids_update_bytes_total",
+        "stage=\"received\"",
+        "Bytes of updates as received and after decompression" },
+    [METRICS_UPDATE_BYTES_DECODED] = { "nsids_update_bytes_total",
+        "stage=\"decoded\"", NULL },
+};
+
+static const struct metrics_desc histogram_descs[METRICS_HISTOGRAM_COUNT] = {
+    [METRICS_UPDATE_DURATION] = { "nsids_update_duration_seconds", NULL,
+        "Time from connecting to the update server to applying an update" },
+};
+
+/** The upper bound of each bucket, in microseconds for a duration */
+static const uint64_t histogram_bounds[METRICS_HISTOGRAM_COUNT][METRICS_BUCKETS] = {
+    [METRICS_UPDATE_DURATION] = {
+        100000, 250000, 500000, 1000000, 2500000,
+        5000000, 10000000, 30000000, 60000000, 120000000
+    },
+};
+
+/** Histogram values are divided by this when they are written */
+static const double histogram_scale[METRICS_HISTOGRAM_COUNT] = {
+    [METRICS_UPDATE_DURATION] = 1e6,
+};
+
+_Thread_local struct metrics_block *metrics_local = NULL;
+
+/** Every block that has been registered */
+static struct metrics_block *blocks = NULL;
+
+/** Used by threads that could not allocate a block of their own */
+static struct metrics_block shared_block;
+static int shared_block_linked = 0;
+
+/** Protects #blocks */
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct metrics_block *
+metrics_register(void)
+{
+    struct metrics_block *b = calloc(1, sizeof(*b));
+
+    pthread_mutex_lock(&blocks_lock);
+    if (!b)
+    {
+        b = &shared_block;
+        if (shared_block_linked) goto done;
+        shared_block_linked = 1;
+    }
+    b->next = blocks;
+    blocks = b;
+
+done:
+    pthread_mutex_unlock(&blocks_lock);
+    metrics_local = b;
+    return b;
+}
+
+/**
+ * Add to a histogram value kept by the calling thread.
+ */
+static inline void
+metrics_add_local(atomic_uint_fast64_t *v, uint64_t n)
+{
+    atomic_store_explicit(v,
+            atomic_load_explicit(v, memory_order_relaxed) + n,
+            memory_order_relaxed);
+}
+
+void
+metrics_observe(enum metrics_histogram h, uint64_t value)
+{
+    struct metrics_block *b = metrics_local ? metrics_local
+            : metrics_register();
+    unsigned int i;
+
+    for (i = 0; i < METRICS_BUCKETS; i++)
+    {
+        if (value <= histogram_bounds[h][i]) break;
+    }
+
+    metrics_add_local(&b->histograms[h].buckets[i], 1);
+    metrics_add_local(&b->histograms[h].sum, value);
+}
+
+/**
+ * The total of a value over all blocks, at the same offset within each.
+ * The caller holds #blocks_lock.
+ */
+static uint64_t
+sum_blocks(size_t offset)
+{
+    struct metrics_block *b;
+    uint64_t total = 0;
+
+    for (b = blocks; b; b = b->next)
+        total += atomic_load_explicit(
+                (atomic_uint_fast64_t *) ((char *) b + offset),
+                memory_order_relaxed);
+
+    return total;
+}
+
+uint64_t
+metrics_read(enum metrics_counter c)
+{
+    uint64_t total;
+
+    pthread_mutex_lock(&blocks_lock);
+    total = sum_blocks(offsetof(struct metrics_block, counters)
+            + c * sizeof(atomic_uint_fast64_t));
+    pthread_mutex_unlock(&blocks_lock);
+
+    return total;
+}
+
+int
+metrics_write_value(FILE *out, const char *name, const char *type,
+        const char *help, const char *labels, uint64_t value)
+{
+    if (help && 0 > fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help,
+            name, type))
+        return -1;
+
+    if (0 > fprintf(out, "%s%s%s%s %" PRIu64 "\n", name, labels ? "{" : "",
+            labels ? labels : "", labels ? "}" : "", value))
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Write a histogram. The caller holds #blocks_lock.
+ */
+static int
+write_histogram(FILE *out, enum metrics_histogram h)
+{
+    const struct metrics_desc *desc = &histogram_descs[h];
+    size_t base = offsetof(struct metrics_block, histograms)
+            + h * sizeof(struct metrics_histogram_block);
+    double scale = histogram_scale[h];
+    uint64_t count = 0;
+    unsigned int i;
+
+    if (0 > fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", desc->name,
+            desc->help, desc->name))
+        return -1;
+
+    for (i = 0; i <= METRICS_BUCKETS; i++)
+    {
+        count += sum_blocks(base + offsetof(struct metrics_histogram_block,
+                buckets) + i * sizeof(atomic_uint_fast64_t));
+
+        if (i < METRICS_BUCKETS)
+        {
+            if (0 > fprintf(out, "%s_bucket{le=\"%g\"} %" PRIu64 "\n",
+                    desc->name, histogram_bounds[h][i] / scale, count))
+                return -1;
+        }
+        else if (0 > fprintf(out, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n",
+                desc->name, count))
+            return -1;
+    }
+
+    if (0 > fprintf(out, "%s_sum %g\n%s_count %" PRIu64 "\n", desc->name,
+            sum_blocks(base + offsetof(struct metrics_histogram_block, sum))
+                / scale,
+            desc->name, count))
+        return -1;
+
+    return 0;
+}
+
+int
+metrics_write(FILE *out)
+{
+    const struct metrics_desc *desc;
+    int ret = -1;
+    unsigned int i;
+
+    pthread_mutex_lock(&blocks_lock);
+
+    for (i = 0; i < METRICS_COUNTER_COUNT; i++)
+    {
+        desc = &counter_descs[i];
+        if (0 != metrics_write_value(out, desc->name, "counter", desc->help,
+                desc->labels, sum_blocks(offsetof(struct metrics_block,
+                        counters) + i * sizeof(atomic_uint_fast64_t))))
+            goto done;
+    }
+
+    for (i = 0; i < METRICS_HISTOGRAM_COUNT; i++)
+    {
+        if (0 != write_histogram(out, i)) goto done;
+    }
+
+    ret = 0;
+
+done:
+    pthread_mutex_unlock(&blocks_lock);
+    return ret;
+}
+
+void
+metrics_free(void)
+{
+    struct metrics_block *b, *next;
+
+    pthread_mutex_lock(&blocks_lock);
+    for (b = blocks; b; b = next)
+    {
+        next = b->next;
+        if (b != &shared_block) free(b);
+    }
+    blocks = NULL;
+    memset(&shared_block, 0, sizeof(shared_block));
+    shared_block_linked = 0;
+    pthread_mutex_unlock(&blocks_lock);
+
+    metrics_local = NULL;
+}
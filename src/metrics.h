@@ -0,0 +1,226 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Runtime counters and histograms
+ *
+ * Each thread that updates a metric is given its own block of counters the
+ * first time it does so. A thread only ever writes to its own block, so an
+ * update is a plain load, add and store with no locked instruction or shared
+ * cache line. The blocks are summed when the metrics are read, which is the
+ * only time the lock on the list of blocks is taken after a thread's first
+ * update.
+ *
+ * Values that are already kept elsewhere, such as the sizes of the
+ * blacklists, are not counted here; they are read when the metrics are
+ * written. See metrics_server.h
+ */
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Counters. Counters with the same name and different labels are adjacent,
+ * see metrics.c
+ */
+enum metrics_counter
+{
+    /** Packets read with a TCP header */
+    METRICS_PACKETS_TCP,
+    /** Packets read with a UDP header */
+    METRICS_PACKETS_UDP,
+    /** Packets without a transport header of interest */
+    METRICS_PACKETS_OTHER,
+    /** IPv4 packets with a transport header of interest */
+    METRICS_IP_PACKETS_V4,
+    /** IPv6 packets with a transport header of interest */
+    METRICS_IP_PACKETS_V6,
+    /** Fragments passed to the reassembly cache */
+    METRICS_IP_FRAGMENTS,
+    /** Datagrams completed by the reassembly cache */
+    METRICS_IP_REASSEMBLED,
+    /** DNS messages carried over UDP */
+    METRICS_DNS_MESSAGES_UDP,
+    /** DNS messages reassembled from TCP */
+    METRICS_DNS_MESSAGES_TCP,
+    /** Server names found in TLS ClientHellos */
+    METRICS_SERVER_NAMES_TLS,
+    /** Server names found in QUIC Initial packets */
+    METRICS_SERVER_NAMES_QUIC,
+    /** Packets that could not be read */
+    METRICS_PARSE_ERRORS_PACKET,
+    /** Malformed DNS messages and names */
+    METRICS_PARSE_ERRORS_DNS,
+    /** Lookups in the domain blacklist */
+    METRICS_LOOKUPS_DOMAIN,
+    /** Lookups in the IPv4 blacklist */
+    METRICS_LOOKUPS_IP,
+    /** Lookups in the IPv6 blacklist */
+    METRICS_LOOKUPS_IP6,
+    /** Lookups in the watchlist */
+    METRICS_LOOKUPS_WATCHLIST,
+    /** Hits in the domain blacklist */
+    METRICS_HITS_DOMAIN,
+    /** Hits in the IPv4 blacklist */
+    METRICS_HITS_IP,
+    /** Hits in the IPv6 blacklist */
+    METRICS_HITS_IP6,
+    /** Hits in the watchlist */
+    METRICS_HITS_WATCHLIST,
+    /** Data segments of connections to port 443 looked up in the TLS
+     * connection table */
+    METRICS_FLOW_LOOKUPS_TLS,
+    /** QUIC packets looked up in the QUIC flow table */
+    METRICS_FLOW_LOOKUPS_QUIC,
+    /** Data segments that were the first of a connection with a recorded
+     * SYN, and so were inspected */
+    METRICS_FLOW_HITS_TLS,
+    /** QUIC packets that were the first of their flow, and so were
+     * inspected */
+    METRICS_FLOW_HITS_QUIC,
+    /** Observations added to the event list */
+    METRICS_EVENTS,
+    /** Updates that were applied */
+    METRICS_UPDATES_OK,
+    /** Update connections that closed before an update was applied */
+    METRICS_UPDATES_FAILED,
+    /** Updates that reached the memory budget of the blacklists, and were
+     * refused or truncated */
+    METRICS_UPDATES_OVER_BUDGET,
+    /** Updates that were applied as changes to the active blacklists */
+    METRICS_UPDATES_DELTA,
+    /** Bytes of updates received from the update server */
+    METRICS_UPDATE_BYTES_RECEIVED,
+    /** Bytes of updates after they were decompressed */
+    METRICS_UPDATE_BYTES_DECODED,
+    METRICS_COUNTER_COUNT
+};
+
+/** Histograms */
+enum metrics_histogram
+{
+    /** The time from the start of an update connection until the update is
+     * applied */
+    METRICS_UPDATE_DURATION,
+    METRICS_HISTOGRAM_COUNT
+};
+
+/** The number of buckets in each histogram, not counting +Inf */
+#define METRICS_BUCKETS 10
+
+/** The histograms of a single thread */
+struct metrics_histogram_block
+{
+    /** The number of observations no greater than each bound. Not
+     * cumulative. */
+    atomic_uint_fast64_t buckets[METRICS_BUCKETS + 1];
+    /** The sum of the observations */
+    atomic_uint_fast64_t sum;
+};
+
+/**
+ * The metrics of a single thread. Only written by that thread.
+ */
+struct metrics_block
+{
+    atomic_uint_fast64_t counters[METRICS_COUNTER_COUNT];
+    struct metrics_histogram_block histograms[METRICS_HISTOGRAM_COUNT];
+    /** The next block in the list of all blocks */
+    struct metrics_block *next;
+};
+
+/** The block of the calling thread, or NULL before its first update */
+extern _Thread_local struct metrics_block *metrics_local;
+
+/**
+ * Allocate a block for the calling thread and add it to the list of all
+ * blocks. Called by the first update made by a thread.
+ *
+ * @return The block of the calling thread. Never NULL: if a block cannot be
+ * allocated, a block shared by such threads is returned.
+ */
+struct metrics_block *
+metrics_register(void);
+
+/**
+ * Add to a counter value kept by the calling thread.
+ */
+static inline void
+metrics_add(enum metrics_counter c, uint64_t n)
+{
+    struct metrics_block *b = metrics_local ? metrics_local
+            : metrics_register();
+
+    // Only this thread writes the block, so a relaxed load and store are
+    // enough, and are compiled to plain moves
+    atomic_store_explicit(&b->counters[c],
+            atomic_load_explicit(&b->counters[c], memory_order_relaxed) + n,
+            memory_order_relaxed);
+}
+
+/**
+ * Add one to a counter.
+ */
+static inline void
+metrics_inc(enum metrics_counter c)
+{
+    metrics_add(c, 1);
+}
+
+/**
+ * Add an observation to a histogram.
+ *
+ * @param value The observation, in microseconds for a duration
+ */
+void
+metrics_observe(enum metrics_histogram h, uint64_t value);
+
+/**
+ * The total of a counter over all threads.
+ */
+uint64_t
+metrics_read(enum metrics_counter c);
+
+/**
+ * Write every counter and histogram in the Prometheus text format.
+ *
+ * @return 0 if successful, -1 if writing to \p out failed
+ */
+int
+metrics_write(FILE *out);
+
+/**
+ * Write a single value in the Prometheus text format, for values that are
+ * not counted by this module.
+ *
+ * @param name The name of the metric
+ * @param type "gauge" or "counter"
+ * @param help The description of the metric, or NULL if the metric has the
+ * same name as the previous one written and only differs in its labels
+ * @param labels The labels of the value without braces, or NULL
+ * @return 0 if successful, -1 if writing to \p out failed
+ */
+int
+metrics_write_value(FILE *out, const char *name, const char *type,
+        const char *help, const char *labels, uint64_t value);
+
+/**
+ * Free the blocks of all threads. Must not be called while any thread may
+ * update a metric.
+ */
+void
+metrics_free(void);
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,480 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/logging.h"
+#include "utils/mem.h"
+#include "metrics.h"
+#include "metrics_server.h"
+#include "trace.h"
+
+/** The path that the trace stacks are served on */
+#define MS_TRACE_PATH "/trace"
+
+/** The maximum number of concurrent connections to the server */
+#define MS_MAX_CONNS 8
+
+/** The maximum length of the request headers. Longer requests are closed
+ * without a response. */
+#define MS_REQ_MAX 2048
+
+/** How long a client has to send its request, in milliseconds */
+#define MS_REQ_TIMEOUT_MS 5000
+
+/** How often clients are checked for timeouts */
+#define MS_REQ_POLL_MS 1000
+
+static const char *ms_header = "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Connection: close\r\n\r\n";
+
+static const char *ms_error = "HTTP/1.0 500 Internal Server Error\r\n"
+        "Connection: close\r\n\r\n";
+
+/**
+ * A client connection to the metrics server.
+ *
+ * The TCP handle must be the first member so that the handle passed to libuv
+ * callbacks can be cast back to the client.
+ */
+typedef struct ms_client_s
+{
+    /** The TCP connection to the client */
+    uv_tcp_t tcp;
+    /** The time that the connection was accepted, from uv_now() */
+    uint64_t accepted_at;
+    /** The request received so far */
+    char req[MS_REQ_MAX];
+    /** The number of bytes in #req */
+    size_t req_len;
+    /** Non-zero once a response has been started */
+    int responded;
+    /** The response, or NULL. Freed when the client is closed. */
+    char *out;
+    /** Writes the response to the client */
+    uv_write_t write_req;
+    /** Shuts down the connection once the response has been written */
+    uv_shutdown_t shutdown_req;
+    /** Previous client awaiting a request */
+    struct ms_client_s *prev;
+    /** Next client awaiting a request */
+    struct ms_client_s *next;
+} ms_client_t;
+
+/**
+ * State shared by all connections to the metrics server
+ */
+typedef struct ms_server_s
+{
+    /** The structures that values are read from */
+    struct metrics_sources sources;
+    /** Periodically checks whether #pending clients have timed out */
+    uv_timer_t req_timer;
+    /** Clients that have not yet sent a complete request */
+    ms_client_t *pending;
+    /** The number of open connections */
+    unsigned int conns;
+} ms_server_t;
+
+static ms_server_t ms_server;
+
+static void
+ms_client_unlink(ms_client_t *client)
+{
+    if (client->prev)
+        client->prev->next = client->next;
+    else if (ms_server.pending == client)
+        ms_server.pending = client->next;
+    if (client->next)
+        client->next->prev = client->prev;
+
+    client->prev = NULL;
+    client->next = NULL;
+
+    if (!ms_server.pending) uv_timer_stop(&ms_server.req_timer);
+}
+
+static void
+ms_on_client_close(uv_handle_t *handle)
+{
+    ms_client_t *client = (ms_client_t *) handle;
+
+    ms_server.conns--;
+    free(client->out);
+    free(client);
+}
+
+static void
+ms_client_close(ms_client_t *client)
+{
+    ms_client_unlink(client);
+    if (!uv_is_closing((uv_handle_t *) client))
+        uv_close((uv_handle_t *) client, ms_on_client_close);
+}
+
+static void
+ms_shutdown_cb(uv_shutdown_t *req, int status __attribute__((unused)))
+{
+    ms_client_t *client = (ms_client_t *) req->handle;
+
+    if (!uv_is_closing((uv_handle_t *) client))
+        uv_close((uv_handle_t *) client, ms_on_client_close);
+}
+
+static void
+ms_write_cb(uv_write_t *req __attribute__((unused)), int status)
+{
+    if (status && UV_ECANCELED != status)
+        logger(L_WARN, "metrics server: write error: %s", uv_strerror(status));
+}
+
+/**
+ * Write the memory allocated to each account, see utils/mem.h. The sizes are
+ * left out if the allocator cannot report them.
+ *
+ * @return 0 if successful, -1 if writing to \p out failed
+ */
+static int
+ms_write_memory(FILE *out)
+{
+    char labels[64];
+    unsigned int a;
+
+    for (a = 0; a < MEM_ACCOUNT_COUNT; a++)
+    {
+        snprintf(labels, sizeof(labels), "account=\"%s\"",
+                mem_account_names[a]);
+        if (metrics_write_value(out, "nsids_memory_allocations_total",
+                "counter", a ? NULL : "Allocations by subsystem", labels,
+                mem_allocations(a)))
+            return -1;
+    }
+
+    if (!mem_accounting_enabled()) return 0;
+
+    for (a = 0; a < MEM_ACCOUNT_COUNT; a++)
+    {
+        snprintf(labels, sizeof(labels), "account=\"%s\"",
+                mem_account_names[a]);
+        if (metrics_write_value(out, "nsids_memory_bytes", "gauge",
+                a ? NULL : "Bytes allocated by subsystem", labels,
+                mem_in_use(a)))
+            return -1;
+    }
+    for (a = 0; a < MEM_ACCOUNT_COUNT; a++)
+    {
+        snprintf(labels, sizeof(labels), "account=\"%s\"",
+                mem_account_names[a]);
+        if (metrics_write_value(out, "nsids_memory_peak_bytes", "gauge",
+                a ? NULL : "The most bytes allocated at once by subsystem",
+                labels, mem_peak(a)))
+            return -1;
+    }
+
+    if (mem_blacklist_budget() && metrics_write_value(out,
+            "nsids_blacklist_memory_budget_bytes", "gauge",
+            "The memory budget of the blacklists", NULL,
+            mem_blacklist_budget()))
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Write the values that are read from other structures rather than counted.
+ *
+ * @return 0 if successful, -1 if writing to \p out failed
+ */
+static int
+ms_write_sources(FILE *out, const struct metrics_sources *src)
+{
+    const struct ids_event *event;
+    struct pcap_stat ps;
+    uint64_t events = 0;
+    const char *help = "Entries by blacklist";
+
+    if (src->events)
+    {
+        for (event = src->events->head; event; event = event->next) events++;
+        if (metrics_write_value(out, "nsids_event_list_events", "gauge",
+                "Events in the event list", NULL, events))
+            return -1;
+    }
+
+    // Only the first of the blacklist values carries the help text
+    if (src->dn_bl && *src->dn_bl)
+    {
+        if (metrics_write_value(out, "nsids_blacklist_entries", "gauge", help,
+                "list=\"domain\"", hattrie_size(*src->dn_bl)))
+            return -1;
+        help = NULL;
+    }
+    if (src->ip_bl && *src->ip_bl)
+    {
+        if (metrics_write_value(out, "nsids_blacklist_entries", "gauge", help,
+                "list=\"ip\"", ip_blacklist_count(*src->ip_bl)))
+            return -1;
+        help = NULL;
+    }
+    if (src->ip6_bl && *src->ip6_bl)
+    {
+        if (metrics_write_value(out, "nsids_blacklist_entries", "gauge", help,
+                "list=\"ip6\"", ip6_blacklist_count(*src->ip6_bl)))
+            return -1;
+        help = NULL;
+    }
+    if (src->ip_wl)
+    {
+        if (metrics_write_value(out, "nsids_blacklist_entries", "gauge", help,
+                "list=\"watchlist\"", ip_watchlist_count(src->ip_wl)))
+            return -1;
+    }
+
+    if (src->tcp_dns && metrics_write_value(out, "nsids_tcp_dns_flows",
+            "gauge", "TCP DNS flows being tracked", NULL,
+            tcp_dns_tracker_count(src->tcp_dns)))
+        return -1;
+
+    if (src->ip_frags && metrics_write_value(out, "nsids_ip_reassembly_datagrams",
+            "gauge", "IPv4 datagrams being reassembled", NULL,
+            ip_reasm_count(src->ip_frags)))
+        return -1;
+
+    // The counts are those of the capture handle, which wrap on some
+    // platforms
+    if (src->pcap && 0 == pcap_stats(src->pcap, &ps))
+    {
+        if (metrics_write_value(out, "nsids_pcap_received_total", "counter",
+                    "Packets received by the capture", NULL, ps.ps_recv)
+                || metrics_write_value(out, "nsids_pcap_dropped_total",
+                    "counter", "Packets dropped because the capture buffer "
+                    "was full", NULL, ps.ps_drop)
+                || metrics_write_value(out, "nsids_pcap_interface_dropped_total",
+                    "counter", "Packets dropped by the interface", NULL,
+                    ps.ps_ifdrop))
+            return -1;
+    }
+
+    return ms_write_memory(out);
+}
+
+#ifdef ENABLE_TRACING
+/**
+ * Whether a request is for the trace stacks rather than the metrics.
+ */
+static int
+ms_is_trace_request(const char *req)
+{
+    static const char *path = "GET " MS_TRACE_PATH;
+    size_t len = strlen(path);
+
+    return 0 == strncmp(req, path, len)
+            && (' ' == req[len] || '?' == req[len]);
+}
+#endif
+
+/**
+ * Write the metrics to a client and close the connection once they have
+ * been written.
+ */
+static void
+ms_client_respond(ms_client_t *client)
+{
+    FILE *out;
+    size_t len = 0;
+    int err = 0;
+    uv_buf_t buf;
+
+    client->responded = 1;
+    ms_client_unlink(client);
+    uv_read_stop((uv_stream_t *) client);
+
+    if (NULL == (out = open_memstream(&client->out, &len)))
+    {
+        err = 1;
+    }
+    else
+    {
+        if (0 > fputs(ms_header, out)) err = 1;
+#ifdef ENABLE_TRACING
+        if (ms_is_trace_request(client->req))
+        {
+            if (!err && 0 != trace_write_folded(out)) err = 1;
+        }
+        else
+        {
+            if (!err && 0 != metrics_write(out)) err = 1;
+            if (!err && 0 != ms_write_sources(out, &ms_server.sources))
+                err = 1;
+            if (!err && 0 != trace_write_metrics(out)) err = 1;
+        }
+#else
+        if (!err && 0 != metrics_write(out)) err = 1;
+        if (!err && 0 != ms_write_sources(out, &ms_server.sources)) err = 1;
+#endif
+        if (0 != fclose(out)) err = 1;
+    }
+
+    if (err)
+    {
+        logger(L_ERROR, "metrics server: could not write the metrics");
+        buf = uv_buf_init((char *) ms_error, strlen(ms_error));
+    }
+    else
+        buf = uv_buf_init(client->out, len);
+
+    if (0 > uv_write(&client->write_req, (uv_stream_t *) client, &buf, 1,
+            ms_write_cb)
+            || 0 > uv_shutdown(&client->shutdown_req, (uv_stream_t *) client,
+            ms_shutdown_cb))
+        ms_client_close(client);
+}
+
+/**
+ * Read the request directly into the client structure. Leaves space for a
+ * NULL terminator.
+ */
+static void
+ms_alloc_req(uv_handle_t *handle, size_t suggested_size __attribute__((unused)),
+        uv_buf_t *buf)
+{
+    ms_client_t *client = (ms_client_t *) handle;
+
+    buf->base = client->req + client->req_len;
+    buf->len = sizeof(client->req) - client->req_len - 1;
+}
+
+static void
+ms_read_req(uv_stream_t *stream, ssize_t nread,
+        const uv_buf_t *buf __attribute__((unused)))
+{
+    ms_client_t *client = (ms_client_t *) stream;
+
+    if (client->responded) return;
+
+    if (nread < 0)
+    {
+        if (UV_EOF != nread)
+            logger(L_WARN, "metrics server: read error: %s",
+                    uv_strerror(nread));
+        ms_client_close(client);
+        return;
+    }
+
+    client->req_len += nread;
+    client->req[client->req_len] = '\0';
+
+    // Any path gets the metrics, so only the end of the headers matters
+    if (strstr(client->req, "\r\n\r\n") || strstr(client->req, "\n\n"))
+        ms_client_respond(client);
+    else if (client->req_len >= sizeof(client->req) - 1)
+    {
+        logger(L_WARN, "metrics server: request too long");
+        ms_client_close(client);
+    }
+}
+
+static void
+ms_req_timer_cb(uv_timer_t *timer)
+{
+    uint64_t now = uv_now(timer->loop);
+    ms_client_t *client = ms_server.pending, *next;
+
+    while (client)
+    {
+        next = client->next;
+        if (now - client->accepted_at >= MS_REQ_TIMEOUT_MS)
+            ms_client_close(client);
+        client = next;
+    }
+}
+
+static void
+ms_on_new_connection(uv_stream_t *server, int status)
+{
+    ms_client_t *client = NULL;
+    int err;
+
+    if (0 > (err = status)) goto msg;
+    if (NULL == (client = calloc(1, sizeof(*client))))
+    {
+        logger(L_ERROR, "metrics server: could not allocate client");
+        return;
+    }
+    if (0 != (err = uv_tcp_init(server->loop, &client->tcp)))
+    {
+        free(client);
+        goto msg;
+    }
+    ms_server.conns++;
+
+    if (0 != (err = uv_accept(server, (uv_stream_t *) client))) goto close;
+
+    if (ms_server.conns > MS_MAX_CONNS)
+    {
+        logger(L_WARN, "metrics server: too many connections");
+        goto close;
+    }
+
+    client->accepted_at = uv_now(server->loop);
+    if (0 != (err = uv_read_start((uv_stream_t *) client, ms_alloc_req,
+            ms_read_req)))
+        goto close;
+
+    if (!ms_server.pending)
+        uv_timer_start(&ms_server.req_timer, ms_req_timer_cb,
+                MS_REQ_POLL_MS, MS_REQ_POLL_MS);
+    client->next = ms_server.pending;
+    if (client->next) client->next->prev = client;
+    ms_server.pending = client;
+    return;
+
+close:
+    ms_client_close(client);
+    if (!err) return;
+msg:
+    logger(L_ERROR, "metrics server: connection error: %s", uv_strerror(err));
+}
+
+int
+setup_metrics_server(uv_loop_t *loop, uv_tcp_t *handle, int port,
+        const struct metrics_sources *sources)
+{
+    assert(loop);
+    assert(handle);
+    assert(port);
+    assert(sources);
+
+    struct sockaddr_in server_addr;
+
+    memset(&ms_server, 0, sizeof(ms_server));
+    ms_server.sources = *sources;
+    if (0 != uv_timer_init(loop, &ms_server.req_timer)) goto error;
+
+    if (0 != uv_tcp_init(loop, handle)) goto error;
+    handle->data = &ms_server;
+    if (0 != uv_ip4_addr("0.0.0.0", port, &server_addr)) goto error;
+    if (0 != uv_tcp_bind(handle, (const struct sockaddr *) &server_addr, 0))
+        goto error;
+    if (0 != uv_listen((uv_stream_t *) handle, MS_MAX_CONNS,
+            ms_on_new_connection))
+        goto error;
+    return 0;
+
+error:
+    logger(L_ERROR, "Could not setup uv_tcp_t handle for metrics server");
+    return -1;
+}
@@ -0,0 +1,70 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Serves the metrics over HTTP in the Prometheus text format
+ *
+ * A request for any path is answered with the counters and histograms of
+ * metrics.h, followed by values read from the structures in #metrics_sources
+ * at the time of the request: the number of events in the event list, the
+ * number of entries in each blacklist, the sizes of the reassembly tables and
+ * the packet statistics of the capture.
+ *
+ * If tracing is compiled in (see trace.h), the metrics include the latency
+ * histograms of the stages of the packet handler, and a request for `/trace`
+ * is answered with the stacks of stages in the folded format instead.
+ */
+#ifndef SRC_METRICS_SERVER_H_
+#define SRC_METRICS_SERVER_H_
+
+#include <pcap/pcap.h>
+#include <uv.h>
+
+#include "ids_event_list.h"
+#include "ip_reasm.h"
+#include "tcp_dns.h"
+#include "blacklist/domain_blacklist.h"
+#include "blacklist/ip_blacklist.h"
+#include "blacklist/ip6_blacklist.h"
+#include "blacklist/ip_watchlist.h"
+
+/**
+ * The structures that values are read from when the metrics are requested.
+ * Any member may be NULL. The blacklists are given as pointers to the
+ * pointers that the updates replace.
+ */
+struct metrics_sources
+{
+    pcap_t *pcap;
+    struct ids_event_list *events;
+    domain_blacklist **dn_bl;
+    ip_blacklist **ip_bl;
+    ip6_blacklist **ip6_bl;
+    ip_watchlist *ip_wl;
+    tcp_dns_tracker *tcp_dns;
+    ip_reasm *ip_frags;
+};
+
+/**
+ * Sets up libuv variables for the metrics server.
+ *
+ * @param loop The main event loop of the IDS
+ * @param handle The address of an uninitialized uv_tcp_t structure
+ * @param port The TCP port for the server to listen on
+ * @param sources The structures to read values from. Copied.
+ * @return 0 if successful, -1 on error
+ */
+int
+setup_metrics_server(uv_loop_t *loop, uv_tcp_t *handle, int port,
+        const struct metrics_sources *sources);
+
+#endif /* SRC_METRICS_SERVER_H_ */
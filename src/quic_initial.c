@@ -0,0 +1,384 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <config.h>
+
+#ifdef HAVE_OPENSSL
+
+#include <assert.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "utils/logging.h"
+#include "quic_initial.h"
+#include "tls_sni.h"
+
+#define QUIC_VERSION_1 0x00000001
+
+#define MAX_CID_LEN 20
+
+/** The length of the ciphertext sampled for header protection */
+#define HP_SAMPLE_LEN 16
+
+/** The length of the AEAD_AES_128_GCM authentication tag */
+#define TAG_LEN 16
+
+#define KEY_LEN 16
+#define IV_LEN 12
+#define SECRET_LEN 32
+
+/** The maximum number of CRYPTO frames collected from one packet */
+#define MAX_CRYPTO_FRAMES 32
+
+#define FRAME_PADDING 0x00
+#define FRAME_PING 0x01
+#define FRAME_ACK 0x02
+#define FRAME_ACK_ECN 0x03
+#define FRAME_CRYPTO 0x06
+#define FRAME_CONNECTION_CLOSE 0x1c
+
+/** RFC 9001 section 5.2 */
+static const uint8_t initial_salt[] = {
+    0x38, 0x76, 0x2c, 0xf7, 0xf5, 0x59, 0x34, 0xb3, 0x4d, 0x17,
+    0x9a, 0xe6, 0xa4, 0xc8, 0x0c, 0xad, 0xcc, 0xbb, 0x7f, 0x0a
+};
+
+/**
+ * The keys protecting the packets sent by the client
+ */
+struct quic_keys
+{
+    uint8_t key[KEY_LEN];
+    uint8_t iv[IV_LEN];
+    uint8_t hp[KEY_LEN];
+};
+
+/**
+ * A CRYPTO frame within the decrypted payload
+ */
+struct crypto_frame
+{
+    uint64_t offset;
+    uint64_t len;
+    const uint8_t *data;
+};
+
+/**
+ * Read a variable-length integer (RFC 9000 section 16), moving \p pos past it.
+ *
+ * @return 0 if successful, -1 if it runs past \p end
+ */
+static int
+get_varint(const uint8_t **pos, const uint8_t *end, uint64_t *out)
+{
+    size_t n, i;
+
+    if (*pos >= end) return -1;
+    n = (size_t) 1 << (**pos >> 6);
+    if ((size_t) (end - *pos) < n) return -1;
+
+    *out = **pos & 0x3f;
+    for (i = 1; i < n; i++) *out = *out << 8 | (*pos)[i];
+    *pos += n;
+    return 0;
+}
+
+/**
+ * HKDF-Expand-Label from TLS 1.3 with an empty context, for outputs of up to
+ * one SHA-256 block.
+ */
+static int
+hkdf_expand_label(const uint8_t *secret, const char *label, uint8_t *out,
+        size_t out_len)
+{
+    static const char prefix[] = "tls13 ";
+    uint8_t info[2 + 1 + sizeof(prefix) - 1 + 32 + 1 + 1];
+    uint8_t block[SECRET_LEN];
+    unsigned int block_len;
+    size_t label_len = strlen(label), n = 0;
+
+    assert(out_len <= SECRET_LEN);
+    assert(label_len <= 32);
+
+    info[n++] = (uint8_t) (out_len >> 8);
+    info[n++] = (uint8_t) out_len;
+    info[n++] = (uint8_t) (sizeof(prefix) - 1 + label_len);
+    memcpy(info + n, prefix, sizeof(prefix) - 1);
+    n += sizeof(prefix) - 1;
+    memcpy(info + n, label, label_len);
+    n += label_len;
+    info[n++] = 0;      // Empty context
+    info[n++] = 1;      // HKDF-Expand block counter
+
+    if (!HMAC(EVP_sha256(), secret, SECRET_LEN, info, n, block, &block_len))
+        return -1;
+
+    memcpy(out, block, out_len);
+    return 0;
+}
+
+/**
+ * Derive the client's Initial keys from the Destination Connection ID.
+ */
+static int
+derive_keys(const uint8_t *dcid, size_t dcid_len, struct quic_keys *keys)
+{
+    uint8_t initial_secret[SECRET_LEN], client_secret[SECRET_LEN];
+    unsigned int secret_len;
+
+    // HKDF-Extract
+    if (!HMAC(EVP_sha256(), initial_salt, sizeof(initial_salt), dcid, dcid_len,
+            initial_secret, &secret_len))
+        return -1;
+
+    if (hkdf_expand_label(initial_secret, "client in", client_secret,
+            SECRET_LEN))
+        return -1;
+
+    if (hkdf_expand_label(client_secret, "quic key", keys->key, KEY_LEN)
+            || hkdf_expand_label(client_secret, "quic iv", keys->iv, IV_LEN)
+            || hkdf_expand_label(client_secret, "quic hp", keys->hp, KEY_LEN))
+        return -1;
+
+    return 0;
+}
+
+/**
+ * Compute the header protection mask from a sample of the ciphertext.
+ */
+static int
+header_mask(const uint8_t *hp, const uint8_t *sample, uint8_t *mask)
+{
+    EVP_CIPHER_CTX *ctx;
+    int len, rc = -1;
+
+    if (NULL == (ctx = EVP_CIPHER_CTX_new())) return -1;
+
+    if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_ecb(), NULL, hp, NULL))
+        goto done;
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    if (1 != EVP_EncryptUpdate(ctx, mask, &len, sample, HP_SAMPLE_LEN))
+        goto done;
+
+    rc = 0;
+
+done:
+    EVP_CIPHER_CTX_free(ctx);
+    return rc;
+}
+
+/**
+ * Decrypt and authenticate the payload of a packet.
+ *
+ * @return 0 if successful, -1 if the packet could not be authenticated
+ */
+static int
+decrypt_payload(const struct quic_keys *keys, const uint8_t *nonce,
+        const uint8_t *aad, size_t aad_len, const uint8_t *ct, size_t ct_len,
+        uint8_t *out)
+{
+    EVP_CIPHER_CTX *ctx;
+    int len, rc = -1;
+
+    if (NULL == (ctx = EVP_CIPHER_CTX_new())) return -1;
+
+    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, keys->key,
+            nonce))
+        goto done;
+    if (1 != EVP_DecryptUpdate(ctx, NULL, &len, aad, aad_len)) goto done;
+    if (1 != EVP_DecryptUpdate(ctx, out, &len, ct, ct_len - TAG_LEN))
+        goto done;
+    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_LEN,
+            (void *) (ct + ct_len - TAG_LEN)))
+        goto done;
+    if (1 != EVP_DecryptFinal_ex(ctx, out + len, &len)) goto done;
+
+    rc = 0;
+
+done:
+    EVP_CIPHER_CTX_free(ctx);
+    return rc;
+}
+
+/**
+ * Collect the CRYPTO frames of a decrypted payload.
+ *
+ * @return The number of frames stored in \p frames
+ */
+static size_t
+collect_crypto_frames(const uint8_t *pos, const uint8_t *end,
+        struct crypto_frame *frames)
+{
+    uint64_t type, n, i, ignored;
+    size_t count = 0;
+
+    while (pos < end && count < MAX_CRYPTO_FRAMES)
+    {
+        if (get_varint(&pos, end, &type)) break;
+
+        switch (type)
+        {
+        case FRAME_PADDING:
+        case FRAME_PING:
+            break;
+        case FRAME_ACK:
+        case FRAME_ACK_ECN:
+            // Largest acknowledged, delay, range count, first range
+            if (get_varint(&pos, end, &ignored)
+                    || get_varint(&pos, end, &ignored)
+                    || get_varint(&pos, end, &n)
+                    || get_varint(&pos, end, &ignored))
+                return count;
+            // Gap and length of each further range, and the ECN counts
+            n = n * 2 + (FRAME_ACK_ECN == type ? 3 : 0);
+            for (i = 0; i < n; i++)
+                if (get_varint(&pos, end, &ignored)) return count;
+            break;
+        case FRAME_CRYPTO:
+            if (get_varint(&pos, end, &frames[count].offset)
+                    || get_varint(&pos, end, &frames[count].len)
+                    || (uint64_t) (end - pos) < frames[count].len)
+                return count;
+            frames[count].data = pos;
+            pos += frames[count].len;
+            count++;
+            break;
+        case FRAME_CONNECTION_CLOSE:
+        default:
+            // No other frames may carry the ClientHello
+            return count;
+        }
+    }
+
+    return count;
+}
+
+/**
+ * Join the CRYPTO frames that start at offset zero, which may be in any
+ * order within the packet.
+ *
+ * @return The number of contiguous bytes copied to \p out
+ */
+static size_t
+assemble_crypto(const struct crypto_frame *frames, size_t count,
+        uint8_t *out, size_t out_sz)
+{
+    size_t have = 0, i;
+    int progress = 1;
+
+    while (progress)
+    {
+        progress = 0;
+        for (i = 0; i < count; i++)
+        {
+            uint64_t start = frames[i].offset, stop = start + frames[i].len;
+
+            if (start > have || stop <= have) continue;
+            if (stop > out_sz) stop = out_sz;
+            if (stop <= have) continue;
+
+            memcpy(out + have, frames[i].data + (have - start), stop - have);
+            have = stop;
+            progress = 1;
+        }
+    }
+
+    return have;
+}
+
+int
+quic_initial_sni(const uint8_t *data, size_t len, char *buf, size_t buf_sz)
+{
+    assert(data || !len);
+    assert(buf);
+
+    uint8_t pkt[QUIC_INITIAL_MAX_LEN], plain[QUIC_INITIAL_MAX_LEN];
+    uint8_t crypto[QUIC_INITIAL_MAX_LEN];
+    uint8_t mask[HP_SAMPLE_LEN], nonce[IV_LEN];
+    struct crypto_frame frames[MAX_CRYPTO_FRAMES];
+    struct quic_keys keys;
+    const uint8_t *pos = data, *end = data + len, *dcid;
+    uint64_t token_len, length, pn = 0;
+    size_t dcid_len, scid_len, pn_offset, pn_len, pkt_len, hdr_len, i;
+    size_t crypto_len, count;
+
+    if (!buf_sz) return -1;
+    buf[0] = '\0';
+
+    // Long header, fixed bit set, Initial packet type
+    if (len < 6 || 0xc0 != (data[0] & 0xf0)) return -1;
+    if (QUIC_VERSION_1 != ((uint32_t) data[1] << 24 | (uint32_t) data[2] << 16
+            | (uint32_t) data[3] << 8 | data[4]))
+        return -1;
+    pos += 5;
+
+    dcid_len = *pos++;
+    if (dcid_len > MAX_CID_LEN || (size_t) (end - pos) < dcid_len + 1)
+        return -1;
+    dcid = pos;
+    pos += dcid_len;
+
+    scid_len = *pos++;
+    if (scid_len > MAX_CID_LEN || (size_t) (end - pos) < scid_len) return -1;
+    pos += scid_len;
+
+    if (get_varint(&pos, end, &token_len)) return -1;
+    if ((uint64_t) (end - pos) < token_len) return -1;
+    pos += token_len;
+
+    // The length covers the packet number and the protected payload
+    if (get_varint(&pos, end, &length)) return -1;
+    if ((uint64_t) (end - pos) < length) return -1;
+
+    pn_offset = pos - data;
+    pkt_len = pn_offset + length;
+    if (pkt_len > sizeof(pkt)) return -1;
+    // The sample starts four bytes after the start of the packet number
+    if (length < 4 + HP_SAMPLE_LEN) return -1;
+
+    if (derive_keys(dcid, dcid_len, &keys)) return -1;
+
+    // Remove header protection (RFC 9001 section 5.4) from a copy
+    memcpy(pkt, data, pkt_len);
+    if (header_mask(keys.hp, pkt + pn_offset + 4, mask)) return -1;
+    pkt[0] ^= mask[0] & 0x0f;
+    pn_len = (pkt[0] & 0x03) + 1;
+    for (i = 0; i < pn_len; i++)
+    {
+        pkt[pn_offset + i] ^= mask[1 + i];
+        pn = pn << 8 | pkt[pn_offset + i];
+    }
+
+    hdr_len = pn_offset + pn_len;
+    if (pkt_len - hdr_len < TAG_LEN) return -1;
+
+    memcpy(nonce, keys.iv, IV_LEN);
+    for (i = 0; i < 8; i++) nonce[IV_LEN - 1 - i] ^= (uint8_t) (pn >> (8 * i));
+
+    if (decrypt_payload(&keys, nonce, pkt, hdr_len, pkt + hdr_len,
+            pkt_len - hdr_len, plain))
+    {
+        logger(L_DEBUG, "quic_initial_sni(): could not decrypt Initial packet");
+        return -1;
+    }
+
+    count = collect_crypto_frames(plain, plain + pkt_len - hdr_len - TAG_LEN,
+            frames);
+    crypto_len = assemble_crypto(frames, count, crypto, sizeof(crypto));
+    if (!crypto_len) return 0;
+
+    return tls_sni_parse_handshake(crypto, crypto_len, buf, buf_sz);
+}
+
+#endif /* HAVE_OPENSSL */
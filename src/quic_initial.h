@@ -0,0 +1,52 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Extraction of the server name from a QUIC Initial packet
+ *
+ * The first packet a QUIC client sends is an Initial packet carrying the TLS
+ * ClientHello in CRYPTO frames. It is encrypted, but with keys derived only
+ * from the Destination Connection ID in its header (RFC 9001 section 5.2),
+ * so anyone who sees the packet can decrypt it and read the server name.
+ *
+ * Only QUIC version 1 is supported, and only the part of the ClientHello in
+ * the packet given is inspected. Decryption uses OpenSSL, so these functions
+ * are only available when HAVE_OPENSSL is defined.
+ */
+#ifndef QUIC_INITIAL_H_
+#define QUIC_INITIAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The UDP port used by HTTP/3 */
+#define QUIC_PORT 443
+
+/** Initial packets larger than this are not inspected, in bytes */
+#define QUIC_INITIAL_MAX_LEN 1500
+
+/**
+ * Decrypt a QUIC version 1 Initial packet and extract the server name from
+ * the ClientHello in its CRYPTO frames.
+ *
+ * @param data The start of the UDP payload
+ * @param len The length of \p data
+ * @param buf The buffer to write the NULL-terminated name to
+ * @param buf_sz The size of \p buf
+ * @return The length of the name, 0 if the packet has no server name or it
+ * is in a later packet, or -1 if \p data is not a QUIC version 1 Initial
+ * packet or could not be decrypted
+ */
+int
+quic_initial_sni(const uint8_t *data, size_t len, char *buf, size_t buf_sz);
+
+#endif /* QUIC_INITIAL_H_ */
@@ -0,0 +1,487 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/logging.h"
+#include "utils/mem.h"
+#include "tcp_dns.h"
+
+/** Marks the end of a hash chain or the LRU list */
+#define NONE UINT32_MAX
+
+/** The length of the length field before each message */
+#define PREFIX_LEN 2
+
+struct tcp_dns_flow
+{
+    struct tcp_dns_key key;
+    /** The sequence number of the next byte expected */
+    uint32_t next_seq;
+    /** The time of the last segment */
+    uint32_t last_seen;
+    /** The length field of the partial message */
+    uint8_t prefix[PREFIX_LEN];
+    /** The number of bytes of #prefix received */
+    uint8_t prefix_have;
+    /** The body of the partial message, once its length is known */
+    uint8_t *msg;
+    /** The length of the message body */
+    size_t msg_len;
+    /** The number of bytes of #msg received */
+    size_t msg_have;
+    /** Non-zero once a segment has been missed. Where the next message starts
+     * is then unknown, so the rest of the flow is ignored. */
+    int desync;
+    /** The next flow in the same hash bucket, or the next free flow */
+    uint32_t hash_next;
+    /** The next more recently used flow */
+    uint32_t lru_prev;
+    /** The next less recently used flow */
+    uint32_t lru_next;
+};
+
+struct tcp_dns_tracker
+{
+    /** All flows, used or free */
+    struct tcp_dns_flow *flows;
+    /** The number of elements in #flows */
+    uint32_t max_flows;
+    /** The number of flows in use */
+    uint32_t count;
+    /** The first unused flow */
+    uint32_t free_head;
+    /** The first flow of each hash chain */
+    uint32_t *buckets;
+    /** log2 of the number of buckets */
+    unsigned int bucket_bits;
+    /** The most recently used flow */
+    uint32_t lru_head;
+    /** The least recently used flow */
+    uint32_t lru_tail;
+    /** The number of bytes allocated for message bodies */
+    size_t memory;
+    /** The limit on #memory */
+    size_t max_memory;
+};
+
+static inline uint16_t
+get_uint16(const uint8_t *pos)
+{
+    return (uint16_t) (pos[0] << 8 | pos[1]);
+}
+
+static inline int
+key_equal(const struct tcp_dns_key *a, const struct tcp_dns_key *b)
+{
+    return IN6_ARE_ADDR_EQUAL(&a->src_ip, &b->src_ip)
+            && IN6_ARE_ADDR_EQUAL(&a->dest_ip, &b->dest_ip)
+            && a->src_port == b->src_port && a->dest_port == b->dest_port;
+}
+
+static inline uint32_t
+hash_addr(uint32_t h, const struct in6_addr *addr)
+{
+    uint32_t word;
+    int i;
+
+    for (i = 0; i < 16; i += 4)
+    {
+        memcpy(&word, addr->s6_addr + i, sizeof(word));
+        h = (h ^ word) * 2654435761u;
+    }
+    return h;
+}
+
+static inline uint32_t
+bucket_of(const tcp_dns_tracker *tr, const struct tcp_dns_key *key)
+{
+    uint32_t h = hash_addr(hash_addr(0, &key->src_ip), &key->dest_ip);
+
+    h = (h ^ ((uint32_t) key->src_port << 16 | key->dest_port)) * 2654435761u;
+    return h >> (32 - tr->bucket_bits);
+}
+
+/**
+ * Find a flow, returning its index or NONE. If \p prev is not NULL, the index
+ * of the previous flow in the hash chain is stored there.
+ */
+static uint32_t
+find(const tcp_dns_tracker *tr, const struct tcp_dns_key *key, uint32_t *prev)
+{
+    uint32_t idx = tr->buckets[bucket_of(tr, key)], last = NONE;
+
+    while (NONE != idx && !key_equal(&tr->flows[idx].key, key))
+    {
+        last = idx;
+        idx = tr->flows[idx].hash_next;
+    }
+
+    if (prev) *prev = last;
+    return idx;
+}
+
+static void
+lru_unlink(tcp_dns_tracker *tr, uint32_t idx)
+{
+    struct tcp_dns_flow *f = &tr->flows[idx];
+
+    if (NONE != f->lru_prev)
+        tr->flows[f->lru_prev].lru_next = f->lru_next;
+    else
+        tr->lru_head = f->lru_next;
+    if (NONE != f->lru_next)
+        tr->flows[f->lru_next].lru_prev = f->lru_prev;
+    else
+        tr->lru_tail = f->lru_prev;
+}
+
+static void
+lru_push(tcp_dns_tracker *tr, uint32_t idx)
+{
+    struct tcp_dns_flow *f = &tr->flows[idx];
+
+    f->lru_prev = NONE;
+    f->lru_next = tr->lru_head;
+    if (NONE != tr->lru_head)
+        tr->flows[tr->lru_head].lru_prev = idx;
+    else
+        tr->lru_tail = idx;
+    tr->lru_head = idx;
+}
+
+/**
+ * Discard the partial message of a flow, if any.
+ */
+static void
+flow_reset_msg(tcp_dns_tracker *tr, uint32_t idx)
+{
+    struct tcp_dns_flow *f = &tr->flows[idx];
+
+    if (f->msg)
+    {
+        mem_free(MEM_DNS, f->msg);
+        f->msg = NULL;
+        tr->memory -= f->msg_len;
+    }
+    f->prefix_have = 0;
+    f->msg_len = 0;
+    f->msg_have = 0;
+}
+
+/**
+ * Stop looking for messages in a flow, which is kept until it ends so that
+ * its remaining segments are not mistaken for the start of a message.
+ */
+static void
+flow_desync(tcp_dns_tracker *tr, uint32_t idx)
+{
+    flow_reset_msg(tr, idx);
+    tr->flows[idx].desync = 1;
+}
+
+/**
+ * Remove a flow from the hash table and the LRU list, and free it.
+ */
+static void
+flow_free(tcp_dns_tracker *tr, uint32_t idx)
+{
+    struct tcp_dns_flow *f = &tr->flows[idx];
+    uint32_t prev;
+
+    find(tr, &f->key, &prev);
+    if (NONE != prev)
+        tr->flows[prev].hash_next = f->hash_next;
+    else
+        tr->buckets[bucket_of(tr, &f->key)] = f->hash_next;
+
+    lru_unlink(tr, idx);
+    flow_reset_msg(tr, idx);
+
+    f->hash_next = tr->free_head;
+    tr->free_head = idx;
+    tr->count--;
+}
+
+/**
+ * Start tracking a flow, discarding the least recently used flow if the
+ * table is full.
+ */
+static uint32_t
+flow_new(tcp_dns_tracker *tr, const struct tcp_dns_key *key, uint32_t seq,
+        uint32_t now)
+{
+    struct tcp_dns_flow *f;
+    uint32_t idx, bucket;
+
+    if (NONE == tr->free_head) flow_free(tr, tr->lru_tail);
+
+    idx = tr->free_head;
+    f = &tr->flows[idx];
+    tr->free_head = f->hash_next;
+
+    f->key = *key;
+    f->next_seq = seq;
+    f->last_seen = now;
+    f->prefix_have = 0;
+    f->msg = NULL;
+    f->msg_len = 0;
+    f->msg_have = 0;
+    f->desync = 0;
+
+    bucket = bucket_of(tr, key);
+    f->hash_next = tr->buckets[bucket];
+    tr->buckets[bucket] = idx;
+    lru_push(tr, idx);
+    tr->count++;
+
+    return idx;
+}
+
+/**
+ * Discard flows that have been idle for longer than #TCP_DNS_IDLE_TIMEOUT.
+ */
+static void
+expire(tcp_dns_tracker *tr, uint32_t now)
+{
+    while (NONE != tr->lru_tail
+            && (int32_t) (now - tr->flows[tr->lru_tail].last_seen)
+                    >= TCP_DNS_IDLE_TIMEOUT)
+        flow_free(tr, tr->lru_tail);
+}
+
+/**
+ * Allocate the body of the message of flow \p idx, discarding the partial
+ * messages of other flows if that would use more than the memory limit.
+ *
+ * @return 0 if successful, -1 if the message could not be allocated
+ */
+static int
+flow_alloc_msg(tcp_dns_tracker *tr, uint32_t idx)
+{
+    struct tcp_dns_flow *f = &tr->flows[idx];
+    uint32_t victim;
+
+    while (tr->memory + f->msg_len > tr->max_memory)
+    {
+        victim = tr->lru_tail;
+        while (NONE != victim && (victim == idx || !tr->flows[victim].msg))
+            victim = tr->flows[victim].lru_prev;
+        if (NONE == victim) return -1;
+        flow_desync(tr, victim);
+    }
+
+    if (NULL == (f->msg = mem_malloc(MEM_DNS, f->msg_len))) return -1;
+    tr->memory += f->msg_len;
+    return 0;
+}
+
+/**
+ * Copy as much of \p data into the partial message of flow \p idx as it
+ * needs. \p data and \p len are advanced past the bytes that were used.
+ *
+ * @return 1 if the message is complete, 0 if more data is needed, -1 if the
+ * message could not be allocated
+ */
+static int
+flow_append(tcp_dns_tracker *tr, uint32_t idx, const uint8_t **data,
+        size_t *len)
+{
+    struct tcp_dns_flow *f = &tr->flows[idx];
+    size_t n;
+
+    while (f->prefix_have < PREFIX_LEN && *len)
+    {
+        f->prefix[f->prefix_have++] = **data;
+        (*data)++;
+        (*len)--;
+    }
+    if (f->prefix_have < PREFIX_LEN) return 0;
+
+    if (!f->msg)
+    {
+        if (!(f->msg_len = get_uint16(f->prefix))) return 1;
+        if (0 != flow_alloc_msg(tr, idx)) return -1;
+    }
+
+    n = f->msg_len - f->msg_have;
+    if (n > *len) n = *len;
+    memcpy(f->msg + f->msg_have, *data, n);
+    f->msg_have += n;
+    *data += n;
+    *len -= n;
+
+    return f->msg_have == f->msg_len;
+}
+
+tcp_dns_tracker *
+new_tcp_dns_tracker(unsigned int max_flows, size_t max_memory)
+{
+    tcp_dns_tracker *tr = NULL;
+    uint32_t i;
+
+    if (!max_flows) goto error;
+
+    if (NULL == (tr = mem_calloc(MEM_DNS, 1, sizeof(*tr)))) goto error;
+
+    while ((1u << tr->bucket_bits) < max_flows) tr->bucket_bits++;
+    if (!tr->bucket_bits) tr->bucket_bits = 1;
+
+    tr->flows = mem_calloc(MEM_DNS, max_flows, sizeof(*tr->flows));
+    tr->buckets = mem_malloc(MEM_DNS,
+            (1u << tr->bucket_bits) * sizeof(*tr->buckets));
+    if (!tr->flows || !tr->buckets) goto error;
+
+    tr->max_flows = max_flows;
+    tr->max_memory = max_memory;
+    for (i = 0; i < max_flows; i++)
+        tr->flows[i].hash_next = i + 1 < max_flows ? i + 1 : NONE;
+    tr->free_head = 0;
+    for (i = 0; i < (1u << tr->bucket_bits); i++) tr->buckets[i] = NONE;
+    tr->lru_head = tr->lru_tail = NONE;
+
+    return tr;
+
+error:
+    free_tcp_dns_tracker(&tr);
+    return NULL;
+}
+
+void
+free_tcp_dns_tracker(tcp_dns_tracker **tr)
+{
+    assert(tr);
+
+    if (*tr)
+    {
+        if ((*tr)->flows && (*tr)->buckets)
+        {
+            while (NONE != (*tr)->lru_tail) flow_free(*tr, (*tr)->lru_tail);
+        }
+        mem_free(MEM_DNS, (*tr)->flows);
+        mem_free(MEM_DNS, (*tr)->buckets);
+        mem_free(MEM_DNS, *tr);
+        *tr = NULL;
+    }
+}
+
+unsigned int
+tcp_dns_tracker_segment(tcp_dns_tracker *tr, const struct tcp_dns_key *key,
+        uint32_t seq, uint8_t flags, const uint8_t *data, size_t len,
+        uint32_t now, tcp_dns_message_cb cb, void *arg)
+{
+    assert(tr);
+    assert(key);
+    assert(data || !len);
+    assert(cb);
+
+    const uint32_t end_seq = seq + len;
+    struct tcp_dns_flow *f;
+    unsigned int msgs = 0;
+    size_t msg_len;
+    int32_t offset;
+    uint32_t idx;
+    int rc;
+
+    expire(tr, now);
+    idx = find(tr, key, NULL);
+
+    if ((flags & TCP_DNS_RST) || !len) goto done;
+
+    // The first data seen in a direction is taken to start with a length
+    if (NONE == idx) idx = flow_new(tr, key, seq, now);
+
+    f = &tr->flows[idx];
+    f->last_seen = now;
+    lru_unlink(tr, idx);
+    lru_push(tr, idx);
+    if (f->desync) goto done;
+
+    offset = (int32_t) (seq - f->next_seq);
+    if (offset > 0)
+    {
+        // A segment was missed so the message cannot be completed, and
+        // where the next message starts is unknown
+        logger(L_DEBUG, "tcp_dns_tracker_segment(): missing segment");
+        flow_desync(tr, idx);
+        goto done;
+    }
+    if (offset < 0)
+    {
+        // Skip data that has already been received
+        if ((size_t) -(int64_t) offset >= len) goto done;
+        data += -(int64_t) offset;
+        len -= -(int64_t) offset;
+    }
+    f->next_seq = end_seq;
+
+    if (f->prefix_have)
+    {
+        rc = flow_append(tr, idx, &data, &len);
+        if (rc < 0) goto memory;
+        if (0 == rc) goto done;
+
+        if (f->msg_len)
+        {
+            cb(f->msg, f->msg_len, arg);
+            msgs++;
+        }
+        flow_reset_msg(tr, idx);
+    }
+
+    // Messages that are complete within the segment are not copied
+    while (len >= PREFIX_LEN)
+    {
+        msg_len = get_uint16(data);
+        if (len - PREFIX_LEN < msg_len) break;
+
+        if (msg_len)
+        {
+            cb(data + PREFIX_LEN, msg_len, arg);
+            msgs++;
+        }
+        data += PREFIX_LEN + msg_len;
+        len -= PREFIX_LEN + msg_len;
+    }
+
+    if (len && !(flags & TCP_DNS_FIN) && 0 > flow_append(tr, idx, &data, &len))
+        goto memory;
+
+done:
+    if (NONE != idx && (flags & (TCP_DNS_FIN | TCP_DNS_RST)))
+        flow_free(tr, idx);
+
+    return msgs;
+
+memory:
+    logger(L_DEBUG, "tcp_dns_tracker_segment(): memory limit reached");
+    flow_desync(tr, idx);
+    goto done;
+}
+
+unsigned int
+tcp_dns_tracker_count(const tcp_dns_tracker *tr)
+{
+    assert(tr);
+
+    return tr->count;
+}
+
+size_t
+tcp_dns_tracker_memory(const tcp_dns_tracker *tr)
+{
+    assert(tr);
+
+    return tr->memory;
+}
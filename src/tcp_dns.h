@@ -0,0 +1,131 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Reassembly of DNS messages carried over TCP
+ *
+ * Over TCP, each DNS message is preceded by a two byte length (RFC 1035
+ * section 4.2.2) and a message may be split across several segments. Each
+ * direction of a connection is tracked separately.
+ *
+ * Segments are only copied when a message is not complete by the end of a
+ * segment; complete messages within a segment are passed to the callback
+ * directly from the packet. Each direction that has sent data is kept in a
+ * flow table with a fixed number of flows, until it ends or is idle, and
+ * partially received messages are subject to a limit on the total number of
+ * buffered bytes. When the table is full the least recently used flow is
+ * discarded, and when the memory limit is reached the least recently used
+ * partial message is.
+ *
+ * The first data seen in a direction is taken to start with a length prefix.
+ * Segments are expected in order after that, and retransmitted data is
+ * ignored. If a segment is missing, or a partial message is discarded, where
+ * the next message starts is unknown, so the rest of the flow is ignored
+ * rather than being parsed from the wrong place.
+ */
+#ifndef TCP_DNS_H_
+#define TCP_DNS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+/** The default maximum number of flows with a partially received message */
+#define TCP_DNS_DEFAULT_FLOWS 128
+
+/** The default maximum number of bytes buffered across all flows */
+#define TCP_DNS_DEFAULT_MEMORY (1024 * 1024)
+
+/** Flows that have not seen a segment for this long are discarded, in
+ * seconds */
+#define TCP_DNS_IDLE_TIMEOUT 30
+
+/** The FIN flag of a TCP header */
+#define TCP_DNS_FIN 0x01
+
+/** The RST flag of a TCP header */
+#define TCP_DNS_RST 0x04
+
+/** Hide the implementation from dependent modules */
+typedef struct tcp_dns_tracker tcp_dns_tracker;
+
+/**
+ * Identifies one direction of a TCP connection. Addresses and ports are in
+ * network byte order, and IPv4 addresses are stored as IPv4-mapped IPv6
+ * addresses.
+ */
+struct tcp_dns_key
+{
+    struct in6_addr src_ip;
+    struct in6_addr dest_ip;
+    uint16_t src_port;
+    uint16_t dest_port;
+};
+
+/**
+ * Called with each complete DNS message, without the length prefix. The
+ * message is only valid until the callback returns.
+ */
+typedef void (*tcp_dns_message_cb)(const uint8_t *msg, size_t len, void *arg);
+
+/**
+ * Allocate a new tracker.
+ *
+ * @param max_flows The maximum number of flows with a partial message
+ * @param max_memory The maximum number of bytes of partial messages
+ * @return A pointer to the tracker, or NULL if memory could not be allocated
+ */
+tcp_dns_tracker *
+new_tcp_dns_tracker(unsigned int max_flows, size_t max_memory);
+
+/**
+ * @brief Free the memory used by the tracker
+ * Sets the value pointed to by \p tr to NULL
+ */
+void
+free_tcp_dns_tracker(tcp_dns_tracker **tr);
+
+/**
+ * Add the payload of a TCP segment, calling \p cb for each DNS message that
+ * it completes.
+ *
+ * @param tr The tracker
+ * @param key The direction of the connection that the segment belongs to
+ * @param seq The sequence number of the first byte of \p data
+ * @param flags The flags from the TCP header. The flow is discarded after a
+ * FIN or RST.
+ * @param data The payload of the segment
+ * @param len The length of \p data, which may be zero
+ * @param now The capture time of the segment, in seconds
+ * @param cb Called with each complete message
+ * @param arg Passed to \p cb
+ * @return The number of messages passed to \p cb
+ */
+unsigned int
+tcp_dns_tracker_segment(tcp_dns_tracker *tr, const struct tcp_dns_key *key,
+        uint32_t seq, uint8_t flags, const uint8_t *data, size_t len,
+        uint32_t now, tcp_dns_message_cb cb, void *arg);
+
+/**
+ * The number of flows currently tracked.
+ */
+unsigned int
+tcp_dns_tracker_count(const tcp_dns_tracker *tr);
+
+/**
+ * The number of bytes of partial messages currently buffered.
+ */
+size_t
+tcp_dns_tracker_memory(const tcp_dns_tracker *tr);
+
+#endif /* TCP_DNS_H_ */
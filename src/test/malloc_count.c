@@ -0,0 +1,164 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Count the allocations made by a program
+ *
+ * Built as a shared object and loaded with LD_PRELOAD, this wraps malloc(),
+ * calloc(), realloc() and the aligned allocators, counting each call that
+ * returns new memory. When the program exits, the number of allocations and
+ * the peak resident set size are written as a line of the form
+ *
+ *     allocations=<count> peak_rss_kib=<kib>
+ *
+ * to the file named by the MALLOC_COUNT_OUTPUT environment variable, or to
+ * stderr if it is not set. Used by `make perfcheck`.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/** Serves calloc() while dlsym() is looking up the real functions */
+static char bootstrap_buf[4096];
+static size_t bootstrap_used;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+
+static uint64_t allocations;
+static int initializing;
+
+static void
+count(void)
+{
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+}
+
+static void
+init(void)
+{
+    if (real_malloc || initializing) return;
+
+    initializing = 1;
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    initializing = 0;
+}
+
+static int
+is_bootstrap(const void *ptr)
+{
+    return (const char *) ptr >= bootstrap_buf
+            && (const char *) ptr < bootstrap_buf + sizeof(bootstrap_buf);
+}
+
+void *
+malloc(size_t size)
+{
+    init();
+    count();
+    return real_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    init();
+    if (!real_calloc)
+    {
+        // dlsym() itself may call calloc(), so hand out zeroed static memory
+        size = (nmemb * size + 15) & ~(size_t) 15;
+        if (size > sizeof(bootstrap_buf) - bootstrap_used) return NULL;
+        ptr = bootstrap_buf + bootstrap_used;
+        bootstrap_used += size;
+        return ptr;
+    }
+
+    count();
+    return real_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    size_t old_size;
+    void *moved;
+
+    init();
+    if (is_bootstrap(ptr))
+    {
+        old_size = bootstrap_buf + sizeof(bootstrap_buf) - (char *) ptr;
+        if (!(moved = malloc(size))) return NULL;
+        memcpy(moved, ptr, size < old_size ? size : old_size);
+        return moved;
+    }
+
+    // Growing a buffer costs as much as a new allocation
+    count();
+    return real_realloc(ptr, size);
+}
+
+void
+free(void *ptr)
+{
+    init();
+    if (is_bootstrap(ptr)) return;
+    real_free(ptr);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    init();
+    count();
+    return real_posix_memalign(memptr, alignment, size);
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+    init();
+    count();
+    return real_aligned_alloc(alignment, size);
+}
+
+__attribute__((destructor))
+static void
+report(void)
+{
+    const char *path = getenv("MALLOC_COUNT_OUTPUT");
+    struct rusage usage;
+    FILE *out = stderr;
+
+    if (0 != getrusage(RUSAGE_SELF, &usage)) usage.ru_maxrss = 0;
+    if (path && !(out = fopen(path, "w"))) return;
+
+    fprintf(out, "allocations=%llu peak_rss_kib=%ld\n",
+            (unsigned long long) __atomic_load_n(&allocations, __ATOMIC_RELAXED),
+            usage.ru_maxrss);
+
+    if (out != stderr) fclose(out);
+}
@@ -0,0 +1,816 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Write synthetic captures for load tests of the capture path
+ *
+ * Writes an Ethernet pcap file of DNS queries over UDP, TCP SYNs and
+ * malformed packets, mixed in the given proportions, from devices on
+ * 192.168.1.0/24. Everything is derived from the seed, so the same options
+ * always produce the same file.
+ *
+ * Queried names are drawn from a set of benign names and from a set of
+ * blacklisted names, and SYNs are sent to a set of benign addresses and to a
+ * set of blacklisted addresses. Within each set, entries are chosen with a
+ * Zipf distribution so that a few are much more popular than the rest. The
+ * blacklisted names and addresses can be written to files in the formats
+ * read by `nsids --dnbl` and `nsids --ipbl`, so that replaying the capture
+ * with `nsids --replay` finds the chosen share of IoCs.
+ *
+ * The profiles set all of the proportions at once:
+ *  - `mixed`: 60% DNS, 35% SYN and 5% malformed (the default)
+ *  - `dns`: only DNS queries
+ *  - `syn`: only SYNs
+ *  - `malformed`: half malformed packets, half DNS queries
+ *
+ * Usage: pcapgen -o <file> [options], see usage()
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pcap/pcap.h>
+
+#define DEFAULT_PACKETS 100000
+#define DEFAULT_SEED 1
+#define DEFAULT_NAMES 10000
+#define DEFAULT_DESTINATIONS 1000
+#define DEFAULT_BLACKLIST 1000
+#define DEFAULT_ZIPF 1.0
+#define DEFAULT_HIT_RATE 0.01
+#define DEFAULT_DEPTH 2
+#define DEFAULT_RATE 10000
+
+/** The most labels added in front of a registered name */
+#define MAX_DEPTH 8
+
+/** Longer than any generated name or frame */
+#define MAX_NAME_LEN 256
+#define MAX_FRAME_LEN 512
+
+/** Headers of the frames that are written */
+#define ETH_LEN 14
+#define IP_LEN 20
+#define UDP_LEN 8
+#define TCP_LEN 20
+#define DNS_HEADER_LEN 12
+
+/** The first second of every capture, so that files can be compared */
+#define START_TIME 1586313317
+
+enum packet_kind
+{
+    KIND_DNS,
+    KIND_SYN,
+    KIND_MALFORMED,
+    KIND_COUNT
+};
+
+static const char *kind_names[KIND_COUNT] = {
+    [KIND_DNS] = "dns",
+    [KIND_SYN] = "syn",
+    [KIND_MALFORMED] = "malformed",
+};
+
+struct profile
+{
+    const char *name;
+    double shares[KIND_COUNT];
+};
+
+static const struct profile profiles[] = {
+    { "mixed", { 0.60, 0.35, 0.05 } },
+    { "dns", { 1.0, 0.0, 0.0 } },
+    { "syn", { 0.0, 1.0, 0.0 } },
+    { "malformed", { 0.5, 0.0, 0.5 } },
+};
+
+struct options
+{
+    const char *output;
+    const char *dnbl_output;
+    const char *ipbl_output;
+    unsigned long packets;
+    unsigned long long seed;
+    double shares[KIND_COUNT];
+    unsigned long names;
+    unsigned long destinations;
+    unsigned long blacklist;
+    double zipf;
+    double dns_hit_rate;
+    double ip_hit_rate;
+    unsigned int depth;
+    unsigned long rate;
+};
+
+/** A set of entries chosen with a Zipf distribution */
+struct zipf_set
+{
+    /** The cumulative probability of each rank */
+    double *cdf;
+    size_t count;
+};
+
+static uint64_t rand_state;
+
+static const char *words[] = {
+    "an", "ar", "ba", "be", "co", "da", "de", "el", "en", "er", "fi", "go",
+    "in", "ka", "la", "le", "lo", "ma", "me", "mo", "na", "ne", "no", "on",
+    "or", "pa", "pro", "ra", "re", "ri", "sa", "se", "shop", "st", "ta", "te",
+    "ti", "to", "tech", "un", "va", "web", "za",
+};
+
+static const char *tlds[] = {
+    "com", "com", "com", "com", "net", "org", "ru", "de", "info", "io",
+    "xyz", "top", "cn", "co.uk",
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint64_t
+next_rand(void)
+{
+    // xorshift64*
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t
+uniform(size_t n)
+{
+    return next_rand() % n;
+}
+
+/** A number in [0, 1) */
+static double
+uniform_real(void)
+{
+    return (next_rand() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int
+zipf_init(struct zipf_set *z, size_t count, double exponent)
+{
+    double total = 0;
+    size_t i;
+
+    z->count = count;
+    if (!(z->cdf = malloc(count * sizeof(*z->cdf)))) return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        total += 1.0 / pow(i + 1, exponent);
+        z->cdf[i] = total;
+    }
+    for (i = 0; i < count; i++) z->cdf[i] /= total;
+
+    return 0;
+}
+
+/**
+ * Choose a rank, where rank 0 is the most popular.
+ */
+static size_t
+zipf_next(const struct zipf_set *z)
+{
+    double u = uniform_real();
+    size_t lo = 0, hi = z->count - 1, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (z->cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+/**
+ * Write the name of entry \p index of a set of names. Each name is derived
+ * from its index and the seed alone, so it is not stored.
+ *
+ * @param set Distinguishes the benign names from the blacklisted names
+ * @param depth The most labels to add in front of the registered name
+ */
+static void
+make_name(char *out, unsigned long long seed, int set, size_t index,
+        unsigned int depth)
+{
+    uint64_t saved = rand_state;
+    size_t len = 0, parts, i;
+    unsigned int labels;
+
+    rand_state = (seed * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t) set << 56)
+            ^ (index + 1);
+    next_rand();
+
+    labels = depth ? uniform(depth + 1) : 0;
+    for (i = 0; i < labels; i++)
+        len += sprintf(out + len, "%s%u.", words[uniform(ARRAY_LEN(words))],
+                (unsigned int) uniform(100));
+
+    for (i = 0, parts = 2 + uniform(3); i < parts; i++)
+        len += sprintf(out + len, "%s", words[uniform(ARRAY_LEN(words))]);
+
+    // The index makes every name in a set distinct
+    sprintf(out + len, "%zu%s.%s", index, set ? "-bad" : "",
+            tlds[uniform(ARRAY_LEN(tlds))]);
+
+    rand_state = saved;
+}
+
+/**
+ * The address of entry \p index of a set of destinations, in host byte
+ * order. Blacklisted addresses are in 198.18.0.0/15 and benign addresses in
+ * 100.64.0.0/10, so the sets never overlap.
+ */
+static uint32_t
+make_address(int set, size_t index)
+{
+    if (set) return 0xc6120000 | (index & 0x1ffff);
+    return 0x64400000 | (index & 0x3fffff);
+}
+
+static uint8_t *
+put_u16(uint8_t *pos, uint16_t v)
+{
+    pos[0] = v >> 8;
+    pos[1] = v & 0xff;
+    return pos + 2;
+}
+
+static uint8_t *
+put_u32(uint8_t *pos, uint32_t v)
+{
+    pos = put_u16(pos, v >> 16);
+    return put_u16(pos, v & 0xffff);
+}
+
+/**
+ * The internet checksum of \p len bytes, added to \p sum.
+ */
+static uint32_t
+checksum_add(uint32_t sum, const uint8_t *data, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) sum += (data[i] << 8) | data[i + 1];
+    if (len & 1) sum += data[len - 1] << 8;
+
+    return sum;
+}
+
+static uint16_t
+checksum_fold(uint32_t sum)
+{
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum & 0xffff;
+}
+
+/**
+ * Write the Ethernet and IPv4 headers of a frame from \p device.
+ *
+ * @return The start of the transport header
+ */
+static uint8_t *
+put_headers(uint8_t *frame, unsigned int device, uint32_t dst,
+        uint8_t protocol, size_t payload_len)
+{
+    static const uint8_t router_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    uint8_t *ip = frame + ETH_LEN, *pos;
+
+    memcpy(frame, router_mac, 6);
+    frame[6] = 0x02;
+    frame[7] = 0x00;
+    frame[8] = 0x00;
+    frame[9] = 0x00;
+    frame[10] = 0x01;
+    frame[11] = device;
+    put_u16(frame + 12, 0x0800);
+
+    pos = ip;
+    *pos++ = 0x45;
+    *pos++ = 0;
+    pos = put_u16(pos, IP_LEN + payload_len);
+    pos = put_u16(pos, next_rand());
+    pos = put_u16(pos, 0x4000);     // Don't fragment
+    *pos++ = 64;
+    *pos++ = protocol;
+    pos = put_u16(pos, 0);
+    pos = put_u32(pos, 0xc0a80100 | device);
+    pos = put_u32(pos, dst);
+    put_u16(ip + 10, checksum_fold(checksum_add(0, ip, IP_LEN)));
+
+    return pos;
+}
+
+/**
+ * Write a DNS query for \p name over UDP.
+ *
+ * @return The length of the frame
+ */
+static size_t
+put_dns_query(uint8_t *frame, unsigned int device, const char *name)
+{
+    uint8_t dns[MAX_NAME_LEN + DNS_HEADER_LEN + 8], *pos = dns, *udp;
+    const char *label = name, *dot;
+    size_t dns_len, len;
+
+    pos = put_u16(pos, next_rand());
+    pos = put_u16(pos, 0x0100);     // Recursion desired
+    pos = put_u16(pos, 1);
+    pos = put_u16(pos, 0);
+    pos = put_u16(pos, 0);
+    pos = put_u16(pos, 0);
+
+    while (*label)
+    {
+        dot = strchr(label, '.');
+        len = dot ? (size_t) (dot - label) : strlen(label);
+        *pos++ = len;
+        memcpy(pos, label, len);
+        pos += len;
+        label += len + (dot ? 1 : 0);
+    }
+    *pos++ = 0;
+    pos = put_u16(pos, uniform(10) < 7 ? 1 : 28);     // A or AAAA
+    pos = put_u16(pos, 1);
+    dns_len = pos - dns;
+
+    udp = put_headers(frame, device, 0xc0a80101, 17, UDP_LEN + dns_len);
+    pos = put_u16(udp, 1024 + uniform(64511));
+    pos = put_u16(pos, 53);
+    pos = put_u16(pos, UDP_LEN + dns_len);
+    pos = put_u16(pos, 0);          // No checksum
+    memcpy(pos, dns, dns_len);
+
+    return ETH_LEN + IP_LEN + UDP_LEN + dns_len;
+}
+
+/**
+ * Write a TCP SYN to \p dst.
+ *
+ * @return The length of the frame
+ */
+static size_t
+put_syn(uint8_t *frame, unsigned int device, uint32_t dst)
+{
+    uint8_t *tcp = put_headers(frame, device, dst, 6, TCP_LEN), *pos;
+    uint8_t pseudo[12];
+    uint32_t sum;
+
+    pos = put_u16(tcp, 1024 + uniform(64511));
+    pos = put_u16(pos, uniform(10) < 7 ? 443 : 80);
+    pos = put_u32(pos, next_rand());
+    pos = put_u32(pos, 0);
+    *pos++ = (TCP_LEN / 4) << 4;
+    *pos++ = 0x02;                  // SYN
+    pos = put_u16(pos, 64240);
+    pos = put_u16(pos, 0);
+    put_u16(pos, 0);
+
+    memcpy(pseudo, frame + ETH_LEN + 12, 8);
+    pseudo[8] = 0;
+    pseudo[9] = 6;
+    put_u16(pseudo + 10, TCP_LEN);
+    sum = checksum_add(checksum_add(0, pseudo, sizeof(pseudo)), tcp, TCP_LEN);
+    put_u16(tcp + 16, checksum_fold(sum));
+
+    return ETH_LEN + IP_LEN + TCP_LEN;
+}
+
+/**
+ * Write a frame that the packet handler must reject without reading past its
+ * end. The kinds of damage are those seen from broken stacks and fuzzers.
+ *
+ * @return The length of the frame
+ */
+static size_t
+put_malformed(uint8_t *frame, unsigned int device, const char *name)
+{
+    size_t len = put_dns_query(frame, device, name), i;
+    uint8_t *ip = frame + ETH_LEN, *udp = ip + IP_LEN;
+    uint8_t *dns = udp + UDP_LEN;
+
+    switch (uniform(6))
+    {
+    case 0:
+        // Cut off in the middle of the IP header
+        return ETH_LEN + 1 + uniform(IP_LEN - 1);
+    case 1:
+        // Header length longer than the packet
+        ip[0] = 0x4f;
+        break;
+    case 2:
+        // UDP length longer than the datagram
+        put_u16(udp + 4, 0xffff);
+        break;
+    case 3:
+        // A label that runs past the end of the message
+        dns[DNS_HEADER_LEN] = 63;
+        break;
+    case 4:
+        // A compression pointer to itself
+        put_u16(dns + DNS_HEADER_LEN, 0xc000 | DNS_HEADER_LEN);
+        break;
+    default:
+        // More questions than the message holds, and garbage after the header
+        put_u16(dns + 4, 1 + uniform(0xfffe));
+        for (i = DNS_HEADER_LEN; dns + i < frame + len; i++)
+            dns[i] = next_rand();
+        break;
+    }
+
+    return len;
+}
+
+/**
+ * Write the blacklisted names in the format read by `nsids --dnbl`.
+ */
+static int
+write_dnbl(const struct options *opts)
+{
+    char name[MAX_NAME_LEN];
+    FILE *fp = fopen(opts->dnbl_output, "w");
+    size_t i;
+
+    if (!fp) goto error;
+
+    fprintf(fp, "# Blacklisted names for pcapgen seed %llu\n", opts->seed);
+    for (i = 0; i < opts->blacklist; i++)
+    {
+        make_name(name, opts->seed, 1, i, opts->depth);
+        if (0 > fprintf(fp, "http://%s/\n", name)) goto error;
+    }
+
+    if (0 != fclose(fp))
+    {
+        fp = NULL;
+        goto error;
+    }
+    return 0;
+
+error:
+    perror(opts->dnbl_output);
+    if (fp) fclose(fp);
+    return -1;
+}
+
+/**
+ * Write the blacklisted addresses in the format read by `nsids --ipbl`.
+ */
+static int
+write_ipbl(const struct options *opts)
+{
+    FILE *fp = fopen(opts->ipbl_output, "w");
+    uint32_t addr;
+    size_t i;
+
+    if (!fp) goto error;
+
+    fprintf(fp, "# Blacklisted addresses for pcapgen\n");
+    for (i = 0; i < opts->blacklist; i++)
+    {
+        addr = make_address(1, i);
+        if (0 > fprintf(fp, "%u.%u.%u.%u\n", addr >> 24, (addr >> 16) & 0xff,
+                (addr >> 8) & 0xff, addr & 0xff))
+            goto error;
+    }
+
+    if (0 != fclose(fp))
+    {
+        fp = NULL;
+        goto error;
+    }
+    return 0;
+
+error:
+    perror(opts->ipbl_output);
+    if (fp) fclose(fp);
+    return -1;
+}
+
+static int
+generate(const struct options *opts)
+{
+    struct zipf_set names, destinations, blacklist;
+    unsigned long counts[KIND_COUNT] = { 0 }, dns_hits = 0, ip_hits = 0, i;
+    uint8_t frame[MAX_FRAME_LEN];
+    char name[MAX_NAME_LEN];
+    struct pcap_pkthdr hdr;
+    pcap_dumper_t *dumper = NULL;
+    pcap_t *pcap = NULL;
+    double total = 0, pick;
+    unsigned int device;
+    int kind, hit, ret = -1;
+
+    for (kind = 0; kind < KIND_COUNT; kind++) total += opts->shares[kind];
+
+    if (0 != zipf_init(&names, opts->names, opts->zipf)
+            || 0 != zipf_init(&destinations, opts->destinations, opts->zipf)
+            || 0 != zipf_init(&blacklist, opts->blacklist, opts->zipf))
+    {
+        fprintf(stderr, "Could not allocate distributions\n");
+        return -1;
+    }
+
+    if (NULL == (pcap = pcap_open_dead(DLT_EN10MB, MAX_FRAME_LEN))
+            || NULL == (dumper = pcap_dump_open(pcap, opts->output)))
+    {
+        fprintf(stderr, "Could not open %s: %s\n", opts->output,
+                pcap ? pcap_geterr(pcap) : "out of memory");
+        goto done;
+    }
+
+    rand_state = opts->seed * 0x9e3779b97f4a7c15ULL + 1;
+
+    for (i = 0; i < opts->packets; i++)
+    {
+        pick = uniform_real() * total;
+        for (kind = 0; kind < KIND_COUNT - 1; kind++)
+        {
+            if (pick < opts->shares[kind]) break;
+            pick -= opts->shares[kind];
+        }
+        counts[kind]++;
+
+        device = 2 + uniform(253);
+
+        switch (kind)
+        {
+        case KIND_DNS:
+            hit = uniform_real() < opts->dns_hit_rate;
+            make_name(name, opts->seed, hit,
+                    zipf_next(hit ? &blacklist : &names), opts->depth);
+            hdr.caplen = put_dns_query(frame, device, name);
+            dns_hits += hit;
+            break;
+        case KIND_SYN:
+            hit = uniform_real() < opts->ip_hit_rate;
+            hdr.caplen = put_syn(frame, device, make_address(hit,
+                    zipf_next(hit ? &blacklist : &destinations)));
+            ip_hits += hit;
+            break;
+        default:
+            make_name(name, opts->seed, 0, zipf_next(&names), opts->depth);
+            hdr.caplen = put_malformed(frame, device, name);
+            break;
+        }
+
+        hdr.len = hdr.caplen;
+        hdr.ts.tv_sec = START_TIME + i / opts->rate;
+        hdr.ts.tv_usec = (i % opts->rate) * 1000000 / opts->rate;
+        pcap_dump((unsigned char *) dumper, &hdr, frame);
+    }
+
+    if (0 != pcap_dump_flush(dumper))
+    {
+        fprintf(stderr, "Could not write %s\n", opts->output);
+        goto done;
+    }
+
+    // A summary that scripts can compare with what the IDS reports
+    printf("packets=%lu", opts->packets);
+    for (kind = 0; kind < KIND_COUNT; kind++)
+        printf(" %s=%lu", kind_names[kind], counts[kind]);
+    printf(" dns_hits=%lu syn_hits=%lu\n", dns_hits, ip_hits);
+
+    ret = 0;
+
+done:
+    if (dumper) pcap_dump_close(dumper);
+    if (pcap) pcap_close(pcap);
+    free(names.cdf);
+    free(destinations.cdf);
+    free(blacklist.cdf);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s -o <file> [options]\n"
+        "\t-o, --output <file>\tThe pcap file to write\n"
+        "\t-n, --packets <n>\tThe number of packets (%d)\n"
+        "\t-s, --seed <n>\t\tThe seed of all random choices (%d)\n"
+        "\t--profile <name>\tmixed, dns, syn or malformed (mixed)\n"
+        "\t--dns-share <f>\t\tThe share of DNS queries, overriding the profile\n"
+        "\t--syn-share <f>\t\tThe share of TCP SYNs\n"
+        "\t--malformed-share <f>\tThe share of malformed packets\n"
+        "\t--names <n>\t\tThe number of benign names (%d)\n"
+        "\t--destinations <n>\tThe number of benign addresses (%d)\n"
+        "\t--blacklist <n>\t\tThe number of blacklisted names and addresses (%d)\n"
+        "\t--zipf <s>\t\tThe exponent of the popularity of entries (%.1f)\n"
+        "\t--dns-hit-rate <f>\tThe share of queries for blacklisted names (%.2f)\n"
+        "\t--ip-hit-rate <f>\tThe share of SYNs to blacklisted addresses (%.2f)\n"
+        "\t--depth <n>\t\tThe most labels in front of a registered name (%d)\n"
+        "\t--rate <n>\t\tPackets per second of capture time (%d)\n"
+        "\t--dnbl <file>\t\tWrite the blacklisted names for nsids --dnbl\n"
+        "\t--ipbl <file>\t\tWrite the blacklisted addresses for nsids --ipbl\n",
+        prog, DEFAULT_PACKETS, DEFAULT_SEED, DEFAULT_NAMES,
+        DEFAULT_DESTINATIONS, DEFAULT_BLACKLIST, DEFAULT_ZIPF,
+        DEFAULT_HIT_RATE, DEFAULT_HIT_RATE, DEFAULT_DEPTH, DEFAULT_RATE);
+}
+
+/**
+ * Parse a number, which must be at least \p min.
+ */
+static int
+parse_ul(const char *arg, unsigned long min, unsigned long *out)
+{
+    char *end;
+
+    errno = 0;
+    *out = strtoul(arg, &end, 10);
+    if (ERANGE == errno || '\0' != *end || end == arg || *out < min)
+    {
+        fprintf(stderr, "Invalid number: %s\n", arg);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Parse a fraction in [0, \p max].
+ */
+static int
+parse_fraction(const char *arg, double max, double *out)
+{
+    char *end;
+
+    *out = strtod(arg, &end);
+    if ('\0' != *end || end == arg || *out < 0 || *out > max)
+    {
+        fprintf(stderr, "Invalid value: %s\n", arg);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"output", required_argument, 0, 'o'},
+        {"packets", required_argument, 0, 'n'},
+        {"seed", required_argument, 0, 's'},
+        {"profile", required_argument, 0, 'P'},
+        {"dns-share", required_argument, 0, 'D'},
+        {"syn-share", required_argument, 0, 'S'},
+        {"malformed-share", required_argument, 0, 'M'},
+        {"names", required_argument, 0, 'N'},
+        {"destinations", required_argument, 0, 'T'},
+        {"blacklist", required_argument, 0, 'B'},
+        {"zipf", required_argument, 0, 'Z'},
+        {"dns-hit-rate", required_argument, 0, 'H'},
+        {"ip-hit-rate", required_argument, 0, 'I'},
+        {"depth", required_argument, 0, 'd'},
+        {"rate", required_argument, 0, 'r'},
+        {"dnbl", required_argument, 0, 'w'},
+        {"ipbl", required_argument, 0, 'W'},
+        {0, 0, 0, 0}
+    };
+    struct options opts = {
+        .packets = DEFAULT_PACKETS,
+        .seed = DEFAULT_SEED,
+        .names = DEFAULT_NAMES,
+        .destinations = DEFAULT_DESTINATIONS,
+        .blacklist = DEFAULT_BLACKLIST,
+        .zipf = DEFAULT_ZIPF,
+        .dns_hit_rate = DEFAULT_HIT_RATE,
+        .ip_hit_rate = DEFAULT_HIT_RATE,
+        .depth = DEFAULT_DEPTH,
+        .rate = DEFAULT_RATE,
+    };
+    double shares[KIND_COUNT] = { -1, -1, -1 };
+    unsigned long value;
+    size_t i;
+    int opt, kind;
+
+    memcpy(opts.shares, profiles[0].shares, sizeof(opts.shares));
+
+    while (-1 != (opt = getopt_long(argc, argv, "o:n:s:", long_options,
+            NULL)))
+    {
+        switch (opt)
+        {
+        case 'o': opts.output = optarg; break;
+        case 'w': opts.dnbl_output = optarg; break;
+        case 'W': opts.ipbl_output = optarg; break;
+        case 'n':
+            if (parse_ul(optarg, 1, &opts.packets)) return EXIT_FAILURE;
+            break;
+        case 's':
+            if (parse_ul(optarg, 0, &value)) return EXIT_FAILURE;
+            opts.seed = value;
+            break;
+        case 'P':
+            for (i = 0; i < ARRAY_LEN(profiles); i++)
+            {
+                if (!strcmp(optarg, profiles[i].name)) break;
+            }
+            if (i == ARRAY_LEN(profiles))
+            {
+                fprintf(stderr, "Unknown profile: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            memcpy(opts.shares, profiles[i].shares, sizeof(opts.shares));
+            break;
+        case 'D':
+            if (parse_fraction(optarg, 1, &shares[KIND_DNS]))
+                return EXIT_FAILURE;
+            break;
+        case 'S':
+            if (parse_fraction(optarg, 1, &shares[KIND_SYN]))
+                return EXIT_FAILURE;
+            break;
+        case 'M':
+            if (parse_fraction(optarg, 1, &shares[KIND_MALFORMED]))
+                return EXIT_FAILURE;
+            break;
+        case 'N':
+            if (parse_ul(optarg, 1, &opts.names)) return EXIT_FAILURE;
+            break;
+        case 'T':
+            if (parse_ul(optarg, 1, &opts.destinations)) return EXIT_FAILURE;
+            break;
+        case 'B':
+            if (parse_ul(optarg, 1, &opts.blacklist)) return EXIT_FAILURE;
+            // Blacklisted addresses come from a /15
+            if (opts.blacklist > 0x20000)
+            {
+                fprintf(stderr, "At most %d blacklist entries\n", 0x20000);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'Z':
+            if (parse_fraction(optarg, 10, &opts.zipf)) return EXIT_FAILURE;
+            break;
+        case 'H':
+            if (parse_fraction(optarg, 1, &opts.dns_hit_rate))
+                return EXIT_FAILURE;
+            break;
+        case 'I':
+            if (parse_fraction(optarg, 1, &opts.ip_hit_rate))
+                return EXIT_FAILURE;
+            break;
+        case 'd':
+            if (parse_ul(optarg, 0, &value) || value > MAX_DEPTH)
+            {
+                fprintf(stderr, "Depth must be at most %d\n", MAX_DEPTH);
+                return EXIT_FAILURE;
+            }
+            opts.depth = value;
+            break;
+        case 'r':
+            if (parse_ul(optarg, 1, &opts.rate)) return EXIT_FAILURE;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!opts.output || optind != argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Shares given on the command line replace those of the profile
+    for (kind = 0; kind < KIND_COUNT; kind++)
+    {
+        if (shares[kind] >= 0) opts.shares[kind] = shares[kind];
+    }
+    if (opts.shares[KIND_DNS] + opts.shares[KIND_SYN]
+            + opts.shares[KIND_MALFORMED] <= 0)
+    {
+        fprintf(stderr, "The shares of the packets must not all be 0\n");
+        return EXIT_FAILURE;
+    }
+
+    if (opts.dnbl_output && 0 != write_dnbl(&opts)) return EXIT_FAILURE;
+    if (opts.ipbl_output && 0 != write_ipbl(&opts)) return EXIT_FAILURE;
+    if (0 != generate(&opts)) return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+#!/bin/sh
+#
+# Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+#
+# This file is part of netstinky-ids.
+#
+# Use of this source code is governed by a BSD-style
+# license that can be found in the LICENSE file or at
+# https://opensource.org/licenses/BSD-2-Clause
+#
+# End-to-end performance check, run by `make perfcheck`.
+#
+# Replays a synthetic capture through `nsids --replay` with the blacklists
+# that test/pcapgen writes alongside it, and measures:
+#
+#   packets_per_sec    the best of PERFCHECK_RUNS replays
+#   allocs_per_packet  allocations made while replaying, counted by the
+#                      malloc_count shim, less those made by a replay of a
+#                      single packet (loading the blacklists and starting up)
+#   peak_rss_kib       the lowest peak resident set size of the replays
+#
+# The check fails if any of them is worse than its baseline by more than
+# PERFCHECK_THRESHOLD percent.
+#
+# The capture is generated from a fixed seed, so it is the same on every
+# machine, and so is the number of allocations it takes. Their baseline is
+# kept in the source tree, in ALLOCS_BASELINE; update it along with a change
+# that is meant to alter them. Packets per second and peak RSS depend on the
+# machine and the build, so their baseline, in BASELINE, is recorded on the
+# machine that runs the check with --record, with --enable-debug off (a
+# debug build stops when stdin is closed). Without it they are only printed.
+
+set -e
+
+NSIDS=${NSIDS:-./nsids}
+PCAPGEN=${PCAPGEN:-./test/pcapgen}
+MALLOC_COUNT=${MALLOC_COUNT:-./test/malloc_count.so}
+BASELINE=${BASELINE:-perfcheck.baseline}
+ALLOCS_BASELINE=${ALLOCS_BASELINE:-test/perfcheck.allocs}
+WORKDIR=${WORKDIR:-perfcheck.d}
+PERFCHECK_PACKETS=${PERFCHECK_PACKETS:-500000}
+PERFCHECK_RUNS=${PERFCHECK_RUNS:-3}
+PERFCHECK_THRESHOLD=${PERFCHECK_THRESHOLD:-10}
+
+record=no
+if [ "x$1" = "x--record" ]; then
+    record=yes
+elif [ ! -f "$ALLOCS_BASELINE" ]; then
+    echo "perfcheck: there is no baseline in $ALLOCS_BASELINE" >&2
+    exit 1
+fi
+
+case "$MALLOC_COUNT" in
+    /*) ;;
+    *) MALLOC_COUNT="$(pwd)/$MALLOC_COUNT" ;;
+esac
+
+mkdir -p "$WORKDIR"
+
+# The capture for the measurements and a single packet from the same mix
+"$PCAPGEN" -o "$WORKDIR/replay.pcap" -n "$PERFCHECK_PACKETS" -s 1 \
+    --profile mixed --dnbl "$WORKDIR/replay.dnbl" \
+    --ipbl "$WORKDIR/replay.ipbl" > "$WORKDIR/replay.summary"
+"$PCAPGEN" -o "$WORKDIR/one.pcap" -n 1 -s 1 --profile mixed > /dev/null
+
+# replay <capture> <name>: writes <name>.out and <name>.count
+replay() {
+    MALLOC_COUNT_OUTPUT="$WORKDIR/$2.count" LD_PRELOAD="$MALLOC_COUNT" \
+        "$NSIDS" --replay "$1" --dnbl "$WORKDIR/replay.dnbl" \
+        --ipbl "$WORKDIR/replay.ipbl" > "$WORKDIR/$2.out" 2> "$WORKDIR/$2.err" \
+        || { echo "perfcheck: nsids failed, see $WORKDIR/$2.err" >&2; exit 1; }
+    if [ ! -s "$WORKDIR/$2.count" ]; then
+        echo "perfcheck: $MALLOC_COUNT did not report" >&2
+        exit 1
+    fi
+}
+
+# field <file> <key>: the value of key=value in file
+field() {
+    sed -n "s/^\\(.* \\)\\{0,1\\}$2=\\([0-9.]*\\).*$/\\2/p" "$1"
+}
+
+replay "$WORKDIR/one.pcap" one
+startup_allocs=$(field "$WORKDIR/one.count" allocations)
+
+# One line per run: packets, packets/s, allocations and peak RSS
+: > "$WORKDIR/runs"
+run=1
+while [ "$run" -le "$PERFCHECK_RUNS" ]; do
+    replay "$WORKDIR/replay.pcap" run$run
+    printf '%s %s %s\n' \
+        "$(sed -n 's/^Replayed \([0-9]*\) packets .*(\([0-9.]*\) packets\/s)$/\1 \2/p' \
+            "$WORKDIR/run$run.out")" \
+        "$(field "$WORKDIR/run$run.count" allocations)" \
+        "$(field "$WORKDIR/run$run.count" peak_rss_kib)" >> "$WORKDIR/runs"
+    run=$((run + 1))
+done
+
+# Summarise the runs in the same key=value form as the baseline
+results=$(
+    awk -v startup="$startup_allocs" '
+        NF != 4 { exit 1 }
+        {
+            if ($2 > pps) pps = $2
+            if (!rss || $4 < rss) rss = $4
+            if (!allocs || $3 < allocs) allocs = $3
+            packets = $1
+        }
+        END {
+            if (!packets) exit 1
+            printf "packets_per_sec=%.0f\n", pps
+            printf "allocs_per_packet=%.3f\n", (allocs - startup) / (packets - 1)
+            printf "peak_rss_kib=%d\n", rss
+        }' "$WORKDIR/runs"
+) || { echo "perfcheck: could not read the results in $WORKDIR" >&2; exit 1; }
+
+echo "$results"
+
+if [ "$record" = yes ]; then
+    {
+        echo "# nsids perfcheck baseline for this machine, $PERFCHECK_PACKETS packets"
+        echo "$results" | grep -v '^allocs_per_packet='
+    } > "$BASELINE"
+    echo "perfcheck: recorded the baseline in $BASELINE"
+    exit 0
+fi
+
+# compare <baseline> <key> <higher is better>: prints a line and fails on a
+# regression
+status=0
+compare() {
+    base=$(field "$1" "$2")
+    now=$(echo "$results" | field /dev/stdin "$2")
+    if [ -z "$base" ]; then
+        echo "perfcheck: $2 is not in $1" >&2
+        status=1
+        return
+    fi
+    awk -v key="$2" -v base="$base" -v now="$now" -v higher="$3" \
+            -v limit="$PERFCHECK_THRESHOLD" '
+        BEGIN {
+            # Treat tiny baselines as 0.01 so that 0 allocations can regress
+            denom = base > 0.01 ? base : 0.01
+            change = (now - base) * 100 / denom
+            worse = higher ? -change : change
+            verdict = worse > limit ? "REGRESSED" : "ok"
+            printf "%-18s baseline %-12s now %-12s %+7.1f%%  %s\n", \
+                key, base, now, change, verdict
+            exit worse > limit
+        }' || status=1
+}
+
+compare "$ALLOCS_BASELINE" allocs_per_packet 0
+if [ -f "$BASELINE" ]; then
+    compare "$BASELINE" packets_per_sec 1
+    compare "$BASELINE" peak_rss_kib 0
+else
+    echo "perfcheck: packets/s and peak RSS were not checked, as there is" \
+        "no baseline for this machine in $BASELINE;" \
+        "run \`make perfcheck-baseline' to record one"
+fi
+
+if [ "$status" -ne 0 ]; then
+    echo "perfcheck: regressed by more than $PERFCHECK_THRESHOLD%" >&2
+fi
+exit $status
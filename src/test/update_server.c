@@ -0,0 +1,616 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief A stand-in update server for measuring updates
+ *
+ * Serves a full update of generated IoCs over TLS on the loopback interface,
+ * speaking the server side of the update protocol (see protocols.dox). Point
+ * nsids at it with `--update-host 127.0.0.1 --update-port <port>
+ * --ssl-no-verify`.
+ *
+ * The update is 60% domain names and the rest IPv4 addresses and ports, as
+ * text for protocol v1 and v2 and as binary records for v3. The server offers
+ * the compression methods given with --compress, and compresses the update
+ * if the client asks for one of them. For each connection it prints the size
+ * of the update, the bytes sent for it, the CPU time spent compressing it and
+ * the time until the client confirmed it, so that the methods can be
+ * compared with each other and with no compression.
+ *
+ * Any certificate will do, for example one made with
+ * `openssl req -x509 -newkey rsa:2048 -nodes -subj /CN=localhost
+ * -keyout key.pem -out cert.pem`.
+ *
+ * Usage: update_server --cert <file> --key <file> [options], see usage()
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define DEFAULT_PORT 8443
+#define DEFAULT_IOCS 100000
+#define DEFAULT_SEED 1
+#define DEFAULT_PROTOCOL 3
+#define DEFAULT_CONNECTIONS 1
+
+/** The share of IoCs that are domain names, in percent */
+#define DOMAIN_PERCENT 60
+
+/** The most plaintext in one TLS record */
+#define CHUNK_LEN 16384
+
+/** Longer than any request from the client */
+#define REQUEST_LEN 4096
+
+/** The longest generated name, including the NULL terminator */
+#define MAX_NAME_LEN 128
+
+struct options
+{
+    const char *cert;
+    const char *key;
+    const char *methods;
+    const char *version;
+    unsigned long port;
+    unsigned long iocs;
+    unsigned long long seed;
+    unsigned long protocol;
+    unsigned long connections;
+};
+
+/** An update, or a compressed update, as it is sent */
+struct payload
+{
+    unsigned char *buf;
+    size_t len;
+    size_t cap;
+};
+
+static uint64_t rand_state;
+
+static const char *words[] = {
+    "an", "ar", "ba", "be", "co", "da", "de", "el", "en", "er", "fi", "go",
+    "in", "ka", "la", "le", "lo", "ma", "me", "mo", "na", "ne", "no", "on",
+    "or", "pa", "pro", "ra", "re", "ri", "sa", "se", "shop", "st", "ta", "te",
+    "ti", "to", "tech", "un", "va", "web", "za",
+};
+
+static const char *tlds[] = {
+    "com", "com", "com", "com", "net", "org", "ru", "de", "info", "io",
+    "xyz", "top", "cn", "co.uk",
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+static uint64_t
+next_rand(void)
+{
+    // xorshift64*
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static size_t
+uniform(size_t n)
+{
+    return next_rand() % n;
+}
+
+static int
+append(struct payload *p, const void *data, size_t len)
+{
+    unsigned char *buf;
+
+    if (p->len + len > p->cap)
+    {
+        p->cap = (p->cap + len) * 2;
+        if (!(buf = realloc(p->buf, p->cap))) return -1;
+        p->buf = buf;
+    }
+    memcpy(p->buf + p->len, data, len);
+    p->len += len;
+    return 0;
+}
+
+/**
+ * Write a name of a few syllables under a common TLD, with a number in it so
+ * that every name is different.
+ */
+static size_t
+make_name(char *out, size_t i)
+{
+    size_t len = 0, syllables = 2 + uniform(3), j;
+
+    for (j = 0; j < syllables; j++)
+        len += sprintf(out + len, "%s", words[uniform(ARRAY_LEN(words))]);
+    len += sprintf(out + len, "%zu.%s", i, tlds[uniform(ARRAY_LEN(tlds))]);
+    return len;
+}
+
+/**
+ * Generate the update that every client is sent, after the protocol version.
+ */
+static int
+make_update(const struct options *opts, struct payload *p)
+{
+    char name[MAX_NAME_LEN], line[MAX_NAME_LEN + 16];
+    unsigned char rec[3 + 1 + MAX_NAME_LEN + 4];
+    uint32_t addr, be_addr;
+    size_t i, len;
+    int rc = 0;
+
+    rand_state = opts->seed * 0x9e3779b97f4a7c15ULL + 1;
+    memset(p, 0, sizeof(*p));
+
+    if (opts->protocol >= 2)
+    {
+        len = snprintf(line, sizeof(line), "FULL: %s\n", opts->version);
+        rc = append(p, line, len);
+    }
+
+    for (i = 0; i < opts->iocs && !rc; i++)
+    {
+        if (uniform(100) < DOMAIN_PERCENT)
+        {
+            len = make_name(name, i);
+            if (opts->protocol >= 3)
+            {
+                rec[0] = 3;
+                rec[1] = 0;
+                rec[2] = 1 + len + 4;
+                rec[3] = len;
+                memcpy(rec + 4, name, len);
+                memset(rec + 4 + len, 0, 4);
+                rc = append(p, rec, 3 + 1 + len + 4);
+            }
+            else
+            {
+                len = snprintf(line, sizeof(line), "DN_IOC: %s\n", name);
+                rc = append(p, line, len);
+            }
+            continue;
+        }
+
+        addr = (uint32_t) next_rand();
+        if (opts->protocol >= 3)
+        {
+            rec[0] = 1;
+            rec[1] = 0;
+            rec[2] = 10;
+            be_addr = htonl(addr);
+            memcpy(rec + 3, &be_addr, 4);
+            rec[7] = 0;
+            rec[8] = 80;
+            memset(rec + 9, 0, 4);
+            rc = append(p, rec, 13);
+        }
+        else
+        {
+            len = snprintf(line, sizeof(line), "IP_IOC: %u.%u.%u.%u 80\n",
+                    addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff,
+                    addr & 0xff);
+            rc = append(p, line, len);
+        }
+    }
+
+    // The end of the update: an end record or a blank line
+    if (!rc) rc = opts->protocol >= 3 ? append(p, "\0\0\0", 3)
+            : append(p, "\n", 1);
+
+    return rc;
+}
+
+/**
+ * Compress the update with \p method, a chunk at a time as a server that
+ * streams its database would.
+ *
+ * @return 0 if successful, -1 if the method is not available or failed
+ */
+static int
+compress_update(const char *method, const struct payload *in,
+        struct payload *out)
+{
+    unsigned char buf[CHUNK_LEN];
+    size_t pos, n;
+
+    memset(out, 0, sizeof(*out));
+
+#ifdef HAVE_ZLIB
+    if (!strcmp(method, "zlib"))
+    {
+        z_stream z;
+        int flush, zrc;
+
+        memset(&z, 0, sizeof(z));
+        if (Z_OK != deflateInit(&z, Z_DEFAULT_COMPRESSION)) return -1;
+        for (pos = 0; pos < in->len || !pos; pos += n)
+        {
+            n = in->len - pos < CHUNK_LEN ? in->len - pos : CHUNK_LEN;
+            flush = pos + n == in->len ? Z_FINISH : Z_NO_FLUSH;
+            z.next_in = in->buf + pos;
+            z.avail_in = n;
+            do
+            {
+                z.next_out = buf;
+                z.avail_out = sizeof(buf);
+                zrc = deflate(&z, flush);
+                if (Z_STREAM_ERROR == zrc
+                        || append(out, buf, sizeof(buf) - z.avail_out))
+                {
+                    deflateEnd(&z);
+                    return -1;
+                }
+            } while (!z.avail_out);
+            if (Z_FINISH == flush) break;
+        }
+        deflateEnd(&z);
+        return 0;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (!strcmp(method, "zstd"))
+    {
+        ZSTD_CStream *z = ZSTD_createCStream();
+        ZSTD_inBuffer zin;
+        ZSTD_outBuffer zout;
+        size_t left;
+        int last;
+
+        if (!z || ZSTD_isError(ZSTD_initCStream(z, 3))) goto zstd_error;
+        for (pos = 0; pos < in->len || !pos; pos += n)
+        {
+            n = in->len - pos < CHUNK_LEN ? in->len - pos : CHUNK_LEN;
+            last = pos + n == in->len;
+            zin.src = in->buf + pos;
+            zin.size = n;
+            zin.pos = 0;
+            do
+            {
+                zout.dst = buf;
+                zout.size = sizeof(buf);
+                zout.pos = 0;
+                left = ZSTD_compressStream2(z, &zout, &zin,
+                        last ? ZSTD_e_end : ZSTD_e_continue);
+                if (ZSTD_isError(left) || append(out, buf, zout.pos))
+                    goto zstd_error;
+            } while (last ? 0 != left : zin.pos < zin.size);
+            if (last) break;
+        }
+        ZSTD_freeCStream(z);
+        return 0;
+
+zstd_error:
+        ZSTD_freeCStream(z);
+        return -1;
+    }
+#endif
+
+    return -1;
+}
+
+/**
+ * Whether \p method is in the space separated list \p methods.
+ */
+static int
+is_offered(const char *methods, const char *method)
+{
+    size_t len = strlen(method);
+    const char *p = methods;
+
+    while ((p = strstr(p, method)))
+    {
+        if ((p == methods || ' ' == p[-1]) && (' ' == p[len] || !p[len]))
+            return 1;
+        p += len;
+    }
+    return 0;
+}
+
+/**
+ * Read from the client until a blank line or the end of the connection.
+ *
+ * @return The length read, or -1 on an error
+ */
+static int
+read_message(SSL *ssl, char *buf, size_t size)
+{
+    size_t len = 0;
+    int n;
+
+    while (len < size - 1)
+    {
+        if ((n = SSL_read(ssl, buf + len, size - 1 - len)) <= 0)
+            return SSL_ERROR_ZERO_RETURN == SSL_get_error(ssl, n) ? (int) len
+                    : -1;
+        len += n;
+        buf[len] = '\0';
+        if (strstr(buf, "\n\n")) break;
+    }
+
+    return len;
+}
+
+static int
+write_all(SSL *ssl, const unsigned char *data, size_t len)
+{
+    size_t pos, n;
+
+    for (pos = 0; pos < len; pos += n)
+    {
+        n = len - pos < CHUNK_LEN ? len - pos : CHUNK_LEN;
+        if (SSL_write(ssl, data + pos, n) <= 0) return -1;
+    }
+    return 0;
+}
+
+static double
+seconds(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/**
+ * Serve the update over one connection and print what it took.
+ */
+static int
+serve(SSL *ssl, const struct options *opts, const struct payload *update)
+{
+    char greeting[64], request[REQUEST_LEN], method[16] = "none";
+    struct payload compressed = { NULL, 0, 0 };
+    const struct payload *sent = update;
+    struct timespec start, end;
+    clock_t cpu;
+    const char *field;
+    int len, ret = -1;
+
+    if (SSL_accept(ssl) <= 0)
+    {
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+
+    len = snprintf(greeting, sizeof(greeting), "v%lu%s%s\n", opts->protocol,
+            *opts->methods ? " " : "", opts->methods);
+    if (SSL_write(ssl, greeting, len) <= 0) goto done;
+
+    if ((len = read_message(ssl, request, sizeof(request))) <= 0) goto done;
+    if ((field = strstr(request, "COMPRESSION: ")))
+    {
+        sscanf(field, "COMPRESSION: %15s", method);
+        if (!is_offered(opts->methods, method))
+        {
+            fprintf(stderr, "The client asked for %s, which was not offered\n",
+                    method);
+            goto done;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cpu = clock();
+    if (strcmp(method, "none"))
+    {
+        if (compress_update(method, update, &compressed))
+        {
+            fprintf(stderr, "Could not compress the update with %s\n", method);
+            goto done;
+        }
+        sent = &compressed;
+    }
+    cpu = clock() - cpu;
+
+    if (write_all(ssl, sent->buf, sent->len)) goto done;
+    if ((len = read_message(ssl, request, sizeof(request))) < 0) goto done;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    request[strcspn(request, "\n")] = '\0';
+    printf("v%lu %s: %zu bytes sent for %zu bytes of update (%.1f%%), "
+            "%.3f s CPU compressing, %.3f s until \"%s\"\n", opts->protocol,
+            method, sent->len, update->len, sent->len * 100.0 / update->len,
+            (double) cpu / CLOCKS_PER_SEC, seconds(&start, &end), request);
+    fflush(stdout);
+    ret = 0;
+
+done:
+    free(compressed.buf);
+    SSL_shutdown(ssl);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s --cert <file> --key <file> [options]\n"
+        "\t--cert <file>\t\tThe certificate to present, in PEM\n"
+        "\t--key <file>\t\tIts private key, in PEM\n"
+        "\t-p, --port <n>\t\tThe port to listen on, on 127.0.0.1 (%d)\n"
+        "\t-n, --iocs <n>\t\tThe number of IoCs in the update (%d)\n"
+        "\t-s, --seed <n>\t\tThe seed of the generated IoCs (%d)\n"
+        "\t--protocol <n>\t\tThe protocol version, 1 to 3 (%d)\n"
+        "\t--compress <list>\tThe compression methods to offer, separated\n"
+        "\t\t\t\tby spaces (every method built in)\n"
+        "\t--version <v>\t\tThe version of the update for protocol v2 and v3\n"
+        "\t--connections <n>\tExit after this many connections, or 0 to\n"
+        "\t\t\t\tserve forever (%d)\n",
+        prog, DEFAULT_PORT, DEFAULT_IOCS, DEFAULT_SEED, DEFAULT_PROTOCOL,
+        DEFAULT_CONNECTIONS);
+}
+
+/**
+ * Parse a number, which must be at least \p min.
+ */
+static int
+parse_ul(const char *arg, unsigned long min, unsigned long *out)
+{
+    char *end;
+
+    errno = 0;
+    *out = strtoul(arg, &end, 10);
+    if (ERANGE == errno || '\0' != *end || end == arg || *out < min)
+    {
+        fprintf(stderr, "Invalid number: %s\n", arg);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"cert", required_argument, 0, 'C'},
+        {"key", required_argument, 0, 'K'},
+        {"port", required_argument, 0, 'p'},
+        {"iocs", required_argument, 0, 'n'},
+        {"seed", required_argument, 0, 's'},
+        {"protocol", required_argument, 0, 'P'},
+        {"compress", required_argument, 0, 'c'},
+        {"version", required_argument, 0, 'V'},
+        {"connections", required_argument, 0, 'N'},
+        {0, 0, 0, 0}
+    };
+    struct options opts = {
+        .methods = ""
+#ifdef HAVE_ZSTD
+            "zstd "
+#endif
+#ifdef HAVE_ZLIB
+            "zlib"
+#endif
+            ,
+        .version = "1",
+        .port = DEFAULT_PORT,
+        .iocs = DEFAULT_IOCS,
+        .seed = DEFAULT_SEED,
+        .protocol = DEFAULT_PROTOCOL,
+        .connections = DEFAULT_CONNECTIONS,
+    };
+    struct sockaddr_in addr;
+    struct payload update;
+    unsigned long value, served;
+    SSL_CTX *ctx;
+    SSL *ssl;
+    int opt, sock, conn, one = 1;
+
+    while (-1 != (opt = getopt_long(argc, argv, "p:n:s:", long_options,
+            NULL)))
+    {
+        switch (opt)
+        {
+        case 'C': opts.cert = optarg; break;
+        case 'K': opts.key = optarg; break;
+        case 'c': opts.methods = optarg; break;
+        case 'V': opts.version = optarg; break;
+        case 'p':
+            if (parse_ul(optarg, 1, &opts.port) || opts.port > UINT16_MAX)
+                return EXIT_FAILURE;
+            break;
+        case 'n':
+            if (parse_ul(optarg, 0, &opts.iocs)) return EXIT_FAILURE;
+            break;
+        case 's':
+            if (parse_ul(optarg, 0, &value)) return EXIT_FAILURE;
+            opts.seed = value;
+            break;
+        case 'P':
+            if (parse_ul(optarg, 1, &opts.protocol) || opts.protocol > 3)
+                return EXIT_FAILURE;
+            break;
+        case 'N':
+            if (parse_ul(optarg, 0, &opts.connections)) return EXIT_FAILURE;
+            break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!opts.cert || !opts.key || optind != argc)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (make_update(&opts, &update))
+    {
+        fprintf(stderr, "Could not allocate the update\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!(ctx = SSL_CTX_new(TLS_server_method()))
+            || 1 != SSL_CTX_use_certificate_chain_file(ctx, opts.cert)
+            || 1 != SSL_CTX_use_PrivateKey_file(ctx, opts.key,
+                    SSL_FILETYPE_PEM))
+    {
+        ERR_print_errors_fp(stderr);
+        return EXIT_FAILURE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opts.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (-1 == (sock = socket(AF_INET, SOCK_STREAM, 0))
+            || setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one))
+            || bind(sock, (struct sockaddr *) &addr, sizeof(addr))
+            || listen(sock, 1))
+    {
+        perror("Could not listen");
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "Serving %lu IoCs (%zu bytes) on 127.0.0.1:%lu\n",
+            opts.iocs, update.len, opts.port);
+
+    for (served = 0; !opts.connections || served < opts.connections; served++)
+    {
+        if (-1 == (conn = accept(sock, NULL, NULL)))
+        {
+            perror("accept");
+            continue;
+        }
+        if ((ssl = SSL_new(ctx)))
+        {
+            SSL_set_fd(ssl, conn);
+            serve(ssl, &opts, &update);
+            SSL_free(ssl);
+        }
+        close(conn);
+    }
+
+    close(sock);
+    SSL_CTX_free(ctx);
+    free(update.buf);
+    return EXIT_SUCCESS;
+}
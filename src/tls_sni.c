@@ -0,0 +1,318 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/mem.h"
+#include "tls_sni.h"
+
+#define TLS_RECORD_HANDSHAKE 0x16
+#define TLS_HANDSHAKE_CLIENT_HELLO 0x01
+#define TLS_EXT_SERVER_NAME 0x0000
+#define TLS_SERVER_NAME_HOST 0x00
+
+/** The length of the record header: type, version and length */
+#define RECORD_HEADER_LEN 5
+
+/** The length of the version and random fields of a ClientHello */
+#define HELLO_FIXED_LEN (2 + 32)
+
+/**
+ * A position within the ClientHello that cannot move past END
+ */
+struct cursor
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+};
+
+static inline int
+get_uint8(struct cursor *c, unsigned int *out)
+{
+    if (c->end - c->pos < 1) return -1;
+    *out = c->pos[0];
+    c->pos += 1;
+    return 0;
+}
+
+static inline int
+get_uint16(struct cursor *c, unsigned int *out)
+{
+    if (c->end - c->pos < 2) return -1;
+    *out = (unsigned int) c->pos[0] << 8 | c->pos[1];
+    c->pos += 2;
+    return 0;
+}
+
+static inline int
+get_uint24(struct cursor *c, unsigned int *out)
+{
+    if (c->end - c->pos < 3) return -1;
+    *out = (unsigned int) c->pos[0] << 16 | (unsigned int) c->pos[1] << 8
+            | c->pos[2];
+    c->pos += 3;
+    return 0;
+}
+
+static inline int
+skip(struct cursor *c, size_t n)
+{
+    if ((size_t) (c->end - c->pos) < n) return -1;
+    c->pos += n;
+    return 0;
+}
+
+/**
+ * Move to a vector with a length field of \p len_bytes bytes, setting \p inner
+ * to its contents and moving \p c past it.
+ */
+static int
+enter_vector(struct cursor *c, unsigned int len_bytes, struct cursor *inner)
+{
+    unsigned int len;
+    int rc = (1 == len_bytes) ? get_uint8(c, &len) : get_uint16(c, &len);
+
+    if (rc) return -1;
+    inner->pos = c->pos;
+    if (skip(c, len)) return -1;
+    inner->end = c->pos;
+    return 0;
+}
+
+/**
+ * Find the host name in the contents of a server_name extension.
+ */
+static int
+parse_server_name(struct cursor ext, char *buf, size_t buf_sz)
+{
+    struct cursor list, name;
+    unsigned int name_type;
+
+    if (enter_vector(&ext, 2, &list)) return -1;
+
+    while (list.pos < list.end)
+    {
+        if (get_uint8(&list, &name_type)) return -1;
+        if (enter_vector(&list, 2, &name)) return -1;
+        if (TLS_SERVER_NAME_HOST != name_type) continue;
+
+        size_t name_len = name.end - name.pos;
+        if (!name_len || name_len >= buf_sz) return -1;
+        // A NULL within the name would truncate it
+        if (memchr(name.pos, '\0', name_len)) return -1;
+
+        memcpy(buf, name.pos, name_len);
+        buf[name_len] = '\0';
+        return (int) name_len;
+    }
+
+    return 0;
+}
+
+/**
+ * Parse a ClientHello from the handshake message header onwards.
+ */
+static int
+parse_client_hello(struct cursor c, char *buf, size_t buf_sz)
+{
+    struct cursor v, exts, ext;
+    unsigned int type, length;
+
+    if (get_uint8(&c, &type) || TLS_HANDSHAKE_CLIENT_HELLO != type) return -1;
+    if (get_uint24(&c, &length)) return 0;
+    if ((size_t) (c.end - c.pos) > length) c.end = c.pos + length;
+
+    // Running out of data after this point means the extension is in a
+    // later segment rather than that the data is not a ClientHello
+    if (skip(&c, HELLO_FIXED_LEN)) return 0;
+    if (enter_vector(&c, 1, &v)) return 0;                // session_id
+    if (enter_vector(&c, 2, &v)) return 0;                // cipher_suites
+    if (enter_vector(&c, 1, &v)) return 0;                // compression_methods
+    if (enter_vector(&c, 2, &exts)) return 0;
+
+    while (exts.pos < exts.end)
+    {
+        if (get_uint16(&exts, &type)) return 0;
+        if (enter_vector(&exts, 2, &ext)) return 0;
+        if (TLS_EXT_SERVER_NAME == type)
+            return parse_server_name(ext, buf, buf_sz);
+    }
+
+    return 0;
+}
+
+int
+tls_sni_parse(const uint8_t *data, size_t len, char *buf, size_t buf_sz)
+{
+    assert(data || !len);
+    assert(buf);
+
+    struct cursor c = { data, data + len };
+    unsigned int type, version, length;
+
+    if (!buf_sz) return -1;
+    buf[0] = '\0';
+
+    if (get_uint8(&c, &type) || TLS_RECORD_HANDSHAKE != type) return -1;
+    if (get_uint16(&c, &version) || 0x03 != (version >> 8)) return -1;
+    if (get_uint16(&c, &length)) return -1;
+
+    // A ClientHello larger than one segment is cut short by the end of the
+    // data, so the server name is only found if it is in the first segment
+    if ((size_t) (c.end - c.pos) > length) c.end = c.pos + length;
+
+    return parse_client_hello(c, buf, buf_sz);
+}
+
+int
+tls_sni_parse_handshake(const uint8_t *data, size_t len, char *buf,
+        size_t buf_sz)
+{
+    assert(data || !len);
+    assert(buf);
+
+    struct cursor c = { data, data + len };
+
+    if (!buf_sz) return -1;
+    buf[0] = '\0';
+
+    return parse_client_hello(c, buf, buf_sz);
+}
+
+struct tls_sni_slot
+{
+    struct in6_addr src_ip;
+    struct in6_addr dest_ip;
+    uint16_t src_port;
+    /** Non-zero if the slot holds a connection */
+    uint16_t used;
+    /** The time of the SYN */
+    uint32_t added;
+};
+
+struct tls_sni_table
+{
+    struct tls_sni_slot *slots;
+    /** The number of slots minus one */
+    uint32_t mask;
+};
+
+static inline uint32_t
+hash_addr(uint32_t h, const struct in6_addr *addr)
+{
+    uint32_t word;
+    int i;
+
+    for (i = 0; i < 16; i += 4)
+    {
+        memcpy(&word, addr->s6_addr + i, sizeof(word));
+        h = (h ^ word) * 2654435761u;
+    }
+    return h;
+}
+
+static inline struct tls_sni_slot *
+slot_of(const tls_sni_table *table, const struct in6_addr *src_ip,
+        const struct in6_addr *dest_ip, uint16_t src_port)
+{
+    uint32_t h = hash_addr(hash_addr(0, src_ip), dest_ip);
+
+    h = (h ^ src_port) * 2654435761u;
+    return &table->slots[(h >> 16) & table->mask];
+}
+
+tls_sni_table *
+new_tls_sni_table(unsigned int slots)
+{
+    tls_sni_table *table = NULL;
+    uint32_t n = 1;
+
+    if (!slots) goto error;
+    while (n < slots) n <<= 1;
+
+    if (NULL == (table = mem_calloc(MEM_FLOWS, 1, sizeof(*table)))) goto error;
+    if (NULL == (table->slots = mem_calloc(MEM_FLOWS, n,
+            sizeof(*table->slots))))
+        goto error;
+    table->mask = n - 1;
+
+    return table;
+
+error:
+    free_tls_sni_table(&table);
+    return NULL;
+}
+
+void
+free_tls_sni_table(tls_sni_table **table)
+{
+    assert(table);
+
+    if (*table)
+    {
+        mem_free(MEM_FLOWS, (*table)->slots);
+        mem_free(MEM_FLOWS, *table);
+        *table = NULL;
+    }
+}
+
+void
+tls_sni_table_add(tls_sni_table *table, const struct in6_addr *src_ip,
+        const struct in6_addr *dest_ip, uint16_t src_port, uint32_t now)
+{
+    assert(table);
+
+    struct tls_sni_slot *s = slot_of(table, src_ip, dest_ip, src_port);
+
+    s->src_ip = *src_ip;
+    s->dest_ip = *dest_ip;
+    s->src_port = src_port;
+    s->used = 1;
+    s->added = now;
+}
+
+int
+tls_sni_table_take(tls_sni_table *table, const struct in6_addr *src_ip,
+        const struct in6_addr *dest_ip, uint16_t src_port, uint32_t now)
+{
+    assert(table);
+
+    struct tls_sni_slot *s = slot_of(table, src_ip, dest_ip, src_port);
+
+    if (!s->used || !IN6_ARE_ADDR_EQUAL(&s->src_ip, src_ip)
+            || !IN6_ARE_ADDR_EQUAL(&s->dest_ip, dest_ip)
+            || s->src_port != src_port)
+        return 0;
+
+    s->used = 0;
+    return (int32_t) (now - s->added) < TLS_SNI_TIMEOUT;
+}
+
+int
+tls_sni_table_first(tls_sni_table *table, const struct in6_addr *src_ip,
+        const struct in6_addr *dest_ip, uint16_t src_port, uint32_t now)
+{
+    assert(table);
+
+    struct tls_sni_slot *s = slot_of(table, src_ip, dest_ip, src_port);
+
+    if (s->used && IN6_ARE_ADDR_EQUAL(&s->src_ip, src_ip)
+            && IN6_ARE_ADDR_EQUAL(&s->dest_ip, dest_ip)
+            && s->src_port == src_port
+            && (int32_t) (now - s->added) < TLS_SNI_TIMEOUT)
+        return 0;
+
+    tls_sni_table_add(table, src_ip, dest_ip, src_port, now);
+    return 1;
+}
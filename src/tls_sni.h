@@ -0,0 +1,126 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Extraction of the server name from a TLS ClientHello
+ *
+ * The client names the server it wants in the server_name extension (SNI) of
+ * its ClientHello, which is sent unencrypted in the first data of an HTTPS
+ * connection. The name can be checked against the domain blacklist in the
+ * same way as a DNS query.
+ *
+ * Only the first segment sent by the client is inspected. A #tls_sni_table
+ * remembers which connections have started but not yet sent that segment.
+ */
+#ifndef TLS_SNI_H_
+#define TLS_SNI_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+/** The TCP port used by HTTPS */
+#define TLS_SNI_PORT 443
+
+/** The default number of slots in a #tls_sni_table */
+#define TLS_SNI_DEFAULT_SLOTS 1024
+
+/** Connections that do not send data within this many seconds of their SYN
+ * are forgotten */
+#define TLS_SNI_TIMEOUT 10
+
+/** Hide the implementation from dependent modules */
+typedef struct tls_sni_table tls_sni_table;
+
+/**
+ * Extract the server name from a TLS record containing a ClientHello. Every
+ * length is checked against the end of the data and nothing is allocated.
+ *
+ * @param data The start of the TCP payload
+ * @param len The length of \p data
+ * @param buf The buffer to write the NULL-terminated name to
+ * @param buf_sz The size of \p buf
+ * @return The length of the name, 0 if the ClientHello has no server name or
+ * it is not within \p data, or -1 if \p data is not a ClientHello or the
+ * name does not fit in \p buf
+ */
+int
+tls_sni_parse(const uint8_t *data, size_t len, char *buf, size_t buf_sz);
+
+/**
+ * Extract the server name from a ClientHello handshake message that is not
+ * wrapped in a TLS record, as carried in the CRYPTO frames of QUIC.
+ *
+ * @return As for tls_sni_parse()
+ */
+int
+tls_sni_parse_handshake(const uint8_t *data, size_t len, char *buf,
+        size_t buf_sz);
+
+/**
+ * Allocate a table of connections waiting for their ClientHello.
+ *
+ * The table is direct-mapped: a connection that hashes to the same slot as
+ * an existing connection replaces it. This keeps the table a fixed size
+ * however many connections are opened.
+ *
+ * @param slots The number of connections that can be remembered, which is
+ * rounded up to a power of two
+ * @return A pointer to the table, or NULL if memory could not be allocated
+ */
+tls_sni_table *
+new_tls_sni_table(unsigned int slots);
+
+/**
+ * @brief Free the memory used by the table
+ * Sets the value pointed to by \p table to NULL
+ */
+void
+free_tls_sni_table(tls_sni_table **table);
+
+/**
+ * Remember a connection after seeing its SYN. Addresses and ports are in
+ * network byte order, and IPv4 addresses are IPv4-mapped IPv6 addresses.
+ *
+ * @param now The capture time of the SYN, in seconds
+ */
+void
+tls_sni_table_add(tls_sni_table *table, const struct in6_addr *src_ip,
+        const struct in6_addr *dest_ip, uint16_t src_port, uint32_t now);
+
+/**
+ * Forget a connection, returning whether it was waiting for its first data.
+ * Call this with each segment that carries data so that only the first one
+ * is parsed.
+ *
+ * @param now The capture time of the segment, in seconds
+ * @return 1 if the connection was in the table and had not timed out,
+ * otherwise 0
+ */
+int
+tls_sni_table_take(tls_sni_table *table, const struct in6_addr *src_ip,
+        const struct in6_addr *dest_ip, uint16_t src_port, uint32_t now);
+
+/**
+ * Remember a connection that has no SYN, such as a QUIC connection, the
+ * first time it is seen.
+ *
+ * @param now The capture time of the packet, in seconds
+ * @return 1 if the connection was not in the table or had timed out, so
+ * this packet is the first of the connection, otherwise 0
+ */
+int
+tls_sni_table_first(tls_sni_table *table, const struct in6_addr *src_ip,
+        const struct in6_addr *dest_ip, uint16_t src_port, uint32_t now);
+
+#endif /* TLS_SNI_H_ */
@@ -0,0 +1,282 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_USE_TSC 1
+#endif
+
+#include "trace.h"
+
+/** Histogram buckets are powers of two nanoseconds, from 2^TRACE_MIN_SHIFT
+ * to 2^TRACE_MAX_SHIFT (64 ns to about 16 ms) */
+#define TRACE_MIN_SHIFT 6
+#define TRACE_MAX_SHIFT 24
+#define TRACE_BUCKETS (TRACE_MAX_SHIFT - TRACE_MIN_SHIFT + 1)
+
+/** How long the TSC is calibrated for, in nanoseconds */
+#define TRACE_CALIBRATE_NS (20 * 1000 * 1000)
+
+/** The number of bits that a stage takes in a stack key */
+#define STACK_KEY_BITS 4
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    [TRACE_PACKET] = "packet_handler",
+    [TRACE_DECODE] = "decode",
+    [TRACE_LINK] = "link",
+    [TRACE_TCP_DNS] = "tcp_dns",
+    [TRACE_SNI] = "sni",
+    [TRACE_CHECK] = "check",
+    [TRACE_DNS_NAME] = "dns_name",
+    [TRACE_REVERSE] = "reverse_labels",
+    [TRACE_TRIE] = "trie",
+    [TRACE_IP_LOOKUP] = "ip_lookup",
+    [TRACE_EVENT] = "event",
+};
+
+/** A stage that has begun but not ended */
+struct trace_frame
+{
+    enum trace_stage stage;
+    /** The clock when the stage began */
+    uint64_t start;
+    /** The time spent in stages called by this one, in clock ticks */
+    uint64_t children;
+};
+
+/** The total self time of a stack of stages */
+struct trace_stack
+{
+    /** The stages of the stack, #STACK_KEY_BITS each with the outermost in
+     * the lowest bits, each stored as one more than the stage. 0 if the slot
+     * is unused. */
+    uint32_t key;
+    /** In nanoseconds */
+    uint64_t self_ns;
+};
+
+/** The latency histogram of a stage */
+struct trace_histogram
+{
+    /** Not cumulative. The last bucket counts values above the largest
+     * bound. */
+    uint64_t buckets[TRACE_BUCKETS + 1];
+    /** In nanoseconds */
+    uint64_t sum;
+};
+
+static struct trace_frame frames[TRACE_MAX_DEPTH];
+/** The number of stages that have begun but not ended. May be more than
+ * #TRACE_MAX_DEPTH, in which case the deepest are not recorded. */
+static unsigned int depth;
+
+static struct trace_stack stacks[TRACE_MAX_STACKS];
+/** Self time that was not recorded because #stacks was full */
+static uint64_t stacks_overflow_ns;
+
+static struct trace_histogram histograms[TRACE_STAGE_COUNT];
+
+/** The length of a clock tick, in nanoseconds */
+static double ns_per_tick = 1.0;
+
+static uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t
+trace_now(void)
+{
+#ifdef TRACE_USE_TSC
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+void
+trace_init(void)
+{
+#ifdef TRACE_USE_TSC
+    const struct timespec wait = { 0, TRACE_CALIBRATE_NS };
+    uint64_t ns, ticks;
+
+    ns = monotonic_ns();
+    ticks = __rdtsc();
+    nanosleep(&wait, NULL);
+    ns = monotonic_ns() - ns;
+    ticks = __rdtsc() - ticks;
+
+    if (ticks) ns_per_tick = (double) ns / ticks;
+#endif
+    depth = 0;
+    memset(stacks, 0, sizeof(stacks));
+    memset(histograms, 0, sizeof(histograms));
+    stacks_overflow_ns = 0;
+}
+
+void
+trace_begin(enum trace_stage stage)
+{
+    if (depth < TRACE_MAX_DEPTH)
+    {
+        frames[depth].stage = stage;
+        frames[depth].children = 0;
+        frames[depth].start = trace_now();
+    }
+    depth++;
+}
+
+/**
+ * Add self time to the stack of stages that are currently begun.
+ */
+static void
+record_stack(uint64_t self_ns)
+{
+    uint32_t key = 0;
+    unsigned int i, slot;
+
+    for (i = 0; i < depth; i++)
+        key |= (uint32_t) (frames[i].stage + 1) << (i * STACK_KEY_BITS);
+
+    // The table is small and rarely has more than a few stacks in it
+    slot = (key * 2654435761u) % TRACE_MAX_STACKS;
+    for (i = 0; i < TRACE_MAX_STACKS; i++)
+    {
+        struct trace_stack *s = &stacks[(slot + i) % TRACE_MAX_STACKS];
+
+        if (!s->key) s->key = key;
+        if (s->key == key)
+        {
+            s->self_ns += self_ns;
+            return;
+        }
+    }
+
+    stacks_overflow_ns += self_ns;
+}
+
+/**
+ * Add a latency to the histogram of a stage.
+ */
+static void
+record_latency(enum trace_stage stage, uint64_t ns)
+{
+    unsigned int bucket = 0;
+
+    while (bucket < TRACE_BUCKETS
+            && ns > (UINT64_C(1) << (bucket + TRACE_MIN_SHIFT)))
+        bucket++;
+
+    histograms[stage].buckets[bucket]++;
+    histograms[stage].sum += ns;
+}
+
+void
+trace_end(enum trace_stage stage)
+{
+    struct trace_frame *f;
+    uint64_t now = trace_now(), elapsed;
+
+    if (depth > TRACE_MAX_DEPTH)
+    {
+        // Too deep to have been recorded
+        depth--;
+        return;
+    }
+
+    while (depth)
+    {
+        f = &frames[depth - 1];
+        elapsed = now - f->start;
+
+        record_latency(f->stage, elapsed * ns_per_tick);
+        record_stack((elapsed - f->children) * ns_per_tick);
+
+        depth--;
+        if (depth) frames[depth - 1].children += elapsed;
+        if (f->stage == stage) break;
+    }
+}
+
+int
+trace_write_folded(FILE *out)
+{
+    unsigned int i, j;
+    uint32_t key;
+
+    for (i = 0; i < TRACE_MAX_STACKS; i++)
+    {
+        if (!stacks[i].key) continue;
+
+        for (j = 0, key = stacks[i].key; key; j++, key >>= STACK_KEY_BITS)
+        {
+            if (0 > fprintf(out, "%s%s", j ? ";" : "",
+                    stage_names[(key & ((1 << STACK_KEY_BITS) - 1)) - 1]))
+                return -1;
+        }
+        if (0 > fprintf(out, " %" PRIu64 "\n", stacks[i].self_ns)) return -1;
+    }
+
+    if (stacks_overflow_ns
+            && 0 > fprintf(out, "other %" PRIu64 "\n", stacks_overflow_ns))
+        return -1;
+
+    return 0;
+}
+
+int
+trace_write_metrics(FILE *out)
+{
+    const char *name = "nsids_trace_stage_seconds";
+    const struct trace_histogram *h;
+    uint64_t count;
+    unsigned int i, b;
+
+    if (0 > fprintf(out, "# HELP %s Time spent in each stage of the packet "
+            "handler, including the stages it called\n# TYPE %s histogram\n",
+            name, name))
+        return -1;
+
+    for (i = 0; i < TRACE_STAGE_COUNT; i++)
+    {
+        h = &histograms[i];
+        count = 0;
+
+        for (b = 0; b < TRACE_BUCKETS; b++)
+        {
+            count += h->buckets[b];
+            if (0 > fprintf(out, "%s_bucket{stage=\"%s\",le=\"%g\"} %" PRIu64
+                    "\n", name, stage_names[i],
+                    (double) (UINT64_C(1) << (b + TRACE_MIN_SHIFT)) / 1e9,
+                    count))
+                return -1;
+        }
+        count += h->buckets[TRACE_BUCKETS];
+
+        if (0 > fprintf(out, "%s_bucket{stage=\"%s\",le=\"+Inf\"} %" PRIu64
+                "\n%s_sum{stage=\"%s\"} %g\n%s_count{stage=\"%s\"} %" PRIu64
+                "\n", name, stage_names[i], count, name, stage_names[i],
+                h->sum / 1e9, name, stage_names[i], count))
+            return -1;
+    }
+
+    return 0;
+}
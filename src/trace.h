@@ -0,0 +1,130 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Timing of the stages of the packet handler
+ *
+ * Tracing is compiled in with `./configure --enable-tracing`. Otherwise
+ * TRACE_BEGIN() and TRACE_END() expand to nothing and the packet path is
+ * unchanged.
+ *
+ * When it is compiled in, each stage records its inclusive time in a latency
+ * histogram and its self time (its time less that of the stages it called)
+ * against the stack of stages that it was called from. The stacks can be
+ * written in the folded format read by flamegraph.pl, so that the breakdown
+ * of a packet's time can be drawn as a flame graph.
+ *
+ * Time is read from the TSC on x86, which is calibrated against
+ * `CLOCK_MONOTONIC` by trace_init(), and from `CLOCK_MONOTONIC` elsewhere.
+ *
+ * The stages are only traced on the thread that runs the event loop, and the
+ * results must be read from the same thread.
+ */
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** The stages of the packet handler */
+enum trace_stage
+{
+    /** The whole of packet_handler() */
+    TRACE_PACKET,
+    /** Reading the headers of a packet */
+    TRACE_DECODE,
+    /** Decoding the link layer header */
+    TRACE_LINK,
+    /** Reassembling DNS messages from TCP */
+    TRACE_TCP_DNS,
+    /** Extracting the server name from a TLS or QUIC ClientHello */
+    TRACE_SNI,
+    /** Checking the fields of a packet against the blacklists */
+    TRACE_CHECK,
+    /** Decoding a name from a DNS message */
+    TRACE_DNS_NAME,
+    /** Reversing the labels of a domain name */
+    TRACE_REVERSE,
+    /** Looking up a reversed domain name in the trie */
+    TRACE_TRIE,
+    /** Looking up an address in the IP blacklists and watchlist */
+    TRACE_IP_LOOKUP,
+    /** Creating an event and adding it to the event list */
+    TRACE_EVENT,
+    TRACE_STAGE_COUNT
+};
+
+/** The deepest stack of stages that is recorded. Deeper stages are timed
+ * but not recorded. */
+#define TRACE_MAX_DEPTH 8
+
+/** The number of distinct stacks that are recorded */
+#define TRACE_MAX_STACKS 64
+
+#ifdef ENABLE_TRACING
+
+/** Start timing \p stage */
+#define TRACE_BEGIN(stage) trace_begin(stage)
+/** Stop timing \p stage, which must be the latest stage begun */
+#define TRACE_END(stage) trace_end(stage)
+
+#else
+
+#define TRACE_BEGIN(stage) do { } while (0)
+#define TRACE_END(stage) do { } while (0)
+
+#endif /* ENABLE_TRACING */
+
+/**
+ * Calibrate the clock. Must be called before any stage is traced.
+ */
+void
+trace_init(void);
+
+/**
+ * Start timing a stage. Use TRACE_BEGIN() instead.
+ */
+void
+trace_begin(enum trace_stage stage);
+
+/**
+ * Stop timing a stage. Use TRACE_END() instead.
+ *
+ * If stages that were begun after \p stage have not ended, they are ended
+ * as well.
+ */
+void
+trace_end(enum trace_stage stage);
+
+/**
+ * Write the self time of each stack of stages in the folded format, one
+ * stack per line: the names of the stages separated by semicolons, then the
+ * total self time in nanoseconds.
+ *
+ * @return 0 if successful, -1 if writing to \p out failed
+ */
+int
+trace_write_folded(FILE *out);
+
+/**
+ * Write the latency histogram of each stage in the Prometheus text format.
+ *
+ * @return 0 if successful, -1 if writing to \p out failed
+ */
+int
+trace_write_metrics(FILE *out);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,282 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <config.h>
+
+#include <assert.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "utils/logging.h"
+#include "../utils/mem.h"
+#include "decompressor.h"
+
+static const char *const method_names[NS_COMPRESSION_COUNT] = {
+    [NS_COMPRESSION_NONE] = "none",
+    [NS_COMPRESSION_ZSTD] = "zstd",
+    [NS_COMPRESSION_ZLIB] = "zlib",
+};
+
+/**
+ * Whether a method was built in.
+ */
+static int
+is_available(enum ns_compression method)
+{
+    switch (method)
+    {
+#ifdef HAVE_ZSTD
+    case NS_COMPRESSION_ZSTD:
+        return 1;
+#endif
+#ifdef HAVE_ZLIB
+    case NS_COMPRESSION_ZLIB:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+const char *
+ns_compression_name(enum ns_compression method)
+{
+    if (method >= NS_COMPRESSION_COUNT) return NULL;
+    return method_names[method];
+}
+
+enum ns_compression
+ns_compression_choose(const char *offer, size_t len)
+{
+    const char *end, *newline, *token;
+    enum ns_compression method, best = NS_COMPRESSION_COUNT;
+    size_t token_len;
+
+    assert(offer || !len);
+
+    if ((newline = memchr(offer, '\n', len))) len = newline - offer;
+    end = offer + len;
+
+    while (offer < end)
+    {
+        while (offer < end && ' ' == *offer) offer++;
+        token = offer;
+        while (offer < end && ' ' != *offer) offer++;
+        token_len = offer - token;
+
+        for (method = NS_COMPRESSION_NONE + 1; method < best; method++)
+        {
+            if (is_available(method)
+                    && strlen(method_names[method]) == token_len
+                    && !memcmp(method_names[method], token, token_len))
+                best = method;
+        }
+    }
+
+    return NS_COMPRESSION_COUNT == best ? NS_COMPRESSION_NONE : best;
+}
+
+int
+ns_decompressor_init(struct ns_decompressor *d, enum ns_compression method)
+{
+    assert(d);
+    assert(is_available(method));
+
+    memset(d, 0, sizeof(*d));
+    d->method = method;
+    if (!(d->out = mem_malloc(MEM_TLS, NS_DECOMPRESS_BUF_LEN))) goto error;
+
+    switch (method)
+    {
+#ifdef HAVE_ZLIB
+    case NS_COMPRESSION_ZLIB:
+    {
+        z_stream *z = mem_calloc(MEM_TLS, 1, sizeof(*z));
+
+        if (!z) goto error;
+        d->stream = z;
+        if (Z_OK != inflateInit(z))
+        {
+            mem_free(MEM_TLS, z);
+            d->stream = NULL;
+            goto error;
+        }
+        break;
+    }
+#endif
+#ifdef HAVE_ZSTD
+    case NS_COMPRESSION_ZSTD:
+        if (!(d->stream = ZSTD_createDStream())) goto error;
+        if (ZSTD_isError(ZSTD_initDStream(d->stream))) goto error;
+        break;
+#endif
+    default:
+        goto error;
+    }
+
+    return 0;
+
+error:
+    logger(L_ERROR, "Could not start decompressing a %s update",
+            method_names[method]);
+    ns_decompressor_end(d);
+    return -1;
+}
+
+#ifdef HAVE_ZLIB
+static int
+feed_zlib(struct ns_decompressor *d, const char *data, size_t len,
+        ns_decompress_cb cb, void *cb_data)
+{
+    z_stream *z = d->stream;
+    size_t produced;
+    int zrc, rc;
+
+    z->next_in = (Bytef *) data;
+    z->avail_in = len;
+
+    do
+    {
+        z->next_out = (Bytef *) d->out;
+        z->avail_out = NS_DECOMPRESS_BUF_LEN;
+        zrc = inflate(z, Z_NO_FLUSH);
+        if (Z_OK != zrc && Z_STREAM_END != zrc && Z_BUF_ERROR != zrc)
+        {
+            logger(L_WARN, "Corrupt zlib update: %s",
+                    z->msg ? z->msg : "unknown error");
+            return -1;
+        }
+
+        produced = NS_DECOMPRESS_BUF_LEN - z->avail_out;
+        if (produced)
+        {
+            d->out_bytes += produced;
+            if ((rc = cb(d->out, produced, cb_data)) <= 0) return rc;
+        }
+        if (Z_STREAM_END == zrc) goto truncated;
+    } while (produced && (z->avail_in || !z->avail_out));
+
+    return 1;
+
+truncated:
+    logger(L_WARN, "zlib update ended before the last IoC");
+    return -1;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int
+feed_zstd(struct ns_decompressor *d, const char *data, size_t len,
+        ns_decompress_cb cb, void *cb_data)
+{
+    ZSTD_inBuffer in = { .src = data, .size = len, .pos = 0 };
+    ZSTD_outBuffer out;
+    size_t zrc;
+    int rc;
+
+    do
+    {
+        out.dst = d->out;
+        out.size = NS_DECOMPRESS_BUF_LEN;
+        out.pos = 0;
+        zrc = ZSTD_decompressStream(d->stream, &out, &in);
+        if (ZSTD_isError(zrc))
+        {
+            logger(L_WARN, "Corrupt zstd update: %s", ZSTD_getErrorName(zrc));
+            return -1;
+        }
+
+        if (out.pos)
+        {
+            d->out_bytes += out.pos;
+            if ((rc = cb(d->out, out.pos, cb_data)) <= 0) return rc;
+        }
+        if (0 == zrc)
+        {
+            // A frame has ended. A server that ends a frame each time it
+            // flushes sends several, so start on the next one, which may be
+            // in this piece or a later one.
+            zrc = ZSTD_initDStream(d->stream);
+            if (ZSTD_isError(zrc))
+            {
+                logger(L_WARN, "Could not restart zstd decompression: %s",
+                        ZSTD_getErrorName(zrc));
+                return -1;
+            }
+        }
+    } while (in.pos < in.size || out.pos == out.size);
+
+    return 1;
+}
+#endif
+
+int
+ns_decompressor_feed(struct ns_decompressor *d, const char *data, size_t len,
+        ns_decompress_cb cb, void *cb_data)
+{
+    assert(d);
+    assert(data || !len);
+    assert(cb);
+
+    if (!d->stream) return -1;
+    d->in_bytes += len;
+
+    switch (d->method)
+    {
+#ifdef HAVE_ZLIB
+    case NS_COMPRESSION_ZLIB:
+        return feed_zlib(d, data, len, cb, cb_data);
+#endif
+#ifdef HAVE_ZSTD
+    case NS_COMPRESSION_ZSTD:
+        return feed_zstd(d, data, len, cb, cb_data);
+#endif
+    default:
+        return -1;
+    }
+}
+
+void
+ns_decompressor_end(struct ns_decompressor *d)
+{
+    assert(d);
+
+    if (d->stream)
+    {
+        switch (d->method)
+        {
+#ifdef HAVE_ZLIB
+        case NS_COMPRESSION_ZLIB:
+            inflateEnd(d->stream);
+            mem_free(MEM_TLS, d->stream);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case NS_COMPRESSION_ZSTD:
+            ZSTD_freeDStream(d->stream);
+            break;
+#endif
+        default:
+            break;
+        }
+        d->stream = NULL;
+    }
+
+    mem_free(MEM_TLS, d->out);
+    d->out = NULL;
+}
@@ -0,0 +1,122 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Streaming decompression of updates
+ *
+ * An update server may compress its response with any of the methods that
+ * the client asks for. The decompressor is fed the compressed response in
+ * whatever pieces it arrives in, and passes it on to the update parser a
+ * buffer at a time, so the whole update is never held in memory.
+ *
+ * The methods are only available if the library for them was found by
+ * configure.
+ */
+#ifndef SRC_BLACKLIST_UPDATES_DECOMPRESSOR_H_
+#define SRC_BLACKLIST_UPDATES_DECOMPRESSOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The size of the buffer that is decompressed into */
+#define NS_DECOMPRESS_BUF_LEN 16384
+
+/** Compression methods, in order of preference */
+enum ns_compression
+{
+    /** The update is not compressed */
+    NS_COMPRESSION_NONE = 0,
+    /** One or more zstd frames, one after another */
+    NS_COMPRESSION_ZSTD,
+    /** A zlib (RFC 1950) stream */
+    NS_COMPRESSION_ZLIB,
+    NS_COMPRESSION_COUNT
+};
+
+/**
+ * Called with each buffer of decompressed data
+ *
+ * @param data The data. It may be changed, but is only valid during the
+ * callback.
+ * @param len The length of \p data
+ * @param cb_data The data passed to ns_decompressor_feed()
+ * @return 1 if more data is needed, 0 once it has all been received, or -1
+ * on an error
+ */
+typedef int (*ns_decompress_cb)(char *data, size_t len, void *cb_data);
+
+/** The state of a decompressor between pieces of input */
+struct ns_decompressor
+{
+    enum ns_compression method;
+    /** The state of the library, or NULL if not decompressing */
+    void *stream;
+    /** Where the data is decompressed to, while decompressing */
+    char *out;
+    /** The compressed bytes received */
+    uint64_t in_bytes;
+    /** The decompressed bytes passed to the callback */
+    uint64_t out_bytes;
+};
+
+/**
+ * The name of a method in the update protocol, such as "zlib".
+ */
+const char *
+ns_compression_name(enum ns_compression method);
+
+/**
+ * Choose the most preferred method that is both available and offered by
+ * the server.
+ *
+ * @param offer The methods that the server offers, separated by spaces. Ends
+ * at the first newline or after \p len bytes.
+ * @param len The length of \p offer
+ * @return The method, or #NS_COMPRESSION_NONE if there is none in common
+ */
+enum ns_compression
+ns_compression_choose(const char *offer, size_t len);
+
+/**
+ * Prepare a decompressor for an update compressed with \p method.
+ *
+ * @return 0 if successful, -1 if memory could not be allocated
+ */
+int
+ns_decompressor_init(struct ns_decompressor *d, enum ns_compression method);
+
+/**
+ * Decompress the next piece of an update, and pass what it decompresses to
+ * to \p cb.
+ *
+ * @param d The decompressor
+ * @param data The next piece of the compressed update
+ * @param len The length of \p data
+ * @param cb Called with each buffer of decompressed data
+ * @param cb_data Passed to \p cb
+ * @return 1 if more input is needed, 0 once \p cb has returned 0, or -1 if
+ * the input is corrupt, a zlib stream ends before \p cb has all of the
+ * update, or \p cb returned -1. The end of a zstd frame is not the end of
+ * the update, as another frame may follow it.
+ */
+int
+ns_decompressor_feed(struct ns_decompressor *d, const char *data, size_t len,
+        ns_decompress_cb cb, void *cb_data);
+
+/**
+ * Release the memory of a decompressor. It may be initialised again
+ * afterwards. Safe to call on a decompressor that is not decompressing.
+ */
+void
+ns_decompressor_end(struct ns_decompressor *d);
+
+#endif /* SRC_BLACKLIST_UPDATES_DECOMPRESSOR_H_ */
@@ -0,0 +1,187 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "../utils/mem.h"
+#include "delta.h"
+
+/** The number of changes of each kind that space is first allocated for */
+#define DELTA_INITIAL_LEN 64
+
+/**
+ * Make room for one more change in an array of changes, doubling it if it is
+ * full.
+ *
+ * @param len The number of changes there is room for
+ * @return 0 if successful, -1 if memory could not be allocated
+ */
+static int
+reserve(enum mem_account account, void **changes, size_t *len, size_t n,
+        size_t size)
+{
+    size_t new_len;
+    void *grown;
+
+    if (n < *len) return 0;
+
+    new_len = *len ? 2 * *len : DELTA_INITIAL_LEN;
+    if (!(grown = mem_realloc(account, *changes, new_len * size))) return -1;
+
+    *changes = grown;
+    *len = new_len;
+    return 0;
+}
+
+void
+ns_delta_init(struct ns_delta *delta)
+{
+    assert(delta);
+
+    memset(delta, 0, sizeof(*delta));
+}
+
+void
+ns_delta_free(struct ns_delta *delta)
+{
+    size_t i;
+
+    if (!delta) return;
+
+    for (i = 0; i < delta->n_domains; i++)
+        mem_free(MEM_DOMAIN_BLACKLIST, delta->domains[i].name);
+    mem_free(MEM_DOMAIN_BLACKLIST, delta->domains);
+    mem_free(MEM_IP_BLACKLIST, delta->ips);
+    mem_free(MEM_IP6_BLACKLIST, delta->ip6s);
+
+    ns_delta_init(delta);
+}
+
+int
+ns_delta_domain(struct ns_delta *delta, const char *name, int botnet_id,
+        int remove)
+{
+    struct ns_delta_domain *change;
+    char *copy;
+
+    assert(delta);
+    assert(name);
+
+    if (0 != reserve(MEM_DOMAIN_BLACKLIST, (void **)&delta->domains,
+            &delta->domains_len, delta->n_domains, sizeof(*delta->domains)))
+        return -1;
+    if (!(copy = mem_strdup(MEM_DOMAIN_BLACKLIST, name))) return -1;
+
+    change = &delta->domains[delta->n_domains++];
+    change->name = copy;
+    change->botnet_id = botnet_id;
+    change->remove = remove;
+
+    return 0;
+}
+
+int
+ns_delta_ip(struct ns_delta *delta, const ip_key_value_t *ioc, int remove)
+{
+    ip_blacklist_change_t *change;
+
+    assert(delta);
+    assert(ioc);
+
+    if (0 != reserve(MEM_IP_BLACKLIST, (void **)&delta->ips, &delta->ips_len,
+            delta->n_ips, sizeof(*delta->ips)))
+        return -1;
+
+    change = &delta->ips[delta->n_ips++];
+    change->entry = *ioc;
+    change->remove = remove;
+
+    return 0;
+}
+
+int
+ns_delta_ip6(struct ns_delta *delta, const struct in6_addr *prefix,
+        unsigned int prefix_len, const ids_ioc_value_t *value, int remove)
+{
+    struct ns_delta_ip6 *change;
+
+    assert(delta);
+    assert(prefix);
+    assert(prefix_len <= 128);
+    assert(value || remove);
+
+    if (0 != reserve(MEM_IP6_BLACKLIST, (void **)&delta->ip6s,
+            &delta->ip6s_len, delta->n_ip6s, sizeof(*delta->ip6s)))
+        return -1;
+
+    change = &delta->ip6s[delta->n_ip6s++];
+    memset(change, 0, sizeof(*change));
+    change->prefix = *prefix;
+    change->prefix_len = prefix_len;
+    if (value) change->value = *value;
+    change->remove = remove;
+
+    return 0;
+}
+
+int
+ns_delta_apply(struct ns_delta *delta, domain_blacklist *dn, ip_blacklist *ip,
+        ip6_blacklist *ip6)
+{
+    struct ns_delta_domain *domain;
+    struct ns_delta_ip6 *prefix;
+    ids_ioc_value_t *value;
+    size_t i;
+
+    assert(delta);
+    assert(dn);
+    assert(ip);
+    assert(ip6);
+
+    for (i = 0; i < delta->n_domains; i++)
+    {
+        domain = &delta->domains[i];
+        if (domain->remove)
+        {
+            domain_blacklist_remove(dn, domain->name);
+            continue;
+        }
+        if (!(value = new_ids_ioc_value(domain->botnet_id)))
+            goto error;
+        if (!domain_blacklist_add(dn, domain->name, value))
+        {
+            free_ids_ioc_value(value);
+            goto error;
+        }
+    }
+
+    if (!ip_blacklist_apply(ip, delta->ips, delta->n_ips))
+        goto error;
+
+    for (i = 0; i < delta->n_ip6s; i++)
+    {
+        prefix = &delta->ip6s[i];
+        if (prefix->remove)
+            ip6_blacklist_remove(ip6, &prefix->prefix, prefix->prefix_len);
+        else if (0 != ip6_blacklist_add(ip6, &prefix->prefix,
+                prefix->prefix_len, &prefix->value))
+            goto error;
+    }
+
+    ns_delta_free(delta);
+    return 0;
+
+error:
+    ns_delta_free(delta);
+    return -1;
+}
@@ -0,0 +1,134 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief The changes of a delta update, kept until the update is confirmed
+ *
+ * A delta update adds and removes a few IoCs in blacklists that may be large.
+ * Rather than copying the blacklists so that the active ones are untouched
+ * while the update arrives, its changes are recorded here and made in place
+ * once the whole update has been received. The memory an update needs, and
+ * the time it takes to apply, then depend on the size of the change rather
+ * than the size of the blacklists.
+ *
+ * The changes are allocated to the account of the blacklist they are for, so
+ * that the memory budget counts them.
+ */
+#ifndef SRC_BLACKLIST_UPDATES_DELTA_H_
+#define SRC_BLACKLIST_UPDATES_DELTA_H_
+
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+#include "../blacklist/domain_blacklist.h"
+#include "../blacklist/ip_blacklist.h"
+#include "../blacklist/ip6_blacklist.h"
+#include "../blacklist/ids_storedvalues.h"
+
+/** A change to the domain blacklist */
+struct ns_delta_domain
+{
+    /** The domain, in its usual label order */
+    char *name;
+    /** The botnet of a domain to add */
+    int botnet_id;
+    /** Non-zero to remove the domain, not add it */
+    int remove;
+};
+
+/** A change to the IPv6 blacklist */
+struct ns_delta_ip6
+{
+    /** The address or network */
+    struct in6_addr prefix;
+    /** The number of significant bits in #prefix */
+    unsigned int prefix_len;
+    /** The value of a prefix to add */
+    ids_ioc_value_t value;
+    /** Non-zero to remove the prefix, not add it */
+    int remove;
+};
+
+/** The changes to each blacklist, in the order they arrived */
+struct ns_delta
+{
+    struct ns_delta_domain *domains;
+    size_t n_domains;
+    size_t domains_len;
+
+    ip_blacklist_change_t *ips;
+    size_t n_ips;
+    size_t ips_len;
+
+    struct ns_delta_ip6 *ip6s;
+    size_t n_ip6s;
+    size_t ip6s_len;
+};
+
+/**
+ * Prepare an empty delta
+ */
+void
+ns_delta_init(struct ns_delta *delta);
+
+/**
+ * Free the changes of a delta, leaving it empty
+ */
+void
+ns_delta_free(struct ns_delta *delta);
+
+/**
+ * Record the addition or removal of a domain
+ *
+ * @param name The domain, in its usual label order. It is copied.
+ * @return 0 if successful, -1 if memory could not be allocated
+ */
+int
+ns_delta_domain(struct ns_delta *delta, const char *name, int botnet_id,
+        int remove);
+
+/**
+ * Record the addition or removal of an IPv4 address and port
+ *
+ * @return 0 if successful, -1 if memory could not be allocated
+ */
+int
+ns_delta_ip(struct ns_delta *delta, const ip_key_value_t *ioc, int remove);
+
+/**
+ * Record the addition or removal of an IPv6 prefix
+ *
+ * @param prefix_len The number of significant bits in \p prefix, which must
+ * be at most 128
+ * @param value The value of a prefix to add, or NULL for a removal
+ * @return 0 if successful, -1 if memory could not be allocated
+ */
+int
+ns_delta_ip6(struct ns_delta *delta, const struct in6_addr *prefix,
+        unsigned int prefix_len, const ids_ioc_value_t *value, int remove);
+
+/**
+ * Make the changes of a delta to the blacklists, in the order they were
+ * recorded, and free them.
+ *
+ * The IPv4 changes are made together with ip_blacklist_apply(), so the IPv4
+ * blacklist stays sorted.
+ *
+ * @return 0 if successful, or -1 if memory ran out, in which case some of the
+ * changes may not have been made
+ */
+int
+ns_delta_apply(struct ns_delta *delta, domain_blacklist *dn, ip_blacklist *ip,
+        ip6_blacklist *ip6);
+
+#endif /* SRC_BLACKLIST_UPDATES_DELTA_H_ */
@@ -16,6 +16,7 @@
 #include <string.h>
 
 #include "utils/logging.h"
+#include "../metrics.h"
 #include "ids_tls_update.h"
 
 #include "utils/uvtls/uv_tls.h"
@@ -39,13 +40,14 @@ update_timer_on_write(tls_stream_t *stream, int status, uv_buf_t *bufs,
 int
 setup_update_context(ids_update_ctx_t *update_ctx, uv_loop_t *loop,
         const char *update_host, const uint16_t update_port,
-        int ssl_no_verify,
-        domain_blacklist **domain, ip_blacklist **ip)
+        int ssl_no_verify, int budget_truncate,
+        domain_blacklist **domain, ip_blacklist **ip, ip6_blacklist **ip6)
 {
     assert(update_ctx);
     assert(loop);
     assert(domain);
     assert(ip);
+    assert(ip6);
 
     memset(update_ctx, 0, sizeof(*update_ctx));
 
@@ -55,16 +57,19 @@ setup_update_context(ids_update_ctx_t *update_ctx, uv_loop_t *loop,
 
     update_ctx->server_host = update_host;
     update_ctx->server_port = update_port;
+    update_ctx->budget_truncate = budget_truncate;
 
     // Save blacklist pointers
     update_ctx->domain = domain;
     update_ctx->ip = ip;
+    update_ctx->ip6 = ip6;
     update_ctx->proto.state = NS_PROTO_VERSION_WAITING;
     update_ctx->stream.data = update_ctx;
 
     // Prepare new blacklist pointers
     update_ctx->new_domain = NULL;
     update_ctx->new_ip = NULL;
+    update_ctx->new_ip6 = NULL;
 
     return NSIDS_OK;
 }
@@ -95,9 +100,14 @@ teardown_update_context(ids_update_ctx_t *update_ctx)
             *update_ctx->ip == update_ctx->new_ip)
         update_ctx->new_ip = NULL;
 
+    if (update_ctx->ip6 != NULL &&
+            *update_ctx->ip6 == update_ctx->new_ip6)
+        update_ctx->new_ip6 = NULL;
+
     // Not managed by the update ctx, user responsible for freeing
     update_ctx->domain = NULL;
     update_ctx->ip = NULL;
+    update_ctx->ip6 = NULL;
 
     // If the `new` structures are non-NULL, they haven't been set as the
     // active blacklist structures and therefore need to be freed
@@ -105,6 +115,8 @@ teardown_update_context(ids_update_ctx_t *update_ctx)
         domain_blacklist_clear(update_ctx->new_domain);
     if (update_ctx->new_ip)
         ip_blacklist_clear(update_ctx->new_ip);
+    free_ip6_blacklist(&update_ctx->new_ip6);
+    ns_delta_free(&update_ctx->changes);
 
     update_ctx->proto.state = 0;
 
@@ -190,6 +202,15 @@ update_timer_on_write(tls_stream_t *stream, int status, uv_buf_t *bufs,
 static void
 update_timer_on_close(tls_stream_t *stream)
 {
+    ids_update_ctx_t *ctx = stream->data;
+
+    // The start time is cleared when the update is applied
+    if (ctx && ctx->started)
+    {
+        metrics_inc(METRICS_UPDATES_FAILED);
+        ctx->started = 0;
+    }
+    if (ctx) ns_decompressor_end(&ctx->decompressor);
     tls_stream_fini(stream);
     memset(&stream->tcp, 0, sizeof(stream->tcp));
 }
@@ -209,6 +230,7 @@ static void
 update_timer_on_read(tls_stream_t *stream, int status, const uv_buf_t *buf)
 {
     int rc;
+    uv_buf_t received;
     ns_action_t action;
     ids_update_ctx_t *ctx = NULL;
 
@@ -218,7 +240,11 @@ update_timer_on_read(tls_stream_t *stream, int status, const uv_buf_t *buf)
 
     if (TLS_STR_OK != status)
     {
-        if (buf) free(buf->base);
+        if (buf)
+        {
+            received = *buf;
+            tls_stream_dealloc(&received);
+        }
         rc = tls_stream_shutdown(stream, update_timer_on_shutdown);
         return;
     }
@@ -231,7 +257,8 @@ update_timer_on_read(tls_stream_t *stream, int status, const uv_buf_t *buf)
     logger(L_DEBUG, "Rx'd buffer of len: %lu", buf->len);
 
     rc = ns_cl_proto_on_recv(&action, &ctx->proto.state, stream, buf);
-    free(buf->base);
+    received = *buf;
+    tls_stream_dealloc(&received);
     if (0 != rc)
     {
         rc = tls_stream_shutdown(stream, update_timer_on_shutdown);
@@ -368,6 +395,7 @@ update_timer_cb(uv_timer_t *timer)
 
     // Re-init protocol
     ctx->proto.state = NS_PROTO_VERSION_WAITING;
+    ctx->started = uv_hrtime();
 
     // When not initialized, the handle type will be UNKNOWN. Check if the previous TCP
     // handle is still open.
@@ -21,7 +21,15 @@
 #include "../utils/uvtls/uv_tls.h"
 #include "../blacklist/domain_blacklist.h"
 #include "../blacklist/ip_blacklist.h"
+#include "../blacklist/ip6_blacklist.h"
 #include "../error/ids_error.h"
+#include "decompressor.h"
+#include "delta.h"
+#include "line_reader.h"
+#include "record_decoder.h"
+
+/** The longest version string of the blacklists, including the terminator */
+#define NS_UPDATE_VERSION_LEN 64
 
 /** Client states */
 typedef enum
@@ -86,10 +94,52 @@ typedef struct
     domain_blacklist **domain;
     /** Pointer to the active #ip_blacklist pointer */
     ip_blacklist **ip;
+    /** Pointer to the active #ip6_blacklist pointer */
+    ip6_blacklist **ip6;
     /** Pointer to the staging #domain_blacklist */
     domain_blacklist *new_domain;
     /** Pointer to the staging #ip_blacklist */
     ip_blacklist *new_ip;
+    /** Pointer to the staging #ip6_blacklist */
+    ip6_blacklist *new_ip6;
+    /** The time the current connection was started, from uv_hrtime(), or 0
+     * if no update is in progress */
+    uint64_t started;
+    /** If non-zero, an update that reaches the memory budget of the
+     * blacklists is applied without the rest of its entries. Otherwise it is
+     * refused and the active blacklists are kept. See utils/mem.h */
+    int budget_truncate;
+    /** Non-zero once the current update has reached the budget */
+    int over_budget;
+    /** The entries of the current update dropped because of the budget */
+    unsigned long dropped;
+    /** The protocol version reported by the update server */
+    int server_version;
+    /** The version of the active blacklists reported by a v2 server, or
+     * empty if it is unknown and the next update must be a full one */
+    char version[NS_UPDATE_VERSION_LEN];
+    /** The version the current update brings the blacklists to */
+    char new_version[NS_UPDATE_VERSION_LEN];
+    /** Non-zero until the header of a v2 update has been received */
+    int header_pending;
+    /** Splits the text of a v1 or v2 update into lines */
+    struct ns_line_reader reader;
+    /** The part of the header of a v3 update received so far */
+    char header[2 * NS_UPDATE_VERSION_LEN + 16];
+    /** The length of #header */
+    size_t header_len;
+    /** Decodes the binary records of a v3 update */
+    struct ns_record_decoder decoder;
+    /** How the server compresses the current update */
+    enum ns_compression compression;
+    /** Decompresses the current update, if it is compressed */
+    struct ns_decompressor decompressor;
+    /** Non-zero if the current update is a delta. Its changes are then
+     * recorded in #changes rather than building staging blacklists */
+    int delta;
+    /** The changes of the current delta update, made to the active
+     * blacklists once it is confirmed */
+    struct ns_delta changes;
 } ids_update_ctx_t;
 
 /**
@@ -136,15 +186,18 @@ ns_cl_proto_on_handshake(ns_cli_state_t *state, tls_stream_t *stream);
  * @param update_host Hostname of the update server to connect to
  * @param update_port TCP port number of the update server to connect to
  * @param ssl_no_verify Skip verifying TLS certificates
+ * @param budget_truncate Apply updates that reach the memory budget of the
+ * blacklists without their remaining entries, rather than refusing them
  * @param domain Domain blacklist which will be updated
  * @param ip IP blacklist which will be updated
+ * @param ip6 IPv6 blacklist which will be updated
  * @return 0 if successful
  */
 int
 setup_update_context(ids_update_ctx_t *update_ctx, uv_loop_t *loop,
         const char *update_host, const uint16_t update_port,
-        int ssl_no_verify,
-        domain_blacklist **domain, ip_blacklist **ip);
+        int ssl_no_verify, int budget_truncate,
+        domain_blacklist **domain, ip_blacklist **ip, ip6_blacklist **ip6);
 
 /**
  * Teardown an ids_update_ctx_t. This function starts the teardown process but
@@ -0,0 +1,103 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "utils/logging.h"
+#include "line_reader.h"
+
+void
+ns_line_reader_init(struct ns_line_reader *reader)
+{
+    assert(reader);
+
+    reader->len = 0;
+    reader->overflow = 0;
+    reader->finished = 0;
+}
+
+/**
+ * Keep the part of a line at the end of a piece of input.
+ */
+static void
+keep(struct ns_line_reader *reader, const char *data, size_t len)
+{
+    if (reader->overflow) return;
+
+    if (reader->len + len >= sizeof(reader->buf))
+    {
+        logger(L_WARN, "Skipping an update line longer than %d bytes",
+                NS_LINE_BUF_LEN - 1);
+        reader->overflow = 1;
+        reader->len = 0;
+        return;
+    }
+
+    memcpy(reader->buf + reader->len, data, len);
+    reader->len += len;
+}
+
+int
+ns_line_reader_feed(struct ns_line_reader *reader, char *data, size_t len,
+        ns_line_cb cb, void *cb_data)
+{
+    assert(reader);
+    assert(data || !len);
+    assert(cb);
+
+    char *end = data + len;
+    char *newline, *line;
+    size_t line_len;
+    int rc;
+
+    while (!reader->finished && data < end)
+    {
+        // memchr() is vectorised by the C library, unlike a loop over bytes
+        newline = memchr(data, '\n', end - data);
+        if (!newline)
+        {
+            keep(reader, data, end - data);
+            break;
+        }
+
+        if (reader->len || reader->overflow)
+        {
+            // The end of a line that started in an earlier piece
+            keep(reader, data, newline - data);
+            line = reader->buf;
+            line_len = reader->len;
+            reader->len = 0;
+        }
+        else
+        {
+            line = data;
+            line_len = newline - data;
+        }
+        data = newline + 1;
+
+        if (reader->overflow)
+        {
+            reader->overflow = 0;
+            continue;
+        }
+
+        if (line_len && '\r' == line[line_len - 1]) line_len--;
+        line[line_len] = '\0';
+
+        rc = cb(line, line_len, cb_data);
+        if (rc < 0) return -1;
+        if (rc > 0) reader->finished = 1;
+    }
+
+    return reader->finished ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Splits the text of an update into lines as it arrives
+ *
+ * The reader is fed the text in whatever pieces it arrives in. Lines that are
+ * whole within a piece are passed on where they are, after their newline has
+ * been replaced with a NULL terminator, so the pieces must be writable. Only
+ * a line that is split between two pieces is copied, into a buffer in the
+ * reader, until the rest of it arrives. Nothing is allocated for any line.
+ */
+#ifndef SRC_BLACKLIST_UPDATES_LINE_READER_H_
+#define SRC_BLACKLIST_UPDATES_LINE_READER_H_
+
+#include <stddef.h>
+
+/** The longest line that can be split between pieces, including the
+ * terminator. Longer lines are skipped. The longest valid IoC line is a
+ * domain name of 253 characters and its label. */
+#define NS_LINE_BUF_LEN 512
+
+/**
+ * Called for each line
+ *
+ * @param line The line, without its newline (or a carriage return before it)
+ * and NULL terminated. It may be changed, but is only valid during the
+ * callback.
+ * @param len The length of \p line
+ * @param data The data passed to ns_line_reader_feed()
+ * @return 0 to continue, 1 if the line was the last one wanted, or -1 to stop
+ * on an error
+ */
+typedef int (*ns_line_cb)(char *line, size_t len, void *data);
+
+/** The state of a reader between pieces of input */
+struct ns_line_reader
+{
+    /** The start of a line split between pieces of input */
+    char buf[NS_LINE_BUF_LEN];
+    /** The length of the line in #buf */
+    size_t len;
+    /** Non-zero while the rest of a line that was too long is skipped */
+    int overflow;
+    /** Non-zero once the callback has returned 1 */
+    int finished;
+};
+
+/**
+ * Prepare a reader for a new update
+ */
+void
+ns_line_reader_init(struct ns_line_reader *reader);
+
+/**
+ * Pass the lines in the next piece of an update to \p cb.
+ *
+ * @param reader The reader
+ * @param data The next piece of the update. Its newlines are overwritten.
+ * @param len The length of \p data
+ * @param cb Called for each line
+ * @param cb_data Passed to \p cb
+ * @return 1 if more input is needed, 0 once \p cb has returned 1, or -1 if
+ * \p cb stopped on an error. Input after the last line wanted is ignored.
+ */
+int
+ns_line_reader_feed(struct ns_line_reader *reader, char *data, size_t len,
+        ns_line_cb cb, void *cb_data);
+
+#endif /* SRC_BLACKLIST_UPDATES_LINE_READER_H_ */
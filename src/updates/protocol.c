@@ -11,19 +11,64 @@
  *
  */
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <arpa/inet.h>
+
 #include "utils/logging.h"
+#include "../metrics.h"
+#include "../utils/mem.h"
 #include "../blacklist/ids_storedvalues.h"
 #include "../blacklist/domain_blacklist.h"
 #include "ids_tls_update.h"
-#include "uv_buf_helper.h"
 #include "domain_validation.h"
 
 // Labels for contents of each received line
 static const char *dn_label = "DN_IOC:";
 static const char *ip_label = "IP_IOC:";
+static const char *ip6_label = "IP6_IOC:";
+
+// Labels for the header of a v2 update
+static const char *full_label = "FULL:";
+static const char *delta_label = "DELTA:";
+
+/** Marks a line of a delta update as an IoC to remove */
+#define REMOVE_MARK '-'
+
+/**
+ * Record the version the blacklists are now at, and count the update.
+ */
+static void
+finish_update(ids_update_ctx_t * const context)
+{
+    domain_blacklist *dn = *context->domain;
+
+    // A truncated update does not bring the blacklists to its version, so
+    // the next update must be a full one
+    if (context->over_budget)
+        context->version[0] = '\0';
+    else
+        memcpy(context->version, context->new_version,
+                sizeof(context->version));
+
+    logger(L_INFO, "Applied %s update%s%s: %zu domains in a %zu byte trie, "
+            "%zu bytes of blacklists in use", context->delta ? "delta" : "full",
+            context->version[0] ? " to version " : "", context->version,
+            hattrie_size(dn), hattrie_sizeof(dn), mem_blacklists_in_use());
+
+    if (context->delta) metrics_inc(METRICS_UPDATES_DELTA);
+
+    if (context->started)
+    {
+        metrics_observe(METRICS_UPDATE_DURATION,
+                (uv_hrtime() - context->started) / 1000);
+        context->started = 0;
+    }
+    metrics_inc(METRICS_UPDATES_OK);
+}
 
 static void
 swap_blacklists(ids_update_ctx_t * const context)
@@ -31,50 +76,157 @@ swap_blacklists(ids_update_ctx_t * const context)
     // Global blacklist pointers
     domain_blacklist **g_dn = context->domain;
     ip_blacklist **g_ip = context->ip;
+    ip6_blacklist **g_ip6 = context->ip6;
 
     // Old blacklists
     domain_blacklist *old_dn = *g_dn;
     ip_blacklist *old_ip = *g_ip;
+    ip6_blacklist *old_ip6 = *g_ip6;
     // New blacklist pointers
     domain_blacklist *new_dn = context->new_domain;
     ip_blacklist *new_ip = context->new_ip;
+    ip6_blacklist *new_ip6 = context->new_ip6;
+
+    // The entries of a full update were appended as they arrived. Sort them
+    // now rather than in the first lookup of the capture loop.
+    if (!ip_blacklist_sort(new_ip))
+        logger(L_WARN, "Could not sort the new IP blacklist");
 
     // NULL out the new pointers
     context->new_ip = NULL;
+    context->new_ip6 = NULL;
     context->new_domain = NULL;
     // Swap out the active blacklists
     *context->domain = new_dn;
     *context->ip = new_ip;
+    *context->ip6 = new_ip6;
 
     // Free the old blacklists
     domain_blacklist_clear(old_dn);
-    // free_domain_blacklist(dn);
     free_ip_blacklist(&old_ip);
+    free_ip6_blacklist(&old_ip6);
+
+    finish_update(context);
 }
 
+/**
+ * Make the changes of a delta update to the active blacklists. Nothing else
+ * runs on the thread of the capture loop meanwhile, so no lookup sees them
+ * half made.
+ */
 static void
-reinit_staging_blacklists(ids_update_ctx_t * const context)
+apply_delta(ids_update_ctx_t * const context)
 {
-    // For both blacklists:
-    // - if the `new` blacklist is null, skip to CREATE
-    // - if the `new` blacklist is non-null, but *is* the same as the active
-    //   blacklist, skip to CREATE. Otherwise, free the blacklist.
-    // - CREATE: create a new blacklist
+    if (0 != ns_delta_apply(&context->changes, *context->domain,
+            *context->ip, *context->ip6))
+    {
+        // Some of the changes may have been made, so the version of the
+        // blacklists is no longer known
+        logger(L_ERROR, "Could not allocate memory to apply a delta update");
+        context->version[0] = '\0';
+        context->delta = 0;
+        return;
+    }
+
+    finish_update(context);
+    context->delta = 0;
+}
 
+/**
+ * Free the staging blacklists of a full update, or the changes of a delta.
+ */
+static void
+free_staging_blacklists(ids_update_ctx_t * const context)
+{
     if (context->new_domain)
-        if (*context->domain != context->new_domain)
-            free_domain_blacklist(&context->new_domain);
-    context->new_domain = new_domain_blacklist();
+        domain_blacklist_clear(context->new_domain);
+    context->new_domain = NULL;
+
+    free_ip_blacklist(&context->new_ip);
+    free_ip6_blacklist(&context->new_ip6);
+
+    ns_delta_free(&context->changes);
+    context->delta = 0;
+}
 
-    if (context->new_ip)
-        if(*context->ip != context->new_ip)
-            free_ip_blacklist(&context->new_ip);
+/**
+ * Prepare empty staging blacklists for a full update.
+ */
+static void
+reinit_staging_blacklists(ids_update_ctx_t * const context)
+{
+    free_staging_blacklists(context);
+
+    context->new_domain = new_domain_blacklist();
     context->new_ip = new_ip_blacklist();
+    context->new_ip6 = new_ip6_blacklist();
+
+    context->over_budget = 0;
+    context->dropped = 0;
 }
 
+/**
+ * Prepare to record the changes of a delta update, see updates/delta.h.
+ */
+static void
+start_delta(ids_update_ctx_t * const context)
+{
+    free_staging_blacklists(context);
+
+    context->delta = 1;
+    context->over_budget = 0;
+    context->dropped = 0;
+}
+
+/**
+ * Read the protocol version that the server sends when the connection is
+ * opened, "v<number>\n".
+ *
+ * @return The version, or 1 if it could not be read
+ */
+static int
+parse_server_version(const uv_buf_t *buf)
+{
+    char version[16];
+    size_t len = buf->len < sizeof(version) - 1 ? buf->len
+            : sizeof(version) - 1;
+    char *end;
+    long number;
+
+    memcpy(version, buf->base, len);
+    version[len] = '\0';
+
+    if ('v' != version[0]) return 1;
+    number = strtol(version + 1, &end, 10);
+    if (end == version + 1 || number < 1) return 1;
+
+    return number;
+}
+
+/**
+ * Choose how the update is compressed from the methods that the server lists
+ * after its version, "v<number>[ <method>...]\n".
+ */
+static enum ns_compression
+choose_compression(const uv_buf_t *buf)
+{
+    const char *space = memchr(buf->base, ' ', buf->len);
+    const char *newline = memchr(buf->base, '\n', buf->len);
+
+    if (!space || (newline && newline < space)) return NS_COMPRESSION_NONE;
+    return ns_compression_choose(space + 1,
+            buf->len - (space + 1 - buf->base));
+}
+
+static int
+parse_payload(char *data, size_t len, void *stream);
+
 static int
 parse_ioc_update(const uv_buf_t *buf, tls_stream_t *stream);
 
+static int
+parse_binary_update(const uv_buf_t *buf, tls_stream_t *stream);
+
 ns_action_t
 ns_cl_proto_on_handshake(ns_cli_state_t *state, tls_stream_t *stream)
 {
@@ -94,12 +246,15 @@ ns_cl_proto_on_recv(ns_action_t *action, ns_cli_state_t *state,
         tls_stream_t *stream, const uv_buf_t *buf)
 {
     int rc, parse_rc;
+    ids_update_ctx_t *update_ctx = NULL;
 
     action->type = NS_ACTION_NOP;
     action->send_buffer.base = NULL;
     action->send_buffer.len = 0;
 
-    if (!state || !buf) return -1;
+    if (!state || !stream || !buf) return -1;
+
+    update_ctx = stream->data;
 
     switch(*state)
     {
@@ -108,8 +263,30 @@ ns_cl_proto_on_recv(ns_action_t *action, ns_cli_state_t *state,
         action->send_buffer.base = malloc(1500);
         if (!action->send_buffer.base) return -1;
 
+        // A v2 server can send only the changes since the version of the
+        // active blacklists, if it is known
+        update_ctx->server_version = parse_server_version(buf);
         action->type = NS_ACTION_WRITE;
-        rc = snprintf(action->send_buffer.base, 1500, "OPERATION: UPDATE\n\n");
+        if (update_ctx->server_version >= 2 && update_ctx->version[0])
+            rc = snprintf(action->send_buffer.base, 1500,
+                    "OPERATION: UPDATE SINCE %s\n", update_ctx->version);
+        else
+            rc = snprintf(action->send_buffer.base, 1500,
+                    "OPERATION: UPDATE\n");
+
+        // Ask for the update to be compressed if the server can. Without a
+        // decompressor it is simply sent as it is.
+        ns_decompressor_end(&update_ctx->decompressor);
+        update_ctx->compression = choose_compression(buf);
+        if (update_ctx->compression
+                && ns_decompressor_init(&update_ctx->decompressor,
+                        update_ctx->compression) < 0)
+            update_ctx->compression = NS_COMPRESSION_NONE;
+        if (update_ctx->compression)
+            rc += snprintf(action->send_buffer.base + rc, 1500 - rc,
+                    "COMPRESSION: %s\n",
+                    ns_compression_name(update_ctx->compression));
+        rc += snprintf(action->send_buffer.base + rc, 1500 - rc, "\n");
         assert(rc < 1500);
         action->send_buffer.len = rc;
 
@@ -119,12 +296,26 @@ ns_cl_proto_on_recv(ns_action_t *action, ns_cli_state_t *state,
         break;
     case NS_PROTO_IOCS_WAITING:
         // Process IOCs and send confirmation
-        parse_rc = parse_ioc_update(buf, stream);
+        metrics_add(METRICS_UPDATE_BYTES_RECEIVED, buf->len);
+        if (update_ctx->compression)
+            parse_rc = ns_decompressor_feed(&update_ctx->decompressor,
+                    buf->base, buf->len, parse_payload, stream);
+        else
+            parse_rc = parse_payload(buf->base, buf->len, stream);
         if (parse_rc > 0)
         {
             // We have more IoCs coming. Don't change state
             break;
         }
+        if (update_ctx->compression)
+        {
+            logger(L_INFO, "Received %" PRIu64 " bytes of %s compressed "
+                    "update, %" PRIu64 " bytes decompressed",
+                    update_ctx->decompressor.in_bytes,
+                    ns_compression_name(update_ctx->compression),
+                    update_ctx->decompressor.out_bytes);
+            ns_decompressor_end(&update_ctx->decompressor);
+        }
         action->send_buffer.base = malloc(1500);
         if (!action->send_buffer.base) return -1;
 
@@ -133,8 +324,12 @@ ns_cl_proto_on_recv(ns_action_t *action, ns_cli_state_t *state,
             rc = snprintf(action->send_buffer.base, 1500,
                           "UPDATE CONFIRMED\n\n");
         else // parse_rc < 0
+        {
+            // Keep the active blacklists
+            free_staging_blacklists(update_ctx);
             rc = snprintf(action->send_buffer.base, 1500,
                           "ERROR\n\n");
+        }
         assert(rc < 1500);
         action->send_buffer.len = rc;
 
@@ -173,9 +368,20 @@ ns_cl_proto_on_send(ns_action_t *action, ns_cli_state_t *state,
     case NS_PROTO_OP_SENDING:
         *state = NS_PROTO_IOCS_WAITING;
 
-        // Prepare blacklist structures.
+        // Prepare blacklist structures. A v2 server says whether it is
+        // sending a delta or every IoC first, see parse_update_header()
         update_ctx = stream->data;
-        reinit_staging_blacklists(update_ctx);
+        update_ctx->new_version[0] = '\0';
+        ns_line_reader_init(&update_ctx->reader);
+        if (update_ctx->server_version >= 2)
+        {
+            free_staging_blacklists(update_ctx);
+            update_ctx->header_pending = 1;
+            update_ctx->header_len = 0;
+            ns_record_decoder_init(&update_ctx->decoder);
+        }
+        else
+            reinit_staging_blacklists(update_ctx);
         break;
     case NS_PROTO_IOCS_WAITING:
         break;
@@ -184,7 +390,18 @@ ns_cl_proto_on_send(ns_action_t *action, ns_cli_state_t *state,
         action->type = NS_ACTION_CLOSE;
         *state = NS_PROTO_CLOSE;
         update_ctx = stream->data;
-        swap_blacklists(update_ctx);
+
+        // A refused or failed update has already freed its staging
+        // blacklists or changes
+        if (update_ctx->delta)
+            apply_delta(update_ctx);
+        else if (update_ctx->new_domain && update_ctx->new_ip
+                && update_ctx->new_ip6)
+            swap_blacklists(update_ctx);
+        if (update_ctx->over_budget && update_ctx->budget_truncate)
+            logger(L_WARN, "Applied an update without its last %lu entries, "
+                    "which were over the memory budget",
+                    update_ctx->dropped);
         break;
     case NS_PROTO_CLOSE:
         logger(L_WARN, "NS_PROTO_CLOSE in on_send");
@@ -194,6 +411,33 @@ ns_cl_proto_on_send(ns_action_t *action, ns_cli_state_t *state,
     return 0;
 }
 
+/**
+ * Read a decimal number from the start of \p *pos and move \p *pos past it.
+ *
+ * Updates hold an IP address and port on most lines, so this is done by hand
+ * rather than with sscanf().
+ *
+ * @return 0 if successful, -1 if there is no number or it is larger than
+ * \p max
+ */
+static int
+read_number(const char **pos, unsigned long max, unsigned long *out)
+{
+    const char *p = *pos;
+    unsigned long n = 0;
+
+    if (*p < '0' || *p > '9') return -1;
+    for (; *p >= '0' && *p <= '9'; p++)
+    {
+        n = n * 10 + (*p - '0');
+        if (n > max) return -1;
+    }
+
+    *pos = p;
+    *out = n;
+    return 0;
+}
+
 /**
  * IP line is as follows:
  * "IP_IOC: <dotted quad>, <port>\n"
@@ -204,12 +448,12 @@ ns_cl_proto_on_send(ns_action_t *action, ns_cli_state_t *state,
 static int
 parse_ip_line(char *line, ip_key_value_t *ioc)
 {
-    int rc;
     char *token = NULL;
     char *delim = " ";
-    uint32_t ip;
-    uint32_t port;
-    int quads[4];
+    const char *pos;
+    uint32_t ip = 0;
+    unsigned long n;
+    int i;
 
     if (!line || !ioc) return -1;
 
@@ -220,25 +464,28 @@ parse_ip_line(char *line, ip_key_value_t *ioc)
     // Second token is IP address with trailing comma
     token = strtok(NULL, delim);
     if (!token) return -1;
-    rc = sscanf(token, "%3d.%3d.%3d.%3d,", &quads[0], &quads[1], &quads[2],
-            &quads[3]);
-    if (rc < 4) return -1;
-
-    // Convert quads into a 32 bit integer
-    ip = (quads[0] << 24) | (quads[1] << 16) | (quads[2] << 8) | quads[3];
+    pos = token;
+    for (i = 0; i < 4; i++)
+    {
+        if (i && '.' != *pos++) return -1;
+        if (read_number(&pos, 255, &n) < 0) return -1;
+        ip = ip << 8 | n;
+    }
+    if (',' == *pos) pos++;
+    if ('\0' != *pos) return -1;
 
     // Third token is port
     token = strtok(NULL, delim);
     if (!token) return -1;
-    rc = sscanf(token, "%5u", &port);
-    if (rc < 1) return -1;
+    pos = token;
+    if (read_number(&pos, UINT16_MAX, &n) < 0 || '\0' != *pos) return -1;
 
     // Check that there are no extra tokens
     token = strtok(NULL, delim);
     if (NULL != token) return -1;
 
     ioc->ip_addr = ip;
-    ioc->port = port;
+    ioc->port = n;
 
     // TODO: Include botnet ID
     ioc->value.botnet_id = 0;
@@ -246,6 +493,55 @@ parse_ip_line(char *line, ip_key_value_t *ioc)
     return 0;
 }
 
+/**
+ * IPv6 line is as follows:
+ * "IP6_IOC: <address>[/<prefix length>]\n"
+ *
+ * The address is in any of the text forms accepted by inet_pton(). Without a
+ * prefix length, the line is a single address.
+ *
+ * This is a destructive method but currently no other operations need to be
+ * performed on the line after this.
+ */
+static int
+parse_ip6_line(char *line, struct in6_addr *addr, unsigned int *prefix_len,
+        ids_ioc_value_t *value)
+{
+    char *delim = " ";
+    char *token = NULL;
+    char *slash = NULL;
+    char *end = NULL;
+    unsigned long len = 128;
+
+    if (!line || !addr || !prefix_len || !value) return -1;
+
+    // First token is label (which was already checked)
+    token = strtok(line, delim);
+    if (!token) return -1;
+
+    // Second token is the address, optionally followed by a prefix length
+    token = strtok(NULL, delim);
+    if (!token) return -1;
+    if (NULL != (slash = strchr(token, '/')))
+    {
+        *slash++ = '\0';
+        len = strtoul(slash, &end, 10);
+        if (end == slash || *end != '\0' || len > 128) return -1;
+    }
+    if (1 != inet_pton(AF_INET6, token, addr)) return -1;
+
+    // Check that there are no extra tokens
+    token = strtok(NULL, delim);
+    if (NULL != token) return -1;
+
+    *prefix_len = len;
+
+    // TODO: Include botnet ID
+    value->botnet_id = 0;
+
+    return 0;
+}
+
 /**
  * Domain line is as follows:
  * "DN_IOC: <domain>\n"
@@ -253,9 +549,10 @@ parse_ip_line(char *line, ip_key_value_t *ioc)
  * This is a destructive method. Line should not be read after this function
  * has been run. The OUT variable should only be read prior to freeing LINE.
  *
- * Also allocates the value to be associated with the domain name. This will
- * write over whatever value was previously in the VALUE pointer, as it is
- * assumed that that address has been inserted into the hat-trie.
+ * Also allocates the value to be associated with the domain name, unless
+ * VALUE is NULL. This will write over whatever value was previously in the
+ * VALUE pointer, as it is assumed that that address has been inserted into
+ * the hat-trie.
  */
 static int
 parse_dn_line(char *line, char **out, ids_ioc_value_t **value)
@@ -280,6 +577,7 @@ parse_dn_line(char *line, char **out, ids_ioc_value_t **value)
     if (token) return -1;
 
     *out = domain;
+    if (!value) return 0;
 
     // TODO: Include real botnet value
     *value = new_ids_ioc_value(0);
@@ -288,45 +586,121 @@ parse_dn_line(char *line, char **out, ids_ioc_value_t **value)
     return 0;
 }
 
+/**
+ * Check the memory budget before the next IoC of an update is added.
+ *
+ * Building the new blacklists alongside the active ones must not run the
+ * device out of memory, so the update stops once they reach their budget.
+ *
+ * @return 0 if the IoC can be added, 1 if it is dropped because the update
+ * is being truncated, or -1 if the update has been refused and its staging
+ * blacklists freed
+ */
+static int
+check_budget(ids_update_ctx_t * const context)
+{
+    if (!context->over_budget && mem_blacklists_over_budget())
+    {
+        context->over_budget = 1;
+        metrics_inc(METRICS_UPDATES_OVER_BUDGET);
+        logger(L_WARN, "Blacklists reached their memory budget of %zu "
+                "bytes during an update", mem_blacklist_budget());
+
+        if (!context->budget_truncate)
+        {
+            // Refuse the update and release its memory now
+            free_staging_blacklists(context);
+            return -1;
+        }
+    }
+
+    if (context->over_budget)
+    {
+        context->dropped++;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Add the IoC on a line to the staging blacklists or, during a delta update,
+ * record it as a change, which removes it if the line starts with
+ * #REMOVE_MARK.
+ *
+ * @return 0 if successful, NSIDS_MEM if the IoC or change could not be
+ * stored, or -1 if the line could not be parsed
+ */
 static int
-process_line(char *line, domain_blacklist **dn, ip_blacklist **ip)
+process_line(char *line, ids_update_ctx_t * const context)
 {
     int rc;
+    int remove = 0;
     char *domain = NULL;
 
     // IP value will be copied into blacklist data structure but domain value
     // must be allocated and an address copied into the data structure.
     ip_key_value_t ioc;
     ids_ioc_value_t *domain_value = NULL;
+    struct in6_addr ip6_addr;
+    unsigned int ip6_prefix_len;
+    ids_ioc_value_t ip6_value;
 
-    if (!line || !dn || !ip) return -1;
+    if (!line || !context) return -1;
 
     if (line != NULL && *line == '\0')
     {
         // Ignore an empty string (probably a packet boundary)
         return 0;
     }
-    else if (0 == strncmp(dn_label, line, strlen(dn_label)))
+
+    if (REMOVE_MARK == *line)
+    {
+        // Removals only make sense against the active blacklists
+        if (!context->delta) return -1;
+        remove = 1;
+        line++;
+    }
+
+    if (0 == strncmp(dn_label, line, strlen(dn_label)))
     {
-        rc = parse_dn_line(line, &domain, &domain_value);
+        rc = parse_dn_line(line, &domain,
+                context->delta ? NULL : &domain_value);
         if (rc < 0)
         {
             free_ids_ioc_value(domain_value);
             return -1;
         }
-        rc = domain_blacklist_add(*dn, domain, domain_value);
-        if (rc < 0)
+        // TODO: Include real botnet value
+        if (context->delta)
+            return ns_delta_domain(&context->changes, domain, 0, remove)
+                    ? NSIDS_MEM : 0;
+        if (!domain_blacklist_add(context->new_domain, domain, domain_value))
         {
             free_ids_ioc_value(domain_value);
-            return -1;
+            return NSIDS_MEM;
         }
     }
     else if (0 == strncmp(ip_label, line, strlen(ip_label)))
     {
         rc = parse_ip_line(line, &ioc);
         if (rc < 0) return -1;
-        rc = ip_blacklist_add(*ip, &ioc);
+        if (context->delta)
+            return ns_delta_ip(&context->changes, &ioc, remove)
+                    ? NSIDS_MEM : 0;
+        if (!ip_blacklist_add(context->new_ip, &ioc)) return NSIDS_MEM;
+    }
+    else if (0 == strncmp(ip6_label, line, strlen(ip6_label)))
+    {
+        rc = parse_ip6_line(line, &ip6_addr, &ip6_prefix_len, &ip6_value);
         if (rc < 0) return -1;
+        if (context->delta)
+            return ns_delta_ip6(&context->changes, &ip6_addr, ip6_prefix_len,
+                    &ip6_value, remove) ? NSIDS_MEM : 0;
+        // The prefix length has been checked, so only allocation can fail
+        if (0 != ip6_blacklist_add(context->new_ip6, &ip6_addr,
+                ip6_prefix_len, &ip6_value))
+            return NSIDS_MEM;
     }
     else
     {
@@ -338,47 +712,255 @@ process_line(char *line, domain_blacklist **dn, ip_blacklist **ip)
 }
 
 /**
- * Parse an update packet. The update may span multiple packets.
+ * A v2 update starts with a header line, either "FULL: <version>" before
+ * every IoC, or "DELTA: <from version> <to version>" before the IoCs added
+ * and removed since the version of the active blacklists.
+ *
+ * This is a destructive method. Line should not be read after this function
+ * has been run.
+ *
+ * @return 0 if successful, -1 if the line is not a header or the delta is
+ * not from the version of the active blacklists
+ */
+static int
+parse_update_header(char *line, ids_update_ctx_t * const context)
+{
+    char *delim = " ";
+    char *token = NULL;
+    char *from = NULL;
+    int delta;
+
+    token = strtok(line, delim);
+    if (!token) return -1;
+    if (0 == strcmp(token, full_label))
+        delta = 0;
+    else if (0 == strcmp(token, delta_label))
+        delta = 1;
+    else
+    {
+        logger(L_WARN, "Update did not start with a header: %s", line);
+        return -1;
+    }
+
+    if (delta && !(from = strtok(NULL, delim))) return -1;
+    token = strtok(NULL, delim);
+    if (!token || strlen(token) >= sizeof(context->new_version)) return -1;
+    if (strtok(NULL, delim)) return -1;
+
+    if (delta && 0 != strcmp(from, context->version))
+    {
+        // Ask for every IoC next time
+        logger(L_WARN, "Update server sent changes since version %s, but the "
+                "blacklists are at version %s", from,
+                context->version[0] ? context->version : "(unknown)");
+        context->version[0] = '\0';
+        return -1;
+    }
+
+    if (delta)
+        start_delta(context);
+    else
+        reinit_staging_blacklists(context);
+    strcpy(context->new_version, token);
+    context->header_pending = 0;
+
+    return 0;
+}
+
+/**
+ * Parse the next piece of an update after any decompression, see
+ * ns_decompress_cb.
+ */
+static int
+parse_payload(char *data, size_t len, void *stream)
+{
+    tls_stream_t *tls_stream = stream;
+    ids_update_ctx_t *update_ctx = tls_stream->data;
+    uv_buf_t buf = { .base = data, .len = len };
+
+    metrics_add(METRICS_UPDATE_BYTES_DECODED, len);
+    if (update_ctx->server_version >= 3)
+        return parse_binary_update(&buf, tls_stream);
+    return parse_ioc_update(&buf, tls_stream);
+}
+
+/**
+ * Apply a line of a v1 or v2 update, see ns_line_cb.
+ */
+static int
+apply_line(char *line, size_t len, void *data)
+{
+    ids_update_ctx_t *context = data;
+    int rc;
+
+    if (context->header_pending)
+        return parse_update_header(line, context) < 0 ? -1 : 0;
+
+    // The end of the update is a blank line
+    if (0 == len) return 1;
+
+    rc = check_budget(context);
+    if (rc) return rc < 0 ? -1 : 0;
+
+    rc = process_line(line, context);
+    if (NSIDS_MEM == rc)
+    {
+        logger(L_ERROR, "Could not allocate memory to apply an update");
+        return -1;
+    }
+    if (rc < 0)
+        logger(L_WARN, "process_line(): bad line read");
+
+    return 0;
+}
+
+/**
+ * Parse an update packet. The update may span multiple packets, and lines may
+ * be split between them.
  * @returns 0 if successful, and the packet was the last update packet expected,
  * -ve if an error occurred, +ve if successful but more packets expected.
  */
 static int
 parse_ioc_update(const uv_buf_t *buf, tls_stream_t *stream)
 {
-    char *line = NULL;
-    char *next_line = NULL;
-    int rc;
     ids_update_ctx_t *update_ctx = NULL;
 
     if (!buf || !stream)
         return -1;
 
     update_ctx = (ids_update_ctx_t *)stream->data;
-    next_line = buf->base;
 
-    do
+    return ns_line_reader_feed(&update_ctx->reader, buf->base, buf->len,
+            apply_line, update_ctx);
+}
+
+/**
+ * Add or remove the IoC of a binary update record, see record_decoder.h.
+ *
+ * @return 0 to continue, -1 if the update must stop
+ */
+static int
+apply_record(const struct ns_record *record, void *data)
+{
+    ids_update_ctx_t *context = data;
+    ids_ioc_value_t *domain_value = NULL;
+    ids_ioc_value_t value = { .botnet_id = record->botnet_id };
+    ip_key_value_t ioc;
+    int rc;
+
+    if (record->remove && !context->delta)
+    {
+        logger(L_WARN, "Removal in a full update");
+        return 0;
+    }
+
+    rc = check_budget(context);
+    if (rc) return rc < 0 ? -1 : 0;
+
+    switch (record->type)
     {
-        // Iterate through each line in the buffer
-        rc = uv_buf_read_line(buf, next_line, &line, &next_line);
-        if (rc < 0) break;
-        if (!next_line)
+    case NS_RECORD_DOMAIN:
+        if (0 != is_domain_valid(record->name, record->name_len))
+        {
+            logger(L_WARN, "Invalid domain in update");
+            return 0;
+        }
+        if (context->delta)
         {
-            if (line) free(line);
+            if (0 != ns_delta_domain(&context->changes, record->name,
+                    record->botnet_id, record->remove))
+                goto nomem;
             break;
         }
-
-        // Check for end of update (two new-lines in a row)
-        if (line && (*next_line == '\n' || *next_line == '\0')) {
-            free(line);
+        if (!(domain_value = new_ids_ioc_value(record->botnet_id)))
+            goto nomem;
+        if (!domain_blacklist_add(context->new_domain, record->name,
+                domain_value))
+        {
+            free_ids_ioc_value(domain_value);
+            goto nomem;
+        }
+        break;
+    case NS_RECORD_IP:
+        ioc.ip_addr = record->ip_addr;
+        ioc.port = record->port;
+        ioc.value = value;
+        if (context->delta)
+        {
+            if (0 != ns_delta_ip(&context->changes, &ioc, record->remove))
+                goto nomem;
+        }
+        else if (!ip_blacklist_add(context->new_ip, &ioc))
+            goto nomem;
+        break;
+    case NS_RECORD_IP6:
+        if (record->prefix_len > 128)
+        {
+            logger(L_WARN, "Invalid IPv6 prefix length in update");
             return 0;
         }
+        if (context->delta)
+        {
+            if (0 != ns_delta_ip6(&context->changes, &record->ip6_addr,
+                    record->prefix_len, &value, record->remove))
+                goto nomem;
+        }
+        else if (0 != ip6_blacklist_add(context->new_ip6, &record->ip6_addr,
+                record->prefix_len, &value))
+            goto nomem;
+        break;
+    default:
+        break;
+    }
 
-        rc = process_line(line, &update_ctx->new_domain, &update_ctx->new_ip);
-        if (rc < 0)
-            logger(L_WARN, "process_line(): bad line read");
-        free(line);
+    return 0;
 
-    } while (next_line);
+nomem:
+    logger(L_ERROR, "Could not allocate memory to apply an update");
+    return -1;
+}
+
+/**
+ * Parse a piece of a v3 update: a text header line, followed by binary
+ * records. Either may be split between pieces.
+ * @returns 0 if successful, and the piece completed the update, -ve if an
+ * error occurred, +ve if successful but more pieces expected.
+ */
+static int
+parse_binary_update(const uv_buf_t *buf, tls_stream_t *stream)
+{
+    ids_update_ctx_t *update_ctx = NULL;
+    const char *data;
+    const char *newline;
+    size_t len, n;
+
+    if (!buf || !stream)
+        return -1;
+
+    update_ctx = (ids_update_ctx_t *)stream->data;
+    data = buf->base;
+    len = buf->len;
+
+    if (update_ctx->header_pending)
+    {
+        newline = memchr(data, '\n', len);
+        n = newline ? (size_t) (newline - data) : len;
+        if (update_ctx->header_len + n >= sizeof(update_ctx->header))
+        {
+            logger(L_WARN, "Update header is too long");
+            return -1;
+        }
+        memcpy(update_ctx->header + update_ctx->header_len, data, n);
+        update_ctx->header_len += n;
+        if (!newline) return 1;
+
+        update_ctx->header[update_ctx->header_len] = '\0';
+        if (parse_update_header(update_ctx->header, update_ctx) < 0)
+            return -1;
+        data += n + 1;
+        len -= n + 1;
+    }
 
-    return 1;
+    return ns_record_decoder_feed(&update_ctx->decoder, (const uint8_t *)data,
+            len, apply_record, update_ctx);
 }
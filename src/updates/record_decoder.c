@@ -0,0 +1,161 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <assert.h>
+#include <string.h>
+
+#include "utils/logging.h"
+#include "record_decoder.h"
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static inline uint16_t
+load_be16(const uint8_t *pos)
+{
+    return (uint16_t) (pos[0] << 8 | pos[1]);
+}
+
+static inline uint32_t
+load_be32(const uint8_t *pos)
+{
+    return (uint32_t) pos[0] << 24 | (uint32_t) pos[1] << 16
+            | (uint32_t) pos[2] << 8 | pos[3];
+}
+
+void
+ns_record_decoder_init(struct ns_record_decoder *decoder)
+{
+    assert(decoder);
+
+    decoder->have = 0;
+    decoder->need = 0;
+    decoder->finished = 0;
+    decoder->records = 0;
+}
+
+/**
+ * Decode a whole record and pass it to the callback.
+ *
+ * @param rec The record, starting with its type
+ * @param len The bytes available at \p rec. Less than the length of the
+ * record if it was longer than #NS_RECORD_BUF_LEN and its unknown fields were
+ * skipped.
+ * @return 0 to continue, 1 after the end record, or -1 on an error
+ */
+static int
+decode_record(struct ns_record_decoder *decoder, const uint8_t *rec,
+        size_t len, ns_record_cb cb, void *cb_data)
+{
+    struct ns_record record;
+    const uint8_t *body = rec + NS_RECORD_HEADER_LEN;
+    size_t body_len = len - NS_RECORD_HEADER_LEN;
+
+    memset(&record, 0, sizeof(record));
+    record.type = rec[0] & ~NS_RECORD_REMOVE;
+    record.remove = !!(rec[0] & NS_RECORD_REMOVE);
+
+    switch (record.type)
+    {
+    case NS_RECORD_END:
+        decoder->finished = 1;
+        return 1;
+    case NS_RECORD_IP:
+        if (body_len < 4 + 2 + 4) goto malformed;
+        record.ip_addr = load_be32(body);
+        record.port = load_be16(body + 4);
+        record.botnet_id = (int) load_be32(body + 6);
+        break;
+    case NS_RECORD_IP6:
+        if (body_len < 16 + 1 + 4) goto malformed;
+        memcpy(record.ip6_addr.s6_addr, body, 16);
+        record.prefix_len = body[16];
+        record.botnet_id = (int) load_be32(body + 17);
+        break;
+    case NS_RECORD_DOMAIN:
+        if (body_len < 1 || body_len < 1 + (size_t) body[0] + 4)
+            goto malformed;
+        record.name_len = body[0];
+        memcpy(decoder->name, body + 1, record.name_len);
+        decoder->name[record.name_len] = '\0';
+        record.name = decoder->name;
+        record.botnet_id = (int) load_be32(body + 1 + record.name_len);
+        break;
+    default:
+        // A type added in a later version. Its length is known, so skip it.
+        logger(L_DEBUG, "Skipping an update record of unknown type %u",
+                record.type);
+        return 0;
+    }
+
+    decoder->records++;
+    return cb(&record, cb_data);
+
+malformed:
+    logger(L_WARN, "Update record %lu of type %u is too short",
+            decoder->records, record.type);
+    return -1;
+}
+
+int
+ns_record_decoder_feed(struct ns_record_decoder *decoder, const uint8_t *data,
+        size_t len, ns_record_cb cb, void *cb_data)
+{
+    assert(decoder);
+    assert(data || !len);
+    assert(cb);
+
+    size_t pos = 0, n, need;
+    int rc;
+
+    while (!decoder->finished && pos < len)
+    {
+        // Decode a whole record where it is
+        if (!decoder->have && len - pos >= NS_RECORD_HEADER_LEN)
+        {
+            need = NS_RECORD_HEADER_LEN + load_be16(data + pos + 1);
+            if (len - pos >= need)
+            {
+                rc = decode_record(decoder, data + pos, need, cb, cb_data);
+                if (rc < 0) return -1;
+                pos += need;
+                continue;
+            }
+        }
+
+        // Otherwise keep what there is of it, starting with its header
+        if (!decoder->need)
+        {
+            n = MIN(NS_RECORD_HEADER_LEN - decoder->have, len - pos);
+            memcpy(decoder->buf + decoder->have, data + pos, n);
+            decoder->have += n;
+            pos += n;
+            if (decoder->have < NS_RECORD_HEADER_LEN) break;
+            decoder->need = NS_RECORD_HEADER_LEN + load_be16(decoder->buf + 1);
+        }
+
+        n = MIN(decoder->need - decoder->have, len - pos);
+        if (decoder->have < NS_RECORD_BUF_LEN)
+            memcpy(decoder->buf + decoder->have, data + pos,
+                    MIN(n, NS_RECORD_BUF_LEN - decoder->have));
+        decoder->have += n;
+        pos += n;
+        if (decoder->have < decoder->need) break;
+
+        rc = decode_record(decoder, decoder->buf,
+                MIN(decoder->need, NS_RECORD_BUF_LEN), cb, cb_data);
+        decoder->have = 0;
+        decoder->need = 0;
+        if (rc < 0) return -1;
+    }
+
+    return decoder->finished ? 0 : 1;
+}
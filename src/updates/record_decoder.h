@@ -0,0 +1,137 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Streaming decoder for binary update records
+ *
+ * A v3 update server sends the IoCs after the header line as binary records:
+ *
+ *     type     1 byte, one of #ns_record_type, with #NS_RECORD_REMOVE set if
+ *              the IoC is to be removed
+ *     length   2 bytes, big-endian, the number of bytes that follow
+ *     body     IP:     address (4), port (2), botnet ID (4)
+ *              IP6:    address (16), prefix length (1), botnet ID (4)
+ *              DOMAIN: name length (1), name, botnet ID (4)
+ *              END:    empty
+ *
+ * All integers are big-endian. Bytes of a body past these fields are
+ * metadata that this version does not know about, and are skipped.
+ *
+ * The decoder is fed the records in whatever pieces they arrive in, and keeps
+ * a record that is split between two pieces until the rest of it arrives.
+ * Records that arrive whole are decoded where they are, and nothing is
+ * allocated for any record.
+ */
+#ifndef SRC_BLACKLIST_UPDATES_RECORD_DECODER_H_
+#define SRC_BLACKLIST_UPDATES_RECORD_DECODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <netinet/in.h>
+
+/** The types of binary update record */
+enum ns_record_type
+{
+    /** Marks the end of the update */
+    NS_RECORD_END = 0,
+    /** An IPv4 address and port */
+    NS_RECORD_IP = 1,
+    /** An IPv6 address or prefix */
+    NS_RECORD_IP6 = 2,
+    /** A domain name */
+    NS_RECORD_DOMAIN = 3
+};
+
+/** Set in the type of a record whose IoC is to be removed */
+#define NS_RECORD_REMOVE 0x80
+
+/** The length of the type and length of a record */
+#define NS_RECORD_HEADER_LEN 3
+
+/** The longest record the decoder keeps, which holds every known field of
+ * any record. Bytes of a longer record past this are skipped. */
+#define NS_RECORD_BUF_LEN (NS_RECORD_HEADER_LEN + 1 + 255 + 4)
+
+/** A decoded record */
+struct ns_record
+{
+    /** The type, without #NS_RECORD_REMOVE */
+    enum ns_record_type type;
+    /** Non-zero if the IoC is to be removed */
+    int remove;
+    /** The database ID of the botnet associated with the IoC */
+    int botnet_id;
+    /** The IPv4 address, in host byte order */
+    uint32_t ip_addr;
+    /** The port of an IPv4 record, in host byte order */
+    uint16_t port;
+    /** The IPv6 address or prefix */
+    struct in6_addr ip6_addr;
+    /** The length of the IPv6 prefix */
+    unsigned int prefix_len;
+    /** The domain name, NULL terminated. Only valid during the callback */
+    const char *name;
+    /** The length of #name */
+    size_t name_len;
+};
+
+/**
+ * Called for each record decoded, other than the end record
+ *
+ * @param record The record
+ * @param data The data passed to ns_record_decoder_feed()
+ * @return 0 to continue decoding, or -1 to stop
+ */
+typedef int (*ns_record_cb)(const struct ns_record *record, void *data);
+
+/** The state of a decoder between pieces of input */
+struct ns_record_decoder
+{
+    /** The start of a record split between pieces of input */
+    uint8_t buf[NS_RECORD_BUF_LEN];
+    /** The bytes of the current record received so far */
+    size_t have;
+    /** The length of the current record, or 0 until its header is known */
+    size_t need;
+    /** Where a domain name is copied to be NULL terminated */
+    char name[256];
+    /** Non-zero once the end record has been decoded */
+    int finished;
+    /** The number of records decoded */
+    unsigned long records;
+};
+
+/**
+ * Prepare a decoder for a new update
+ */
+void
+ns_record_decoder_init(struct ns_record_decoder *decoder);
+
+/**
+ * Decode the records in the next piece of an update, calling \p cb for each
+ * of them.
+ *
+ * @param decoder The decoder
+ * @param data The next piece of the update
+ * @param len The length of \p data
+ * @param cb Called for each record
+ * @param cb_data Passed to \p cb
+ * @return 1 if more input is needed, 0 once the end record has been decoded,
+ * or -1 if a record is malformed or \p cb stopped decoding. Input after the
+ * end record is ignored.
+ */
+int
+ns_record_decoder_feed(struct ns_record_decoder *decoder, const uint8_t *data,
+        size_t len, ns_record_cb cb, void *cb_data);
+
+#endif /* SRC_BLACKLIST_UPDATES_RECORD_DECODER_H_ */
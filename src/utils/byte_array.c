@@ -130,7 +130,7 @@ byte_array_get_uint32(const uint8_t *array)
 {
     assert(NULL != array);
 
-    uint32_t result = ((array[0] & 0xFF) << 24)
+    uint32_t result = ((uint32_t) (array[0] & 0xFF) << 24)
             | ((array[1] & 0xFF) << 16)
             | ((array[2] & 0xFF) << 8)
             | ((array[3] & 0xFF) << 0);
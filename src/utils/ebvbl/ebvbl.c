@@ -11,6 +11,7 @@
  *
  */
 #include <stdio.h>
+#include "utils/mem.h"
 #include "ebvbl.h"
 
 #define DIVIDEND_REMAINDER(dividend, remainder, i)          \
@@ -70,7 +71,7 @@ init_bv(unsigned int f)
     if (ebvbl_get_bit_vector_size(f) % 8)
         sz++;
     
-    uint8_t *bv = calloc(1, sz);    // clears all bits
+    uint8_t *bv = mem_calloc(MEM_IP_BLACKLIST, 1, sz);    // clears all bits
     return bv;
 }
 
@@ -83,7 +84,7 @@ ebvbl_init(size_t elementSize, cmpElement cmp, unsigned int f, first_bits fb)
     assert(f <= maxKeyLength);
     assert(fb);
     
-    EBVBL *e = malloc(sizeof(EBVBL));
+    EBVBL *e = mem_malloc(MEM_IP_BLACKLIST, sizeof(EBVBL));
     
     bool failure = false;
     
@@ -92,6 +93,7 @@ ebvbl_init(size_t elementSize, cmpElement cmp, unsigned int f, first_bits fb)
         failure = true;
     else
     {
+        e->_bv = NULL;
         e->_sa = sa_initialize(elementSize, cmp);
         if (!e->_sa)
             failure = true;
@@ -115,11 +117,11 @@ ebvbl_init(size_t elementSize, cmpElement cmp, unsigned int f, first_bits fb)
         if (e)
         {
             if (e->_sa)
-                free(e->_sa);
+                sa_free(e->_sa, NULL);
             
             if (e->_bv)
-                free(e->_sa);
-            free(e);
+                mem_free(MEM_IP_BLACKLIST, e->_bv);
+            mem_free(MEM_IP_BLACKLIST, e);
             e = NULL;
         }
     }
@@ -259,6 +261,59 @@ ebvbl_remove_element(EBVBL *e, unsigned int index)
         _clear_bv_index(e, ip);
 }
 
+void
+ebvbl_remove_elements(EBVBL *e, const unsigned int *indexes, unsigned int n)
+{
+    assert(e);
+    assert(sa_is_sorted(e->_sa));
+    
+    unsigned int count = ebvbl_get_number_of_elements(e);
+    unsigned int first, last, m, k, ip;
+    
+    // Elements with the same prefix are next to each other, so a prefix is
+    // gone once no element with it is left beside a run of removed elements
+    for (m = 0; m < n; m = k)
+    {
+        for (k = m + 1; k < n && indexes[k] == indexes[k - 1] + 1; k++)
+            ;
+        first = indexes[m];
+        last = indexes[k - 1];
+        
+        for (; m < k; m++)
+        {
+            ip = e->_fb(ebvbl_get_element(e, indexes[m]), e->_f);
+            if (first > 0
+                    && e->_fb(ebvbl_get_element(e, first - 1), e->_f) == ip)
+                continue;
+            if (last + 1 < count
+                    && e->_fb(ebvbl_get_element(e, last + 1), e->_f) == ip)
+                continue;
+            _clear_bv_index(e, ip);
+        }
+    }
+    
+    sa_remove_elements(e->_sa, indexes, n);
+}
+
+bool
+ebvbl_merge(EBVBL *e, const void *elements, unsigned int n)
+{
+    assert(e);
+    assert(elements || !n);
+    
+    size_t element_sz = sa_get_element_size(e->_sa);
+    unsigned int i;
+    
+    if (!sa_merge(e->_sa, elements, n))
+        return false;
+    
+    for (i = 0; i < n; i++)
+        _set_bv_index(e, _get_bv_index(e,
+                (uint8_t *) elements + i * element_sz));
+    
+    return true;
+}
+
 bool
 ebvbl_contains(EBVBL *e, void *element)
 {
@@ -275,6 +330,17 @@ ebvbl_contains(EBVBL *e, void *element)
     return result;
 }
 
+SA_INDEX
+ebvbl_find_element(EBVBL *e, void *element)
+{
+    unsigned int p = e->_fb(element, e->_f);
+
+    if (!_get_bit_at_index(e, p))
+        return -1;
+
+    return sa_find_element(e->_sa, element);
+}
+
 const void *
 ebvbl_lookup(EBVBL *e, void *element)
 {
@@ -313,13 +379,41 @@ ebvbl_free(EBVBL *e, freeElement e_free)
         sa_free(e->_sa, e_free);
     
     if (e->_bv != NULL)
-        free(e->_bv);
+        mem_free(MEM_IP_BLACKLIST, e->_bv);
     
-    free(e);
+    mem_free(MEM_IP_BLACKLIST, e);
     
     return NULL;
 }
 
+EBVBL *
+ebvbl_copy(EBVBL *e)
+{
+    assert(e);
+
+    size_t sz_bytes = ebvbl_get_bit_vector_size(e->_f) / 8;
+    EBVBL *copy = mem_malloc(MEM_IP_BLACKLIST, sizeof(EBVBL));
+
+    if (!copy)
+        return NULL;
+
+    *copy = *e;
+    copy->_sa = sa_copy(e->_sa);
+    copy->_bv = init_bv(e->_f);
+    if (!copy->_sa || !copy->_bv)
+    {
+        if (copy->_sa)
+            sa_free(copy->_sa, NULL);
+        if (copy->_bv)
+            mem_free(MEM_IP_BLACKLIST, copy->_bv);
+        mem_free(MEM_IP_BLACKLIST, copy);
+        return NULL;
+    }
+    memcpy(copy->_bv, e->_bv, sz_bytes);
+
+    return copy;
+}
+
 bool
 ebvbl_sort(EBVBL *e)
 {
@@ -129,6 +129,15 @@ ebvbl_lookup(EBVBL *e, void *element);
 bool
 ebvbl_contains(EBVBL *e, void *element);
 
+/**
+ * Gets the index of an element equivalent to the provided ELEMENT.
+ * @param e
+ * @param element
+ * @return The index of the element, or -1 if there is no such element
+ */
+SA_INDEX
+ebvbl_find_element(EBVBL *e, void *element);
+
 void
 ebvbl_clear(EBVBL *e, freeElement free_item);
 
@@ -143,6 +152,15 @@ ebvbl_clear(EBVBL *e, freeElement free_item);
 EBVBL *
 ebvbl_free(EBVBL *e, freeElement e_free);
 
+/**
+ * Creates a copy of an EBVBL. Elements are copied byte for byte, so any
+ * memory they point to is shared with the original.
+ * @param e An initialized EBVBL structure.
+ * @return A pointer to the copy (or NULL if failed)
+ */
+EBVBL *
+ebvbl_copy(EBVBL *e);
+
 SA_INDEX
 ebvbl_insert_element(EBVBL *e, void *element);
 
@@ -154,6 +172,29 @@ ebvbl_insert_element(EBVBL *e, void *element);
 void
 ebvbl_remove_element(EBVBL *e, unsigned int index);
 
+/**
+ * Removes the elements at the given indexes in one pass over the array.
+ * @param e	The address of a sorted EBVBL structure.
+ * @param indexes	The indexes to remove, in ascending order without
+ *			repeats.
+ * @param n	The number of INDEXES.
+ */
+void
+ebvbl_remove_elements(EBVBL *e, const unsigned int *indexes, unsigned int n);
+
+/**
+ * Adds elements to the EBVBL, keeping it sorted. Unlike
+ * ebvbl_insert_element(), which appends, the array does not need to be
+ * sorted again before the next lookup.
+ * @param e	The address of an EBVBL structure.
+ * @param elements	The elements to add, sorted by the comparison function
+ *			of the EBVBL.
+ * @param n	The number of ELEMENTS.
+ * @return True if successful, false if memory could not be allocated.
+ */
+bool
+ebvbl_merge(EBVBL *e, const void *elements, unsigned int n);
+
 /**
  * Sort the SortedArray structure within the EBVBL. Will not sort if it is
  * already in sorted order.
@@ -10,6 +10,8 @@
  *
  *
  */
+#include <stdint.h>
+
 #include "quicksort.h"
 
 size_t
@@ -28,6 +30,21 @@ getElement (void *array, ELEMENT_SZ size, ELEMENT_INDEX i)
     return (ELEMENT_PTR)element;
 }
 
+/**
+ * A xorshift generator for choosing pivots. It need not be seeded, only
+ * unrelated to the order of the elements.
+ */
+static unsigned int
+nextRandom (void)
+{
+    static uint32_t state = 2463534242u;
+    
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
 bool
 quicksort (void *array, ELEMENT_SZ size, COMPARE_F_PTR compare,
            ELEMENT_INDEX lo, ELEMENT_INDEX hi)
@@ -36,19 +53,33 @@ quicksort (void *array, ELEMENT_SZ size, COMPARE_F_PTR compare,
     assert(size > 0);
     assert(compare != NULL);
     
-    bool result = true;
+    ELEMENT_INDEX p;
     
-    if (lo < hi)
+    // Recurse into the smaller partition and loop on the larger one, so that
+    // the depth of the recursion is at most log2 of the number of elements
+    while (lo < hi)
     {
-        ELEMENT_INDEX p = partition(array, size, compare, lo, hi);
+        p = partition(array, size, compare, lo, hi);
         
         // possible for sort to fail if swapping doesn't have enough memory
-        if (p == -1 || !quicksort(array, size, compare, lo, p) ||
-                       !quicksort(array, size, compare, p + 1, hi))
-            result = false;
+        if (p == -1)
+            return false;
+        
+        if (p - lo < hi - p)
+        {
+            if (!quicksort(array, size, compare, lo, p))
+                return false;
+            lo = p + 1;
+        }
+        else
+        {
+            if (!quicksort(array, size, compare, p + 1, hi))
+                return false;
+            hi = p;
+        }
     }
     
-    return result;
+    return true;
 }
 
 bool
@@ -78,8 +109,16 @@ partition(void *array, ELEMENT_SZ size, COMPARE_F_PTR compare, ELEMENT_INDEX lo,
     assert(array != NULL);
     assert(size > 0);
     
+    // The pivot is chosen at random from all but the last element, which
+    // would let the partition end at HI. Blacklists often arrive sorted, or
+    // in sorted runs, and a fixed choice of pivot then splits off a few
+    // elements at a time.
     void *pivotValue = malloc(size);
-    memcpy(pivotValue, getElement(array, size, lo), size);
+    if (pivotValue == NULL)
+        return -1;
+    memcpy(pivotValue, getElement(array, size,
+            lo + (ELEMENT_INDEX) (nextRandom() % (unsigned int) (hi - lo))),
+            size);
     
     ELEMENT_INDEX i, j;
     i = lo - 1;
@@ -108,10 +147,8 @@ partition(void *array, ELEMENT_SZ size, COMPARE_F_PTR compare, ELEMENT_INDEX lo,
             break;
         } else
         {        
-            ELEMENT_INDEX swapResult = swapElements(array, size, i, j);
-
             // check swap was successful
-            if (swapResult == -1)
+            if (!swapElements(array, size, i, j))
             {
                 result = -1;
                 break;
@@ -51,15 +51,16 @@ quicksort (void *array, ELEMENT_SZ size, COMPARE_F_PTR compare,
            ELEMENT_INDEX lo, ELEMENT_INDEX hi);
 
 /**
- * Using the element at LO as the pivot point, sorts the partition into elements
- * that lie above and elements that are below the pivot point. Returns the first
- * element in the group of elements that are above the pivot point.
+ * Using an element of the partition chosen at random, other than the last, as
+ * the pivot point, sorts the partition into elements that lie above and elements that are below the
+ * pivot point. Returns the last element in the group of elements that are
+ * below the pivot point, or -1 if memory could not be allocated.
  * @param array Address of the array
  * @param size  Size of each element in bytes
  * @param compare   Function that compares two elements
  * @param lo        Index of the first element in this partition
  * @param hi        Index of the last element in this partition
- * @return          True if the sort succeeded
+ * @return          The index that the partition is split after
  */
 ELEMENT_INDEX
 partition (void *array, ELEMENT_SZ size, COMPARE_F_PTR compare,
@@ -10,6 +10,7 @@
  *
  *
  */
+#include "utils/mem.h"
 #include "sortedarray.h"
 
 struct SortedArray
@@ -29,7 +30,8 @@ sa_initialize(size_t elementSize, cmpElement cmp)
     assert(elementSize);
     assert(cmp);
     
-    struct SortedArray *sa = malloc(sizeof(struct SortedArray));
+    struct SortedArray *sa = mem_malloc(MEM_IP_BLACKLIST,
+            sizeof(struct SortedArray));
     
     if (sa)
     {
@@ -118,7 +120,7 @@ sa_set_array_size(SortedArray *sa, size_t sz)
     if (sz < (sa_get_size_of_elements(sa, sa->_n)))
         return false;
     
-    void *np = realloc(sa->_arr, sz);   // new pointer
+    void *np = mem_realloc(MEM_IP_BLACKLIST, sa->_arr, sz);   // new pointer
     if (np)
     {
         sa->_arr = np;
@@ -165,6 +167,100 @@ sa_remove_element(SortedArray *sa, unsigned int index)
     sa->_n--;
 }
 
+void
+sa_remove_elements(SortedArray *sa, const unsigned int *indexes,
+        unsigned int n)
+{
+    assert(sa);
+    assert(indexes || !n);
+    
+    unsigned int m, from, to, w;
+    
+    if (!n)
+        return;
+    
+    // Close each gap by moving the block of elements up to the next index
+    w = indexes[0];
+    for (m = 0; m < n; m++)
+    {
+        assert(indexes[m] < sa->_n);
+        assert(!m || indexes[m] > indexes[m - 1]);
+        
+        from = indexes[m] + 1;
+        to = m + 1 < n ? indexes[m + 1] : sa->_n;
+        if (to > from)
+        {
+            memmove(_get_element(sa, w), _get_element(sa, from),
+                    sa_get_size_of_elements(sa, to - from));
+            w += to - from;
+        }
+    }
+    
+    sa->_n -= n;
+}
+
+/**
+ * The number of elements at the start of the array that compare less than or
+ * equal to ELEMENT.
+ */
+static unsigned int
+_upper_bound(SortedArray *sa, unsigned int n, const void *element)
+{
+    unsigned int l = 0, r = n, m;
+    
+    while (l < r)
+    {
+        m = l + (r - l) / 2;
+        if (sa->_cmp(_get_element(sa, m), (void *) element) > 0)
+            r = m;
+        else
+            l = m + 1;
+    }
+    
+    return l;
+}
+
+bool
+sa_merge(SortedArray *sa, const void *elements, unsigned int n)
+{
+    assert(sa);
+    assert(elements || !n);
+    
+    unsigned int i, j, pos;
+    const uint8_t *e = elements;
+    
+    if (!n)
+        return true;
+    
+    if (!sa->_srtd && !sa_quicksort(sa))
+        return false;
+    
+    if (!sa_has_capacity(sa, sa->_n + n))
+    {
+        if (!sa_set_array_size(sa, sa_get_size_of_elements(sa,
+                sa->_n + n + ALLOC_NUM)))
+            return false;
+    }
+    
+    // From the last new element to the first, move the elements after its
+    // place up past the new elements still to come, and copy it in below them
+    i = sa->_n;
+    for (j = n; j > 0; j--)
+    {
+        const void *next = e + sa_get_size_of_elements(sa, j - 1);
+        
+        pos = _upper_bound(sa, i, next);
+        if (i > pos)
+            memmove(_get_element(sa, pos + j), _get_element(sa, pos),
+                    sa_get_size_of_elements(sa, i - pos));
+        memcpy(_get_element(sa, pos + j - 1), next, sa->_e_sz);
+        i = pos;
+    }
+    
+    sa->_n += n;
+    return true;
+}
+
 bool sa_quicksort(SortedArray *sa)
 {
     assert(sa != NULL);
@@ -239,6 +335,19 @@ sa_lookup_element(SortedArray *sa, void *element)
     return NULL;
 }
 
+SA_INDEX
+sa_find_element(SortedArray *sa, void *element)
+{
+    assert(sa);
+    assert(element);
+
+    if (!sa->_n) return -1;
+
+    SA_INDEX i = sa_binary_search(sa, element);
+
+    return 0 == sa->_cmp(sa_get_element(sa, i), element) ? i : -1;
+}
+
 size_t
 sa_get_array_size(SortedArray *sa)
 {
@@ -281,9 +390,29 @@ sa_free(SortedArray *sa, freeElement e_free)
             }
         }
 
-        if (sa->_arr) free(sa->_arr);
-        free(sa);
+        if (sa->_arr) mem_free(MEM_IP_BLACKLIST, sa->_arr);
+        mem_free(MEM_IP_BLACKLIST, sa);
     }
     
     return NULL;
 }
+
+SortedArray *
+sa_copy(SortedArray *sa)
+{
+    assert(sa);
+
+    SortedArray *copy = sa_initialize(sa->_e_sz, sa->_cmp);
+
+    if (copy && sa->_n)
+    {
+        if (!sa_set_array_size(copy, sa_get_size_of_elements(sa, sa->_n)))
+            return sa_free(copy, NULL);
+
+        memcpy(copy->_arr, sa->_arr, sa_get_size_of_elements(sa, sa->_n));
+        copy->_n = sa->_n;
+        copy->_srtd = sa->_srtd;
+    }
+
+    return copy;
+}
@@ -50,12 +50,45 @@ sa_insert_element(SortedArray *sa, void *element);
 void
 sa_remove_element(SortedArray *sa, unsigned int index);
 
+/**
+ * Removes the elements at the given indexes, moving each remaining element
+ * at most once.
+ * @param sa
+ * @param indexes The indexes to remove, in ascending order without repeats
+ * @param n The number of INDEXES
+ */
+void
+sa_remove_elements(SortedArray *sa, const unsigned int *indexes,
+        unsigned int n);
+
+/**
+ * Merges elements into a sorted array, so that it stays sorted. Each element
+ * of the array is moved at most once, and only those after the first new
+ * element are moved.
+ * @param sa A sorted array
+ * @param elements The elements to add, sorted by the same comparison
+ * @param n The number of ELEMENTS
+ * @return True if successful, false if memory could not be allocated
+ */
+bool
+sa_merge(SortedArray *sa, const void *elements, unsigned int n);
+
 bool
 sa_contains_element(SortedArray *sa, void *element);
 
 void *
 sa_lookup_element(SortedArray *sa, void *element);
 
+/**
+ * Gets the index of an element that compares equal to ELEMENT, sorting the
+ * array first if necessary.
+ * @param sa
+ * @param element
+ * @return The index, or -1 if there is no such element
+ */
+SA_INDEX
+sa_find_element(SortedArray *sa, void *element);
+
 unsigned int
 sa_get_number_of_elements(SortedArray *sa);
 
@@ -74,5 +107,14 @@ sa_compare(SortedArray *sa);
 void *
 sa_free(SortedArray *sa, freeElement e_free);
 
+/**
+ * Creates a copy of a SortedArray, with space for only the elements that it
+ * holds.
+ * @param sa
+ * @return The copy, or NULL if allocation failed
+ */
+SortedArray *
+sa_copy(SortedArray *sa);
+
 bool
 sa_quicksort(SortedArray *sa);
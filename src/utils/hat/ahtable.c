@@ -136,10 +136,10 @@ void ahtable_free(ahtable_t* table)
 {
     if (table == NULL) return;
     size_t i;
-    for (i = 0; i < table->n; ++i) free(table->slots[i]);
-    free(table->slots);
-    free(table->slot_sizes);
-    free(table);
+    for (i = 0; i < table->n; ++i) free_accounted(table->slots[i]);
+    free_accounted(table->slots);
+    free_accounted(table->slot_sizes);
+    free_accounted(table);
 }
 
 
@@ -164,7 +164,7 @@ size_t ahtable_sizeof(const ahtable_t* table)
 void ahtable_clear(ahtable_t* table)
 {
     size_t i;
-    for (i = 0; i < table->n; ++i) free(table->slots[i]);
+    for (i = 0; i < table->n; ++i) free_accounted(table->slots[i]);
     table->n = ahtable_initial_size;
     table->slots = realloc_or_die(table->slots, table->n * sizeof(slot_t));
     memset(table->slots, 0, table->n * sizeof(slot_t));
@@ -267,13 +267,13 @@ static void ahtable_expand(ahtable_t* table)
     ahtable_iter_free(i);
 
 
-    free(slots_next);
-    for (j = 0; j < table->n; ++j) free(table->slots[j]);
+    free_accounted(slots_next);
+    for (j = 0; j < table->n; ++j) free_accounted(table->slots[j]);
 
-    free(table->slots);
+    free_accounted(table->slots);
     table->slots = slots;
 
-    free(table->slot_sizes);
+    free_accounted(table->slot_sizes);
     table->slot_sizes = slot_sizes;
 
     table->n = new_n;
@@ -464,8 +464,8 @@ static void ahtable_sorted_iter_next(ahtable_sorted_iter_t* i)
 static void ahtable_sorted_iter_free(ahtable_sorted_iter_t* i)
 {
     if (i == NULL) return;
-    free(i->xs);
-    free(i);
+    free_accounted(i->xs);
+    free_accounted(i);
 }
 
 
@@ -548,7 +548,7 @@ static void ahtable_unsorted_iter_next(ahtable_unsorted_iter_t* i)
 
 static void ahtable_unsorted_iter_free(ahtable_unsorted_iter_t* i)
 {
-    free(i);
+    free_accounted(i);
 }
 
 
@@ -631,7 +631,7 @@ void ahtable_iter_free(ahtable_iter_t* i)
     if (i == NULL) return;
     if (i->sorted) ahtable_sorted_iter_free(i->i.sorted);
     else           ahtable_unsorted_iter_free(i->i.unsorted);
-    free(i);
+    free_accounted(i);
 }
 
 
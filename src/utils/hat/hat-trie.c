@@ -197,7 +197,7 @@ static void hattrie_free_node(node_ptr node)
              * to build a very deep trie. */
             if (node.t->xs[i].t) hattrie_free_node(node.t->xs[i]);
         }
-        free(node.t);
+        free_accounted(node.t);
     }
     else {
         ahtable_free(node.b);
@@ -208,7 +208,7 @@ static void hattrie_free_node(node_ptr node)
 void hattrie_free(hattrie_t* T)
 {
     hattrie_free_node(T->root);
-    free(T);
+    free_accounted(T);
 }
 
 
@@ -538,7 +538,7 @@ static void hattrie_iter_nextnode(hattrie_iter_t* i)
     c     = i->stack->c;
     level = i->stack->level;
 
-    free(i->stack);
+    free_accounted(i->stack);
     i->stack = next;
 
     if (*node.flag & NODE_TYPE_TRIE) {
@@ -656,12 +656,12 @@ void hattrie_iter_free(hattrie_iter_t* i)
     hattrie_node_stack_t* next;
     while (i->stack) {
         next = i->stack->next;
-        free(i->stack);
+        free_accounted(i->stack);
         i->stack = next;
     }
 
-    free(i->key);
-    free(i);
+    free_accounted(i->key);
+    free_accounted(i);
 }
 
 
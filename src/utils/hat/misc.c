@@ -8,10 +8,12 @@
 #include "misc.h"
 #include <stdlib.h>
 
+#include "utils/mem.h"
+
 
 void* malloc_or_die(size_t n)
 {
-    void* p = malloc(n);
+    void* p = mem_malloc(MEM_DOMAIN_BLACKLIST, n);
     if (p == NULL && n != 0) {
         fprintf(stderr, "Cannot allocate %zu bytes.\n", n);
         exit(EXIT_FAILURE);
@@ -22,7 +24,7 @@ void* malloc_or_die(size_t n)
 
 void* realloc_or_die(void* ptr, size_t n)
 {
-    void* p = realloc(ptr, n);
+    void* p = mem_realloc(MEM_DOMAIN_BLACKLIST, ptr, n);
     if (p == NULL && n != 0) {
         fprintf(stderr, "Cannot allocate %zu bytes.\n", n);
         exit(EXIT_FAILURE);
@@ -31,6 +33,12 @@ void* realloc_or_die(void* ptr, size_t n)
 }
 
 
+void free_accounted(void* ptr)
+{
+    mem_free(MEM_DOMAIN_BLACKLIST, ptr);
+}
+
+
 FILE* fopen_or_die(const char* path, const char* mode)
 {
     FILE* f = fopen(path, mode);
@@ -13,8 +13,12 @@
 
 #include <stdio.h>
 
+/* The trie only holds the domain blacklist, so its memory is accounted to
+ * MEM_DOMAIN_BLACKLIST (see utils/mem.h). Blocks from malloc_or_die and
+ * realloc_or_die must be freed with free_accounted. */
 void* malloc_or_die(size_t);
 void* realloc_or_die(void*, size_t);
+void  free_accounted(void*);
 FILE* fopen_or_die(const char*, const char*);
 
 #endif
@@ -10,58 +10,274 @@
  *
  *
  */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
 
 #include "logging.h"
 
-static enum log_level current_log_level = L_ERROR;
+/** How long the writer sleeps when the ring is empty, in nanoseconds */
+#define WRITER_IDLE_NS (10 * 1000 * 1000)
+
+#define RING_MASK (LOG_RING_SLOTS - 1)
+
+enum log_level log_runtime_level = L_ERROR;
+
+/**
+ * A line in the ring buffer. The sequence number is used as in Dmitry
+ * Vyukov's bounded queue: a slot may be written by the producer that claims
+ * position `pos` when its sequence is `pos`, and read by the writer when its
+ * sequence is `pos + 1`.
+ */
+struct log_slot
+{
+    atomic_size_t seq;
+    /** The length of #text */
+    size_t len;
+    char text[LOG_LINE_MAX];
+};
+
+static struct log_slot ring[LOG_RING_SLOTS];
+
+/** The next position to be claimed by a producer */
+static atomic_size_t ring_head;
+
+/** The next position to be read by the writer. Only used by the writer. */
+static size_t ring_tail;
+
+/** The number of lines dropped because the ring was full */
+static atomic_ulong dropped;
+
+/** Set while the writer thread is running */
+static atomic_int writer_running;
+
+/** Set to ask the writer thread to finish */
+static atomic_int writer_stop;
+
+static pthread_t writer_thread;
+
+/** The last line written by the writer, for repeat suppression */
+static char last_line[LOG_LINE_MAX];
+static size_t last_len;
+/** The number of times #last_line has been repeated since it was written or
+ * last counted */
+static unsigned long repeats;
+/** The time that #repeats was last reported */
+static time_t repeats_since;
+
+static const char *level_names[] = {
+    [L_NONE] = "none",
+    [L_ERROR] = "error",
+    [L_WARN] = "warn",
+    [L_INFO] = "info",
+    [L_DEBUG] = "debug"
+};
 
 void
 set_log_level(enum log_level lvl)
 {
-    current_log_level = lvl;
+    log_runtime_level = lvl;
+}
+
+/**
+ * Format a line with its level prefix and a trailing newline.
+ *
+ * @return The length of the line
+ */
+static size_t
+format_line(char *out, enum log_level lvl, const char *str, va_list args)
+{
+    int prefix, len;
+
+    prefix = snprintf(out, LOG_LINE_MAX, "[%s] ", level_names[lvl]);
+    len = vsnprintf(out + prefix, LOG_LINE_MAX - prefix, str, args);
+    if (len < 0) len = 0;
+    len += prefix;
+
+    // Leave room for the newline in a truncated line
+    if (len > LOG_LINE_MAX - 1) len = LOG_LINE_MAX - 1;
+    out[len++] = '\n';
+
+    return len;
 }
 
 void
-logger(enum log_level lvl, const char *str, ... )
+log_write(enum log_level lvl, const char *str, ...)
 {
+    struct log_slot *slot;
+    size_t pos, seq;
+    intptr_t diff;
     va_list args;
-    const char *lvl_str = NULL;
-    FILE *log_file = stdout;
+    char line[LOG_LINE_MAX];
 
-    if (current_log_level == L_NONE)
-        return;
-    if (lvl > current_log_level)
-        return;
+    if (lvl <= L_NONE || lvl > L_DEBUG) return;
 
-    switch (lvl)
+    va_start(args, str);
+
+    if (!atomic_load_explicit(&writer_running, memory_order_acquire))
     {
-    case L_DEBUG:
-        lvl_str = "debug";
-        break;
-    case L_INFO:
-        lvl_str = "info";
-        break;
-    case L_WARN:
-        lvl_str = "warn";
-        break;
-    case L_ERROR:
-        lvl_str = "error";
-        break;
-    case L_NONE:
-        // Unreachable, but silence warnings
+        fwrite(line, 1, format_line(line, lvl, str, args), stdout);
+        fflush(stdout);
+        va_end(args);
         return;
     }
 
-    va_start(args, str);
+    // Claim a slot
+    pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    for (;;)
+    {
+        slot = &ring[pos & RING_MASK];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        diff = (intptr_t) seq - (intptr_t) pos;
 
-    // Intentionally omit \n to print prefix
-    fprintf(log_file, "[%s] ", lvl_str);
-    vfprintf(log_file, str, args);
-    fprintf(log_file, "\n");
-    fflush(log_file);
+        if (0 == diff)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring_head, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            // The writer has not caught up, so never block the caller
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            va_end(args);
+            return;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+        }
+    }
+
+    slot->len = format_line(slot->text, lvl, str, args);
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
 
     va_end(args);
 }
+
+/**
+ * Write the number of times the last line was repeated, if it was.
+ */
+static void
+write_repeats(time_t now)
+{
+    if (repeats)
+        fprintf(stdout, "[info] last message repeated %lu times\n", repeats);
+    repeats = 0;
+    repeats_since = now;
+}
+
+/**
+ * Write a line taken from the ring, unless it repeats the last line.
+ */
+static void
+write_line(const char *text, size_t len, time_t now)
+{
+    if (len == last_len && 0 == memcmp(text, last_line, len))
+    {
+        repeats++;
+        if (now - repeats_since >= LOG_REPEAT_INTERVAL) write_repeats(now);
+        return;
+    }
+
+    write_repeats(now);
+    fwrite(text, 1, len, stdout);
+    memcpy(last_line, text, len);
+    last_len = len;
+}
+
+/**
+ * Write every line in the ring.
+ *
+ * @return The number of lines taken from the ring
+ */
+static unsigned int
+drain(void)
+{
+    struct log_slot *slot;
+    unsigned long n_dropped;
+    unsigned int n = 0;
+    time_t now = time(NULL);
+
+    for (;;)
+    {
+        slot = &ring[ring_tail & RING_MASK];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire)
+                != ring_tail + 1)
+            break;
+
+        write_line(slot->text, slot->len, now);
+
+        // Hand the slot back to the producers for the next lap
+        atomic_store_explicit(&slot->seq, ring_tail + LOG_RING_SLOTS,
+                memory_order_release);
+        ring_tail++;
+        n++;
+    }
+
+    if (repeats && now - repeats_since >= LOG_REPEAT_INTERVAL)
+        write_repeats(now);
+
+    if (0 != (n_dropped = atomic_exchange_explicit(&dropped, 0,
+            memory_order_relaxed)))
+        fprintf(stdout, "[warn] %lu log lines dropped\n", n_dropped);
+
+    if (n || n_dropped) fflush(stdout);
+    return n;
+}
+
+static void *
+writer_main(void *arg __attribute__((unused)))
+{
+    const struct timespec idle = { 0, WRITER_IDLE_NS };
+
+    while (!atomic_load_explicit(&writer_stop, memory_order_acquire))
+    {
+        if (!drain()) nanosleep(&idle, NULL);
+    }
+
+    // Lines claimed before the stop flag was seen are still written
+    drain();
+    write_repeats(time(NULL));
+    fflush(stdout);
+
+    return NULL;
+}
+
+int
+logger_start(void)
+{
+    size_t i;
+
+    if (atomic_load(&writer_running)) return 0;
+
+    for (i = 0; i < LOG_RING_SLOTS; i++)
+        atomic_store_explicit(&ring[i].seq, i, memory_order_relaxed);
+    atomic_store(&ring_head, 0);
+    ring_tail = 0;
+    last_len = 0;
+    repeats = 0;
+    repeats_since = time(NULL);
+    atomic_store(&writer_stop, 0);
+
+    if (0 != pthread_create(&writer_thread, NULL, writer_main, NULL))
+        return -1;
+
+    atomic_store_explicit(&writer_running, 1, memory_order_release);
+    return 0;
+}
+
+void
+logger_shutdown(void)
+{
+    if (!atomic_load(&writer_running)) return;
+
+    // New lines are written directly from now on
+    atomic_store_explicit(&writer_running, 0, memory_order_release);
+    atomic_store_explicit(&writer_stop, 1, memory_order_release);
+    pthread_join(writer_thread, NULL);
+}
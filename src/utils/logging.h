@@ -12,6 +12,22 @@
  */
 /** @file
  * @brief Standardized logging for the application
+ *
+ * logger() is a macro that checks the level of a line before its arguments
+ * are evaluated. Lines above #LOG_COMPILE_LEVEL are removed by the compiler,
+ * arguments and all, and lines above the level given to set_log_level() cost
+ * a single comparison.
+ *
+ * Once logger_start() has been called, lines are formatted into a lock-free
+ * ring buffer and written by a background thread, so that logging never
+ * blocks on the output. If the ring is full, the line is dropped and the
+ * number of dropped lines is reported later. A line that is the same as the
+ * one before it is not repeated; instead a count of the repeats is written
+ * when a different line arrives, and at most every
+ * #LOG_REPEAT_INTERVAL seconds while the repeats continue.
+ *
+ * Before logger_start(), and after logger_shutdown(), lines are written
+ * directly.
  */
 #ifndef UTILS_LOGGING_H_
 #define UTILS_LOGGING_H_
@@ -31,6 +47,27 @@ enum log_level
     L_DEBUG = 4
 };
 
+/**
+ * The most verbose level that is compiled in. Set with the `--with-log-level`
+ * configure option.
+ */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL L_DEBUG
+#endif
+
+/** The maximum length of a line, including the level prefix. Longer lines
+ * are truncated. */
+#define LOG_LINE_MAX 256
+
+/** The number of lines that the ring buffer holds. A power of two. */
+#define LOG_RING_SLOTS 1024
+
+/** The interval between counts of a repeated line, in seconds */
+#define LOG_REPEAT_INTERVAL 10
+
+/** The level set by set_log_level(). Read through logger(). */
+extern enum log_level log_runtime_level;
+
 /**
  * @brief Set the log level for the entire application
  *
@@ -46,7 +83,39 @@ set_log_level(enum log_level level);
  * @param str the printf format string to print
  * @param ... extra arguments are passed to printf to be used with \ref str
  */
+#define logger(lvl, ...) \
+    do \
+    { \
+        if ((lvl) <= LOG_COMPILE_LEVEL && (lvl) <= log_runtime_level) \
+            log_write((lvl), __VA_ARGS__); \
+    } while (0)
+
+/**
+ * @brief Write a line to the log without checking its level
+ *
+ * Use logger() instead, which only evaluates the arguments if the line will
+ * be written.
+ */
+void
+log_write(enum log_level lvl, const char *str, ...)
+        __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Start the background thread that writes the log
+ *
+ * @return 0 if successful, or -1 if the thread could not be started, in which
+ * case lines continue to be written directly
+ */
+int
+logger_start(void);
+
+/**
+ * @brief Write any lines that are still buffered and stop the background
+ * thread
+ *
+ * Must not be called at the same time as logger().
+ */
 void
-logger(enum log_level lvl, const char *str, ... );
+logger_shutdown(void);
 
 #endif /* UTILS_LOGGING_H_ */
@@ -0,0 +1,209 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_MALLOC_H)
+#include <malloc.h>
+#elif defined(HAVE_MALLOC_MALLOC_H)
+#include <malloc/malloc.h>
+#endif
+
+#include "mem.h"
+
+#if defined(HAVE_MALLOC_USABLE_SIZE)
+#define BLOCK_SIZE(ptr) malloc_usable_size(ptr)
+#elif defined(HAVE_MALLOC_SIZE)
+#define BLOCK_SIZE(ptr) malloc_size(ptr)
+#else
+#define BLOCK_SIZE(ptr) ((void) (ptr), (size_t) 0)
+#endif
+
+const char *const mem_account_names[MEM_ACCOUNT_COUNT] = {
+    [MEM_DOMAIN_BLACKLIST] = "domain_blacklist",
+    [MEM_IP_BLACKLIST] = "ip_blacklist",
+    [MEM_IP6_BLACKLIST] = "ip6_blacklist",
+    [MEM_EVENTS] = "events",
+    [MEM_DNS] = "dns",
+    [MEM_FLOWS] = "flows",
+    [MEM_TLS] = "tls",
+};
+
+struct mem_counters
+{
+    atomic_size_t in_use;
+    atomic_size_t peak;
+    atomic_uint_fast64_t allocations;
+};
+
+static struct mem_counters counters[MEM_ACCOUNT_COUNT];
+
+static atomic_size_t blacklist_budget;
+
+/**
+ * Add a block of \p size bytes to an account, after \p released bytes have
+ * been taken away.
+ */
+static void
+account(enum mem_account a, size_t size, size_t released)
+{
+    struct mem_counters *c = &counters[a];
+    size_t now, peak;
+
+    atomic_fetch_add_explicit(&c->allocations, 1, memory_order_relaxed);
+    if (size >= released)
+        now = atomic_fetch_add_explicit(&c->in_use, size - released,
+                memory_order_relaxed) + size - released;
+    else
+        now = atomic_fetch_sub_explicit(&c->in_use, released - size,
+                memory_order_relaxed) - (released - size);
+
+    peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+    while (now > peak && !atomic_compare_exchange_weak_explicit(&c->peak,
+            &peak, now, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void *
+mem_malloc(enum mem_account a, size_t size)
+{
+    void *ptr = malloc(size);
+
+    if (ptr) account(a, BLOCK_SIZE(ptr), 0);
+    return ptr;
+}
+
+void *
+mem_calloc(enum mem_account a, size_t nmemb, size_t size)
+{
+    void *ptr = calloc(nmemb, size);
+
+    if (ptr) account(a, BLOCK_SIZE(ptr), 0);
+    return ptr;
+}
+
+void *
+mem_realloc(enum mem_account a, void *ptr, size_t size)
+{
+    size_t old_size = ptr ? BLOCK_SIZE(ptr) : 0;
+    void *resized = realloc(ptr, size);
+
+    // A failed realloc() leaves the old block in place
+    if (resized) account(a, BLOCK_SIZE(resized), old_size);
+    return resized;
+}
+
+char *
+mem_strdup(enum mem_account a, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = mem_malloc(a, len);
+
+    if (copy) memcpy(copy, s, len);
+    return copy;
+}
+
+void
+mem_free(enum mem_account a, void *ptr)
+{
+    if (!ptr) return;
+
+    atomic_fetch_sub_explicit(&counters[a].in_use, BLOCK_SIZE(ptr),
+            memory_order_relaxed);
+    free(ptr);
+}
+
+size_t
+mem_in_use(enum mem_account a)
+{
+    return atomic_load_explicit(&counters[a].in_use, memory_order_relaxed);
+}
+
+size_t
+mem_peak(enum mem_account a)
+{
+    return atomic_load_explicit(&counters[a].peak, memory_order_relaxed);
+}
+
+uint64_t
+mem_allocations(enum mem_account a)
+{
+    return atomic_load_explicit(&counters[a].allocations,
+            memory_order_relaxed);
+}
+
+int
+mem_accounting_enabled(void)
+{
+#if defined(HAVE_MALLOC_USABLE_SIZE) || defined(HAVE_MALLOC_SIZE)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+size_t
+mem_blacklists_in_use(void)
+{
+    return mem_in_use(MEM_DOMAIN_BLACKLIST) + mem_in_use(MEM_IP_BLACKLIST)
+            + mem_in_use(MEM_IP6_BLACKLIST);
+}
+
+void
+mem_set_blacklist_budget(size_t bytes)
+{
+    atomic_store_explicit(&blacklist_budget, bytes, memory_order_relaxed);
+}
+
+size_t
+mem_blacklist_budget(void)
+{
+    return atomic_load_explicit(&blacklist_budget, memory_order_relaxed);
+}
+
+int
+mem_blacklists_over_budget(void)
+{
+    size_t budget = mem_blacklist_budget();
+
+    return budget && mem_blacklists_in_use() >= budget;
+}
+
+int
+mem_parse_size(const char *arg, size_t *out)
+{
+    unsigned long long value;
+    unsigned int shift = 0;
+    char *end;
+
+    errno = 0;
+    value = strtoull(arg, &end, 10);
+    if (ERANGE == errno || end == arg || '-' == *arg) return -1;
+
+    switch (*end)
+    {
+    case '\0': break;
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    default: return -1;
+    }
+    if ('\0' != *end || value > (SIZE_MAX >> shift)) return -1;
+
+    *out = (size_t) value << shift;
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+/** @file
+ * @brief Allocation accounting and memory budgets
+ *
+ * The large structures allocate through these wrappers, which add the size of
+ * each block to the account of the subsystem that owns it and take it away
+ * again when the block is freed. The sizes are those reported by the
+ * allocator, so they include its rounding but not its per-block overhead.
+ *
+ * Memory allocated with mem_malloc(), mem_calloc(), mem_realloc() or
+ * mem_strdup() must be freed with mem_free() and the same account. It is
+ * ordinary heap memory, so freeing it with free() is safe but leaves the
+ * account too high.
+ *
+ * Where the allocator cannot report the size of a block (see
+ * mem_accounting_enabled()) the wrappers only count allocations, and the
+ * budget is never exceeded.
+ */
+#ifndef UTILS_MEM_H_
+#define UTILS_MEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** The subsystems that memory is accounted to */
+enum mem_account
+{
+    /** The HAT-trie and values of the domain blacklist */
+    MEM_DOMAIN_BLACKLIST,
+    /** The EBVBL of the IPv4 blacklist */
+    MEM_IP_BLACKLIST,
+    /** The hash table of the IPv6 blacklist */
+    MEM_IP6_BLACKLIST,
+    /** The event list */
+    MEM_EVENTS,
+    /** DNS messages being reassembled from TCP. Other DNS messages are
+     * decoded on the stack, see dns_view.h */
+    MEM_DNS,
+    /** The IPv4 reassembly cache, the TLS and QUIC flow tables and the
+     * watchlist of addresses resolved from blacklisted domains */
+    MEM_FLOWS,
+    /** The buffers and requests of TLS streams to the update server */
+    MEM_TLS,
+    MEM_ACCOUNT_COUNT
+};
+
+/** The label of each account in the metrics */
+extern const char *const mem_account_names[MEM_ACCOUNT_COUNT];
+
+void *
+mem_malloc(enum mem_account a, size_t size);
+
+void *
+mem_calloc(enum mem_account a, size_t nmemb, size_t size);
+
+/**
+ * Resize a block allocated to the same account. \p ptr may be NULL.
+ */
+void *
+mem_realloc(enum mem_account a, void *ptr, size_t size);
+
+char *
+mem_strdup(enum mem_account a, const char *s);
+
+/**
+ * Free a block allocated to \p a. \p ptr may be NULL.
+ */
+void
+mem_free(enum mem_account a, void *ptr);
+
+/**
+ * The bytes currently allocated to an account.
+ */
+size_t
+mem_in_use(enum mem_account a);
+
+/**
+ * The most bytes that have been allocated to an account at once.
+ */
+size_t
+mem_peak(enum mem_account a);
+
+/**
+ * The number of allocations made for an account, including resizes.
+ */
+uint64_t
+mem_allocations(enum mem_account a);
+
+/**
+ * Whether the sizes of blocks can be found, and so whether mem_in_use() and
+ * the budget mean anything.
+ */
+int
+mem_accounting_enabled(void);
+
+/**
+ * The bytes allocated to the domain, IPv4 and IPv6 blacklists. While an
+ * update is being received this includes both the active blacklists and
+ * those being built, or the changes of a delta update.
+ */
+size_t
+mem_blacklists_in_use(void);
+
+/**
+ * Limit the memory of the blacklists, as counted by mem_blacklists_in_use().
+ *
+ * @param bytes The budget, or 0 for no limit
+ */
+void
+mem_set_blacklist_budget(size_t bytes);
+
+/**
+ * The budget set by mem_set_blacklist_budget(), or 0 if there is none.
+ */
+size_t
+mem_blacklist_budget(void);
+
+/**
+ * Whether the blacklists have reached their budget. Cheap enough to call
+ * before adding each entry.
+ */
+int
+mem_blacklists_over_budget(void);
+
+/**
+ * Parse a size in bytes, with an optional k, M or G suffix for KiB, MiB and
+ * GiB.
+ *
+ * @return 0 if successful, -1 if \p arg is not a size
+ */
+int
+mem_parse_size(const char *arg, size_t *out);
+
+#endif /* UTILS_MEM_H_ */
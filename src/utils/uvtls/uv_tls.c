@@ -17,6 +17,7 @@
 #include <string.h>
 
 #include "utils/logging.h"
+#include "utils/mem.h"
 #include "uv_tls.h"
 
 /**
@@ -140,14 +141,14 @@ tls_stream_read_pending(uv_buf_t *buf, tls_stream_t *stream)
     if (!pending) return TLS_STR_OK;
     if (pending < 0) return TLS_STR_FAIL;
 
-    buf->base = malloc(pending);
+    buf->base = mem_malloc(MEM_TLS, pending);
     if (!buf->base) return TLS_STR_MEM;
 
     nread = NetStinky_ssl->read(stream, buf->base, pending);
     if (nread < pending)
     {
         // Read failed, undo all changes
-        free(buf->base);
+        mem_free(MEM_TLS, buf->base);
         return TLS_STR_FAIL;
     }
 
@@ -173,7 +174,7 @@ tls_stream_send_pending(tls_stream_t *stream, tls_str_write_cb cb)
     pending = NetStinky_ssl->data_pending(stream);
     if (pending <= 0) return TLS_STR_OK;
 
-    buf.base = malloc(pending);
+    buf.base = mem_malloc(MEM_TLS, pending);
     if (!buf.base)
     {
         ret = TLS_STR_MEM;
@@ -184,7 +185,7 @@ tls_stream_send_pending(tls_stream_t *stream, tls_str_write_cb cb)
     read = NetStinky_ssl->read(stream, buf.base, buf.len);
     if (read != pending) goto fail;
 
-    req = malloc(sizeof(*req));
+    req = mem_malloc(MEM_TLS, sizeof(*req));
     if (!req)
     {
         ret = TLS_STR_MEM;
@@ -212,8 +213,8 @@ fail:
     // Free all allocated variables
     if (data) free_write_cb_data(data);
     fini_buf_array(&array);
-    if (req) free(req);
-    if (buf.base) free(buf.base);
+    if (req) mem_free(MEM_TLS, req);
+    if (buf.base) mem_free(MEM_TLS, buf.base);
     return ret;
 }
 
@@ -327,7 +328,7 @@ tls_stream_decrypt_data(tls_stream_t *stream, uv_buf_t *decrypted)
      */
 
     // Create new buffer for decrypted data.
-    decrypted->base = malloc(DEFAULT_BUF_SZ);
+    decrypted->base = mem_malloc(MEM_TLS, DEFAULT_BUF_SZ);
 
     // TODO: I think this may be the source of my bugs. Returning 0 from this
     // function could either mean "we read 0 bytes" or "we tried to read and
@@ -336,7 +337,7 @@ tls_stream_decrypt_data(tls_stream_t *stream, uv_buf_t *decrypted)
     if (nread < 0)
     {
         decrypted->len = 0;
-        free(decrypted->base);
+        mem_free(MEM_TLS, decrypted->base);
         decrypted->base = NULL;
     }
     else decrypted->len = nread;
@@ -391,7 +392,8 @@ tls_stream_decrypt_buffer(uv_buf_t *decrypted, tls_stream_t *stream, ssize_t nre
         // Concatenate onto end of decrypted buff
         if (temp_buf.len > 0)
         {
-            temp_alloc = realloc(decrypted->base, decrypted->len + temp_buf.len);
+            temp_alloc = mem_realloc(MEM_TLS, decrypted->base,
+                    decrypted->len + temp_buf.len);
             if (!temp_alloc)
             {
                 ret = TLS_STR_MEM;
@@ -400,7 +402,7 @@ tls_stream_decrypt_buffer(uv_buf_t *decrypted, tls_stream_t *stream, ssize_t nre
             decrypted->base = temp_alloc;
             memcpy(decrypted->base + decrypted->len, temp_buf.base, temp_buf.len);
             decrypted->len = decrypted->len + temp_buf.len;
-            free(temp_buf.base);
+            mem_free(MEM_TLS, temp_buf.base);
             temp_buf.base = NULL;	// Helps error section know if needs freeing
         }
     }
@@ -408,11 +410,11 @@ tls_stream_decrypt_buffer(uv_buf_t *decrypted, tls_stream_t *stream, ssize_t nre
     return TLS_STR_OK;
 
 error:
-    if (decrypted->base) free(decrypted->base);
+    if (decrypted->base) mem_free(MEM_TLS, decrypted->base);
     decrypted->base = NULL;
     decrypted->len = 0;
 
-    if (temp_buf.base) free(temp_buf.base);
+    if (temp_buf.base) mem_free(MEM_TLS, temp_buf.base);
 
     return ret;
 }
@@ -440,7 +442,7 @@ tls_stream_on_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf)
 
     decrypt_rc = tls_stream_decrypt_buffer(&decrypted, tls, nread, buf);
     // We are finished with this buffer now
-    free(buf->base);
+    mem_free(MEM_TLS, buf->base);
     if (decrypt_rc == TLS_STR_OK && decrypted.len == 0) return;
 
     tls->on_read(tls, decrypt_rc, &decrypted);
@@ -456,7 +458,7 @@ tls_stream_connect_cb(uv_connect_t *req, int status)
     if (!req) return;
 
     stream = req->data;
-    free(req);
+    mem_free(MEM_TLS, req);
 
     if (!status)
     {
@@ -487,7 +489,7 @@ tls_stream_connect(tls_stream_t *stream, const struct sockaddr *addr,
     stream->on_handshake = handshake_cb;
     stream->on_read = read_cb;
 
-    req = malloc(sizeof(*req));
+    req = mem_malloc(MEM_TLS, sizeof(*req));
     if (!req) return TLS_STR_MEM;
 
     req->data = stream;
@@ -510,7 +512,7 @@ tls_stream_tcp_shutdown_cb(uv_shutdown_t *req, int status)
     if (!req) return;
 
     stream = req->data;
-    free(req);
+    mem_free(MEM_TLS, req);
 
     if (status < 0)
         rc = TLS_STR_FAIL;
@@ -536,14 +538,14 @@ tls_stream_shutdown_tcp(tls_stream_t *stream)
 
     if (!stream) return TLS_STR_FAIL;
 
-    req = malloc(sizeof(*req));
+    req = mem_malloc(MEM_TLS, sizeof(*req));
     if (!req) return TLS_STR_MEM;
 
     req->data = stream;
     rc = uv_shutdown(req, (uv_stream_t *)&stream->tcp, tls_stream_tcp_shutdown_cb);
     if (rc < 0)
     {
-        free(req);
+        mem_free(MEM_TLS, req);
         return TLS_STR_FAIL;
     }
 
@@ -663,7 +665,7 @@ tls_stream_alloc_cb(uv_handle_t *handle __attribute__((unused)),
                     size_t suggested_size, uv_buf_t *buf)
 {
     buf->len = 0;
-    buf->base = malloc(suggested_size);
+    buf->base = mem_malloc(MEM_TLS, suggested_size);
     if (buf->base)
         buf->len = suggested_size;
 }
@@ -679,7 +681,7 @@ tls_stream_dealloc(uv_buf_t *buf)
     if (!buf) return;
 
     if (buf->base)
-        free(buf->base);
+        mem_free(MEM_TLS, buf->base);
     buf->len = 0;
 }
 
@@ -841,7 +843,7 @@ tls_stream_write_cb(uv_write_t *req, int status)
     fini_buf_array(&usr_data->plaintext);
 
     free_write_cb_data(usr_data);
-    free(req);
+    mem_free(MEM_TLS, req);
 }
 
 int
@@ -882,7 +884,7 @@ tls_stream_write(tls_stream_t *stream, const uv_buf_t bufs[],
     }
 
     // Prepare request
-    req = malloc(sizeof(*req));
+    req = mem_malloc(MEM_TLS, sizeof(*req));
     if (!req)
     {
         ret = TLS_STR_MEM;
@@ -898,7 +900,7 @@ tls_stream_write(tls_stream_t *stream, const uv_buf_t bufs[],
     return TLS_STR_OK;
 
 error:
-    if (req) free(req);
+    if (req) mem_free(MEM_TLS, req);
     if (usr_data) free_write_cb_data(usr_data);
 
     // Only free encrypted buffers, not plaintext (user can free those)
@@ -958,7 +960,7 @@ tls_stream_close_shutdown_cb(uv_shutdown_t *req,
 
     handle = req->handle;
 
-    free(req);
+    mem_free(MEM_TLS, req);
 
     if (!uv_is_closing((uv_handle_t *)handle))
         uv_close((uv_handle_t *)handle, tls_stream_close_close_cb);
@@ -978,13 +980,13 @@ tls_stream_close(tls_stream_t *stream, tls_str_close_cb cb)
     // tcp
     tcp_stream = (uv_stream_t *) &stream->tcp;
     uv_read_stop((uv_stream_t *) tcp_stream);
-    req = malloc(sizeof(*req));
+    req = mem_malloc(MEM_TLS, sizeof(*req));
     if (req)
     {
         req->data = stream;
         shutdown_rc = uv_shutdown(req, (uv_stream_t *) tcp_stream,
                 tls_stream_close_shutdown_cb);
-        if (shutdown_rc < 0) free(req);
+        if (shutdown_rc < 0) mem_free(MEM_TLS, req);
     }
     // Immediately close if request couldn't be allocated or shutdown was
     // unsuccessful
@@ -1018,7 +1020,7 @@ buf_array_copy_bufs(buf_array_t *array, uv_buf_t *bufs, unsigned int nbufs)
 
     memset(array, 0, sizeof(*array));
 
-    array->bufs = malloc(nbufs * sizeof(*bufs));
+    array->bufs = mem_malloc(MEM_TLS, nbufs * sizeof(*bufs));
     if (array->bufs)
     {
         memcpy(array->bufs, bufs, nbufs * sizeof(*bufs));
@@ -1038,7 +1040,7 @@ static void fini_buf_array(buf_array_t *array)
     if (!array) return;
 
     if (array->bufs)
-        free(array->bufs);
+        mem_free(MEM_TLS, array->bufs);
 
     memset(array, 0, sizeof(*array));
 }
@@ -1062,7 +1064,7 @@ buf_array_append(buf_array_t *array, uv_buf_t *buf)
     // Allocate space for one extra buffer
     array_len = array->nbufs + 1;
     alloc_sz = array_len * sizeof(*buf);
-    new_alloc = realloc(array->bufs, alloc_sz);
+    new_alloc = mem_realloc(MEM_TLS, array->bufs, alloc_sz);
     if (new_alloc)
     {
         array->bufs = new_alloc;
@@ -1087,7 +1089,7 @@ buf_array_free_all_buffers(buf_array_t *array)
 
     for (idx = 0; idx < array->nbufs; idx++)
     {
-        if (array->bufs[idx].base) free(array->bufs[idx].base);
+        if (array->bufs[idx].base) mem_free(MEM_TLS, array->bufs[idx].base);
         memset(&array->bufs[idx], 0, sizeof(uv_buf_t));
     }
 }
@@ -1107,7 +1109,7 @@ buf_array_concatenate(buf_array_t *restrict result,
     if (!result || !first || !second) return TLS_STR_FAIL;
 
     nbufs = first->nbufs + second->nbufs;
-    new_alloc = malloc(nbufs * sizeof(*new_alloc));
+    new_alloc = mem_malloc(MEM_TLS, nbufs * sizeof(*new_alloc));
     if (!new_alloc) return TLS_STR_MEM;
 
     memcpy(new_alloc, first->bufs, first->nbufs * sizeof(*first->bufs));
@@ -1130,7 +1132,7 @@ buf_array_wrap(buf_array_t *result, const uv_buf_t *bufs, unsigned int nbufs)
 
     if (!result || !bufs) return TLS_STR_FAIL;
 
-    new_alloc = malloc(nbufs * sizeof(*bufs));
+    new_alloc = mem_malloc(MEM_TLS, nbufs * sizeof(*bufs));
     if (!new_alloc) return TLS_STR_MEM;
 
     memcpy(new_alloc, bufs, nbufs * sizeof(*bufs));
@@ -1158,7 +1160,7 @@ new_write_cb_data(tls_stream_t *stream, buf_array_t *plaintext,
 
     if (!stream || !encrypted || !hshake_cb) return NULL;
 
-    data = malloc(sizeof(*data));
+    data = mem_malloc(MEM_TLS, sizeof(*data));
     if (data)
     {
         data->stream = stream;
@@ -1181,5 +1183,5 @@ free_write_cb_data(write_cb_data_t *data)
 {
     if (!data) return;
 
-    free(data);
+    mem_free(MEM_TLS, data);
 }
@@ -29,6 +29,11 @@ typedef struct tls_stream_s tls_stream_t;
  * CALLBACKS FOR USERS
  */
 typedef void (*tls_str_handshake_cb)(tls_stream_t *, int status);
+
+/**
+ * Called when data is received. The user owns the base of the buffer and
+ * must free it with tls_stream_dealloc().
+ */
 typedef void (*tls_str_read_cb)(tls_stream_t *, int status,
         const uv_buf_t *buf);
 
@@ -322,6 +327,13 @@ tls_stream_accept(tls_stream_t *server, tls_stream_t *client,
 int
 tls_stream_read_start(tls_stream_t *stream, uv_read_cb cb);
 
+/**
+ * Free a buffer passed to a tls_str_read_cb. Its memory is accounted to
+ * MEM_TLS, so it must not be passed to free().
+ */
+void
+tls_stream_dealloc(uv_buf_t *buf);
+
 int
 tls_stream_read_stop(tls_stream_t *stream);
 
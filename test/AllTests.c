@@ -21,12 +21,43 @@
 //
 CuSuite *StrGetSuite(void);
 CuSuite *IdsEventListGetSuite(void);
+CuSuite *DnsViewGetSuite(void);
+CuSuite *TcpDnsGetSuite(void);
+CuSuite *TlsSniGetSuite(void);
+CuSuite *QuicInitialGetSuite(void);
+CuSuite *Ip6BlacklistGetSuite(void);
+CuSuite *IpReasmGetSuite(void);
+CuSuite *IpBlacklistGetSuite(void);
+CuSuite *DnsGetSuite(void);
+CuSuite *DomainBlacklistGetSuite(void);
+CuSuite *RecordDecoderGetSuite(void);
+CuSuite *LineReaderGetSuite(void);
+CuSuite *DeltaGetSuite(void);
+CuSuite *IpWatchlistGetSuite(void);
+CuSuite *IdsEventFormatGetSuite(void);
+CuSuite *IdsServerRequestGetSuite(void);
 
-void RunAllTests(void) {
+int RunAllTests(void) {
     CuString *output = CuStringNew();
+    int failures;
 
     CuSuite *strSuite = StrGetSuite();
     CuSuite *idsEventListSuite = IdsEventListGetSuite();
+    CuSuite *dnsViewSuite = DnsViewGetSuite();
+    CuSuite *tcpDnsSuite = TcpDnsGetSuite();
+    CuSuite *tlsSniSuite = TlsSniGetSuite();
+    CuSuite *quicInitialSuite = QuicInitialGetSuite();
+    CuSuite *ip6BlacklistSuite = Ip6BlacklistGetSuite();
+    CuSuite *ipReasmSuite = IpReasmGetSuite();
+    CuSuite *ipBlacklistSuite = IpBlacklistGetSuite();
+    CuSuite *dnsSuite = DnsGetSuite();
+    CuSuite *domainBlacklistSuite = DomainBlacklistGetSuite();
+    CuSuite *recordDecoderSuite = RecordDecoderGetSuite();
+    CuSuite *lineReaderSuite = LineReaderGetSuite();
+    CuSuite *deltaSuite = DeltaGetSuite();
+    CuSuite *ipWatchlistSuite = IpWatchlistGetSuite();
+    CuSuite *idsEventFormatSuite = IdsEventFormatGetSuite();
+    CuSuite *idsServerRequestSuite = IdsServerRequestGetSuite();
 
     CuSuite masterSuite;
     memset(&masterSuite, 0, sizeof(masterSuite));
@@ -34,19 +65,50 @@ void RunAllTests(void) {
 
     CuSuiteAddSuite(&masterSuite, strSuite);
     CuSuiteAddSuite(&masterSuite, idsEventListSuite);
+    CuSuiteAddSuite(&masterSuite, dnsViewSuite);
+    CuSuiteAddSuite(&masterSuite, tcpDnsSuite);
+    CuSuiteAddSuite(&masterSuite, tlsSniSuite);
+    CuSuiteAddSuite(&masterSuite, quicInitialSuite);
+    CuSuiteAddSuite(&masterSuite, ip6BlacklistSuite);
+    CuSuiteAddSuite(&masterSuite, ipReasmSuite);
+    CuSuiteAddSuite(&masterSuite, ipBlacklistSuite);
+    CuSuiteAddSuite(&masterSuite, dnsSuite);
+    CuSuiteAddSuite(&masterSuite, domainBlacklistSuite);
+    CuSuiteAddSuite(&masterSuite, recordDecoderSuite);
+    CuSuiteAddSuite(&masterSuite, lineReaderSuite);
+    CuSuiteAddSuite(&masterSuite, deltaSuite);
+    CuSuiteAddSuite(&masterSuite, ipWatchlistSuite);
+    CuSuiteAddSuite(&masterSuite, idsEventFormatSuite);
+    CuSuiteAddSuite(&masterSuite, idsServerRequestSuite);
 
     CuSuiteRun(&masterSuite);
     CuSuiteSummary(&masterSuite, output);
     CuSuiteDetails(&masterSuite, output);
     printf("%s\n", output->buffer);
+    failures = masterSuite.failCount;
 
+    CuSuiteDelete(idsServerRequestSuite);
+    CuSuiteDelete(idsEventFormatSuite);
+    CuSuiteDelete(ipWatchlistSuite);
+    CuSuiteDelete(deltaSuite);
+    CuSuiteDelete(lineReaderSuite);
+    CuSuiteDelete(recordDecoderSuite);
+    CuSuiteDelete(domainBlacklistSuite);
+    CuSuiteDelete(dnsSuite);
+    CuSuiteDelete(ipBlacklistSuite);
+    CuSuiteDelete(ipReasmSuite);
+    CuSuiteDelete(ip6BlacklistSuite);
+    CuSuiteDelete(quicInitialSuite);
+    CuSuiteDelete(tlsSniSuite);
+    CuSuiteDelete(tcpDnsSuite);
+    CuSuiteDelete(dnsViewSuite);
     CuSuiteDelete(idsEventListSuite);
     CuSuiteDelete(strSuite);
     CuStringDelete(output);
+    return failures;
 }
 
 int main(void) {
-    RunAllTests();
-    return 0;
+    return RunAllTests() ? 1 : 0;
 }
 
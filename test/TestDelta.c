@@ -0,0 +1,207 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "CuTest.h"
+#include "updates/delta.h"
+#include "utils/mem.h"
+
+/** The number of addresses in the blacklist of the budget test */
+#define BUDGET_ENTRIES 100000
+
+/** The number of changes in the delta of the budget test */
+#define BUDGET_CHANGES 1000
+
+struct blacklists
+{
+    domain_blacklist *dn;
+    ip_blacklist *ip;
+    ip6_blacklist *ip6;
+};
+
+static void
+blacklists_init(struct blacklists *b)
+{
+    b->dn = new_domain_blacklist();
+    b->ip = new_ip_blacklist();
+    b->ip6 = new_ip6_blacklist();
+}
+
+static void
+blacklists_free(struct blacklists *b)
+{
+    domain_blacklist_clear(b->dn);
+    free_ip_blacklist(&b->ip);
+    free_ip6_blacklist(&b->ip6);
+}
+
+static struct in6_addr
+addr6(const char *s)
+{
+    struct in6_addr a;
+
+    inet_pton(AF_INET6, s, &a);
+    return a;
+}
+
+static ip_key_value_t
+ioc(uint32_t ip_addr, int botnet_id)
+{
+    ip_key_value_t kv;
+
+    memset(&kv, 0, sizeof(kv));
+    kv.ip_addr = ip_addr;
+    kv.value.botnet_id = botnet_id;
+    return kv;
+}
+
+void testDeltaApply_withChanges_makesThemInOrder(CuTest *tc)
+{
+    struct blacklists b;
+    struct ns_delta delta;
+    ip_key_value_t kv;
+    ids_ioc_value_t value = { .botnet_id = 7 };
+    struct in6_addr prefix = addr6("2001:db8::"), host = addr6("2001:db8::1");
+    const ids_ioc_value_t *found;
+
+    blacklists_init(&b);
+    ns_delta_init(&delta);
+
+    kv = ioc(0x0a000001, 1);
+    ip_blacklist_add(b.ip, &kv);
+    domain_blacklist_add(b.dn, "old.example.com", new_ids_ioc_value(1));
+
+    // Nothing changes until the delta is applied
+    CuAssertIntEquals(tc, 0, ns_delta_domain(&delta, "old.example.com", 0, 1));
+    CuAssertIntEquals(tc, 0, ns_delta_domain(&delta, "new.example.com", 2, 0));
+    CuAssertIntEquals(tc, 0, ns_delta_domain(&delta, "gone.example.com", 3, 0));
+    CuAssertIntEquals(tc, 0, ns_delta_domain(&delta, "gone.example.com", 0, 1));
+    kv = ioc(0x0a000001, 0);
+    CuAssertIntEquals(tc, 0, ns_delta_ip(&delta, &kv, 1));
+    kv = ioc(0x0a000002, 4);
+    CuAssertIntEquals(tc, 0, ns_delta_ip(&delta, &kv, 0));
+    CuAssertIntEquals(tc, 0, ns_delta_ip6(&delta, &prefix, 32, NULL, 1));
+    CuAssertIntEquals(tc, 0, ns_delta_ip6(&delta, &prefix, 32, &value, 0));
+    CuAssertPtrNotNull(tc, domain_blacklist_is_blacklisted(b.dn,
+            "old.example.com"));
+    CuAssertIntEquals(tc, 1, ip_blacklist_count(b.ip));
+    CuAssertIntEquals(tc, 0, ip6_blacklist_count(b.ip6));
+
+    CuAssertIntEquals(tc, 0, ns_delta_apply(&delta, b.dn, b.ip, b.ip6));
+
+    CuAssertPtrEquals(tc, NULL, domain_blacklist_is_blacklisted(b.dn,
+            "old.example.com"));
+    CuAssertPtrEquals(tc, NULL, domain_blacklist_is_blacklisted(b.dn,
+            "gone.example.com"));
+    found = domain_blacklist_is_blacklisted(b.dn, "new.example.com");
+    CuAssertPtrNotNull(tc, found);
+    CuAssertIntEquals(tc, 2, found->botnet_id);
+
+    CuAssertPtrEquals(tc, NULL, (void *) ip_blacklist_lookup(b.ip,
+            htonl(0x0a000001), 0));
+    CuAssertPtrNotNull(tc, ip_blacklist_lookup(b.ip, htonl(0x0a000002), 0));
+
+    found = ip6_blacklist_lookup(b.ip6, &host);
+    CuAssertPtrNotNull(tc, found);
+    CuAssertIntEquals(tc, 7, found->botnet_id);
+
+    // The delta is emptied, so applying it again changes nothing
+    CuAssertIntEquals(tc, 0, delta.n_domains + delta.n_ips + delta.n_ip6s);
+    CuAssertIntEquals(tc, 0, ns_delta_apply(&delta, b.dn, b.ip, b.ip6));
+    CuAssertIntEquals(tc, 1, ip_blacklist_count(b.ip));
+
+    blacklists_free(&b);
+}
+
+void testDeltaFree_withChanges_releasesTheirMemory(CuTest *tc)
+{
+    struct ns_delta delta;
+    ip_key_value_t kv = ioc(0x0a000001, 1);
+    struct in6_addr prefix = addr6("2001:db8::");
+    size_t before = mem_blacklists_in_use();
+    unsigned int i;
+
+    ns_delta_init(&delta);
+    for (i = 0; i < 200; i++)
+    {
+        CuAssertIntEquals(tc, 0, ns_delta_domain(&delta, "example.com", 1,
+                0));
+        CuAssertIntEquals(tc, 0, ns_delta_ip(&delta, &kv, 0));
+        CuAssertIntEquals(tc, 0, ns_delta_ip6(&delta, &prefix, 32, NULL, 1));
+    }
+    CuAssertIntEquals(tc, 200, delta.n_ip6s);
+    if (mem_accounting_enabled())
+        CuAssertTrue(tc, mem_blacklists_in_use() > before);
+
+    ns_delta_free(&delta);
+    CuAssertIntEquals(tc, 0, delta.n_domains);
+    CuAssertPtrEquals(tc, NULL, delta.ips);
+    CuAssertTrue(tc, mem_blacklists_in_use() == before);
+}
+
+void testDeltaApply_withBlacklistOverHalfTheBudget_isUnderBudget(CuTest *tc)
+{
+    struct blacklists b;
+    struct ns_delta delta;
+    ip_key_value_t kv;
+    size_t in_use;
+    unsigned int i, missed = 0;
+
+    // Without accounting the budget means nothing
+    if (!mem_accounting_enabled()) return;
+
+    blacklists_init(&b);
+    for (i = 0; i < BUDGET_ENTRIES; i++)
+    {
+        kv = ioc(2 * i, 0);
+        ip_blacklist_add(b.ip, &kv);
+    }
+    ip_blacklist_sort(b.ip);
+
+    // Copying the blacklist would take it over the budget, but a small delta
+    // only needs room for its changes
+    in_use = mem_blacklists_in_use();
+    mem_set_blacklist_budget(in_use + in_use / 2);
+
+    ns_delta_init(&delta);
+    for (i = 0; i < BUDGET_CHANGES; i++)
+    {
+        CuAssertTrue(tc, !mem_blacklists_over_budget());
+        kv = ioc(2 * i + 1, 0);
+        CuAssertIntEquals(tc, 0, ns_delta_ip(&delta, &kv, 0));
+    }
+    CuAssertTrue(tc, !mem_blacklists_over_budget());
+    CuAssertIntEquals(tc, 0, ns_delta_apply(&delta, b.dn, b.ip, b.ip6));
+    mem_set_blacklist_budget(0);
+
+    CuAssertIntEquals(tc, BUDGET_ENTRIES + BUDGET_CHANGES,
+            ip_blacklist_count(b.ip));
+    for (i = 0; i < 2 * BUDGET_CHANGES; i++)
+        missed += NULL == ip_blacklist_lookup(b.ip, htonl(i), 0);
+    CuAssertIntEquals(tc, 0, missed);
+
+    blacklists_free(&b);
+}
+
+CuSuite *DeltaGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testDeltaApply_withChanges_makesThemInOrder);
+    SUITE_ADD_TEST(suite, testDeltaFree_withChanges_releasesTheirMemory);
+    SUITE_ADD_TEST(suite,
+            testDeltaApply_withBlacklistOverHalfTheBudget_isUnderBudget);
+
+    return (suite);
+}
@@ -0,0 +1,100 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "dns.h"
+
+/**
+ * A response for www.example.com holding a CNAME to example.com and two A
+ * records for it, the names after the first compressed.
+ */
+static const uint8_t response[] = {
+    0x12, 0x34, 0x81, 0x80, 0x00, 0x01, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00,
+    // www.example.com IN A
+    3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm',
+    0, 0x00, 0x01, 0x00, 0x01,
+    // www.example.com CNAME example.com
+    0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x02,
+    0xc0, 0x10,
+    // example.com A 192.0.2.1
+    0xc0, 0x10, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x04,
+    192, 0, 2, 1,
+    // example.com A 192.0.2.2
+    0xc0, 0x10, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x0e, 0x10, 0x00, 0x04,
+    192, 0, 2, 2,
+};
+
+/** Parse a copy of the first \p len bytes of #response */
+static struct dns_packet *
+parse(size_t len)
+{
+    uint8_t *copy = malloc(len);
+    struct dns_packet *pkt;
+
+    memcpy(copy, response, len);
+    pkt = dns_parse(copy, copy + len);
+    free(copy);
+    return pkt;
+}
+
+void testDnsParse_withSeveralAnswers_readsEach(CuTest *tc)
+{
+    struct dns_packet *pkt = parse(sizeof(response));
+    struct dns_answer *ans;
+
+    CuAssertPtrNotNull(tc, pkt);
+    CuAssertIntEquals(tc, 3, pkt->header.ancount);
+
+    ans = pkt->answers;
+    CuAssertPtrNotNull(tc, ans);
+    CuAssertIntEquals(tc, CNAME, ans->type);
+    CuAssertIntEquals(tc, 3600, ans->ttl);
+
+    ans = ans->next;
+    CuAssertPtrNotNull(tc, ans);
+    CuAssertIntEquals(tc, A, ans->type);
+    CuAssertIntEquals(tc, 0xc0000201, ans->rdata.a.ip_address);
+
+    ans = ans->next;
+    CuAssertPtrNotNull(tc, ans);
+    CuAssertIntEquals(tc, A, ans->type);
+    CuAssertIntEquals(tc, 0xc0000202, ans->rdata.a.ip_address);
+    CuAssertPtrEquals(tc, NULL, ans->next);
+
+    free_dns_packet(&pkt);
+    CuAssertPtrEquals(tc, NULL, pkt);
+}
+
+void testDnsParse_withTruncatedAnswer_returnsNull(CuTest *tc)
+{
+    struct dns_packet *pkt;
+    size_t len;
+
+    // Each record is missing some of its data, including the last
+    for (len = sizeof(response) - 1; len > sizeof(response) - 16; len--)
+    {
+        pkt = parse(len);
+        CuAssertPtrEquals(tc, NULL, pkt);
+    }
+}
+
+CuSuite *DnsGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testDnsParse_withSeveralAnswers_readsEach);
+    SUITE_ADD_TEST(suite, testDnsParse_withTruncatedAnswer_returnsNull);
+
+    return (suite);
+}
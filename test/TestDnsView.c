@@ -0,0 +1,292 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include "CuTest.h"
+#include "dns_view.h"
+
+/** A response with one question, an answer whose name is a pointer to the
+ * question and a CNAME answer whose data ends with a pointer into the
+ * question */
+static const uint8_t response[] = {
+    0x12, 0x34, 0x81, 0x80, 0x00, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00,
+    // 12: www.example.com A IN
+    3, 'w', 'w', 'w', 7, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 3, 'c', 'o', 'm',
+    0, 0x00, 0x01, 0x00, 0x01,
+    // 33: (12) CNAME IN, TTL 300, cdn.(16)
+    0xc0, 0x0c, 0x00, 0x05, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x06,
+    3, 'c', 'd', 'n', 0xc0, 0x10,
+    // 51: (45) A IN, TTL 300, 93.184.216.34
+    0xc0, 0x2d, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, 0x01, 0x2c, 0x00, 0x04,
+    93, 184, 216, 34
+};
+
+/** A header for a query with one question, followed by nothing */
+#define QUERY_HEADER 0x00, 0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00, \
+    0x00, 0x00, 0x00, 0x00
+
+/**
+ * Decode the name at \p offset in \p msg.
+ */
+static int
+name_at(const uint8_t *msg, size_t len, size_t offset, char *buf,
+        size_t buf_sz)
+{
+    struct dns_view view;
+
+    if (dns_view_init(&view, msg, msg + len)) return -2;
+    return dns_view_name(&view, msg + offset, buf, buf_sz);
+}
+
+void testDnsView_withResponse_readsEveryRecord(CuTest *tc)
+{
+    struct dns_view view;
+    struct dns_view_iter it;
+    struct dns_question_view qn;
+    struct dns_rr_view rr;
+    char name[DNS_NAME_BUF_LEN];
+
+    CuAssertIntEquals(tc, 0,
+            dns_view_init(&view, response, response + sizeof(response)));
+    CuAssertIntEquals(tc, 0x1234, view.header.id);
+    CuAssertIntEquals(tc, 1, view.header.qr);
+    CuAssertIntEquals(tc, 2, view.header.ancount);
+
+    dns_view_iter_init(&view, &it);
+    CuAssertIntEquals(tc, 1, dns_view_next_question(&it, &qn));
+    CuAssertIntEquals(tc, A, qn.qtype);
+    CuAssertIntEquals(tc, 15, dns_view_name(&view, qn.name, name,
+            sizeof(name)));
+    CuAssertStrEquals(tc, "www.example.com", name);
+    CuAssertIntEquals(tc, 0, dns_view_next_question(&it, &qn));
+
+    CuAssertIntEquals(tc, 1, dns_view_next_record(&it, &rr));
+    CuAssertIntEquals(tc, DNS_SECTION_ANSWER, rr.section);
+    CuAssertIntEquals(tc, CNAME, rr.type);
+    CuAssertIntEquals(tc, 300, rr.ttl);
+    CuAssertIntEquals(tc, 15, dns_view_name(&view, rr.name, name,
+            sizeof(name)));
+    CuAssertStrEquals(tc, "www.example.com", name);
+    CuAssertIntEquals(tc, 15, dns_view_rdata_name(&view, &rr, name,
+            sizeof(name)));
+    CuAssertStrEquals(tc, "cdn.example.com", name);
+
+    CuAssertIntEquals(tc, 1, dns_view_next_record(&it, &rr));
+    CuAssertIntEquals(tc, A, rr.type);
+    CuAssertIntEquals(tc, 4, rr.rdlength);
+    CuAssertIntEquals(tc, 93, rr.rdata[0]);
+    CuAssertIntEquals(tc, -1, dns_view_rdata_name(&view, &rr, name,
+            sizeof(name)));
+    // The answer's name is a pointer to the CNAME's data
+    CuAssertIntEquals(tc, 15, dns_view_name(&view, rr.name, name,
+            sizeof(name)));
+    CuAssertStrEquals(tc, "cdn.example.com", name);
+
+    CuAssertIntEquals(tc, 0, dns_view_next_record(&it, &rr));
+}
+
+void testDnsView_withUnreadQuestions_skipsToRecords(CuTest *tc)
+{
+    struct dns_view view;
+    struct dns_view_iter it;
+    struct dns_rr_view rr;
+
+    dns_view_init(&view, response, response + sizeof(response));
+    dns_view_iter_init(&view, &it);
+    CuAssertIntEquals(tc, 1, dns_view_next_record(&it, &rr));
+    CuAssertIntEquals(tc, CNAME, rr.type);
+}
+
+void testDnsViewInit_withShortHeader_returnsNeg1(CuTest *tc)
+{
+    struct dns_view view;
+
+    CuAssertIntEquals(tc, -1, dns_view_init(&view, response, response + 11));
+}
+
+void testDnsView_withTruncatedMessage_returnsNeg1(CuTest *tc)
+{
+    struct dns_view view;
+    struct dns_view_iter it;
+    struct dns_question_view qn;
+    struct dns_rr_view rr;
+    size_t len;
+
+    // Every truncation within the question or a record is malformed
+    for (len = 13; len < sizeof(response); len++)
+    {
+        dns_view_init(&view, response, response + len);
+        dns_view_iter_init(&view, &it);
+        if (len < 33)
+        {
+            CuAssertIntEquals(tc, -1, dns_view_next_question(&it, &qn));
+            continue;
+        }
+        CuAssertIntEquals(tc, 1, dns_view_next_question(&it, &qn));
+        if (len < 51)
+        {
+            CuAssertIntEquals(tc, -1, dns_view_next_record(&it, &rr));
+            continue;
+        }
+        CuAssertIntEquals(tc, 1, dns_view_next_record(&it, &rr));
+        CuAssertIntEquals(tc, -1, dns_view_next_record(&it, &rr));
+    }
+}
+
+void testDnsViewName_withPointerChain_followsIt(CuTest *tc)
+{
+    // 12: a. 15: b.(12) 19: c.(15) 23: (19)
+    const uint8_t msg[] = {
+        QUERY_HEADER,
+        1, 'a', 0,
+        1, 'b', 0xc0, 0x0c,
+        1, 'c', 0xc0, 0x0f,
+        0xc0, 0x13,
+    };
+    char name[DNS_NAME_BUF_LEN];
+
+    CuAssertIntEquals(tc, 5, name_at(msg, sizeof(msg), 23, name,
+            sizeof(name)));
+    CuAssertStrEquals(tc, "c.b.a", name);
+}
+
+void testDnsViewName_withPointerToItself_returnsNeg1(CuTest *tc)
+{
+    const uint8_t msg[] = { QUERY_HEADER, 0xc0, 0x0c };
+    char name[DNS_NAME_BUF_LEN];
+
+    CuAssertIntEquals(tc, -1, name_at(msg, sizeof(msg), 12, name,
+            sizeof(name)));
+}
+
+void testDnsViewName_withPointerIntoOwnLabels_returnsNeg1(CuTest *tc)
+{
+    // The pointer refers back to the start of its own name, so reading on
+    // from there would reach it again
+    const uint8_t msg[] = { QUERY_HEADER, 1, 'a', 1, 'b', 0xc0, 0x0c };
+    char name[DNS_NAME_BUF_LEN];
+
+    CuAssertIntEquals(tc, -1, name_at(msg, sizeof(msg), 12, name,
+            sizeof(name)));
+}
+
+void testDnsViewName_withPointerLoopThroughTwoNames_returnsNeg1(CuTest *tc)
+{
+    // 12: a.(16) 16: b.(12), where the jump to 16 is forwards
+    const uint8_t msg[] = {
+        QUERY_HEADER,
+        1, 'a', 0xc0, 0x10,
+        1, 'b', 0xc0, 0x0c,
+    };
+    char name[DNS_NAME_BUF_LEN];
+
+    CuAssertIntEquals(tc, -1, name_at(msg, sizeof(msg), 16, name,
+            sizeof(name)));
+}
+
+void testDnsViewName_withTooManyPointers_returnsNeg1(CuTest *tc)
+{
+    uint8_t msg[12 + 1 + 2 * 40] = { QUERY_HEADER, 0 };
+    char name[DNS_NAME_BUF_LEN];
+    size_t i;
+
+    // Each pointer refers to the one before it, ending at the root at 12
+    for (i = 0; i < 40; i++)
+    {
+        msg[13 + 2 * i] = 0xc0;
+        msg[13 + 2 * i + 1] = i ? 13 + 2 * (i - 1) : 12;
+    }
+
+    CuAssertIntEquals(tc, 0, name_at(msg, sizeof(msg), 13 + 2 * 31, name,
+            sizeof(name)));
+    CuAssertIntEquals(tc, -1, name_at(msg, sizeof(msg), 13 + 2 * 39, name,
+            sizeof(name)));
+}
+
+void testDnsViewName_withLongLabel_returnsNeg1(CuTest *tc)
+{
+    uint8_t msg[12 + 1 + 64 + 1] = { QUERY_HEADER, 64 };
+    char name[DNS_NAME_BUF_LEN];
+
+    memset(msg + 13, 'a', 64);
+    CuAssertIntEquals(tc, -1, name_at(msg, sizeof(msg), 12, name,
+            sizeof(name)));
+}
+
+void testDnsViewName_withLongName_returnsNeg1(CuTest *tc)
+{
+    // Five labels of 63 bytes make a name of 320 bytes
+    uint8_t msg[12 + 5 * 64 + 1] = { QUERY_HEADER };
+    char name[DNS_NAME_BUF_LEN];
+    size_t i;
+
+    for (i = 0; i < 5; i++)
+    {
+        msg[12 + 64 * i] = 63;
+        memset(msg + 12 + 64 * i + 1, 'a', 63);
+    }
+
+    CuAssertIntEquals(tc, -1, name_at(msg, sizeof(msg), 12, name,
+            sizeof(name)));
+}
+
+void testDnsViewName_withSmallBuffer_returnsNeg1(CuTest *tc)
+{
+    char name[16];
+
+    CuAssertIntEquals(tc, -1, name_at(response, sizeof(response), 12, name,
+            15));
+    CuAssertIntEquals(tc, 15, name_at(response, sizeof(response), 12, name,
+            16));
+}
+
+void testDnsViewName_withNullInLabel_returnsNeg1(CuTest *tc)
+{
+    const uint8_t msg[] = { QUERY_HEADER, 3, 'a', 0, 'b', 0 };
+    char name[DNS_NAME_BUF_LEN];
+
+    CuAssertIntEquals(tc, -1, name_at(msg, sizeof(msg), 12, name,
+            sizeof(name)));
+}
+
+void testDnsViewName_withRoot_returnsEmptyString(CuTest *tc)
+{
+    const uint8_t msg[] = { QUERY_HEADER, 0 };
+    char name[DNS_NAME_BUF_LEN];
+
+    CuAssertIntEquals(tc, 0, name_at(msg, sizeof(msg), 12, name,
+            sizeof(name)));
+    CuAssertStrEquals(tc, "", name);
+}
+
+CuSuite *DnsViewGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testDnsView_withResponse_readsEveryRecord);
+    SUITE_ADD_TEST(suite, testDnsView_withUnreadQuestions_skipsToRecords);
+    SUITE_ADD_TEST(suite, testDnsViewInit_withShortHeader_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsView_withTruncatedMessage_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsViewName_withPointerChain_followsIt);
+    SUITE_ADD_TEST(suite, testDnsViewName_withPointerToItself_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsViewName_withPointerIntoOwnLabels_returnsNeg1);
+    SUITE_ADD_TEST(suite,
+            testDnsViewName_withPointerLoopThroughTwoNames_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsViewName_withTooManyPointers_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsViewName_withLongLabel_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsViewName_withLongName_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsViewName_withSmallBuffer_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsViewName_withNullInLabel_returnsNeg1);
+    SUITE_ADD_TEST(suite, testDnsViewName_withRoot_returnsEmptyString);
+
+    return (suite);
+}
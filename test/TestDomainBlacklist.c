@@ -0,0 +1,116 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include "CuTest.h"
+#include "blacklist/domain_blacklist.h"
+
+/** The botnet ID that \p domain is blacklisted with, or -1 if it is not */
+static int
+lookup(domain_blacklist *b, const char *domain)
+{
+    ids_ioc_value_t *value = domain_blacklist_is_blacklisted(b, domain);
+
+    return value ? value->botnet_id : -1;
+}
+
+static void
+add(domain_blacklist *b, const char *domain, int botnet_id)
+{
+    domain_blacklist_add(b, domain, new_ids_ioc_value(botnet_id));
+}
+
+void testDomainBlacklistRemove_withDomain_removesOnlyIt(CuTest *tc)
+{
+    domain_blacklist *b = new_domain_blacklist();
+
+    add(b, "example.com", 1);
+    add(b, "www.example.com", 2);
+    add(b, "example.org", 3);
+
+    CuAssertIntEquals(tc, 1, domain_blacklist_remove(b, "example.com"));
+    CuAssertIntEquals(tc, 0, domain_blacklist_remove(b, "example.com"));
+    CuAssertIntEquals(tc, 0, domain_blacklist_remove(b, "com"));
+    CuAssertIntEquals(tc, 0, domain_blacklist_remove(b, "ww.example.com"));
+
+    CuAssertIntEquals(tc, -1, lookup(b, "example.com"));
+    CuAssertIntEquals(tc, 2, lookup(b, "www.example.com"));
+    CuAssertIntEquals(tc, 3, lookup(b, "example.org"));
+
+    // It can be added again
+    add(b, "example.com", 4);
+    CuAssertIntEquals(tc, 4, lookup(b, "example.com"));
+
+    domain_blacklist_clear(b);
+}
+
+void testDomainBlacklistRemove_withLongDomain_removesIt(CuTest *tc)
+{
+    domain_blacklist *b = new_domain_blacklist();
+    char domain[300];
+    size_t i;
+
+    // Too long to be reversed on the stack, so an allocation is used
+    for (i = 0; i + 2 < sizeof(domain); i += 2)
+        memcpy(domain + i, "a.", 2);
+    memcpy(domain + i, "z", 2);
+
+    add(b, domain, 1);
+    CuAssertIntEquals(tc, 1, domain_blacklist_remove(b, domain));
+    CuAssertIntEquals(tc, 0, domain_blacklist_remove(b, domain));
+
+    domain_blacklist_clear(b);
+}
+
+void testDomainBlacklistCopy_withDomains_isIndependent(CuTest *tc)
+{
+    domain_blacklist *b = new_domain_blacklist(), *copy;
+
+    add(b, "example.com", 1);
+    add(b, "www.example.com", 2);
+    copy = domain_blacklist_copy(b);
+    CuAssertPtrNotNull(tc, copy);
+
+    // The values are copied too, so each can be freed on its own
+    CuAssertTrue(tc, domain_blacklist_is_blacklisted(b, "example.com")
+            != domain_blacklist_is_blacklisted(copy, "example.com"));
+    CuAssertIntEquals(tc, 1, domain_blacklist_remove(b, "example.com"));
+    add(copy, "example.org", 3);
+
+    CuAssertIntEquals(tc, -1, lookup(b, "example.com"));
+    CuAssertIntEquals(tc, -1, lookup(b, "example.org"));
+    CuAssertIntEquals(tc, 1, lookup(copy, "example.com"));
+    CuAssertIntEquals(tc, 2, lookup(copy, "www.example.com"));
+    CuAssertIntEquals(tc, 3, lookup(copy, "example.org"));
+
+    domain_blacklist_clear(b);
+    domain_blacklist_clear(copy);
+
+    // An empty blacklist
+    b = new_domain_blacklist();
+    copy = domain_blacklist_copy(b);
+    CuAssertPtrNotNull(tc, copy);
+    CuAssertIntEquals(tc, -1, lookup(copy, "example.com"));
+    domain_blacklist_clear(b);
+    domain_blacklist_clear(copy);
+}
+
+CuSuite *DomainBlacklistGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testDomainBlacklistRemove_withDomain_removesOnlyIt);
+    SUITE_ADD_TEST(suite, testDomainBlacklistRemove_withLongDomain_removesIt);
+    SUITE_ADD_TEST(suite, testDomainBlacklistCopy_withDomains_isIndependent);
+
+    return (suite);
+}
@@ -0,0 +1,280 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "CuTest.h"
+#include "ids_event_format.h"
+
+/** Larger than any event the tests format */
+#define OUT_LEN 4096
+
+/** Written after the end of the output to catch overruns */
+#define GUARD 0x5A
+
+/**
+ * An event with one observation, kept with its timestamp so that nothing
+ * needs to be freed.
+ */
+struct test_event
+{
+    struct ids_event event;
+    struct ids_event_ts ts;
+};
+
+static void
+test_event_init(struct test_event *t, const char *src_ip, char *iface,
+        char *ioc)
+{
+    memset(t, 0, sizeof(*t));
+    t->event.times_seen = &t->ts;
+    t->event.iface = iface;
+    t->event.ioc = ioc;
+    if (strchr(src_ip, ':'))
+        inet_pton(AF_INET6, src_ip, &t->event.src_ip);
+    else
+    {
+        t->event.src_ip.s6_addr[10] = t->event.src_ip.s6_addr[11] = 0xff;
+        inet_pton(AF_INET, src_ip, t->event.src_ip.s6_addr + 12);
+    }
+}
+
+/**
+ * Format \p event and check that exactly \p expected was written, within
+ * the bound given by ids_event_format_len_max().
+ */
+static void
+assert_formats_as(CuTest *tc, ids_event_format_t format,
+        const struct ids_event *event, const char *expected, size_t len)
+{
+    char out[OUT_LEN];
+    size_t written, len_max = ids_event_format_len_max(format, event);
+
+    CuAssertTrue(tc, len_max < sizeof(out));
+    memset(out, GUARD, sizeof(out));
+
+    written = ids_event_format(format, out, event);
+    CuAssertTrue(tc, written <= len_max);
+    CuAssertIntEquals(tc, (int) len, (int) written);
+    CuAssertTrue(tc, 0 == memcmp(expected, out, len));
+    CuAssertIntEquals(tc, GUARD, (unsigned char) out[written]);
+}
+
+#define ASSERT_FORMATS_AS(tc, format, event, lit) \
+    assert_formats_as((tc), (format), (event), (lit), sizeof(lit) - 1)
+
+void testIdsEventFormat_withZeroValues_writesEachFormat(CuTest *tc)
+{
+    struct test_event t;
+
+    test_event_init(&t, "0.0.0.0", "", "");
+
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_TEXT, &t.event,
+            "IOC: \n"
+            "Timestamp:           0\n"
+            "Occurrences: 0\n"
+            "Interface: \n"
+            "Src-IP: 0.0.0.0\n"
+            "Src-MAC: 00-00-00-00-00-00\n\n");
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_JSON, &t.event,
+            "{\"seq\":0,\"ioc\":\"\",\"timestamp\":0,\"occurrences\":0,"
+            "\"interface\":\"\",\"src_ip\":\"0.0.0.0\","
+            "\"src_mac\":\"00-00-00-00-00-00\",\"rrtype\":0}\n");
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_BINARY, &t.event,
+            "\x01" "\x00\x00\x00\x30"
+            "\x00\x00\x00\x00\x00\x00\x00\x00"
+            "\x00\x00\x00\x00\x00\x00\x00\x00"
+            "\x00\x00\x00\x00"
+            "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff\x00\x00\x00\x00"
+            "\x00\x00\x00\x00\x00\x00"
+            "\x00\x00"
+            "\x00\x00"
+            "\x00\x00");
+}
+
+void testIdsEventFormat_withMaximumValues_writesEachFormat(CuTest *tc)
+{
+    struct test_event t;
+
+    test_event_init(&t, "255.255.255.255", "eth0", "bad.example.com");
+    t.event.seq = UINT64_MAX;
+    t.event.num_times = UINT_MAX;
+    t.event.rrtype = UINT16_MAX;
+    t.ts.tm_stamp.tv_sec = 1600000000;
+    memset(t.event.mac.m_addr, 0xff, sizeof(t.event.mac.m_addr));
+
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_TEXT, &t.event,
+            "IOC: bad.example.com\n"
+            "Timestamp:  1600000000\n"
+            "Occurrences: 4294967295\n"
+            "Interface: eth0\n"
+            "Src-IP: 255.255.255.255\n"
+            "Src-MAC: FF-FF-FF-FF-FF-FF\n\n");
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_JSON, &t.event,
+            "{\"seq\":18446744073709551615,\"ioc\":\"bad.example.com\","
+            "\"timestamp\":1600000000,\"occurrences\":4294967295,"
+            "\"interface\":\"eth0\",\"src_ip\":\"255.255.255.255\","
+            "\"src_mac\":\"FF-FF-FF-FF-FF-FF\",\"rrtype\":65535}\n");
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_BINARY, &t.event,
+            "\x01" "\x00\x00\x00\x43"
+            "\xff\xff\xff\xff\xff\xff\xff\xff"
+            "\x00\x00\x00\x00\x5f\x5e\x10\x00"
+            "\xff\xff\xff\xff"
+            "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\xff\xff\xff\xff\xff\xff"
+            "\xff\xff\xff\xff\xff\xff"
+            "\x00\x0f" "bad.example.com"
+            "\x00\x04" "eth0"
+            "\xff\xff");
+}
+
+void testIdsEventFormat_withIpv6Source_writesTheAddress(CuTest *tc)
+{
+    struct test_event t;
+
+    test_event_init(&t, "2001:db8::1", "eth0", "bad.example.com");
+    t.event.mac.m_addr[0] = 0x0a;
+    t.event.mac.m_addr[5] = 0xb1;
+
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_TEXT, &t.event,
+            "IOC: bad.example.com\n"
+            "Timestamp:           0\n"
+            "Occurrences: 0\n"
+            "Interface: eth0\n"
+            "Src-IP: 2001:db8::1\n"
+            "Src-MAC: 0A-00-00-00-00-B1\n\n");
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_JSON, &t.event,
+            "{\"seq\":0,\"ioc\":\"bad.example.com\",\"timestamp\":0,"
+            "\"occurrences\":0,\"interface\":\"eth0\","
+            "\"src_ip\":\"2001:db8::1\",\"src_mac\":\"0A-00-00-00-00-B1\","
+            "\"rrtype\":0}\n");
+
+    // The longest text form of an address is within the bound
+    test_event_init(&t, "1111:2222:3333:4444:5555:6666:7777:8888", "", "");
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_TEXT, &t.event,
+            "IOC: \n"
+            "Timestamp:           0\n"
+            "Occurrences: 0\n"
+            "Interface: \n"
+            "Src-IP: 1111:2222:3333:4444:5555:6666:7777:8888\n"
+            "Src-MAC: 00-00-00-00-00-00\n\n");
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_JSON, &t.event,
+            "{\"seq\":0,\"ioc\":\"\",\"timestamp\":0,\"occurrences\":0,"
+            "\"interface\":\"\","
+            "\"src_ip\":\"1111:2222:3333:4444:5555:6666:7777:8888\","
+            "\"src_mac\":\"00-00-00-00-00-00\",\"rrtype\":0}\n");
+}
+
+void testIdsEventFormat_withSpecialCharacters_escapesJson(CuTest *tc)
+{
+    struct test_event t;
+
+    test_event_init(&t, "10.0.0.1", "tab\there", "a\"b\\c\nd\x01\x1f");
+
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_JSON, &t.event,
+            "{\"seq\":0,\"ioc\":\"a\\\"b\\\\c\\u000Ad\\u0001\\u001F\","
+            "\"timestamp\":0,\"occurrences\":0,"
+            "\"interface\":\"tab\\u0009here\",\"src_ip\":\"10.0.0.1\","
+            "\"src_mac\":\"00-00-00-00-00-00\",\"rrtype\":0}\n");
+    // The other formats write the strings as they are
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_TEXT, &t.event,
+            "IOC: a\"b\\c\nd\x01\x1f\n"
+            "Timestamp:           0\n"
+            "Occurrences: 0\n"
+            "Interface: tab\there\n"
+            "Src-IP: 10.0.0.1\n"
+            "Src-MAC: 00-00-00-00-00-00\n\n");
+}
+
+void testIdsEventFormat_withNonAsciiBytes_escapesJson(CuTest *tc)
+{
+    struct test_event t;
+
+    // A UTF-8 sequence and bytes that are not valid UTF-8 are escaped alike
+    test_event_init(&t, "10.0.0.1", "eth0", "caf\xc3\xa9.\x80\xff\x7f.com");
+
+    ASSERT_FORMATS_AS(tc, IDS_EVENT_FORMAT_JSON, &t.event,
+            "{\"seq\":0,\"ioc\":\"caf\\u00C3\\u00A9.\\u0080\\u00FF\x7f.com\","
+            "\"timestamp\":0,\"occurrences\":0,"
+            "\"interface\":\"eth0\",\"src_ip\":\"10.0.0.1\","
+            "\"src_mac\":\"00-00-00-00-00-00\",\"rrtype\":0}\n");
+}
+
+void testIdsEventFormatLenMax_withOnlyEscapedBytes_isEnough(CuTest *tc)
+{
+    struct test_event t;
+    char ioc[256], out[OUT_LEN];
+    int format;
+
+    // Each byte takes the most space escaped
+    memset(ioc, '\x1f', sizeof(ioc) / 2);
+    memset(ioc + sizeof(ioc) / 2, '\xff', sizeof(ioc) - sizeof(ioc) / 2 - 1);
+    ioc[sizeof(ioc) - 1] = '\0';
+    test_event_init(&t, "1111:2222:3333:4444:5555:6666:7777:8888", ioc, ioc);
+    t.event.seq = UINT64_MAX;
+    t.event.num_times = UINT_MAX;
+    t.event.rrtype = UINT16_MAX;
+    t.ts.tm_stamp.tv_sec = INT32_MAX;
+
+    for (format = 0; format < IDS_EVENT_FORMAT_COUNT; format++)
+    {
+        CuAssertTrue(tc, ids_event_format_len_max(format, &t.event)
+                < sizeof(out));
+        CuAssertTrue(tc, ids_event_format(format, out, &t.event)
+                <= ids_event_format_len_max(format, &t.event));
+    }
+}
+
+void testIdsEventFormatCursor_withLargestSeq_fitsInTheMaximum(CuTest *tc)
+{
+    char out[IDS_EVENT_FORMAT_CURSOR_MAX];
+    size_t len;
+
+    len = ids_event_format_cursor(IDS_EVENT_FORMAT_TEXT, out, UINT64_MAX);
+    CuAssertIntEquals(tc, sizeof("Cursor: 18446744073709551615\n\n") - 1, len);
+    CuAssertTrue(tc, 0 == memcmp("Cursor: 18446744073709551615\n\n", out, len));
+
+    len = ids_event_format_cursor(IDS_EVENT_FORMAT_JSON, out, UINT64_MAX);
+    CuAssertIntEquals(tc, sizeof(out), len);
+    CuAssertTrue(tc, 0 == memcmp("{\"cursor\":18446744073709551615}\n", out,
+            len));
+
+    len = ids_event_format_cursor(IDS_EVENT_FORMAT_BINARY, out, 0);
+    CuAssertIntEquals(tc, 13, len);
+    CuAssertTrue(tc, 0 == memcmp("\x02\x00\x00\x00\x08\0\0\0\0\0\0\0\0", out,
+            len));
+
+    len = ids_event_format_dropped(IDS_EVENT_FORMAT_JSON, out, 0);
+    CuAssertTrue(tc, len <= IDS_EVENT_FORMAT_DROPPED_MAX);
+    CuAssertTrue(tc, 0 == memcmp("{\"dropped\":0}\n", out, len));
+}
+
+CuSuite *IdsEventFormatGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testIdsEventFormat_withZeroValues_writesEachFormat);
+    SUITE_ADD_TEST(suite,
+            testIdsEventFormat_withMaximumValues_writesEachFormat);
+    SUITE_ADD_TEST(suite, testIdsEventFormat_withIpv6Source_writesTheAddress);
+    SUITE_ADD_TEST(suite,
+            testIdsEventFormat_withSpecialCharacters_escapesJson);
+    SUITE_ADD_TEST(suite, testIdsEventFormat_withNonAsciiBytes_escapesJson);
+    SUITE_ADD_TEST(suite,
+            testIdsEventFormatLenMax_withOnlyEscapedBytes_isEnough);
+    SUITE_ADD_TEST(suite,
+            testIdsEventFormatCursor_withLargestSeq_fitsInTheMaximum);
+
+    return (suite);
+}
@@ -18,33 +18,30 @@
 #include <time.h>
 
 #include "../src/ids_event_list.h"
+#include "../src/utils/mem.h"
 
 #include "CuTest.h"
 
-struct ids_event_list
-{
-    struct ids_event *head;
-    unsigned int max_events;
-    unsigned int max_timestamps;
-    unsigned int num_events;
-};
-
-struct ids_event_ts
-{
-    struct timespec tm_stamp;
-    struct ids_event_ts *next;
-};
-
-struct ids_event
+/**
+ * Create an event for an IPv4 source address, as the packet handler does.
+ */
+static struct ids_event *
+make_event(char *iface, uint32_t src_ip, const char *ioc)
 {
-    struct ids_event_ts *times_seen;
-    unsigned int num_times;
-    char *iface;
-    uint32_t src_ip;
-    char *ioc;	/* may be a stringify-ed IP address or domain */
-    struct ids_event *next;
-    struct ids_event *previous;
-};
+    struct in6_addr addr;
+    mac_addr mac;
+    ids_ioc_value_t value;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.s6_addr[10] = addr.s6_addr[11] = 0xff;
+    src_ip = htonl(src_ip);
+    memcpy(addr.s6_addr + 12, &src_ip, 4);
+    memset(&mac, 0, sizeof(mac));
+    memset(&value, 0, sizeof(value));
+
+    return new_ids_event(iface, &addr, mem_strdup(MEM_EVENTS, ioc), mac,
+            value);
+}
 
 void test_new_ids_event(CuTest *tc)
 {
@@ -53,15 +50,12 @@ void test_new_ids_event(CuTest *tc)
     char *ioc = "baddomain.com";
 
     inet_pton(AF_INET, "192.168.1.1", &ip_addr);
-    struct ids_event *event = new_ids_event(
-            iface,
-            ntohl(ip_addr.s_addr),
-            strdup(ioc));
+    struct ids_event *event = make_event(iface, ntohl(ip_addr.s_addr), ioc);
     if (event) {
         /* The current time should be in the times_seen */
         CuAssertTrue(tc, event->times_seen != NULL);
         CuAssertTrue(tc, event->iface == iface);
-        CuAssertTrue(tc, event->src_ip == ntohl(ip_addr.s_addr));
+        CuAssertTrue(tc, !memcmp(event->src_ip.s6_addr + 12, &ip_addr, 4));
         CuAssertTrue(tc, strcmp(ioc, event->ioc) == 0);
         CuAssertTrue(tc, event->next == NULL);
         CuAssertTrue(tc, event->previous == NULL);
@@ -86,10 +80,7 @@ void test_new_ids_event_list(CuTest *tc) {
 }
 
 void test_ids_event_list_add_event(CuTest *tc) {
-    struct ids_event *event = new_ids_event(
-            "ether0",
-            5000,
-            strdup("domain.com"));
+    struct ids_event *event = make_event("ether0", 5000, "domain.com");
     struct ids_event *old_event;
     struct ids_event_list *list = new_ids_event_list(2, 2);
 
@@ -98,7 +89,7 @@ void test_ids_event_list_add_event(CuTest *tc) {
         CuAssertTrue(tc, list->head == event);
 
         old_event = event;
-        event = new_ids_event("ether1", 200, strdup("baddomain.com"));
+        event = make_event("ether1", 200, "baddomain.com");
         if (event) {
             CuAssertTrue(tc, ids_event_list_add_event(list, event) == 1);
             CuAssertTrue(tc, list->head == event);
@@ -108,7 +99,7 @@ void test_ids_event_list_add_event(CuTest *tc) {
 
         /* This is the same type as the first event. */
         old_event = event;
-        event = new_ids_event("ether0", 5000, strdup("domain.com"));
+        event = make_event("ether0", 5000, "domain.com");
         if (event) {
             CuAssertTrue(tc, ids_event_list_add_event(list, event) == 1);
             CuAssertTrue(tc, strcmp(list->head->iface, "ether0") == 0);
@@ -0,0 +1,138 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include "CuTest.h"
+#include "ids_server_request.h"
+
+/** Longer than any request line in the tests */
+#define LINE_MAX_LEN 64
+
+/**
+ * Parse a copy of \p line, since parsing modifies it.
+ */
+static int
+parse(const char *line, evs_request_t *req)
+{
+    char copy[LINE_MAX_LEN];
+
+    strncpy(copy, line, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+    return evs_request_parse(copy, req);
+}
+
+static void
+assert_request(CuTest *tc, const char *line, evs_req_type type, int has_seq,
+        uint64_t seq, ids_event_format_t format)
+{
+    evs_request_t req;
+
+    CuAssertIntEquals_Msg(tc, line, 0, parse(line, &req));
+    CuAssertIntEquals_Msg(tc, line, type, req.type);
+    CuAssertIntEquals_Msg(tc, line, has_seq, req.has_seq);
+    CuAssertTrue(tc, seq == req.seq);
+    CuAssertIntEquals_Msg(tc, line, format, req.format);
+}
+
+static void
+assert_invalid(CuTest *tc, const char *line)
+{
+    evs_request_t req;
+
+    CuAssertIntEquals_Msg(tc, line, -1, parse(line, &req));
+}
+
+void testEvsRequestParse_withNoRequest_isList(CuTest *tc)
+{
+    evs_request_t req;
+
+    // Clients of the original protocol send nothing
+    CuAssertIntEquals(tc, 0, evs_request_parse(NULL, &req));
+    CuAssertIntEquals(tc, EVS_REQ_LIST, req.type);
+    CuAssertIntEquals(tc, IDS_EVENT_FORMAT_TEXT, req.format);
+    CuAssertIntEquals(tc, 0, req.has_seq);
+
+    assert_request(tc, "", EVS_REQ_LIST, 0, 0, IDS_EVENT_FORMAT_TEXT);
+    assert_request(tc, "   ", EVS_REQ_LIST, 0, 0, IDS_EVENT_FORMAT_TEXT);
+}
+
+void testEvsRequestParse_withList_parsesTheFormat(CuTest *tc)
+{
+    assert_request(tc, "LIST", EVS_REQ_LIST, 0, 0, IDS_EVENT_FORMAT_TEXT);
+    assert_request(tc, "LIST JSON", EVS_REQ_LIST, 0, 0,
+            IDS_EVENT_FORMAT_JSON);
+    assert_request(tc, "LIST binary", EVS_REQ_LIST, 0, 0,
+            IDS_EVENT_FORMAT_BINARY);
+    assert_request(tc, "  LIST   Text  ", EVS_REQ_LIST, 0, 0,
+            IDS_EVENT_FORMAT_TEXT);
+}
+
+void testEvsRequestParse_withSince_needsTheSeq(CuTest *tc)
+{
+    assert_request(tc, "SINCE 0", EVS_REQ_SINCE, 1, 0, IDS_EVENT_FORMAT_TEXT);
+    assert_request(tc, "SINCE 42 JSON", EVS_REQ_SINCE, 1, 42,
+            IDS_EVENT_FORMAT_JSON);
+    assert_request(tc, "SINCE 18446744073709551615 BINARY", EVS_REQ_SINCE, 1,
+            UINT64_MAX, IDS_EVENT_FORMAT_BINARY);
+
+    assert_invalid(tc, "SINCE");
+    assert_invalid(tc, "SINCE JSON");
+    // The format comes after the sequence number
+    assert_invalid(tc, "SINCE JSON 42");
+}
+
+void testEvsRequestParse_withSubscribe_takesOptionalArguments(CuTest *tc)
+{
+    assert_request(tc, "SUBSCRIBE", EVS_REQ_SUBSCRIBE, 0, 0,
+            IDS_EVENT_FORMAT_TEXT);
+    assert_request(tc, "SUBSCRIBE 7", EVS_REQ_SUBSCRIBE, 1, 7,
+            IDS_EVENT_FORMAT_TEXT);
+    assert_request(tc, "SUBSCRIBE JSON", EVS_REQ_SUBSCRIBE, 0, 0,
+            IDS_EVENT_FORMAT_JSON);
+    assert_request(tc, "SUBSCRIBE 7 BINARY", EVS_REQ_SUBSCRIBE, 1, 7,
+            IDS_EVENT_FORMAT_BINARY);
+
+    assert_invalid(tc, "SUBSCRIBE JSON 7");
+}
+
+void testEvsRequestParse_withBadInput_isInvalid(CuTest *tc)
+{
+    // Request types are case sensitive, unlike formats
+    assert_invalid(tc, "list");
+    assert_invalid(tc, "GET / HTTP/1.1");
+    assert_invalid(tc, "LIST XML");
+    assert_invalid(tc, "LIST JSON JSON");
+    // LIST takes no sequence number
+    assert_invalid(tc, "LIST 5");
+    assert_invalid(tc, "SINCE 5 6");
+    assert_invalid(tc, "SINCE 5 JSON TEXT");
+    assert_invalid(tc, "SINCE -1");
+    assert_invalid(tc, "SINCE 12abc");
+    assert_invalid(tc, "SINCE 0x10");
+    // One more than the largest sequence number
+    assert_invalid(tc, "SINCE 18446744073709551616");
+    assert_invalid(tc, "SUBSCRIBE 1 2");
+}
+
+CuSuite *IdsServerRequestGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testEvsRequestParse_withNoRequest_isList);
+    SUITE_ADD_TEST(suite, testEvsRequestParse_withList_parsesTheFormat);
+    SUITE_ADD_TEST(suite, testEvsRequestParse_withSince_needsTheSeq);
+    SUITE_ADD_TEST(suite,
+            testEvsRequestParse_withSubscribe_takesOptionalArguments);
+    SUITE_ADD_TEST(suite, testEvsRequestParse_withBadInput_isInvalid);
+
+    return (suite);
+}
@@ -0,0 +1,319 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "CuTest.h"
+#include "blacklist/ip6_blacklist.h"
+
+static struct in6_addr
+addr(const char *s)
+{
+    struct in6_addr a;
+
+    inet_pton(AF_INET6, s, &a);
+    return a;
+}
+
+/** The botnet ID that \p s is blacklisted with, or -1 if it is not */
+static int
+lookup(const ip6_blacklist *b, const char *s)
+{
+    struct in6_addr a = addr(s);
+    const ids_ioc_value_t *value = ip6_blacklist_lookup(b, &a);
+
+    return value ? value->botnet_id : -1;
+}
+
+static void
+add(ip6_blacklist *b, const char *s, unsigned int len, int botnet_id)
+{
+    struct in6_addr a = addr(s);
+    ids_ioc_value_t value = { botnet_id };
+
+    ip6_blacklist_add(b, &a, len, &value);
+}
+
+void testIp6Blacklist_withAddress_matchesOnlyIt(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist();
+
+    CuAssertIntEquals(tc, -1, lookup(b, "2001:db8::1"));
+    add(b, "2001:db8::1", 128, 7);
+    CuAssertIntEquals(tc, 1, ip6_blacklist_count(b));
+    CuAssertIntEquals(tc, 7, lookup(b, "2001:db8::1"));
+    CuAssertIntEquals(tc, -1, lookup(b, "2001:db8::2"));
+    CuAssertIntEquals(tc, -1, lookup(b, "2001:db9::1"));
+
+    // Adding it again replaces the value
+    add(b, "2001:db8::1", 128, 8);
+    CuAssertIntEquals(tc, 1, ip6_blacklist_count(b));
+    CuAssertIntEquals(tc, 8, lookup(b, "2001:db8::1"));
+
+    free_ip6_blacklist(&b);
+    CuAssertPtrEquals(tc, NULL, b);
+}
+
+void testIp6Blacklist_withNestedPrefixes_returnsLongest(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist();
+
+    add(b, "2001:db8::", 32, 1);
+    add(b, "2001:db8:1::", 48, 2);
+    add(b, "2001:db8:1:2::", 64, 3);
+    add(b, "2001:db8:1:2::5", 128, 4);
+
+    CuAssertIntEquals(tc, 1, lookup(b, "2001:db8:ffff::1"));
+    CuAssertIntEquals(tc, 2, lookup(b, "2001:db8:1:ffff::1"));
+    CuAssertIntEquals(tc, 3, lookup(b, "2001:db8:1:2::6"));
+    CuAssertIntEquals(tc, 4, lookup(b, "2001:db8:1:2::5"));
+    CuAssertIntEquals(tc, -1, lookup(b, "2001:db7:1:2::5"));
+
+    free_ip6_blacklist(&b);
+}
+
+void testIp6Blacklist_withHostBits_ignoresThem(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist();
+    struct in6_addr a = addr("2001:db8:1:2:3:4:5:6");
+
+    add(b, "2001:db8:1:2:3:4:5:6", 60, 1);
+    CuAssertIntEquals(tc, 1, lookup(b, "2001:db8:1::"));
+    CuAssertIntEquals(tc, 1, lookup(b, "2001:db8:1:f::1"));
+    CuAssertIntEquals(tc, -1, lookup(b, "2001:db8:1:10::1"));
+
+    // The prefix is removed by any address within it
+    a.s6_addr[15] ^= 0xff;
+    CuAssertIntEquals(tc, 0, ip6_blacklist_remove(b, &a, 60));
+    CuAssertIntEquals(tc, -1, lookup(b, "2001:db8:1::"));
+
+    free_ip6_blacklist(&b);
+}
+
+void testIp6Blacklist_withShortPrefix_skipsFrontBitmap(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist();
+
+    // Prefixes shorter than the bitmap are checked for every address
+    add(b, "::", 0, 1);
+    add(b, "2001:db8::", 47, 2);
+    add(b, "2001:db8:2::", 48, 3);
+
+    CuAssertIntEquals(tc, 1, lookup(b, "fe80::1"));
+    CuAssertIntEquals(tc, 2, lookup(b, "2001:db8:1::1"));
+    CuAssertIntEquals(tc, 3, lookup(b, "2001:db8:2::1"));
+    CuAssertIntEquals(tc, 1, lookup(b, "2001:db8:4::1"));
+
+    free_ip6_blacklist(&b);
+}
+
+void testIp6Blacklist_withInvalidLength_returnsNeg1(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist();
+    struct in6_addr a = addr("2001:db8::1");
+    ids_ioc_value_t value = { 1 };
+
+    CuAssertIntEquals(tc, -1, ip6_blacklist_add(b, &a, 129, &value));
+    CuAssertIntEquals(tc, 0, ip6_blacklist_count(b));
+    CuAssertIntEquals(tc, -1, ip6_blacklist_remove(b, &a, 129));
+    CuAssertIntEquals(tc, -1, ip6_blacklist_remove(b, &a, 128));
+
+    free_ip6_blacklist(&b);
+}
+
+void testIp6Blacklist_withManyPrefixes_growsTable(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist();
+    struct in6_addr a = addr("2001:db8::");
+    ids_ioc_value_t value;
+    int i;
+
+    for (i = 0; i < 1000; i++)
+    {
+        a.s6_addr[14] = i >> 8;
+        a.s6_addr[15] = i & 0xff;
+        value.botnet_id = i;
+        CuAssertIntEquals(tc, 0, ip6_blacklist_add(b, &a, 128, &value));
+    }
+    CuAssertIntEquals(tc, 1000, ip6_blacklist_count(b));
+
+    for (i = 0; i < 1024; i++)
+    {
+        a.s6_addr[14] = i >> 8;
+        a.s6_addr[15] = i & 0xff;
+        if (i < 1000)
+            CuAssertIntEquals(tc, i, ip6_blacklist_lookup(b, &a)->botnet_id);
+        else
+            CuAssertPtrEquals(tc, NULL,
+                    (void *) ip6_blacklist_lookup(b, &a));
+    }
+
+    free_ip6_blacklist(&b);
+}
+
+void testIp6Blacklist_withCopy_isIndependent(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist(), *copy;
+    struct in6_addr a = addr("2001:db8::1");
+
+    add(b, "2001:db8::1", 128, 1);
+    add(b, "2001:db8::", 32, 2);
+    copy = ip6_blacklist_copy(b);
+    CuAssertPtrNotNull(tc, copy);
+
+    CuAssertIntEquals(tc, 0, ip6_blacklist_remove(b, &a, 128));
+    add(copy, "2001:db9::", 32, 3);
+
+    CuAssertIntEquals(tc, 2, lookup(b, "2001:db8::1"));
+    CuAssertIntEquals(tc, -1, lookup(b, "2001:db9::1"));
+    CuAssertIntEquals(tc, 1, lookup(copy, "2001:db8::1"));
+    CuAssertIntEquals(tc, 3, lookup(copy, "2001:db9::1"));
+    CuAssertIntEquals(tc, 3, ip6_blacklist_count(copy));
+
+    free_ip6_blacklist(&b);
+    free_ip6_blacklist(&copy);
+}
+
+void testIp6BlacklistRemove_withNestedPrefixes_removesOnlyOne(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist();
+    struct in6_addr a = addr("2001:db8:1::");
+
+    add(b, "2001:db8::", 32, 1);
+    add(b, "2001:db8:1::", 48, 2);
+    add(b, "2001:db8:1::1", 128, 3);
+
+    CuAssertIntEquals(tc, 0, ip6_blacklist_remove(b, &a, 48));
+    CuAssertIntEquals(tc, -1, ip6_blacklist_remove(b, &a, 48));
+    CuAssertIntEquals(tc, 2, ip6_blacklist_count(b));
+    CuAssertIntEquals(tc, 1, lookup(b, "2001:db8:1::2"));
+    CuAssertIntEquals(tc, 3, lookup(b, "2001:db8:1::1"));
+
+    // Without any /32 left, the lookup still finds the /128
+    CuAssertIntEquals(tc, 0, ip6_blacklist_remove(b, &a, 32));
+    CuAssertIntEquals(tc, -1, lookup(b, "2001:db8:1::2"));
+    CuAssertIntEquals(tc, 3, lookup(b, "2001:db8:1::1"));
+
+    free_ip6_blacklist(&b);
+}
+
+/**
+ * Addresses in 2001:db8::/64 whose home slots in a new blacklist, of 64
+ * slots, are at the end of the table, so their probe sequences wrap around
+ * to the start. The slots are those given by hash_prefix() in
+ * ip6_blacklist.c.
+ */
+static const struct
+{
+    const char *addr;
+    unsigned int home;
+} wrapping[] = {
+    { "2001:db8::d", 62 },
+    { "2001:db8::59", 63 },
+    { "2001:db8::7f", 63 },
+    { "2001:db8::16", 0 },
+    { "2001:db8::8d", 0 },
+    { "2001:db8::55", 1 },
+};
+
+#define N_WRAPPING (sizeof(wrapping) / sizeof(wrapping[0]))
+
+static void
+add_wrapping(ip6_blacklist *b)
+{
+    unsigned int i;
+
+    // In this order the entries fill slots 62, 63 and then 0 to 3
+    for (i = 0; i < N_WRAPPING; i++) add(b, wrapping[i].addr, 128, i);
+}
+
+/** Fails unless exactly the entries of #wrapping not in \p removed remain */
+static void
+assert_wrapping(CuTest *tc, const ip6_blacklist *b, const int *removed)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < N_WRAPPING; i++)
+    {
+        CuAssertIntEquals(tc, removed[i] ? -1 : (int) i,
+                lookup(b, wrapping[i].addr));
+        n += !removed[i];
+    }
+    CuAssertIntEquals(tc, n, ip6_blacklist_count(b));
+}
+
+void testIp6BlacklistRemove_withWrappingChain_keepsOthersReachable(CuTest *tc)
+{
+    ip6_blacklist *b;
+    struct in6_addr a;
+    int removed[N_WRAPPING];
+    unsigned int first, i;
+
+    // Remove each entry first, then the rest in order, so that entries are
+    // moved back across the end of the table and past their neighbours'
+    // home slots
+    for (first = 0; first < N_WRAPPING; first++)
+    {
+        b = new_ip6_blacklist();
+        add_wrapping(b);
+        memset(removed, 0, sizeof(removed));
+
+        a = addr(wrapping[first].addr);
+        CuAssertIntEquals(tc, 0, ip6_blacklist_remove(b, &a, 128));
+        removed[first] = 1;
+        assert_wrapping(tc, b, removed);
+
+        for (i = 0; i < N_WRAPPING; i++)
+        {
+            if (removed[i]) continue;
+            a = addr(wrapping[i].addr);
+            CuAssertIntEquals(tc, 0, ip6_blacklist_remove(b, &a, 128));
+            removed[i] = 1;
+            assert_wrapping(tc, b, removed);
+        }
+
+        free_ip6_blacklist(&b);
+    }
+}
+
+void testIp6BlacklistRemove_thenAdd_reusesSlot(CuTest *tc)
+{
+    ip6_blacklist *b = new_ip6_blacklist();
+    struct in6_addr a = addr(wrapping[1].addr);
+    int removed[N_WRAPPING] = { 0 };
+
+    add_wrapping(b);
+    CuAssertIntEquals(tc, 0, ip6_blacklist_remove(b, &a, 128));
+    add(b, wrapping[1].addr, 128, 1);
+    assert_wrapping(tc, b, removed);
+
+    free_ip6_blacklist(&b);
+}
+
+CuSuite *Ip6BlacklistGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testIp6Blacklist_withAddress_matchesOnlyIt);
+    SUITE_ADD_TEST(suite, testIp6Blacklist_withNestedPrefixes_returnsLongest);
+    SUITE_ADD_TEST(suite, testIp6Blacklist_withHostBits_ignoresThem);
+    SUITE_ADD_TEST(suite, testIp6Blacklist_withShortPrefix_skipsFrontBitmap);
+    SUITE_ADD_TEST(suite, testIp6Blacklist_withInvalidLength_returnsNeg1);
+    SUITE_ADD_TEST(suite, testIp6Blacklist_withManyPrefixes_growsTable);
+    SUITE_ADD_TEST(suite, testIp6Blacklist_withCopy_isIndependent);
+    SUITE_ADD_TEST(suite, testIp6BlacklistRemove_withNestedPrefixes_removesOnlyOne);
+    SUITE_ADD_TEST(suite, testIp6BlacklistRemove_withWrappingChain_keepsOthersReachable);
+    SUITE_ADD_TEST(suite, testIp6BlacklistRemove_thenAdd_reusesSlot);
+
+    return (suite);
+}
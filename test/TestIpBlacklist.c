@@ -0,0 +1,471 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+
+#include "CuTest.h"
+#include "blacklist/ip_blacklist.h"
+#include "utils/ebvbl/ebvbl.h"
+
+/** The number of addresses in the large blacklists */
+#define MANY 4096
+
+/** The number of addresses in a blacklist the size of a feed */
+#define FEED 200000
+
+/** The number of changes in a delta to a blacklist the size of a feed */
+#define FEED_DELTA 2000
+
+/** The seconds an operation on a blacklist the size of a feed may take. It
+ * takes a few milliseconds, and minutes if its cost is quadratic. */
+#define FEED_SECONDS 1.0
+
+/**
+ * An address spread over the whole IPv4 space, in host byte order. The
+ * multiplier is odd, so each \p i gives a different address.
+ */
+static uint32_t
+spread_address(uint32_t i)
+{
+    return i * UINT32_C(2654435761);
+}
+
+static ip_blacklist *
+make_blacklist(unsigned int n)
+{
+    ip_blacklist *b = new_ip_blacklist();
+    ip_key_value_t kv;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+    {
+        memset(&kv, 0, sizeof(kv));
+        kv.ip_addr = spread_address(i);
+        kv.value.botnet_id = i;
+        ip_blacklist_add(b, &kv);
+    }
+
+    return b;
+}
+
+static double
+seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+            + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+void testIpBlacklistLookup_withManyAddresses_findsEach(CuTest *tc)
+{
+    ip_blacklist *b = make_blacklist(MANY);
+    const ip_key_value_t *kv;
+    unsigned int i, missed = 0;
+
+    CuAssertIntEquals(tc, MANY, ip_blacklist_count(b));
+
+    // Addresses more than 2^31 apart once compared as if the order wrapped
+    for (i = 0; i < MANY; i++)
+    {
+        kv = ip_blacklist_lookup(b, htonl(spread_address(i)), htons(80));
+        if (!kv || kv->value.botnet_id != (int) i) missed++;
+    }
+    CuAssertIntEquals(tc, 0, missed);
+
+    free_ip_blacklist(&b);
+    CuAssertPtrEquals(tc, NULL, b);
+}
+
+void testIpBlacklistLookup_withManyAddresses_missesOthers(CuTest *tc)
+{
+    ip_blacklist *b = make_blacklist(MANY);
+    unsigned int i, found = 0;
+
+    for (i = MANY; i < 2 * MANY; i++)
+        found += NULL != ip_blacklist_lookup(b, htonl(spread_address(i)), 0);
+    CuAssertIntEquals(tc, 0, found);
+
+    // The ends of the address space
+    CuAssertPtrNotNull(tc, ip_blacklist_lookup(b, 0, 0));
+    CuAssertPtrEquals(tc, NULL, (void *) ip_blacklist_lookup(b, 0xffffffff, 0));
+
+    free_ip_blacklist(&b);
+}
+
+void testIpBlacklistLookup_withPort_matchesPortOrAny(CuTest *tc)
+{
+    ip_blacklist *b = new_ip_blacklist();
+    ip_key_value_t kv;
+    uint32_t a = 0xc0000201, c = 0xc0000202;
+
+    memset(&kv, 0, sizeof(kv));
+    kv.ip_addr = a;
+    kv.port = 443;
+    ip_blacklist_add(b, &kv);
+    kv.ip_addr = c;
+    kv.port = 0;
+    ip_blacklist_add(b, &kv);
+
+    CuAssertPtrNotNull(tc, ip_blacklist_lookup(b, htonl(a), htons(443)));
+    CuAssertPtrEquals(tc, NULL,
+            (void *) ip_blacklist_lookup(b, htonl(a), htons(80)));
+    // A port of 0 matches every port of the address
+    CuAssertPtrNotNull(tc, ip_blacklist_lookup(b, htonl(a), 0));
+    CuAssertPtrNotNull(tc, ip_blacklist_lookup(b, htonl(c), htons(80)));
+
+    free_ip_blacklist(&b);
+}
+
+void testIpBlacklistRemove_withSeveralPorts_removesExactPort(CuTest *tc)
+{
+    ip_blacklist *b = new_ip_blacklist();
+    ip_key_value_t kv;
+    uint32_t a = 0xc0000201;
+    uint16_t port;
+
+    // A run of entries for one address between entries for its neighbours,
+    // so that the lookup for any port lands within the run
+    memset(&kv, 0, sizeof(kv));
+    for (port = 1; port <= 20; port++)
+    {
+        kv.ip_addr = a - 1;
+        kv.port = port;
+        ip_blacklist_add(b, &kv);
+        kv.ip_addr = a;
+        ip_blacklist_add(b, &kv);
+        kv.ip_addr = a + 1;
+        ip_blacklist_add(b, &kv);
+    }
+
+    // The first, last and middle ports of the run
+    kv.ip_addr = a;
+    kv.port = 1;
+    CuAssertIntEquals(tc, 1, ip_blacklist_remove(b, &kv));
+    kv.port = 20;
+    CuAssertIntEquals(tc, 1, ip_blacklist_remove(b, &kv));
+    kv.port = 10;
+    CuAssertIntEquals(tc, 1, ip_blacklist_remove(b, &kv));
+    CuAssertIntEquals(tc, 0, ip_blacklist_remove(b, &kv));
+    kv.port = 21;
+    CuAssertIntEquals(tc, 0, ip_blacklist_remove(b, &kv));
+    CuAssertIntEquals(tc, 57, ip_blacklist_count(b));
+
+    CuAssertPtrEquals(tc, NULL, (void *) ip_blacklist_lookup(b, htonl(a),
+            htons(1)));
+    CuAssertPtrEquals(tc, NULL, (void *) ip_blacklist_lookup(b, htonl(a),
+            htons(10)));
+    CuAssertPtrNotNull(tc, ip_blacklist_lookup(b, htonl(a), htons(11)));
+    CuAssertPtrNotNull(tc, ip_blacklist_lookup(b, htonl(a - 1), htons(1)));
+    CuAssertPtrNotNull(tc, ip_blacklist_lookup(b, htonl(a + 1), htons(20)));
+
+    // An address that is not in the blacklist at all
+    kv.ip_addr = a + 2;
+    kv.port = 1;
+    CuAssertIntEquals(tc, 0, ip_blacklist_remove(b, &kv));
+
+    free_ip_blacklist(&b);
+}
+
+void testIpBlacklistCopy_withAddresses_isIndependent(CuTest *tc)
+{
+    ip_blacklist *b = make_blacklist(MANY), *copy;
+    ip_key_value_t kv;
+    unsigned int i, missed = 0;
+
+    copy = ip_blacklist_copy(b);
+    CuAssertPtrNotNull(tc, copy);
+    CuAssertIntEquals(tc, MANY, ip_blacklist_count(copy));
+
+    memset(&kv, 0, sizeof(kv));
+    kv.ip_addr = spread_address(1);
+    CuAssertIntEquals(tc, 1, ip_blacklist_remove(b, &kv));
+    kv.ip_addr = spread_address(MANY);
+    ip_blacklist_add(copy, &kv);
+
+    CuAssertPtrEquals(tc, NULL, (void *) ip_blacklist_lookup(b,
+            htonl(spread_address(1)), 0));
+    CuAssertPtrEquals(tc, NULL, (void *) ip_blacklist_lookup(b,
+            htonl(spread_address(MANY)), 0));
+    for (i = 0; i <= MANY; i++)
+        missed += NULL == ip_blacklist_lookup(copy, htonl(spread_address(i)), 0);
+    CuAssertIntEquals(tc, 0, missed);
+
+    // An empty blacklist
+    free_ip_blacklist(&copy);
+    ip_blacklist_clear(b);
+    copy = ip_blacklist_copy(b);
+    CuAssertPtrNotNull(tc, copy);
+    CuAssertIntEquals(tc, 0, ip_blacklist_count(copy));
+    CuAssertPtrEquals(tc, NULL, (void *) ip_blacklist_lookup(copy, 0, 0));
+
+    free_ip_blacklist(&copy);
+    free_ip_blacklist(&b);
+}
+
+void testIpBlacklistSort_withSortedEntries_isFast(CuTest *tc)
+{
+    ip_blacklist *b = new_ip_blacklist();
+    ip_key_value_t kv;
+    struct timespec start;
+    unsigned int i, missed = 0;
+
+    // Feeds are often sent in order, forwards or backwards
+    memset(&kv, 0, sizeof(kv));
+    for (i = 0; i < FEED; i++)
+    {
+        kv.ip_addr = i < FEED / 2 ? 2 * i : 2 * (FEED - i) - 1;
+        ip_blacklist_add(b, &kv);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CuAssertIntEquals(tc, 1, ip_blacklist_sort(b));
+    CuAssertTrue(tc, seconds_since(&start) < FEED_SECONDS);
+
+    for (i = 0; i < FEED; i++)
+        missed += NULL == ip_blacklist_lookup(b, htonl(i), 0);
+    CuAssertIntEquals(tc, 0, missed);
+    CuAssertPtrEquals(tc, NULL, (void *) ip_blacklist_lookup(b,
+            htonl(FEED), 0));
+
+    free_ip_blacklist(&b);
+}
+
+/** The addresses of the blacklist in the tests of ip_blacklist_apply(). Half
+ * share their first 16 bits, and so a bit of the bit vector. */
+static const uint32_t apply_addresses[] = {
+    0x0a000001, 0x0a000002, 0x0a000003, 0x0a000004,
+    0x0a000005, 0x0a000006, 0x0a000007, 0x0a000008,
+    0x00000001, 0x10000001, 0x20000001, 0x7fffffff,
+    0x80000000, 0xc0000201, 0xfffffffe, 0xffffffff,
+};
+
+/** The ports of the blacklist in the tests of ip_blacklist_apply() */
+#define APPLY_PORTS 4
+#define APPLY_ADDRESSES \
+    (sizeof(apply_addresses) / sizeof(apply_addresses[0]))
+
+/**
+ * Check that a blacklist holds the entries of \p model and no others, in
+ * order of address. An entry of the model is its botnet ID plus one, or 0 if
+ * it is not in the blacklist.
+ */
+static void
+check_apply_model(CuTest *tc, ip_blacklist *b,
+        int model[APPLY_ADDRESSES][APPLY_PORTS])
+{
+    EBVBL *e = (EBVBL *)b;
+    const ip_key_value_t *kv, *prev = NULL;
+    unsigned int a, p, i, n = 0, wrong = 0;
+    int any;
+
+    for (a = 0; a < APPLY_ADDRESSES; a++)
+        for (p = 0; p < APPLY_PORTS; p++)
+            n += 0 != model[a][p];
+    CuAssertIntEquals(tc, n, ip_blacklist_count(b));
+
+    for (i = 0; i < n; i++)
+    {
+        kv = ebvbl_get_element(e, i);
+        if (prev && prev->ip_addr > kv->ip_addr) wrong++;
+        prev = kv;
+
+        for (a = 0; a < APPLY_ADDRESSES; a++)
+            if (apply_addresses[a] == kv->ip_addr) break;
+        if (a == APPLY_ADDRESSES || kv->port >= APPLY_PORTS
+                || model[a][kv->port] != kv->value.botnet_id + 1)
+            wrong++;
+    }
+    CuAssertIntEquals(tc, 0, wrong);
+
+    // A lookup of any port finds each address with an entry, so the bit
+    // vector is right
+    for (a = 0; a < APPLY_ADDRESSES; a++)
+    {
+        any = 0;
+        for (p = 0; p < APPLY_PORTS; p++)
+            any |= model[a][p];
+        kv = ip_blacklist_lookup(b, htonl(apply_addresses[a]), 0);
+        if ((NULL != kv) != (0 != any)) wrong++;
+    }
+    CuAssertIntEquals(tc, 0, wrong);
+}
+
+void testIpBlacklistApply_withChanges_keepsLastOfEach(CuTest *tc)
+{
+    ip_blacklist *b = new_ip_blacklist();
+    ip_blacklist_change_t changes[64];
+    int model[APPLY_ADDRESSES][APPLY_PORTS];
+    uint32_t state = 1;
+    unsigned int round, i, a, p;
+
+    memset(model, 0, sizeof(model));
+    CuAssertIntEquals(tc, 1, ip_blacklist_apply(b, NULL, 0));
+    check_apply_model(tc, b, model);
+
+    // Batches of changes, many of them to the same entries, which must end
+    // up as if they were made one at a time
+    for (round = 0; round < 200; round++)
+    {
+        for (i = 0; i < 64; i++)
+        {
+            state = state * 1103515245 + 12345;
+            a = (state >> 8) % APPLY_ADDRESSES;
+            p = (state >> 16) % APPLY_PORTS;
+            memset(&changes[i], 0, sizeof(changes[i]));
+            changes[i].entry.ip_addr = apply_addresses[a];
+            changes[i].entry.port = p;
+            changes[i].entry.value.botnet_id = round * 64 + i;
+            changes[i].remove = (state >> 24) % 3 == 0;
+            model[a][p] = changes[i].remove ? 0 : (int) (round * 64 + i) + 1;
+        }
+        CuAssertIntEquals(tc, 1, ip_blacklist_apply(b, changes, 64));
+        check_apply_model(tc, b, model);
+    }
+
+    // Removing everything leaves nothing for a lookup to find
+    for (a = 0; a < APPLY_ADDRESSES; a++)
+    {
+        for (p = 0; p < APPLY_PORTS; p++)
+        {
+            i = a * APPLY_PORTS + p;
+            memset(&changes[i], 0, sizeof(changes[i]));
+            changes[i].entry.ip_addr = apply_addresses[a];
+            changes[i].entry.port = p;
+            changes[i].remove = 1;
+        }
+    }
+    CuAssertIntEquals(tc, 1, ip_blacklist_apply(b, changes,
+            APPLY_ADDRESSES * APPLY_PORTS));
+    memset(model, 0, sizeof(model));
+    check_apply_model(tc, b, model);
+
+    free_ip_blacklist(&b);
+}
+
+void testIpBlacklistApply_withFeedSizedBlacklist_keepsLookupsFast(CuTest *tc)
+{
+    ip_blacklist *b = new_ip_blacklist();
+    ip_blacklist_change_t changes[FEED_DELTA];
+    ip_key_value_t kv;
+    struct timespec start;
+    unsigned int i, missed = 0, found = 0;
+
+    // A sorted blacklist of the even addresses
+    memset(&kv, 0, sizeof(kv));
+    for (i = 0; i < FEED; i++)
+    {
+        kv.ip_addr = 2 * i;
+        ip_blacklist_add(b, &kv);
+    }
+    CuAssertIntEquals(tc, 1, ip_blacklist_sort(b));
+
+    // Add odd addresses and remove even ones throughout it. The step is
+    // prime, so each change is to a different address.
+    memset(changes, 0, sizeof(changes));
+    for (i = 0; i < FEED_DELTA; i++)
+    {
+        changes[i].entry.ip_addr = (i * 199) % (2 * FEED);
+        changes[i].remove = !(changes[i].entry.ip_addr & 1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    CuAssertIntEquals(tc, 1, ip_blacklist_apply(b, changes, FEED_DELTA));
+    for (i = 0; i < 2 * FEED; i++)
+        found += NULL != ip_blacklist_lookup(b, htonl(i), 0);
+    CuAssertTrue(tc, seconds_since(&start) < FEED_SECONDS);
+
+    // The changes were reordered, but are still all there
+    for (i = 0; i < FEED_DELTA; i++)
+    {
+        if ((NULL == ip_blacklist_lookup(b,
+                htonl(changes[i].entry.ip_addr), 0)) != changes[i].remove)
+            missed++;
+    }
+    CuAssertIntEquals(tc, 0, missed);
+    CuAssertIntEquals(tc, found, ip_blacklist_count(b));
+
+    for (i = 1; i < ip_blacklist_count(b); i++)
+    {
+        if (((ip_key_value_t *)ebvbl_get_element((EBVBL *)b, i - 1))->ip_addr
+                > ((ip_key_value_t *)ebvbl_get_element((EBVBL *)b, i))->ip_addr)
+            missed++;
+    }
+    CuAssertIntEquals(tc, 0, missed);
+
+    free_ip_blacklist(&b);
+}
+
+static int
+cmp_int(void *a, void *b)
+{
+    return *(int *) a - *(int *) b;
+}
+
+void testSaCopy_withElements_copiesThemAndOrder(CuTest *tc)
+{
+    SortedArray *sa = sa_initialize(sizeof(int), cmp_int), *copy;
+    int values[] = { 5, 3, 9, 1 }, x;
+    unsigned int i;
+
+    for (i = 0; i < 4; i++) sa_insert_element(sa, &values[i]);
+
+    // An unsorted copy is sorted when it is searched
+    copy = sa_copy(sa);
+    CuAssertPtrNotNull(tc, copy);
+    CuAssertIntEquals(tc, 4, sa_get_number_of_elements(copy));
+    CuAssertTrue(tc, !sa_is_sorted(copy));
+    x = 1;
+    CuAssertIntEquals(tc, 0, sa_find_element(copy, &x));
+    CuAssertTrue(tc, !sa_is_sorted(sa));
+    sa_free(copy, NULL);
+
+    sa_quicksort(sa);
+    copy = sa_copy(sa);
+    CuAssertTrue(tc, sa_is_sorted(copy));
+    x = 9;
+    CuAssertIntEquals(tc, 3, sa_find_element(copy, &x));
+
+    // Changing the copy leaves the original alone
+    sa_remove_element(copy, 3);
+    CuAssertIntEquals(tc, -1, sa_find_element(copy, &x));
+    CuAssertIntEquals(tc, 3, sa_find_element(sa, &x));
+    sa_free(copy, NULL);
+
+    sa_free(sa, NULL);
+    sa = sa_initialize(sizeof(int), cmp_int);
+    copy = sa_copy(sa);
+    CuAssertPtrNotNull(tc, copy);
+    CuAssertIntEquals(tc, 0, sa_get_number_of_elements(copy));
+    sa_free(copy, NULL);
+    sa_free(sa, NULL);
+}
+
+CuSuite *IpBlacklistGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testIpBlacklistLookup_withManyAddresses_findsEach);
+    SUITE_ADD_TEST(suite, testIpBlacklistLookup_withManyAddresses_missesOthers);
+    SUITE_ADD_TEST(suite, testIpBlacklistLookup_withPort_matchesPortOrAny);
+    SUITE_ADD_TEST(suite, testIpBlacklistRemove_withSeveralPorts_removesExactPort);
+    SUITE_ADD_TEST(suite, testIpBlacklistCopy_withAddresses_isIndependent);
+    SUITE_ADD_TEST(suite, testIpBlacklistSort_withSortedEntries_isFast);
+    SUITE_ADD_TEST(suite, testIpBlacklistApply_withChanges_keepsLastOfEach);
+    SUITE_ADD_TEST(suite, testIpBlacklistApply_withFeedSizedBlacklist_keepsLookupsFast);
+    SUITE_ADD_TEST(suite, testSaCopy_withElements_copiesThemAndOrder);
+
+    return (suite);
+}
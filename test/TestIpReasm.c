@@ -0,0 +1,240 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include "CuTest.h"
+#include "ip_reasm.h"
+
+/** A payload of three fragments: 16, 16 and 5 bytes */
+static const uint8_t payload[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+#define PAYLOAD_LEN (sizeof(payload) - 1)
+
+static struct ip_reasm_key
+make_key(uint32_t src_ip, uint16_t id)
+{
+    struct ip_reasm_key key;
+
+    memset(&key, 0, sizeof(key));
+    key.src_ip = src_ip;
+    key.dest_ip = 2;
+    key.id = id;
+    key.protocol = 17;
+    return key;
+}
+
+/** Add the bytes of #payload from \p offset to \p end as a fragment */
+static int
+fragment(ip_reasm *r, const struct ip_reasm_key *key, size_t offset,
+        size_t end, uint32_t now, const uint8_t **out, size_t *out_len)
+{
+    return ip_reasm_fragment(r, key, offset, end < PAYLOAD_LEN,
+            payload + offset, end - offset, now, out, out_len);
+}
+
+void testIpReasm_withFragmentsInOrder_reassemblesThem(CuTest *tc)
+{
+    ip_reasm *r = new_ip_reasm(4, 2);
+    struct ip_reasm_key key = make_key(1, 1);
+    const uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    CuAssertIntEquals(tc, 0, fragment(r, &key, 0, 16, 0, &out, &out_len));
+    CuAssertIntEquals(tc, 0, fragment(r, &key, 16, 32, 0, &out, &out_len));
+    CuAssertIntEquals(tc, 1, ip_reasm_count(r));
+    CuAssertIntEquals(tc, 1, fragment(r, &key, 32, PAYLOAD_LEN, 0, &out,
+            &out_len));
+    CuAssertIntEquals(tc, PAYLOAD_LEN, out_len);
+    CuAssertTrue(tc, !memcmp(payload, out, PAYLOAD_LEN));
+    CuAssertIntEquals(tc, 0, ip_reasm_count(r));
+
+    free_ip_reasm(&r);
+    CuAssertPtrEquals(tc, NULL, r);
+}
+
+void testIpReasm_withFragmentsOutOfOrder_reassemblesThem(CuTest *tc)
+{
+    ip_reasm *r = new_ip_reasm(4, 2);
+    struct ip_reasm_key key = make_key(1, 1);
+    const uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    // In reverse order, as some stacks send them
+    CuAssertIntEquals(tc, 0, fragment(r, &key, 32, PAYLOAD_LEN, 0, &out,
+            &out_len));
+    CuAssertIntEquals(tc, 0, fragment(r, &key, 16, 32, 0, &out, &out_len));
+    CuAssertIntEquals(tc, 1, ip_reasm_count(r));
+    CuAssertIntEquals(tc, 1, fragment(r, &key, 0, 16, 0, &out, &out_len));
+    CuAssertIntEquals(tc, PAYLOAD_LEN, out_len);
+    CuAssertTrue(tc, !memcmp(payload, out, PAYLOAD_LEN));
+
+    // The first fragment in the middle
+    fragment(r, &key, 16, 32, 0, &out, &out_len);
+    fragment(r, &key, 0, 16, 0, &out, &out_len);
+    CuAssertIntEquals(tc, 1, fragment(r, &key, 32, PAYLOAD_LEN, 0, &out,
+            &out_len));
+    CuAssertTrue(tc, !memcmp(payload, out, PAYLOAD_LEN));
+
+    free_ip_reasm(&r);
+}
+
+void testIpReasm_withDiscard_dropsEarlyFragments(CuTest *tc)
+{
+    ip_reasm *r = new_ip_reasm(4, 2);
+    struct ip_reasm_key a = make_key(1, 1), b = make_key(1, 2);
+    const uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    fragment(r, &a, 16, 32, 0, &out, &out_len);
+    fragment(r, &b, 16, 32, 0, &out, &out_len);
+    CuAssertIntEquals(tc, 2, ip_reasm_count(r));
+
+    ip_reasm_discard(r, &a);
+    CuAssertIntEquals(tc, 1, ip_reasm_count(r));
+    ip_reasm_discard(r, &a);
+    CuAssertIntEquals(tc, 1, ip_reasm_count(r));
+
+    // The datagram starts again without the discarded fragment
+    fragment(r, &a, 0, 16, 0, &out, &out_len);
+    CuAssertIntEquals(tc, 0, fragment(r, &a, 32, PAYLOAD_LEN, 0, &out,
+            &out_len));
+
+    free_ip_reasm(&r);
+}
+
+void testIpReasm_withOverlappingFragment_dropsDatagram(CuTest *tc)
+{
+    ip_reasm *r = new_ip_reasm(4, 2);
+    struct ip_reasm_key key = make_key(1, 1);
+    const uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    fragment(r, &key, 0, 16, 0, &out, &out_len);
+    CuAssertIntEquals(tc, -1, fragment(r, &key, 8, 24, 0, &out, &out_len));
+    CuAssertIntEquals(tc, 0, ip_reasm_count(r));
+
+    // A duplicate is an overlap too, even before the first fragment
+    fragment(r, &key, 16, 32, 0, &out, &out_len);
+    CuAssertIntEquals(tc, -1, fragment(r, &key, 16, 32, 0, &out, &out_len));
+    CuAssertIntEquals(tc, 0, ip_reasm_count(r));
+
+    // So is a second last fragment
+    fragment(r, &key, 32, PAYLOAD_LEN, 0, &out, &out_len);
+    CuAssertIntEquals(tc, -1, ip_reasm_fragment(r, &key, 40, 0, payload, 8,
+            0, &out, &out_len));
+    CuAssertIntEquals(tc, 0, ip_reasm_count(r));
+
+    free_ip_reasm(&r);
+}
+
+void testIpReasm_withInconsistentLength_dropsDatagram(CuTest *tc)
+{
+    ip_reasm *r = new_ip_reasm(4, 2);
+    struct ip_reasm_key key = make_key(1, 1);
+    const uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    // A fragment that is not the last must be whole units
+    CuAssertIntEquals(tc, -1, ip_reasm_fragment(r, &key, 0, 1, payload, 15,
+            0, &out, &out_len));
+
+    // A fragment past the end of the datagram
+    fragment(r, &key, 32, PAYLOAD_LEN, 0, &out, &out_len);
+    CuAssertIntEquals(tc, -1, ip_reasm_fragment(r, &key, 40, 1, payload, 8,
+            0, &out, &out_len));
+
+    // A datagram larger than the buffer
+    CuAssertIntEquals(tc, -1, ip_reasm_fragment(r, &key, IP_REASM_MAX_LEN,
+            0, payload, 8, 0, &out, &out_len));
+    CuAssertIntEquals(tc, 0, ip_reasm_count(r));
+
+    free_ip_reasm(&r);
+}
+
+void testIpReasm_withTooManyFromSource_dropsFragment(CuTest *tc)
+{
+    ip_reasm *r = new_ip_reasm(4, 2);
+    struct ip_reasm_key a = make_key(1, 1), b = make_key(1, 2),
+            c = make_key(1, 3), d = make_key(5, 3);
+    const uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    // Fragments before the first count towards the limit
+    CuAssertIntEquals(tc, 0, fragment(r, &a, 0, 16, 0, &out, &out_len));
+    CuAssertIntEquals(tc, 0, fragment(r, &b, 16, 32, 0, &out, &out_len));
+    CuAssertIntEquals(tc, -1, fragment(r, &c, 0, 16, 0, &out, &out_len));
+    CuAssertIntEquals(tc, -1, fragment(r, &c, 16, 32, 0, &out, &out_len));
+    CuAssertIntEquals(tc, 2, ip_reasm_count(r));
+
+    // Other sources are unaffected, and the datagrams in progress complete
+    CuAssertIntEquals(tc, 0, fragment(r, &d, 16, 32, 0, &out, &out_len));
+    fragment(r, &a, 16, 32, 0, &out, &out_len);
+    CuAssertIntEquals(tc, 1, fragment(r, &a, 32, PAYLOAD_LEN, 0, &out,
+            &out_len));
+    CuAssertIntEquals(tc, 0, fragment(r, &c, 16, 32, 0, &out, &out_len));
+
+    free_ip_reasm(&r);
+}
+
+void testIpReasm_withFullCache_discardsOldest(CuTest *tc)
+{
+    ip_reasm *r = new_ip_reasm(2, 2);
+    struct ip_reasm_key a = make_key(1, 1), b = make_key(2, 1),
+            c = make_key(3, 1);
+    const uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    fragment(r, &a, 0, 16, 0, &out, &out_len);
+    fragment(r, &b, 0, 16, 1, &out, &out_len);
+    fragment(r, &c, 0, 16, 2, &out, &out_len);
+    CuAssertIntEquals(tc, 2, ip_reasm_count(r));
+
+    // a was discarded, so a later fragment of it starts a new datagram
+    fragment(r, &b, 16, 32, 2, &out, &out_len);
+    CuAssertIntEquals(tc, 1, fragment(r, &b, 32, PAYLOAD_LEN, 2, &out,
+            &out_len));
+    CuAssertIntEquals(tc, 0, fragment(r, &a, 16, 32, 2, &out, &out_len));
+
+    free_ip_reasm(&r);
+}
+
+void testIpReasm_withTimeout_discardsDatagram(CuTest *tc)
+{
+    ip_reasm *r = new_ip_reasm(4, 2);
+    struct ip_reasm_key key = make_key(1, 1);
+    const uint8_t *out = NULL;
+    size_t out_len = 0;
+
+    fragment(r, &key, 0, 16, 100, &out, &out_len);
+    fragment(r, &key, 16, 32, 100 + IP_REASM_TIMEOUT - 1, &out, &out_len);
+    CuAssertIntEquals(tc, 0, fragment(r, &key, 32, PAYLOAD_LEN,
+            100 + IP_REASM_TIMEOUT, &out, &out_len));
+    CuAssertIntEquals(tc, 1, ip_reasm_count(r));
+
+    free_ip_reasm(&r);
+}
+
+CuSuite *IpReasmGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testIpReasm_withFragmentsInOrder_reassemblesThem);
+    SUITE_ADD_TEST(suite, testIpReasm_withFragmentsOutOfOrder_reassemblesThem);
+    SUITE_ADD_TEST(suite, testIpReasm_withDiscard_dropsEarlyFragments);
+    SUITE_ADD_TEST(suite, testIpReasm_withOverlappingFragment_dropsDatagram);
+    SUITE_ADD_TEST(suite, testIpReasm_withInconsistentLength_dropsDatagram);
+    SUITE_ADD_TEST(suite, testIpReasm_withTooManyFromSource_dropsFragment);
+    SUITE_ADD_TEST(suite, testIpReasm_withFullCache_discardsOldest);
+    SUITE_ADD_TEST(suite, testIpReasm_withTimeout_discardsDatagram);
+
+    return (suite);
+}
@@ -0,0 +1,249 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#include "CuTest.h"
+#include "blacklist/ip_watchlist.h"
+
+/** A start time well away from 0, so that times before it can be given */
+#define T0 100000
+
+/** The IPv4-mapped address of 10.0.0.i */
+static struct in6_addr
+ipv4(unsigned int i)
+{
+    struct in6_addr a;
+    uint32_t addr = htonl(0x0a000000 + i);
+
+    memset(&a, 0, sizeof(a));
+    a.s6_addr[10] = 0xff;
+    a.s6_addr[11] = 0xff;
+    memcpy(a.s6_addr + 12, &addr, sizeof(addr));
+    return a;
+}
+
+static struct in6_addr
+ipv6(const char *s)
+{
+    struct in6_addr a;
+
+    inet_pton(AF_INET6, s, &a);
+    return a;
+}
+
+/** The botnet ID that \p a is watched with, or -1 if it is not */
+static int
+lookup(const ip_watchlist *wl, struct in6_addr a, uint32_t now)
+{
+    const ids_ioc_value_t *value = ip_watchlist_lookup(wl, &a, now);
+
+    return value ? value->botnet_id : -1;
+}
+
+static void
+add(ip_watchlist *wl, struct in6_addr a, uint32_t ttl, int botnet_id,
+        uint32_t now)
+{
+    ids_ioc_value_t value = { .botnet_id = botnet_id };
+
+    ip_watchlist_add(wl, &a, ttl, &value, now);
+}
+
+void testIpWatchlistAdd_withShortOrLongTtl_clampsIt(CuTest *tc)
+{
+    ip_watchlist *wl = new_ip_watchlist(16);
+
+    add(wl, ipv4(1), 0, 1, T0);
+    add(wl, ipv4(2), IP_WATCHLIST_TTL_MAX + 1000, 2, T0);
+    add(wl, ipv4(3), 100, 3, T0);
+
+    CuAssertIntEquals(tc, 1, lookup(wl, ipv4(1),
+            T0 + IP_WATCHLIST_TTL_MIN - 1));
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv4(1), T0 + IP_WATCHLIST_TTL_MIN));
+    CuAssertIntEquals(tc, 3, lookup(wl, ipv4(3), T0 + 99));
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv4(3), T0 + 100));
+    CuAssertIntEquals(tc, 2, lookup(wl, ipv4(2),
+            T0 + IP_WATCHLIST_TTL_MAX - 1));
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv4(2), T0 + IP_WATCHLIST_TTL_MAX));
+
+    free_ip_watchlist(&wl);
+    CuAssertPtrEquals(tc, NULL, wl);
+}
+
+void testIpWatchlistAdd_withIpv6Address_keepsItApartFromIpv4(CuTest *tc)
+{
+    ip_watchlist *wl = new_ip_watchlist(16);
+
+    add(wl, ipv6("2001:db8::a00:1"), 60, 6, T0);
+    add(wl, ipv4(1), 60, 4, T0);
+
+    CuAssertIntEquals(tc, 6, lookup(wl, ipv6("2001:db8::a00:1"), T0));
+    CuAssertIntEquals(tc, 4, lookup(wl, ipv4(1), T0));
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv6("::a00:1"), T0));
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv6("2001:db8::a00:2"), T0));
+    CuAssertIntEquals(tc, 2, ip_watchlist_count(wl));
+
+    free_ip_watchlist(&wl);
+}
+
+void testIpWatchlistAdvance_withExpiredEntries_removesOnlyThose(CuTest *tc)
+{
+    ip_watchlist *wl = new_ip_watchlist(16);
+
+    ip_watchlist_advance(wl, T0);
+    add(wl, ipv4(1), 30, 1, T0);
+    add(wl, ipv4(2), 60, 2, T0);
+    add(wl, ipv4(3), 600, 3, T0);
+
+    ip_watchlist_advance(wl, T0 + 29);
+    CuAssertIntEquals(tc, 3, ip_watchlist_count(wl));
+    ip_watchlist_advance(wl, T0 + 30);
+    CuAssertIntEquals(tc, 2, ip_watchlist_count(wl));
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv4(1), T0 + 30));
+    CuAssertIntEquals(tc, 2, lookup(wl, ipv4(2), T0 + 30));
+
+    // An entry further away than the wheel goes round is kept when its slot
+    // comes around early
+    ip_watchlist_advance(wl, T0 + 300);
+    CuAssertIntEquals(tc, 1, ip_watchlist_count(wl));
+    CuAssertIntEquals(tc, 3, lookup(wl, ipv4(3), T0 + 300));
+
+    ip_watchlist_advance(wl, T0 + 600);
+    CuAssertIntEquals(tc, 0, ip_watchlist_count(wl));
+
+    free_ip_watchlist(&wl);
+}
+
+void testIpWatchlistAdvance_withLongJump_removesEverythingExpired(CuTest *tc)
+{
+    ip_watchlist *wl = new_ip_watchlist(64);
+    unsigned int i;
+
+    ip_watchlist_advance(wl, T0);
+    for (i = 0; i < 50; i++)
+        add(wl, ipv4(i), 30 + i * 20, i, T0);
+    add(wl, ipv4(100), IP_WATCHLIST_TTL_MAX, 100, T0);
+
+    // Far more seconds than the wheel has slots pass between packets
+    ip_watchlist_advance(wl, T0 + 2000);
+    CuAssertIntEquals(tc, 1, ip_watchlist_count(wl));
+    CuAssertIntEquals(tc, 100, lookup(wl, ipv4(100), T0 + 2000));
+    for (i = 0; i < 50; i++)
+        CuAssertIntEquals(tc, -1, lookup(wl, ipv4(i), T0 + 2000));
+
+    // The entry left is still removed in its slot afterwards
+    ip_watchlist_advance(wl, T0 + IP_WATCHLIST_TTL_MAX);
+    CuAssertIntEquals(tc, 0, ip_watchlist_count(wl));
+
+    free_ip_watchlist(&wl);
+}
+
+void testIpWatchlistAdvance_withTimeGoingBackwards_keepsEntries(CuTest *tc)
+{
+    ip_watchlist *wl = new_ip_watchlist(16);
+
+    ip_watchlist_advance(wl, T0);
+    add(wl, ipv4(1), 60, 1, T0);
+
+    ip_watchlist_advance(wl, T0 - 50);
+    ip_watchlist_advance(wl, T0 - 50000);
+    CuAssertIntEquals(tc, 1, ip_watchlist_count(wl));
+    CuAssertIntEquals(tc, 1, lookup(wl, ipv4(1), T0 + 59));
+
+    // The wheel carries on from where it was
+    ip_watchlist_advance(wl, T0 + 59);
+    CuAssertIntEquals(tc, 1, ip_watchlist_count(wl));
+    ip_watchlist_advance(wl, T0 + 60);
+    CuAssertIntEquals(tc, 0, ip_watchlist_count(wl));
+
+    free_ip_watchlist(&wl);
+}
+
+void testIpWatchlistAdd_whenFull_evictsTheNextToExpire(CuTest *tc)
+{
+    ip_watchlist *wl = new_ip_watchlist(4);
+    unsigned int i;
+
+    // Within one turn of the wheel, so the next slot is the next to expire
+    ip_watchlist_advance(wl, T0);
+    add(wl, ipv4(1), 250, 1, T0);
+    add(wl, ipv4(2), 40, 2, T0);
+    add(wl, ipv4(3), 200, 3, T0);
+    add(wl, ipv4(4), 100, 4, T0);
+    CuAssertIntEquals(tc, 4, ip_watchlist_count(wl));
+
+    add(wl, ipv4(5), 60, 5, T0);
+    CuAssertIntEquals(tc, 4, ip_watchlist_count(wl));
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv4(2), T0));
+    CuAssertIntEquals(tc, 5, lookup(wl, ipv4(5), T0));
+
+    add(wl, ipv4(6), 60, 6, T0);
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv4(5), T0));
+    CuAssertIntEquals(tc, 1, lookup(wl, ipv4(1), T0));
+    CuAssertIntEquals(tc, 3, lookup(wl, ipv4(3), T0));
+    CuAssertIntEquals(tc, 4, lookup(wl, ipv4(4), T0));
+    CuAssertIntEquals(tc, 6, lookup(wl, ipv4(6), T0));
+
+    // Many more addresses than fit never take it over capacity
+    for (i = 10; i < 1000; i++)
+        add(wl, ipv4(i), 30 + i % 500, i, T0 + i / 10);
+    CuAssertIntEquals(tc, 4, ip_watchlist_count(wl));
+
+    free_ip_watchlist(&wl);
+}
+
+void testIpWatchlistAdd_withWatchedAddress_refreshesIt(CuTest *tc)
+{
+    ip_watchlist *wl = new_ip_watchlist(16);
+
+    ip_watchlist_advance(wl, T0);
+    add(wl, ipv4(1), 60, 1, T0);
+
+    // A later answer extends the lifetime and replaces the value
+    add(wl, ipv4(1), 60, 2, T0 + 50);
+    CuAssertIntEquals(tc, 1, ip_watchlist_count(wl));
+    ip_watchlist_advance(wl, T0 + 60);
+    CuAssertIntEquals(tc, 2, lookup(wl, ipv4(1), T0 + 60));
+    CuAssertIntEquals(tc, 1, ip_watchlist_count(wl));
+
+    // A shorter answer does not shorten it
+    add(wl, ipv4(1), 30, 3, T0 + 70);
+    ip_watchlist_advance(wl, T0 + 100);
+    CuAssertIntEquals(tc, 3, lookup(wl, ipv4(1), T0 + 100));
+
+    ip_watchlist_advance(wl, T0 + 110);
+    CuAssertIntEquals(tc, -1, lookup(wl, ipv4(1), T0 + 110));
+    CuAssertIntEquals(tc, 0, ip_watchlist_count(wl));
+
+    free_ip_watchlist(&wl);
+}
+
+CuSuite *IpWatchlistGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testIpWatchlistAdd_withShortOrLongTtl_clampsIt);
+    SUITE_ADD_TEST(suite,
+            testIpWatchlistAdd_withIpv6Address_keepsItApartFromIpv4);
+    SUITE_ADD_TEST(suite,
+            testIpWatchlistAdvance_withExpiredEntries_removesOnlyThose);
+    SUITE_ADD_TEST(suite,
+            testIpWatchlistAdvance_withLongJump_removesEverythingExpired);
+    SUITE_ADD_TEST(suite,
+            testIpWatchlistAdvance_withTimeGoingBackwards_keepsEntries);
+    SUITE_ADD_TEST(suite, testIpWatchlistAdd_whenFull_evictsTheNextToExpire);
+    SUITE_ADD_TEST(suite, testIpWatchlistAdd_withWatchedAddress_refreshesIt);
+
+    return (suite);
+}
@@ -0,0 +1,214 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "updates/line_reader.h"
+
+/** The lines passed to the callback, each followed by '|' */
+struct lines
+{
+    unsigned int count;
+    char text[2048];
+};
+
+/** Stops at a blank line, as the end of an update */
+static int
+on_line(char *line, size_t len, void *data)
+{
+    struct lines *l = data;
+    size_t used = strlen(l->text);
+
+    if (strlen(line) != len) return -1;
+    if (!len) return 1;
+
+    if (used + len + 1 < sizeof(l->text))
+    {
+        memcpy(l->text + used, line, len);
+        l->text[used + len] = '|';
+        l->text[used + len + 1] = '\0';
+    }
+    l->count++;
+    return 0;
+}
+
+/**
+ * Feed a copy of \p len bytes of \p text, in an allocation of its own so
+ * that accesses past it are caught by the address sanitizer.
+ */
+static int
+feed(struct ns_line_reader *reader, const char *text, size_t len,
+        struct lines *l)
+{
+    char *copy = malloc(len ? len : 1);
+    int rc;
+
+    memcpy(copy, text, len);
+    rc = ns_line_reader_feed(reader, copy, len, on_line, l);
+    free(copy);
+    return rc;
+}
+
+static const char update[] = "dn: example.com\r\nip: 192.0.2.1\n"
+        "dn: example.org\n\nip: 192.0.2.2\n";
+
+static const char update_lines[] = "dn: example.com|ip: 192.0.2.1|"
+        "dn: example.org|";
+
+#define UPDATE_LEN (sizeof(update) - 1)
+
+/** The offset just after the blank line */
+#define UPDATE_END (sizeof("dn: example.com\r\nip: 192.0.2.1\n"\
+        "dn: example.org\n\n") - 1)
+
+void testLineReader_withWholeLines_passesEach(CuTest *tc)
+{
+    struct ns_line_reader reader;
+    struct lines l;
+
+    memset(&l, 0, sizeof(l));
+    ns_line_reader_init(&reader);
+    CuAssertIntEquals(tc, 0, feed(&reader, update, UPDATE_LEN, &l));
+    CuAssertStrEquals(tc, update_lines, l.text);
+
+    // Nothing after the blank line is read
+    CuAssertIntEquals(tc, 0, feed(&reader, "ip: 192.0.2.3\n", 14, &l));
+    CuAssertIntEquals(tc, 3, l.count);
+}
+
+void testLineReader_withSplitLines_joinsThem(CuTest *tc)
+{
+    struct ns_line_reader reader;
+    struct lines l;
+    size_t split, pos;
+
+    // Split the update in two at every offset, including just after a
+    // newline and between a carriage return and its newline
+    for (split = 0; split <= UPDATE_LEN; split++)
+    {
+        memset(&l, 0, sizeof(l));
+        ns_line_reader_init(&reader);
+        CuAssertIntEquals(tc, split < UPDATE_END ? 1 : 0,
+                feed(&reader, update, split, &l));
+        CuAssertIntEquals(tc, 0, feed(&reader, update + split,
+                UPDATE_LEN - split, &l));
+        CuAssertStrEquals(tc, update_lines, l.text);
+    }
+
+    // One byte at a time
+    memset(&l, 0, sizeof(l));
+    ns_line_reader_init(&reader);
+    for (pos = 0; pos < UPDATE_LEN; pos++)
+    {
+        CuAssertIntEquals(tc, pos + 1 < UPDATE_END ? 1 : 0,
+                feed(&reader, update + pos, 1, &l));
+    }
+    CuAssertStrEquals(tc, update_lines, l.text);
+}
+
+void testLineReader_withLineEndingAtPiece_passesItAtOnce(CuTest *tc)
+{
+    struct ns_line_reader reader;
+    struct lines l;
+
+    memset(&l, 0, sizeof(l));
+    ns_line_reader_init(&reader);
+    CuAssertIntEquals(tc, 1, feed(&reader, "ip: 192.0.2.1\n", 14, &l));
+    CuAssertStrEquals(tc, "ip: 192.0.2.1|", l.text);
+    CuAssertIntEquals(tc, 0, reader.len);
+
+    // The next piece starts a new line
+    CuAssertIntEquals(tc, 1, feed(&reader, "ip: 192.0.2.2\r\n", 15, &l));
+    CuAssertIntEquals(tc, 0, feed(&reader, "\n", 1, &l));
+    CuAssertStrEquals(tc, "ip: 192.0.2.1|ip: 192.0.2.2|", l.text);
+}
+
+void testLineReader_withCarriageReturn_stripsOnlyLast(CuTest *tc)
+{
+    struct ns_line_reader reader;
+    struct lines l;
+
+    memset(&l, 0, sizeof(l));
+    ns_line_reader_init(&reader);
+    CuAssertIntEquals(tc, 1, feed(&reader, "a\rb\r\r\nc\r", 8, &l));
+    CuAssertIntEquals(tc, 1, feed(&reader, "\n", 1, &l));
+    CuAssertStrEquals(tc, "a\rb\r|c|", l.text);
+
+    // A blank line ending in a carriage return is still blank
+    CuAssertIntEquals(tc, 0, feed(&reader, "\r\n", 2, &l));
+    CuAssertIntEquals(tc, 2, l.count);
+}
+
+void testLineReader_withLongSplitLine_skipsIt(CuTest *tc)
+{
+    struct ns_line_reader reader;
+    struct lines l;
+    char line[NS_LINE_BUF_LEN + 16];
+    size_t i;
+
+    memset(line, 'x', sizeof(line));
+
+    // The longest line that fits, split in the middle
+    memset(&l, 0, sizeof(l));
+    ns_line_reader_init(&reader);
+    feed(&reader, line, 300, &l);
+    feed(&reader, line, NS_LINE_BUF_LEN - 1 - 300, &l);
+    CuAssertIntEquals(tc, 1, feed(&reader, "\n", 1, &l));
+    CuAssertIntEquals(tc, 1, l.count);
+    CuAssertIntEquals(tc, NS_LINE_BUF_LEN, strlen(l.text));
+
+    // One byte longer, in pieces of every size, is skipped whole and the
+    // lines around it are kept
+    for (i = 1; i <= NS_LINE_BUF_LEN; i++)
+    {
+        size_t pos;
+
+        memset(&l, 0, sizeof(l));
+        ns_line_reader_init(&reader);
+        feed(&reader, "a\nb", 3, &l);
+        for (pos = 0; pos < NS_LINE_BUF_LEN - 1; pos += i)
+        {
+            feed(&reader, line, NS_LINE_BUF_LEN - 1 - pos < i
+                    ? NS_LINE_BUF_LEN - 1 - pos : i, &l);
+        }
+        CuAssertIntEquals(tc, 1, feed(&reader, "\nc\n", 3, &l));
+        CuAssertStrEquals(tc, "a|c|", l.text);
+    }
+}
+
+void testLineReader_withCallbackError_returnsNeg1(CuTest *tc)
+{
+    struct ns_line_reader reader;
+    struct lines l;
+    char data[] = "a\0b\nc\n";
+
+    // The callback fails on a line with a NULL in it
+    memset(&l, 0, sizeof(l));
+    ns_line_reader_init(&reader);
+    CuAssertIntEquals(tc, -1, feed(&reader, data, sizeof(data) - 1, &l));
+    CuAssertIntEquals(tc, 0, l.count);
+}
+
+CuSuite *LineReaderGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testLineReader_withWholeLines_passesEach);
+    SUITE_ADD_TEST(suite, testLineReader_withSplitLines_joinsThem);
+    SUITE_ADD_TEST(suite, testLineReader_withLineEndingAtPiece_passesItAtOnce);
+    SUITE_ADD_TEST(suite, testLineReader_withCarriageReturn_stripsOnlyLast);
+    SUITE_ADD_TEST(suite, testLineReader_withLongSplitLine_skipsIt);
+    SUITE_ADD_TEST(suite, testLineReader_withCallbackError_returnsNeg1);
+
+    return (suite);
+}
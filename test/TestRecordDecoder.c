@@ -0,0 +1,267 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "updates/record_decoder.h"
+
+/** The records passed to the callback, written out as text */
+struct decoded
+{
+    unsigned int count;
+    char text[512];
+    /** Stop decoding after this many records, if not 0 */
+    unsigned int stop_after;
+};
+
+static int
+on_record(const struct ns_record *r, void *data)
+{
+    struct decoded *d = data;
+    size_t used = strlen(d->text);
+    char *pos = d->text + used;
+    size_t left = sizeof(d->text) - used;
+
+    switch (r->type)
+    {
+    case NS_RECORD_IP:
+        snprintf(pos, left, "%sip %08x:%u %d;", r->remove ? "-" : "",
+                r->ip_addr, r->port, r->botnet_id);
+        break;
+    case NS_RECORD_IP6:
+        snprintf(pos, left, "%sip6 %02x..%02x/%u %d;", r->remove ? "-" : "",
+                r->ip6_addr.s6_addr[0], r->ip6_addr.s6_addr[15],
+                r->prefix_len, r->botnet_id);
+        break;
+    case NS_RECORD_DOMAIN:
+        snprintf(pos, left, "%sdn %s(%zu) %d;", r->remove ? "-" : "",
+                r->name, r->name_len, r->botnet_id);
+        break;
+    default:
+        snprintf(pos, left, "?;");
+        break;
+    }
+
+    d->count++;
+    return d->stop_after && d->count >= d->stop_after ? -1 : 0;
+}
+
+/** An IPv4 record, an IPv6 removal, a domain, an unknown type and the end */
+static const uint8_t update[] = {
+    NS_RECORD_IP, 0, 10, 192, 0, 2, 1, 0x01, 0xbb, 0, 0, 0, 7,
+    NS_RECORD_IP6 | NS_RECORD_REMOVE, 0, 21,
+    0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 48,
+    0, 0, 1, 0,
+    NS_RECORD_DOMAIN, 0, 16, 11, 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c',
+    'o', 'm', 0, 0, 0, 9,
+    0x7f, 0, 3, 'a', 'b', 'c',
+    NS_RECORD_END, 0, 0,
+};
+
+static const char update_text[] = "ip c0000201:443 7;-ip6 20..01/48 256;"
+        "dn example.com(11) 9;";
+
+void testRecordDecoder_withWholeUpdate_decodesEach(CuTest *tc)
+{
+    struct ns_record_decoder decoder;
+    struct decoded d;
+
+    memset(&d, 0, sizeof(d));
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, 0, ns_record_decoder_feed(&decoder, update,
+            sizeof(update), on_record, &d));
+    CuAssertStrEquals(tc, update_text, d.text);
+    CuAssertIntEquals(tc, 3, decoder.records);
+}
+
+void testRecordDecoder_withSplitUpdate_decodesEach(CuTest *tc)
+{
+    struct ns_record_decoder decoder;
+    struct decoded d;
+    size_t split, pos;
+    uint8_t *copy;
+    int rc;
+
+    // Split the update in two at every offset. Each piece is copied to its
+    // own allocation so that reading past it is caught by the address
+    // sanitizer.
+    for (split = 0; split <= sizeof(update); split++)
+    {
+        memset(&d, 0, sizeof(d));
+        ns_record_decoder_init(&decoder);
+
+        copy = malloc(split ? split : 1);
+        memcpy(copy, update, split);
+        rc = ns_record_decoder_feed(&decoder, copy, split, on_record, &d);
+        free(copy);
+        CuAssertIntEquals(tc, split < sizeof(update) ? 1 : 0, rc);
+
+        copy = malloc(sizeof(update) - split + 1);
+        memcpy(copy, update + split, sizeof(update) - split);
+        rc = ns_record_decoder_feed(&decoder, copy, sizeof(update) - split,
+                on_record, &d);
+        free(copy);
+        CuAssertIntEquals(tc, 0, rc);
+        CuAssertStrEquals(tc, update_text, d.text);
+    }
+
+    // One byte at a time
+    memset(&d, 0, sizeof(d));
+    ns_record_decoder_init(&decoder);
+    for (pos = 0; pos < sizeof(update); pos++)
+    {
+        rc = ns_record_decoder_feed(&decoder, update + pos, 1, on_record, &d);
+        CuAssertIntEquals(tc, pos + 1 < sizeof(update) ? 1 : 0, rc);
+    }
+    CuAssertStrEquals(tc, update_text, d.text);
+}
+
+void testRecordDecoder_withLongRecord_skipsMetadata(CuTest *tc)
+{
+    struct ns_record_decoder decoder;
+    struct decoded d;
+    uint8_t *rec;
+    size_t body_len = 1000, len = NS_RECORD_HEADER_LEN + body_len, pos;
+    const uint8_t end[] = { NS_RECORD_END, 0, 0 };
+
+    // An IPv4 record followed by metadata, longer than the decoder keeps
+    rec = malloc(len);
+    memset(rec, 0xee, len);
+    rec[0] = NS_RECORD_IP;
+    rec[1] = body_len >> 8;
+    rec[2] = body_len & 0xff;
+    memcpy(rec + 3, "\xc0\x00\x02\x01\x00\x50\x00\x00\x00\x02", 10);
+
+    // Whole, and then in pieces that leave it split past the buffer
+    memset(&d, 0, sizeof(d));
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, 1, ns_record_decoder_feed(&decoder, rec, len,
+            on_record, &d));
+    for (pos = 0; pos < len; pos += 7)
+    {
+        CuAssertIntEquals(tc, 1, ns_record_decoder_feed(&decoder, rec + pos,
+                len - pos < 7 ? len - pos : 7, on_record, &d));
+    }
+    CuAssertIntEquals(tc, 0, ns_record_decoder_feed(&decoder, end,
+            sizeof(end), on_record, &d));
+    CuAssertStrEquals(tc, "ip c0000201:80 2;ip c0000201:80 2;", d.text);
+
+    free(rec);
+}
+
+void testRecordDecoder_withUnknownType_skipsIt(CuTest *tc)
+{
+    struct ns_record_decoder decoder;
+    struct decoded d;
+    const uint8_t data[] = {
+        0x10, 0, 0,
+        0x7f | NS_RECORD_REMOVE, 0, 2, 0xff, 0xff,
+        NS_RECORD_IP, 0, 10, 10, 0, 0, 1, 0, 0, 0, 0, 0, 1,
+    };
+
+    memset(&d, 0, sizeof(d));
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, 1, ns_record_decoder_feed(&decoder, data,
+            sizeof(data), on_record, &d));
+    CuAssertStrEquals(tc, "ip 0a000001:0 1;", d.text);
+    CuAssertIntEquals(tc, 1, decoder.records);
+}
+
+void testRecordDecoder_withEndRecord_ignoresRest(CuTest *tc)
+{
+    struct ns_record_decoder decoder;
+    struct decoded d;
+    const uint8_t data[] = {
+        NS_RECORD_END, 0, 0,
+        NS_RECORD_IP, 0, 10, 10, 0, 0, 1, 0, 0, 0, 0, 0, 1,
+    };
+
+    memset(&d, 0, sizeof(d));
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, 0, ns_record_decoder_feed(&decoder, data,
+            sizeof(data), on_record, &d));
+    CuAssertIntEquals(tc, 0, d.count);
+    CuAssertIntEquals(tc, 0, ns_record_decoder_feed(&decoder, data + 3,
+            sizeof(data) - 3, on_record, &d));
+    CuAssertIntEquals(tc, 0, d.count);
+
+    // An end record with a body is still the end
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, 0, ns_record_decoder_feed(&decoder,
+            (const uint8_t *) "\x00\x00\x02xy", 5, on_record, &d));
+    CuAssertIntEquals(tc, 0, d.count);
+}
+
+void testRecordDecoder_withShortBody_returnsNeg1(CuTest *tc)
+{
+    struct ns_record_decoder decoder;
+    struct decoded d;
+    const uint8_t ip[] = { NS_RECORD_IP, 0, 9, 10, 0, 0, 1, 0, 0, 0, 0, 0 };
+    const uint8_t ip6[] = { NS_RECORD_IP6, 0, 20, 0x20, 0x01, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 128, 0, 0, 0 };
+    const uint8_t no_name[] = { NS_RECORD_DOMAIN, 0, 0 };
+    // The name is longer than the record
+    const uint8_t long_name[] = { NS_RECORD_DOMAIN, 0, 7, 3, 'a', 'b', 'c',
+        0, 0, 0 };
+
+    memset(&d, 0, sizeof(d));
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, -1, ns_record_decoder_feed(&decoder, ip,
+            sizeof(ip), on_record, &d));
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, -1, ns_record_decoder_feed(&decoder, ip6,
+            sizeof(ip6), on_record, &d));
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, -1, ns_record_decoder_feed(&decoder, no_name,
+            sizeof(no_name), on_record, &d));
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, -1, ns_record_decoder_feed(&decoder, long_name,
+            sizeof(long_name), on_record, &d));
+
+    // Also when the record was split between pieces
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, 1, ns_record_decoder_feed(&decoder, ip, 4,
+            on_record, &d));
+    CuAssertIntEquals(tc, -1, ns_record_decoder_feed(&decoder, ip + 4,
+            sizeof(ip) - 4, on_record, &d));
+    CuAssertIntEquals(tc, 0, d.count);
+}
+
+void testRecordDecoder_withCallbackStop_returnsNeg1(CuTest *tc)
+{
+    struct ns_record_decoder decoder;
+    struct decoded d;
+
+    memset(&d, 0, sizeof(d));
+    d.stop_after = 2;
+    ns_record_decoder_init(&decoder);
+    CuAssertIntEquals(tc, -1, ns_record_decoder_feed(&decoder, update,
+            sizeof(update), on_record, &d));
+    CuAssertIntEquals(tc, 2, d.count);
+}
+
+CuSuite *RecordDecoderGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testRecordDecoder_withWholeUpdate_decodesEach);
+    SUITE_ADD_TEST(suite, testRecordDecoder_withSplitUpdate_decodesEach);
+    SUITE_ADD_TEST(suite, testRecordDecoder_withLongRecord_skipsMetadata);
+    SUITE_ADD_TEST(suite, testRecordDecoder_withUnknownType_skipsIt);
+    SUITE_ADD_TEST(suite, testRecordDecoder_withEndRecord_ignoresRest);
+    SUITE_ADD_TEST(suite, testRecordDecoder_withShortBody_returnsNeg1);
+    SUITE_ADD_TEST(suite, testRecordDecoder_withCallbackStop_returnsNeg1);
+
+    return (suite);
+}
@@ -0,0 +1,253 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <string.h>
+
+#include "CuTest.h"
+#include "tcp_dns.h"
+
+/** The messages passed to the callback */
+struct received
+{
+    unsigned int count;
+    /** The concatenation of every message */
+    uint8_t data[256];
+    size_t len;
+};
+
+static void
+on_message(const uint8_t *msg, size_t len, void *arg)
+{
+    struct received *r = arg;
+
+    r->count++;
+    if (r->len + len <= sizeof(r->data))
+    {
+        memcpy(r->data + r->len, msg, len);
+        r->len += len;
+    }
+}
+
+/** Two messages of 5 and 3 bytes, each with its length */
+static const uint8_t stream[] = {
+    0, 5, 'h', 'e', 'l', 'l', 'o',
+    0, 3, 'a', 'b', 'c',
+};
+
+static struct tcp_dns_key
+make_key(uint16_t src_port)
+{
+    struct tcp_dns_key key;
+
+    memset(&key, 0, sizeof(key));
+    key.src_ip.s6_addr[15] = 1;
+    key.dest_ip.s6_addr[15] = 2;
+    key.src_port = src_port;
+    key.dest_port = 53;
+    return key;
+}
+
+/**
+ * Pass \p len bytes of #stream from \p offset, as a segment starting at
+ * sequence number 1000 + \p offset.
+ */
+static unsigned int
+segment(tcp_dns_tracker *tr, const struct tcp_dns_key *key, size_t offset,
+        size_t len, uint8_t flags, uint32_t now, struct received *r)
+{
+    return tcp_dns_tracker_segment(tr, key, 1000 + offset, flags,
+            stream + offset, len, now, on_message, r);
+}
+
+void testTcpDns_withWholeMessages_passesEach(CuTest *tc)
+{
+    tcp_dns_tracker *tr = new_tcp_dns_tracker(4, 1024);
+    struct tcp_dns_key key = make_key(1);
+    struct received r = { 0 };
+
+    CuAssertIntEquals(tc, 2, segment(tr, &key, 0, sizeof(stream), 0, 0, &r));
+    CuAssertIntEquals(tc, 8, r.len);
+    CuAssertTrue(tc, !memcmp("helloabc", r.data, 8));
+    CuAssertIntEquals(tc, 0, tcp_dns_tracker_memory(tr));
+
+    free_tcp_dns_tracker(&tr);
+    CuAssertPtrEquals(tc, NULL, tr);
+}
+
+void testTcpDns_withSplitMessages_reassemblesThem(CuTest *tc)
+{
+    tcp_dns_tracker *tr = new_tcp_dns_tracker(4, 1024);
+    struct tcp_dns_key key = make_key(1);
+    struct received r;
+    size_t split, pos;
+
+    // Split the stream at every offset, and into single bytes
+    for (split = 1; split < sizeof(stream); split++)
+    {
+        memset(&r, 0, sizeof(r));
+        segment(tr, &key, 0, split, 0, 0, &r);
+        segment(tr, &key, split, sizeof(stream) - split, TCP_DNS_FIN, 0, &r);
+        CuAssertIntEquals(tc, 2, r.count);
+        CuAssertTrue(tc, !memcmp("helloabc", r.data, 8));
+        CuAssertIntEquals(tc, 0, tcp_dns_tracker_count(tr));
+    }
+
+    memset(&r, 0, sizeof(r));
+    for (pos = 0; pos < sizeof(stream); pos++)
+        segment(tr, &key, pos, 1, 0, 0, &r);
+    CuAssertIntEquals(tc, 2, r.count);
+    CuAssertTrue(tc, !memcmp("helloabc", r.data, 8));
+
+    free_tcp_dns_tracker(&tr);
+}
+
+void testTcpDns_withRetransmission_ignoresIt(CuTest *tc)
+{
+    tcp_dns_tracker *tr = new_tcp_dns_tracker(4, 1024);
+    struct tcp_dns_key key = make_key(1);
+    struct received r = { 0 };
+
+    segment(tr, &key, 0, 4, 0, 0, &r);
+    segment(tr, &key, 4, 3, 0, 0, &r);
+    CuAssertIntEquals(tc, 1, r.count);
+
+    // The middle of the first message again, after it was complete
+    CuAssertIntEquals(tc, 0, segment(tr, &key, 4, 3, 0, 0, &r));
+    // Partly old and partly new data
+    CuAssertIntEquals(tc, 1, segment(tr, &key, 2, 10, 0, 0, &r));
+    CuAssertIntEquals(tc, 2, r.count);
+    CuAssertTrue(tc, !memcmp("helloabc", r.data, 8));
+
+    free_tcp_dns_tracker(&tr);
+}
+
+void testTcpDns_withMissingSegment_ignoresRestOfFlow(CuTest *tc)
+{
+    tcp_dns_tracker *tr = new_tcp_dns_tracker(4, 1024);
+    struct tcp_dns_key key = make_key(1);
+    struct received r = { 0 };
+
+    segment(tr, &key, 0, 3, 0, 0, &r);
+    // The bytes at 3 and 4 are missed
+    CuAssertIntEquals(tc, 0, segment(tr, &key, 5, 2, 0, 0, &r));
+    // Whole messages later in the flow could start anywhere
+    CuAssertIntEquals(tc, 0, segment(tr, &key, 7, 5, 0, 0, &r));
+    CuAssertIntEquals(tc, 0, tcp_dns_tracker_segment(tr, &key, 2000, 0,
+            stream, sizeof(stream), 0, on_message, &r));
+    CuAssertIntEquals(tc, 0, r.count);
+    CuAssertIntEquals(tc, 1, tcp_dns_tracker_count(tr));
+    CuAssertIntEquals(tc, 0, tcp_dns_tracker_memory(tr));
+
+    // A new connection after the flow ends is parsed again
+    tcp_dns_tracker_segment(tr, &key, 3000, TCP_DNS_FIN, NULL, 0, 0,
+            on_message, &r);
+    CuAssertIntEquals(tc, 0, tcp_dns_tracker_count(tr));
+    CuAssertIntEquals(tc, 2, segment(tr, &key, 0, sizeof(stream), 0, 0, &r));
+
+    free_tcp_dns_tracker(&tr);
+}
+
+void testTcpDns_withRst_discardsFlow(CuTest *tc)
+{
+    tcp_dns_tracker *tr = new_tcp_dns_tracker(4, 1024);
+    struct tcp_dns_key key = make_key(1);
+    struct received r = { 0 };
+
+    segment(tr, &key, 0, 4, 0, 0, &r);
+    CuAssertIntEquals(tc, 1, tcp_dns_tracker_count(tr));
+    CuAssertIntEquals(tc, 5, tcp_dns_tracker_memory(tr));
+    CuAssertIntEquals(tc, 0, segment(tr, &key, 4, 3, TCP_DNS_RST, 0, &r));
+    CuAssertIntEquals(tc, 0, tcp_dns_tracker_count(tr));
+    CuAssertIntEquals(tc, 0, tcp_dns_tracker_memory(tr));
+
+    free_tcp_dns_tracker(&tr);
+}
+
+void testTcpDns_withIdleFlow_expiresIt(CuTest *tc)
+{
+    tcp_dns_tracker *tr = new_tcp_dns_tracker(4, 1024);
+    struct tcp_dns_key a = make_key(1), b = make_key(2);
+    struct received r = { 0 };
+
+    segment(tr, &a, 0, 4, 0, 100, &r);
+    segment(tr, &b, 0, 4, 0, 100 + TCP_DNS_IDLE_TIMEOUT - 1, &r);
+    CuAssertIntEquals(tc, 2, tcp_dns_tracker_count(tr));
+    segment(tr, &b, 4, 3, 0, 100 + TCP_DNS_IDLE_TIMEOUT, &r);
+    CuAssertIntEquals(tc, 1, tcp_dns_tracker_count(tr));
+    CuAssertIntEquals(tc, 1, r.count);
+
+    free_tcp_dns_tracker(&tr);
+}
+
+void testTcpDns_withFullTable_discardsLeastRecentlyUsed(CuTest *tc)
+{
+    tcp_dns_tracker *tr = new_tcp_dns_tracker(2, 1024);
+    struct tcp_dns_key a = make_key(1), b = make_key(2), c = make_key(3);
+    struct received r = { 0 };
+
+    segment(tr, &a, 0, 4, 0, 0, &r);
+    segment(tr, &b, 0, 4, 0, 0, &r);
+    segment(tr, &a, 4, 1, 0, 0, &r);
+    segment(tr, &c, 0, 4, 0, 0, &r);
+    CuAssertIntEquals(tc, 2, tcp_dns_tracker_count(tr));
+
+    // b was discarded, so only a completes
+    segment(tr, &a, 5, 2, 0, 0, &r);
+    segment(tr, &b, 4, 3, 0, 0, &r);
+    CuAssertIntEquals(tc, 1, r.count);
+
+    free_tcp_dns_tracker(&tr);
+}
+
+void testTcpDns_withMemoryLimit_discardsPartialMessages(CuTest *tc)
+{
+    tcp_dns_tracker *tr = new_tcp_dns_tracker(4, 8);
+    struct tcp_dns_key a = make_key(1), b = make_key(2), c = make_key(3);
+    struct received r = { 0 };
+    const uint8_t big[] = { 0, 9, 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x', 'x' };
+
+    // A message longer than the limit cannot be buffered, and the rest of
+    // its flow is ignored
+    tcp_dns_tracker_segment(tr, &a, 0, 0, big, 3, 0, on_message, &r);
+    CuAssertIntEquals(tc, 0, tcp_dns_tracker_memory(tr));
+    tcp_dns_tracker_segment(tr, &a, 3, 0, big + 3, 8, 0, on_message, &r);
+    CuAssertIntEquals(tc, 0, r.count);
+
+    // The least recently used partial message makes room for another
+    segment(tr, &b, 0, 4, 0, 0, &r);
+    CuAssertIntEquals(tc, 5, tcp_dns_tracker_memory(tr));
+    tcp_dns_tracker_segment(tr, &c, 0, 0, stream, 4, 0, on_message, &r);
+    CuAssertIntEquals(tc, 5, tcp_dns_tracker_memory(tr));
+    CuAssertIntEquals(tc, 3, tcp_dns_tracker_count(tr));
+
+    segment(tr, &b, 4, 3, 0, 0, &r);
+    CuAssertIntEquals(tc, 0, r.count);
+    tcp_dns_tracker_segment(tr, &c, 4, 0, stream + 4, 3, 0, on_message, &r);
+    CuAssertIntEquals(tc, 1, r.count);
+
+    free_tcp_dns_tracker(&tr);
+}
+
+CuSuite *TcpDnsGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testTcpDns_withWholeMessages_passesEach);
+    SUITE_ADD_TEST(suite, testTcpDns_withSplitMessages_reassemblesThem);
+    SUITE_ADD_TEST(suite, testTcpDns_withRetransmission_ignoresIt);
+    SUITE_ADD_TEST(suite, testTcpDns_withMissingSegment_ignoresRestOfFlow);
+    SUITE_ADD_TEST(suite, testTcpDns_withRst_discardsFlow);
+    SUITE_ADD_TEST(suite, testTcpDns_withIdleFlow_expiresIt);
+    SUITE_ADD_TEST(suite, testTcpDns_withFullTable_discardsLeastRecentlyUsed);
+    SUITE_ADD_TEST(suite, testTcpDns_withMemoryLimit_discardsPartialMessages);
+
+    return (suite);
+}
@@ -0,0 +1,275 @@
+/*
+ *
+ * Copyright (c) 2020 The University of Waikato, Hamilton, New Zealand.
+ *
+ * This file is part of netstinky-ids.
+ *
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/BSD-2-Clause
+ *
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "CuTest.h"
+#include "tls_sni.h"
+
+/** A supported_groups extension, which comes before the server name */
+static const uint8_t groups_ext[] = { 0x00, 0x0a, 0x00, 0x04, 0x00, 0x02,
+    0x00, 0x1d };
+
+/** A server_name extension naming example.com */
+static const uint8_t sni_ext[] = { 0x00, 0x00, 0x00, 0x10, 0x00, 0x0e, 0x00,
+    0x00, 0x0b, 'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm' };
+
+static void
+put_uint16(uint8_t *pos, size_t n)
+{
+    pos[0] = n >> 8;
+    pos[1] = n & 0xff;
+}
+
+/**
+ * Write a TLS record holding a ClientHello with the given extensions.
+ *
+ * @return The length of the record
+ */
+static size_t
+make_hello(uint8_t *buf, const uint8_t *exts, size_t exts_len)
+{
+    uint8_t *pos = buf + 5 + 4;
+
+    // Version and random
+    *pos++ = 0x03;
+    *pos++ = 0x03;
+    memset(pos, 0xaa, 32);
+    pos += 32;
+    // A session ID of 32 bytes
+    *pos++ = 32;
+    memset(pos, 0xbb, 32);
+    pos += 32;
+    // Two cipher suites
+    put_uint16(pos, 4);
+    memcpy(pos + 2, "\x13\x01\x13\x02", 4);
+    pos += 6;
+    // The null compression method
+    *pos++ = 1;
+    *pos++ = 0;
+    put_uint16(pos, exts_len);
+    memcpy(pos + 2, exts, exts_len);
+    pos += 2 + exts_len;
+
+    buf[0] = 0x16;
+    buf[1] = 0x03;
+    buf[2] = 0x01;
+    put_uint16(buf + 3, pos - buf - 5);
+    buf[5] = 0x01;
+    buf[6] = 0;
+    put_uint16(buf + 7, pos - buf - 9);
+    return pos - buf;
+}
+
+/**
+ * Write a ClientHello with a supported_groups extension and then \p sni.
+ */
+static size_t
+make_hello_sni(uint8_t *buf, const uint8_t *sni, size_t sni_len)
+{
+    uint8_t exts[256];
+
+    memcpy(exts, groups_ext, sizeof(groups_ext));
+    memcpy(exts + sizeof(groups_ext), sni, sni_len);
+    return make_hello(buf, exts, sizeof(groups_ext) + sni_len);
+}
+
+void testTlsSniParse_withServerName_returnsIt(CuTest *tc)
+{
+    uint8_t hello[512];
+    char name[256];
+    size_t len = make_hello_sni(hello, sni_ext, sizeof(sni_ext));
+
+    CuAssertIntEquals(tc, 11, tls_sni_parse(hello, len, name, sizeof(name)));
+    CuAssertStrEquals(tc, "example.com", name);
+
+    // The same message without the record header, as QUIC carries it
+    memset(name, 0, sizeof(name));
+    CuAssertIntEquals(tc, 11, tls_sni_parse_handshake(hello + 5, len - 5,
+            name, sizeof(name)));
+    CuAssertStrEquals(tc, "example.com", name);
+}
+
+void testTlsSniParse_withoutServerName_returns0(CuTest *tc)
+{
+    uint8_t hello[512];
+    char name[256];
+    size_t len = make_hello(hello, groups_ext, sizeof(groups_ext));
+
+    CuAssertIntEquals(tc, 0, tls_sni_parse(hello, len, name, sizeof(name)));
+    CuAssertStrEquals(tc, "", name);
+}
+
+void testTlsSniParse_withOtherRecord_returnsNeg1(CuTest *tc)
+{
+    uint8_t hello[512];
+    char name[256];
+    size_t len = make_hello_sni(hello, sni_ext, sizeof(sni_ext));
+
+    // Application data
+    hello[0] = 0x17;
+    CuAssertIntEquals(tc, -1, tls_sni_parse(hello, len, name, sizeof(name)));
+    // A ServerHello
+    hello[0] = 0x16;
+    hello[5] = 0x02;
+    CuAssertIntEquals(tc, -1, tls_sni_parse(hello, len, name, sizeof(name)));
+    // Not TLS at all
+    CuAssertIntEquals(tc, -1, tls_sni_parse((const uint8_t *) "GET / HTTP/1.1",
+            14, name, sizeof(name)));
+}
+
+void testTlsSniParse_withTruncatedHello_neverReadsPastEnd(CuTest *tc)
+{
+    uint8_t hello[512], *copy;
+    char name[256];
+    size_t len = make_hello_sni(hello, sni_ext, sizeof(sni_ext)), cut;
+    int rc;
+
+    // Each truncation is copied to its own allocation so that reading past
+    // the end is caught by the address sanitizer
+    for (cut = 0; cut < len; cut++)
+    {
+        copy = malloc(cut ? cut : 1);
+        memcpy(copy, hello, cut);
+        rc = tls_sni_parse(copy, cut, name, sizeof(name));
+        free(copy);
+
+        // Without the handshake type it is not known to be a ClientHello
+        CuAssertIntEquals(tc, cut < 6 ? -1 : 0, rc);
+    }
+}
+
+void testTlsSniParse_withTruncatedExtension_returns0(CuTest *tc)
+{
+    uint8_t hello[512];
+    char name[256];
+    size_t len = make_hello_sni(hello, sni_ext, sizeof(sni_ext));
+
+    // The extension claims more than the extensions hold
+    hello[len - sizeof(sni_ext) + 3] = 0x40;
+    CuAssertIntEquals(tc, 0, tls_sni_parse(hello, len, name, sizeof(name)));
+}
+
+void testTlsSniParse_withLongRecordLength_stopsAtData(CuTest *tc)
+{
+    uint8_t hello[512];
+    char name[256];
+    size_t len = make_hello_sni(hello, sni_ext, sizeof(sni_ext));
+
+    // The ClientHello continues in a later segment
+    put_uint16(hello + 3, 0x4000);
+    hello[6] = 0x01;
+    CuAssertIntEquals(tc, 11, tls_sni_parse(hello, len, name, sizeof(name)));
+}
+
+void testTlsSniParse_withMalformedServerName_returnsNeg1(CuTest *tc)
+{
+    uint8_t hello[512], sni[sizeof(sni_ext)];
+    char name[256];
+    size_t len;
+
+    // The list is longer than the extension
+    memcpy(sni, sni_ext, sizeof(sni));
+    sni[5] = 0x20;
+    len = make_hello_sni(hello, sni, sizeof(sni));
+    CuAssertIntEquals(tc, -1, tls_sni_parse(hello, len, name, sizeof(name)));
+
+    // The name is longer than the list
+    memcpy(sni, sni_ext, sizeof(sni));
+    sni[8] = 0x20;
+    len = make_hello_sni(hello, sni, sizeof(sni));
+    CuAssertIntEquals(tc, -1, tls_sni_parse(hello, len, name, sizeof(name)));
+
+    // A NULL within the name
+    memcpy(sni, sni_ext, sizeof(sni));
+    sni[12] = '\0';
+    len = make_hello_sni(hello, sni, sizeof(sni));
+    CuAssertIntEquals(tc, -1, tls_sni_parse(hello, len, name, sizeof(name)));
+
+    // A name that does not fit in the buffer
+    len = make_hello_sni(hello, sni_ext, sizeof(sni_ext));
+    CuAssertIntEquals(tc, -1, tls_sni_parse(hello, len, name, 11));
+    CuAssertIntEquals(tc, 11, tls_sni_parse(hello, len, name, 12));
+}
+
+void testTlsSniParse_withOtherNameType_skipsIt(CuTest *tc)
+{
+    const uint8_t sni[] = { 0x00, 0x00, 0x00, 0x0e, 0x00, 0x0c,
+        0x05, 0x00, 0x03, 'a', 'b', 'c',
+        0x00, 0x00, 0x03, 'x', '.', 'y' };
+    uint8_t hello[512];
+    char name[256];
+    size_t len = make_hello_sni(hello, sni, sizeof(sni));
+
+    CuAssertIntEquals(tc, 3, tls_sni_parse(hello, len, name, sizeof(name)));
+    CuAssertStrEquals(tc, "x.y", name);
+}
+
+void testTlsSniTable_withSyn_takesFirstSegmentOnly(CuTest *tc)
+{
+    tls_sni_table *table = new_tls_sni_table(16);
+    struct in6_addr a, b;
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.s6_addr[15] = 1;
+    b.s6_addr[15] = 2;
+
+    CuAssertIntEquals(tc, 0, tls_sni_table_take(table, &a, &b, 1000, 0));
+    tls_sni_table_add(table, &a, &b, 1000, 0);
+    CuAssertIntEquals(tc, 0, tls_sni_table_take(table, &a, &b, 1001, 0));
+    CuAssertIntEquals(tc, 1, tls_sni_table_take(table, &a, &b, 1000, 1));
+    CuAssertIntEquals(tc, 0, tls_sni_table_take(table, &a, &b, 1000, 1));
+
+    // A connection that sends nothing until after the timeout
+    tls_sni_table_add(table, &a, &b, 1000, 0);
+    CuAssertIntEquals(tc, 0, tls_sni_table_take(table, &a, &b, 1000,
+            TLS_SNI_TIMEOUT + 1));
+
+    free_tls_sni_table(&table);
+    CuAssertPtrEquals(tc, NULL, table);
+}
+
+void testTlsSniTable_withoutSyn_reportsFirstPacket(CuTest *tc)
+{
+    tls_sni_table *table = new_tls_sni_table(16);
+    struct in6_addr a, b;
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    a.s6_addr[15] = 1;
+
+    CuAssertIntEquals(tc, 1, tls_sni_table_first(table, &a, &b, 1000, 0));
+    CuAssertIntEquals(tc, 0, tls_sni_table_first(table, &a, &b, 1000, 1));
+    CuAssertIntEquals(tc, 1, tls_sni_table_first(table, &a, &b, 1000,
+            TLS_SNI_TIMEOUT + 2));
+
+    free_tls_sni_table(&table);
+}
+
+CuSuite *TlsSniGetSuite()
+{
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testTlsSniParse_withServerName_returnsIt);
+    SUITE_ADD_TEST(suite, testTlsSniParse_withoutServerName_returns0);
+    SUITE_ADD_TEST(suite, testTlsSniParse_withOtherRecord_returnsNeg1);
+    SUITE_ADD_TEST(suite, testTlsSniParse_withTruncatedHello_neverReadsPastEnd);
+    SUITE_ADD_TEST(suite, testTlsSniParse_withTruncatedExtension_returns0);
+    SUITE_ADD_TEST(suite, testTlsSniParse_withLongRecordLength_stopsAtData);
+    SUITE_ADD_TEST(suite, testTlsSniParse_withMalformedServerName_returnsNeg1);
+    SUITE_ADD_TEST(suite, testTlsSniParse_withOtherNameType_skipsIt);
+    SUITE_ADD_TEST(suite, testTlsSniTable_withSyn_takesFirstSegmentOnly);
+    SUITE_ADD_TEST(suite, testTlsSniTable_withoutSyn_reportsFirstPacket);
+
+    return (suite);
+}